@@ -14,7 +14,11 @@
 
 #include <linux/completion.h>
 #include <linux/device.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
 #include <linux/types.h>
+#include <linux/workqueue.h>
 
 #include "serial_hub.h"
 
@@ -36,6 +40,9 @@ enum ssam_event_flags {
  * @command_id:      Command ID of the event.
  * @instance_id:     Instance ID of the event source.
  * @length:          Length of the event payload in bytes.
+ * @replayed:        Whether the event has been replayed from the event cache
+ *                   instead of having just been received from the EC. See
+ *                   %SSAM_EVENT_NOTIFIER_REPLAY.
  * @data:            Event payload data.
  */
 struct ssam_event {
@@ -44,6 +51,7 @@ struct ssam_event {
 	u8 command_id;
 	u8 instance_id;
 	u16 length;
+	bool replayed;
 	u8 data[];
 };
 
@@ -60,10 +68,21 @@ struct ssam_event {
  *	Specifies that the request should be transmitted via an unsequenced
  *	packet. If set, the request must not have a response, meaning that this
  *	flag and the %SSAM_REQUEST_HAS_RESPONSE flag are mutually exclusive.
+ *
+ * @SSAM_REQUEST_DEFERRABLE:
+ *	Specifies that the request is not urgent and may be held back for a
+ *	short time to avoid waking the EC UART just for this request. Such
+ *	requests are sent together with other traffic while the UART is awake,
+ *	or otherwise in one batch after a bounded delay. Deferrable requests
+ *	may be reordered with respect to non-deferrable requests. Intended for
+ *	periodic low-priority requests (e.g. polling, telemetry). Should not be
+ *	used for requests somebody is actively waiting on, e.g. reads on
+ *	behalf of user space or re-checks triggered by events.
  */
 enum ssam_request_flags {
 	SSAM_REQUEST_HAS_RESPONSE = BIT(0),
 	SSAM_REQUEST_UNSEQUENCED  = BIT(1),
+	SSAM_REQUEST_DEFERRABLE   = BIT(2),
 };
 
 /**
@@ -104,11 +123,14 @@ struct ssam_response {
 };
 
 struct ssam_controller;
+struct dentry;
 
 struct ssam_controller *ssam_get_controller(void);
 struct ssam_controller *ssam_client_bind(struct device *client);
 int ssam_client_link(struct ssam_controller *ctrl, struct device *client);
 
+struct dentry *ssam_debugfs_dir(void);
+
 struct device *ssam_controller_device(struct ssam_controller *c);
 
 struct ssam_controller *ssam_controller_get(struct ssam_controller *c);
@@ -124,6 +146,22 @@ ssize_t ssam_request_write_data(struct ssam_span *buf,
 
 /* -- Synchronous request interface. ---------------------------------------- */
 
+/**
+ * typedef ssam_response_parse_fn_t - Callback for parsing a response in place.
+ * @ctx:  The context provided when setting the callback.
+ * @data: The response payload. Only valid for the duration of the call.
+ *
+ * Called from the receiver thread with the response payload as stored in the
+ * receive buffer, allowing the response to be parsed without copying it to an
+ * intermediate buffer first. The callback must not sleep.
+ *
+ * Return: Zero on success or a negative error code on failure, which will be
+ * used as status of the request.
+ */
+typedef int (*ssam_response_parse_fn_t)(void *ctx, const struct ssam_span *data);
+
+struct ssam_client_stats;
+
 /**
  * struct ssam_request_sync - Synchronous SAM request struct.
  * @base:   Underlying SSH request.
@@ -132,14 +170,36 @@ ssize_t ssam_request_write_data(struct ssam_span *buf,
  *          deallocated after the completion has been signaled.
  *          request has been submitted,
  * @resp:   Buffer to store the response.
+ * @parse:  Response parser, used instead of @resp if set.
+ * @parse.fn:  Callback parsing the response in place.
+ * @parse.ctx: Context passed to the callback.
  * @status: Status of the request, set after the base request has been
  *          completed or has failed.
+ * @acct:        Per-client accounting data. Managed by the controller.
+ * @acct.caller: Address of the code which issued the request, used to
+ *               attribute the request to its client module. Set on
+ *               submission if not already set.
+ * @acct.stats:  Statistics entry of the client module. Resolved from
+ *               @acct.caller on submission if not already set.
+ * @acct.time:   Time at which the request has been submitted.
  */
 struct ssam_request_sync {
 	struct ssh_request base;
 	struct completion comp;
 	struct ssam_response *resp;
+
+	struct {
+		ssam_response_parse_fn_t fn;
+		void *ctx;
+	} parse;
+
 	int status;
+
+	struct {
+		unsigned long caller;
+		struct ssam_client_stats *stats;
+		ktime_t time;
+	} acct;
 };
 
 int ssam_request_sync_alloc(size_t payload_len, gfp_t flags,
@@ -181,6 +241,25 @@ static inline void ssam_request_sync_set_resp(struct ssam_request_sync *rqst,
 	rqst->resp = resp;
 }
 
+/**
+ * ssam_request_sync_set_parser - Set response parser of a synchronous request.
+ * @rqst: The request.
+ * @fn:   The callback parsing the response. May be %NULL.
+ * @ctx:  The context passed to the callback.
+ *
+ * Sets a callback receiving the response of the request directly from the
+ * receive buffer, avoiding a copy of the response data. If set, the response
+ * buffer set via ssam_request_sync_set_resp() will not be used. See
+ * &typedef ssam_response_parse_fn_t for the constraints on the callback.
+ */
+static inline void ssam_request_sync_set_parser(struct ssam_request_sync *rqst,
+						ssam_response_parse_fn_t fn,
+						void *ctx)
+{
+	rqst->parse.fn = fn;
+	rqst->parse.ctx = ctx;
+}
+
 int ssam_request_sync_submit(struct ssam_controller *ctrl,
 			     struct ssam_request_sync *rqst);
 
@@ -216,6 +295,11 @@ int ssam_request_sync_with_buffer(struct ssam_controller *ctrl,
 				  struct ssam_response *rsp,
 				  struct ssam_span *buf);
 
+int ssam_request_sync_with_parser(struct ssam_controller *ctrl,
+				  const struct ssam_request *spec,
+				  ssam_response_parse_fn_t fn, void *ctx,
+				  struct ssam_span *buf);
+
 /**
  * ssam_request_sync_onstack - Execute a synchronous request on the stack.
  * @ctrl: The controller via which the request is submitted.
@@ -243,6 +327,30 @@ int ssam_request_sync_with_buffer(struct ssam_controller *ctrl,
 		ssam_request_sync_with_buffer(ctrl, rqst, rsp, &__buf);		\
 	})
 
+/**
+ * ssam_request_sync_onstack_parse - Execute a synchronous request on the
+ * stack, parsing its response in place.
+ * @ctrl: The controller via which the request is submitted.
+ * @rqst: The request specification.
+ * @fn:   The callback parsing the response.
+ * @ctx:  The context passed to the callback.
+ * @payload_len: The (maximum) request payload length.
+ *
+ * Same as ssam_request_sync_onstack(), but instead of copying the response to
+ * a response buffer, passes it directly from the receive buffer to the given
+ * parser callback. See ssam_request_sync_with_parser().
+ *
+ * Return: Returns the status of the request or any failure during setup, i.e.
+ * zero on success and a negative value on failure.
+ */
+#define ssam_request_sync_onstack_parse(ctrl, rqst, fn, ctx, payload_len)	\
+	({									\
+		u8 __data[SSH_COMMAND_MESSAGE_LENGTH(payload_len)];		\
+		struct ssam_span __buf = { &__data[0], ARRAY_SIZE(__data) };	\
+										\
+		ssam_request_sync_with_parser(ctrl, rqst, fn, ctx, &__buf);	\
+	})
+
 /**
  * __ssam_retry - Retry request in case of I/O errors or timeouts.
  * @request: The request function to execute. Must return an integer.
@@ -804,9 +912,44 @@ enum ssam_event_mask {
  *	notifier with this flag may not even correspond to a certain event at
  *	all, only to a specific event target category. Event matching will not
  *	be influenced by this flag.
+ *
+ * @SSAM_EVENT_NOTIFIER_REPLAY:
+ *	Replay the most recently received events matching this notifier to
+ *	the notifier on registration. This allows clients to obtain the
+ *	current state without querying the EC, provided that such an event
+ *	has been received while the event was enabled. Events are only cached
+ *	while at least one notifier with this flag is registered for their
+ *	target category, so only notifiers registered while another such
+ *	notifier is present can be seeded this way. Replayed events have
+ *	&ssam_event.replayed set and are delivered from the event workqueue,
+ *	ordered with respect to live events, before ssam_notifier_register()
+ *	returns. Their return values are ignored. The number of replayed
+ *	events is stored in &ssam_event_notifier.replay_count. Cached events
+ *	are discarded when the corresponding event is disabled and when the
+ *	controller is suspended, so that only fresh values are replayed.
+ *
+ * @SSAM_EVENT_NOTIFIER_MAY_BLOCK:
+ *	The notifier callback may block for extended periods of time, e.g. by
+ *	executing EC requests or calling into ACPI. Instead of calling it
+ *	directly from the event completion workqueue, where it would delay all
+ *	subsequent events of the same event queue, matching events are copied
+ *	and the callback is executed on a separate worker. Events are delivered
+ *	to the callback in order.
+ *
+ *	As the callback runs asynchronously, its return value is ignored
+ *	except for logging errors. Every event matching the notifier counts
+ *	as handled, even if the callback later returns zero, e.g. because the
+ *	event is meant for a different instance. Returning %SSAM_NOTIF_STOP
+ *	has no effect, i.e. the notifier cannot stop the notifier chain. As a
+ *	consequence, the warning for unhandled events is never emitted for
+ *	events matched by such a notifier. Clients that need either of these
+ *	should set &ssam_event_notifier.event.mask to only match the events
+ *	they actually handle, or not use this flag.
  */
 enum ssam_event_notifier_flags {
-	SSAM_EVENT_NOTIFIER_OBSERVER = BIT(0),
+	SSAM_EVENT_NOTIFIER_OBSERVER  = BIT(0),
+	SSAM_EVENT_NOTIFIER_REPLAY    = BIT(1),
+	SSAM_EVENT_NOTIFIER_MAY_BLOCK = BIT(2),
 };
 
 /**
@@ -818,6 +961,16 @@ enum ssam_event_notifier_flags {
  * @event.mask:  Flags determining how events are matched to the notifier.
  * @event.flags: Flags used for enabling the event.
  * @flags:       Notifier flags (see &enum ssam_event_notifier_flags).
+ * @replay_count: Number of cached events replayed to the notifier during
+ *               its registration, see %SSAM_EVENT_NOTIFIER_REPLAY. Set by
+ *               ssam_notifier_register().
+ * @deferred:    Deferred execution of the notifier callback for notifiers
+ *               marked with %SSAM_EVENT_NOTIFIER_MAY_BLOCK. Managed by the
+ *               controller.
+ * @deferred.work:  Work item executing the notifier callback.
+ * @deferred.lock:  Lock guarding the queue.
+ * @deferred.queue: Queue of events pending delivery to the callback.
+ * @deferred.dev:   Device of the controller, used for logging.
  */
 struct ssam_event_notifier {
 	struct ssam_notifier_block base;
@@ -830,6 +983,14 @@ struct ssam_event_notifier {
 	} event;
 
 	unsigned long flags;
+	unsigned int replay_count;
+
+	struct {
+		struct work_struct work;
+		spinlock_t lock;
+		struct list_head queue;
+		struct device *dev;
+	} deferred;
 };
 
 int ssam_notifier_register(struct ssam_controller *ctrl,
@@ -866,4 +1027,49 @@ int ssam_controller_event_disable(struct ssam_controller *ctrl,
 				  struct ssam_event_registry reg,
 				  struct ssam_event_id id, u8 flags);
 
+
+/* -- Diagnostics. ---------------------------------------------------------- */
+
+/**
+ * struct ssam_diag - Ratelimited, counter-backed diagnostic.
+ * @node:        List node for the global diagnostics list.
+ * @dev:         The device the diagnostic is reported on.
+ * @what:        Short description of the condition.
+ * @count:       Total number of occurrences.
+ * @unreported:  Number of occurrences not yet included in a summary.
+ * @last_report: Time (in jiffies) of the last summary.
+ * @report:      Work item emitting the summary.
+ *
+ * Diagnostics replace per-occurrence log messages on hot paths. Instead of
+ * printing each occurrence, occurrences are counted and a summary is emitted
+ * at most once per report interval. Exact counts of all registered
+ * diagnostics are available via the ``diag`` file in the debugfs directory
+ * of the controller.
+ */
+struct ssam_diag {
+	struct list_head node;
+	struct device *dev;
+	const char *what;
+	atomic_long_t count;
+	atomic_t unreported;
+	unsigned long last_report;
+	struct delayed_work report;
+};
+
+void ssam_diag_init(struct ssam_diag *d, struct device *dev, const char *what);
+void ssam_diag_destroy(struct ssam_diag *d);
+void ssam_diag_hit(struct ssam_diag *d);
+
+/**
+ * ssam_diag_count() - Get the total number of occurrences of a diagnostic.
+ * @d: The diagnostic.
+ *
+ * Return: Returns the number of times ssam_diag_hit() has been called on the
+ * given diagnostic.
+ */
+static inline unsigned long ssam_diag_count(struct ssam_diag *d)
+{
+	return atomic_long_read(&d->count);
+}
+
 #endif /* _LINUX_SURFACE_AGGREGATOR_CONTROLLER_H */
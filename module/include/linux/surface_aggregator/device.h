@@ -164,6 +164,8 @@ enum ssam_device_flags {
  * @ctrl:  SSAM controller managing this device.
  * @uid:   UID identifying the device.
  * @flags: Device state flags, see &enum ssam_device_flags.
+ * @stats: Request statistics of the module of the bound driver. Managed by
+ *         the bus.
  */
 struct ssam_device {
 	struct device dev;
@@ -172,6 +174,8 @@ struct ssam_device {
 	struct ssam_device_uid uid;
 
 	unsigned long flags;
+
+	struct ssam_client_stats *stats;
 };
 
 /**
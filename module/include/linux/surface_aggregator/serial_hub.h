@@ -333,13 +333,11 @@ enum ssam_ssh_tc {
 
 /**
  * enum ssh_packet_base_priority - Base priorities for &struct ssh_packet.
- * @SSH_PACKET_PRIORITY_FLUSH: Base priority for flush packets.
  * @SSH_PACKET_PRIORITY_DATA:  Base priority for normal data packets.
  * @SSH_PACKET_PRIORITY_NAK:   Base priority for NAK packets.
  * @SSH_PACKET_PRIORITY_ACK:   Base priority for ACK packets.
  */
 enum ssh_packet_base_priority {
-	SSH_PACKET_PRIORITY_FLUSH = 0,	/* same as DATA to sequence flush */
 	SSH_PACKET_PRIORITY_DATA  = 0,
 	SSH_PACKET_PRIORITY_NAK   = 1,
 	SSH_PACKET_PRIORITY_ACK   = 2,
@@ -355,7 +353,7 @@ enum ssh_packet_base_priority {
  * SSH_PACKET_PRIORITY() - Compute packet priority from base priority and
  * number of tries.
  * @base: The base priority as suffix of &enum ssh_packet_base_priority, e.g.
- *        ``FLUSH``, ``DATA``, ``ACK``, or ``NAK``.
+ *        ``DATA``, ``ACK``, or ``NAK``.
  * @try:  The number of tries (must be less than 16).
  *
  * Compute the combined packet priority. The combined priority is dominated by
@@ -404,7 +402,6 @@ enum ssh_packet_flags {
 	SSH_PACKET_SF_COMPLETED_BIT,
 
 	/* type flags */
-	SSH_PACKET_TY_FLUSH_BIT,
 	SSH_PACKET_TY_SEQUENCED_BIT,
 	SSH_PACKET_TY_BLOCKING_BIT,
 
@@ -421,8 +418,7 @@ enum ssh_packet_flags {
 
 	/* mask for type flags */
 	SSH_PACKET_FLAGS_TY_MASK =
-		  BIT(SSH_PACKET_TY_FLUSH_BIT)
-		| BIT(SSH_PACKET_TY_SEQUENCED_BIT)
+		  BIT(SSH_PACKET_TY_SEQUENCED_BIT)
 		| BIT(SSH_PACKET_TY_BLOCKING_BIT),
 };
 
@@ -465,6 +461,9 @@ struct ssh_packet_ops {
  *            before or in-between transmission attempts. Used for the packet
  *            timeout implementation. Must only be accessed while holding the
  *            pending lock after first submission.
+ * @submitted: Timestamp specifying when the packet has been submitted to the
+ *            packet transport layer. %KTIME_MAX before submission. Only used
+ *            for diagnostics.
  * @queue_node:	The list node for the packet queue.
  * @pending_node: The list node for the set of pending packets.
  * @ops:      Packet operations.
@@ -482,6 +481,7 @@ struct ssh_packet {
 
 	unsigned long state;
 	ktime_t timestamp;
+	ktime_t submitted;
 
 	struct list_head queue_node;
 	struct list_head pending_node;
@@ -527,8 +527,8 @@ enum ssh_request_flags {
 	SSH_REQUEST_SF_COMPLETED_BIT,
 
 	/* type flags */
-	SSH_REQUEST_TY_FLUSH_BIT,
 	SSH_REQUEST_TY_HAS_RESPONSE_BIT,
+	SSH_REQUEST_TY_DEFERRABLE_BIT,
 
 	/* mask for state flags */
 	SSH_REQUEST_FLAGS_SF_MASK =
@@ -543,8 +543,8 @@ enum ssh_request_flags {
 
 	/* mask for type flags */
 	SSH_REQUEST_FLAGS_TY_MASK =
-		  BIT(SSH_REQUEST_TY_FLUSH_BIT)
-		| BIT(SSH_REQUEST_TY_HAS_RESPONSE_BIT),
+		  BIT(SSH_REQUEST_TY_HAS_RESPONSE_BIT)
+		| BIT(SSH_REQUEST_TY_DEFERRABLE_BIT),
 };
 
 struct ssh_rtl;
@@ -593,6 +593,13 @@ struct ssh_request_ops {
  *          completed and may be %KTIME_MAX before that, or when the request
  *          does not expect a response. Used for the request timeout
  *          implementation.
+ * @submitted: Timestamp specifying when the request has been submitted to
+ *          the request transport layer. %KTIME_MAX before submission.
+ * @epoch:  Flush epoch slot in which the request has been accounted upon
+ *          submission. Managed by the request transport layer.
+ * @throttled: Whether the request has been held back in the queue due to its
+ *          target exceeding its share of the request window. Only used for
+ *          statistics. Managed by the request transport layer.
  * @ops:    Request Operations.
  */
 struct ssh_request {
@@ -601,6 +608,9 @@ struct ssh_request {
 
 	unsigned long state;
 	ktime_t timestamp;
+	ktime_t submitted;
+	u8 epoch;
+	bool throttled;
 
 	const struct ssh_request_ops *ops;
 };
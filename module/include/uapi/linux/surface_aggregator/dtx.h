@@ -42,6 +42,8 @@
 /* Runtime errors (non-critical) */
 #define SDTX_DETACH_NOT_FEASIBLE	SDTX_ERR_RT(0x01)
 #define SDTX_DETACH_TIMEDOUT		SDTX_ERR_RT(0x02)
+#define SDTX_HEARTBEAT_LATE		SDTX_ERR_RT(0x03)
+#define SDTX_HEARTBEAT_FAILED		SDTX_ERR_RT(0x04)
 
 /* Hardware errors (critical) */
 #define SDTX_ERR_FAILED_TO_OPEN		SDTX_ERR_HW(0x01)
@@ -98,6 +100,10 @@ struct sdtx_event {
  * @SDTX_EVENT_BASE_CONNECTION: Base/clipboard connection change event type.
  * @SDTX_EVENT_LATCH_STATUS:    Latch status change event type.
  * @SDTX_EVENT_DEVICE_MODE:     Device mode change event type.
+ * @SDTX_EVENT_HEARTBEAT:       Automatic latch heartbeat error event type.
+ *                              Sent when a heartbeat has been sent late
+ *                              (%SDTX_HEARTBEAT_LATE) or could not be sent
+ *                              (%SDTX_HEARTBEAT_FAILED).
  *
  * Used in &struct sdtx_event to describe the type of the event. Further event
  * codes are reserved for future use. Any event parser should be able to
@@ -112,6 +118,7 @@ enum sdtx_event_code {
 	SDTX_EVENT_BASE_CONNECTION	= 3,
 	SDTX_EVENT_LATCH_STATUS		= 4,
 	SDTX_EVENT_DEVICE_MODE		= 5,
+	SDTX_EVENT_HEARTBEAT		= 6,
 };
 
 /**
@@ -127,6 +134,31 @@ struct sdtx_base_info {
 	__u16 base_id;
 } __attribute__((__packed__));
 
+/**
+ * struct sdtx_state_page - Device state shared with user-space.
+ * @seq:          Sequence counter. Odd while the state is being updated.
+ * @base:         Base connection state, as returned by
+ *                %SDTX_IOCTL_GET_BASE_INFO.
+ * @device_mode:  Device mode, as returned by %SDTX_IOCTL_GET_DEVICE_MODE.
+ * @latch_status: Latch status, as returned by %SDTX_IOCTL_GET_LATCH_STATUS.
+ *
+ * Obtained by mapping the first page of the DTX device file (read-only). The
+ * state is kept up to date by the driver based on EC events, thus reading it
+ * does not require any system calls or EC requests.
+ *
+ * The state is protected by a sequence counter: Readers must read @seq, wait
+ * until it is even, read the state, and then re-read @seq. If @seq has
+ * changed in the meantime, the state may be inconsistent and the read must
+ * be retried. Reads of @seq must be ordered against reads of the state via
+ * acquire semantics (or respective memory barriers).
+ */
+struct sdtx_state_page {
+	__u32 seq;
+	struct sdtx_base_info base;
+	__u16 device_mode;
+	__u16 latch_status;
+};
+
 /* IOCTLs */
 #define SDTX_IOCTL_EVENTS_ENABLE	_IO(0xa5, 0x21)
 #define SDTX_IOCTL_EVENTS_DISABLE	_IO(0xa5, 0x22)
@@ -5,7 +5,10 @@
  * Copyright (C) 2019-2021 Maximilian Luz <luzmaximilian@gmail.com>
  */
 
+#include <linux/atomic.h>
 #include <linux/device.h>
+#include <linux/math64.h>
+#include <linux/module.h>
 #include <linux/slab.h>
 
 #include "../include/linux/surface_aggregator/controller.h"
@@ -29,7 +32,64 @@ static struct attribute *ssam_device_attrs[] = {
 	&dev_attr_modalias.attr,
 	NULL,
 };
-ATTRIBUTE_GROUPS(ssam_device);
+
+static const struct attribute_group ssam_device_group = {
+	.attrs = ssam_device_attrs,
+};
+
+/*
+ * Request statistics of the bound driver. Requests are attributed to the
+ * module issuing them, so all devices bound to the same driver report the
+ * same values. All values are zero if no driver is bound.
+ */
+static ssize_t ssam_device_traffic_show(struct device *dev, char *buf,
+					 size_t offset, u32 div)
+{
+	struct ssam_client_stats *stats = READ_ONCE(to_ssam_device(dev)->stats);
+	u64 value = 0;
+
+	if (stats)
+		value = atomic64_read((atomic64_t *)((u8 *)stats + offset));
+
+	return sysfs_emit(buf, "%llu\n", div_u64(value, div));
+}
+
+#define SSAM_DEVICE_TRAFFIC_ATTR(_name, _field, _div)				\
+	static ssize_t _name##_show(struct device *dev,				\
+				    struct device_attribute *attr, char *buf)	\
+	{									\
+		return ssam_device_traffic_show(dev, buf,			\
+			offsetof(struct ssam_client_stats, _field), _div);	\
+	}									\
+	static DEVICE_ATTR_RO(_name)
+
+SSAM_DEVICE_TRAFFIC_ATTR(requests, requests, 1);
+SSAM_DEVICE_TRAFFIC_ATTR(tx_bytes, tx_bytes, 1);
+SSAM_DEVICE_TRAFFIC_ATTR(rx_bytes, rx_bytes, 1);
+SSAM_DEVICE_TRAFFIC_ATTR(timeouts, timeouts, 1);
+SSAM_DEVICE_TRAFFIC_ATTR(errors, errors, 1);
+SSAM_DEVICE_TRAFFIC_ATTR(request_time_us, request_time_ns, NSEC_PER_USEC);
+
+static struct attribute *ssam_device_traffic_attrs[] = {
+	&dev_attr_requests.attr,
+	&dev_attr_tx_bytes.attr,
+	&dev_attr_rx_bytes.attr,
+	&dev_attr_timeouts.attr,
+	&dev_attr_errors.attr,
+	&dev_attr_request_time_us.attr,
+	NULL,
+};
+
+static const struct attribute_group ssam_device_traffic_group = {
+	.name  = "ec_traffic",
+	.attrs = ssam_device_traffic_attrs,
+};
+
+static const struct attribute_group *ssam_device_groups[] = {
+	&ssam_device_group,
+	&ssam_device_traffic_group,
+	NULL,
+};
 
 static int ssam_device_uevent(struct device *dev, struct kobj_uevent_env *env)
 {
@@ -312,17 +372,30 @@ static int ssam_bus_match(struct device *dev, struct device_driver *drv)
 
 static int ssam_bus_probe(struct device *dev)
 {
-	return to_ssam_device_driver(dev->driver)
-		->probe(to_ssam_device(dev));
+	struct ssam_device *sdev = to_ssam_device(dev);
+	struct ssam_client_stats *stats;
+	int status;
+
+	stats = ssam_controller_get_client(sdev->ctrl,
+					   module_name(dev->driver->owner));
+	WRITE_ONCE(sdev->stats, stats);
+
+	status = to_ssam_device_driver(dev->driver)->probe(sdev);
+	if (status)
+		WRITE_ONCE(sdev->stats, NULL);
+
+	return status;
 }
 
 static int ssam_bus_remove(struct device *dev)
 {
 	struct ssam_device_driver *sdrv = to_ssam_device_driver(dev->driver);
+	struct ssam_device *sdev = to_ssam_device(dev);
 
 	if (sdrv->remove)
-		sdrv->remove(to_ssam_device(dev));
+		sdrv->remove(sdev);
 
+	WRITE_ONCE(sdev->stats, NULL);
 	return 0;
 }
 
@@ -685,6 +685,7 @@ static int san_events_register(struct platform_device *pdev)
 	d->nf_bat.event.id.instance = 0;
 	d->nf_bat.event.mask = SSAM_EVENT_MASK_TARGET;
 	d->nf_bat.event.flags = SSAM_EVENT_SEQUENCED;
+	d->nf_bat.flags = SSAM_EVENT_NOTIFIER_MAY_BLOCK;	/* calls into ACPI */
 
 	d->nf_tmp.base.priority = 1;
 	d->nf_tmp.base.fn = san_evt_tmp_nf;
@@ -8,15 +8,18 @@
 
 #include <linux/fs.h>
 #include <linux/ioctl.h>
+#include <linux/jiffies.h>
 #include <linux/kernel.h>
 #include <linux/kfifo.h>
 #include <linux/kref.h>
 #include <linux/miscdevice.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/platform_device.h>
 #include <linux/poll.h>
 #include <linux/rwsem.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
 
@@ -26,6 +29,18 @@
 
 #define SSAM_CDEV_DEVICE_NAME	"surface_aggregator_cdev"
 
+static unsigned int request_max_inflight = 4;
+module_param(request_max_inflight, uint, 0644);
+MODULE_PARM_DESC(request_max_inflight, "maximum number of concurrent requests per client, 0 for no limit [default: 4]");
+
+static unsigned int request_rate = 50;
+module_param(request_rate, uint, 0644);
+MODULE_PARM_DESC(request_rate, "sustained request rate per client in requests per second, 0 for no limit [default: 50]");
+
+static unsigned int request_burst = 10;
+module_param(request_burst, uint, 0644);
+MODULE_PARM_DESC(request_burst, "maximum request burst per client above the sustained rate [default: 10]");
+
 
 /* -- Main structures. ------------------------------------------------------ */
 
@@ -44,6 +59,10 @@ struct ssam_cdev {
 
 	struct rw_semaphore client_lock;  /* Guards client list. */
 	struct list_head client_list;
+
+	struct ssam_diag overrun;
+	struct ssam_diag rejected;
+	struct ssam_diag throttled;
 };
 
 struct ssam_cdev_client;
@@ -66,6 +85,13 @@ struct ssam_cdev_client {
 
 	wait_queue_head_t waitq;
 	struct fasync_struct *fasync;
+
+	struct {
+		atomic_t inflight;
+		spinlock_t lock;	/* Guards token bucket */
+		u64 tokens;
+		unsigned long time;
+	} quota;
 };
 
 static void __ssam_cdev_release(struct kref *kref)
@@ -108,9 +134,10 @@ static u32 ssam_cdev_notifier(struct ssam_event_notifier *nf, const struct ssam_
 
 	/* Make sure we have enough space. */
 	if (kfifo_avail(&client->buffer) < n) {
-		dev_warn(client->cdev->dev,
-			 "buffer full, dropping event (tc: %#04x, tid: %#04x, cid: %#04x, iid: %#04x)\n",
-			 in->target_category, in->target_id, in->command_id, in->instance_id);
+		dev_dbg(client->cdev->dev,
+			"buffer full, dropping event (tc: %#04x, tid: %#04x, cid: %#04x, iid: %#04x)\n",
+			in->target_category, in->target_id, in->command_id, in->instance_id);
+		ssam_diag_hit(&client->cdev->overrun);
 		mutex_unlock(&client->write_lock);
 		return 0;
 	}
@@ -250,6 +277,77 @@ static void ssam_cdev_notifier_unregister_all(struct ssam_cdev_client *client)
 }
 
 
+/* -- Request quotas. ------------------------------------------------------- */
+
+/*
+ * Requests of user-space clients share the request queue with kernel drivers
+ * (e.g. HID, battery). To prevent a single client from degrading their
+ * latency, limit both the number of concurrent requests and the request rate
+ * per client. The rate is enforced via a token bucket, refilled at
+ * request_rate tokens per second and holding at most request_burst tokens.
+ * Tokens are kept scaled by HZ, such that refilling works in whole jiffies.
+ */
+
+static void ssam_cdev_quota_init(struct ssam_cdev_client *client)
+{
+	atomic_set(&client->quota.inflight, 0);
+	spin_lock_init(&client->quota.lock);
+	client->quota.tokens = (u64)max(READ_ONCE(request_burst), 1U) * HZ;
+	client->quota.time = jiffies;
+}
+
+static bool ssam_cdev_quota_take_token(struct ssam_cdev_client *client)
+{
+	const unsigned int rate = READ_ONCE(request_rate);
+	const unsigned int burst = max(READ_ONCE(request_burst), 1U);
+	unsigned long now = jiffies;
+	bool ok;
+	u64 tokens;
+
+	if (!rate)
+		return true;
+
+	spin_lock(&client->quota.lock);
+
+	tokens = client->quota.tokens + (u64)(now - client->quota.time) * rate;
+	tokens = min_t(u64, tokens, (u64)burst * HZ);
+
+	ok = tokens >= HZ;
+	if (ok)
+		tokens -= HZ;
+
+	client->quota.tokens = tokens;
+	client->quota.time = now;
+
+	spin_unlock(&client->quota.lock);
+	return ok;
+}
+
+static int ssam_cdev_quota_acquire(struct ssam_cdev_client *client)
+{
+	const unsigned int max_inflight = READ_ONCE(request_max_inflight);
+
+	if (atomic_inc_return(&client->quota.inflight) > max_inflight && max_inflight) {
+		atomic_dec(&client->quota.inflight);
+		ssam_diag_hit(&client->cdev->rejected);
+		return -EBUSY;
+	}
+
+	if (!ssam_cdev_quota_take_token(client)) {
+		atomic_dec(&client->quota.inflight);
+		ssam_diag_hit(&client->cdev->throttled);
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+static void ssam_cdev_quota_release(struct ssam_cdev_client *client)
+{
+	atomic_dec(&client->quota.inflight);
+}
+
+
 /* -- IOCTL functions. ------------------------------------------------------ */
 
 static long ssam_cdev_request(struct ssam_cdev_client *client, struct ssam_cdev_request __user *r)
@@ -263,6 +361,14 @@ static long ssam_cdev_request(struct ssam_cdev_client *client, struct ssam_cdev_
 
 	lockdep_assert_held_read(&client->cdev->lock);
 
+	/*
+	 * Enforce quotas before doing anything else. Rejected requests are
+	 * not submitted and neither response-length nor status are written.
+	 */
+	ret = ssam_cdev_quota_acquire(client);
+	if (ret)
+		return ret;
+
 	ret = copy_struct_from_user(&rqst, sizeof(rqst), r, sizeof(*r));
 	if (ret)
 		goto out;
@@ -364,6 +470,7 @@ out:
 	kfree(spec.payload);
 	kfree(rsp.pointer);
 
+	ssam_cdev_quota_release(client);
 	return ret;
 }
 
@@ -478,6 +585,8 @@ static int ssam_cdev_device_open(struct inode *inode, struct file *filp)
 	INIT_KFIFO(client->buffer);
 	init_waitqueue_head(&client->waitq);
 
+	ssam_cdev_quota_init(client);
+
 	filp->private_data = client;
 
 	/* Attach client. */
@@ -704,8 +813,17 @@ static int ssam_dbg_device_probe(struct platform_device *pdev)
 	init_rwsem(&cdev->client_lock);
 	INIT_LIST_HEAD(&cdev->client_list);
 
+	ssam_diag_init(&cdev->overrun, &pdev->dev, "buffer full, event dropped");
+	ssam_diag_init(&cdev->rejected, &pdev->dev,
+		       "too many requests in flight, request rejected");
+	ssam_diag_init(&cdev->throttled, &pdev->dev,
+		       "request rate exceeded, request rejected");
+
 	status = misc_register(&cdev->mdev);
 	if (status) {
+		ssam_diag_destroy(&cdev->throttled);
+		ssam_diag_destroy(&cdev->rejected);
+		ssam_diag_destroy(&cdev->overrun);
 		kfree(cdev);
 		return status;
 	}
@@ -754,6 +872,14 @@ static int ssam_dbg_device_remove(struct platform_device *pdev)
 	cdev->dev = NULL;
 	up_write(&cdev->lock);
 
+	/*
+	 * With all notifiers removed and no more requests being executed, the
+	 * diagnostics can no longer be hit.
+	 */
+	ssam_diag_destroy(&cdev->throttled);
+	ssam_diag_destroy(&cdev->rejected);
+	ssam_diag_destroy(&cdev->overrun);
+
 	misc_deregister(&cdev->mdev);
 
 	ssam_cdev_put(cdev);
@@ -0,0 +1,463 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Provides a bulk reader for the telemetry/crash-log (TCL) buffers of the
+ * SSAM EC via debugfs. Intended for debugging and diagnostics.
+ *
+ * Copyright (C) 2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#include <asm/unaligned.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/platform_device.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+#include <linux/vmalloc.h>
+
+#include "../../include/linux/surface_aggregator/controller.h"
+#include "../../include/linux/surface_aggregator/serial_hub.h"
+
+#define STCL_DEVICE_NAME	"surface_aggregator_tcl"
+
+
+/* -- TCL interface. -------------------------------------------------------- */
+
+/*
+ * Buffers are read block-wise via TC 0x0C, CID 0x0C. The instance ID selects
+ * the buffer source, the buffer ID is specified in the payload. Both request
+ * and response start with a block header, the response is followed by the
+ * block data.
+ */
+struct stcl_block_hdr {
+	__le16 buf_id;
+	__le32 offset;
+	__le16 length;
+	u8 end;
+} __packed;
+
+static_assert(sizeof(struct stcl_block_hdr) == 9);
+
+/*
+ * STCL_CHUNK_MAX - Maximum number of data bytes requested per block. Chosen
+ * such that the response, including message framing and block header, fits
+ * into the receive buffer of the packet transport layer (4 KiB). If the EC
+ * returns less data than requested, subsequent blocks are requested with
+ * that (smaller) size.
+ */
+#define STCL_CHUNK_MAX		0xf00
+
+/*
+ * STCL_CHUNK_MIN - Minimum number of data bytes requested per block. Known
+ * to be accepted by all devices.
+ */
+#define STCL_CHUNK_MIN		0x20
+
+/*
+ * STCL_PIPELINE_DEPTH - Number of block requests kept in flight.
+ */
+#define STCL_PIPELINE_DEPTH	4
+
+/*
+ * STCL_RETRIES - Number of tries for reading a single block with the minimum
+ * chunk size before giving up. The EC may not respond at all to blocks that
+ * are too large, so on any error, reading is first retried with smaller
+ * chunk sizes down to STCL_CHUNK_MIN.
+ */
+#define STCL_RETRIES		3
+
+/*
+ * STCL_MAX_SIZE - Maximum size of a buffer.
+ */
+#define STCL_MAX_SIZE		SZ_4M
+
+struct stcl_block {
+	struct ssam_request_sync *rqst;
+	struct ssam_span msgbuf;
+	struct ssam_response rsp;
+	struct stcl_block_hdr hdr;
+	unsigned int gen;
+	u32 offset;
+	u16 length;
+
+	u8 data[sizeof(struct stcl_block_hdr) + STCL_CHUNK_MAX];
+};
+
+struct stcl_reader {
+	struct ssam_controller *ctrl;
+	u8 iid;
+	u16 buf_id;
+
+	/* Request state. */
+	unsigned int gen;
+	u32 next;
+	u16 chunk;
+	unsigned int tries;
+	bool done;
+
+	/* Reassembled data. */
+	u8 *data;
+	size_t size;
+	size_t capacity;
+};
+
+static int stcl_block_submit(struct stcl_reader *r, struct stcl_block *b)
+{
+	struct ssam_request spec;
+	ssize_t len;
+	int status;
+
+	b->gen = r->gen;
+	b->offset = r->next;
+	b->length = r->chunk;
+
+	b->hdr.buf_id = cpu_to_le16(r->buf_id);
+	b->hdr.offset = cpu_to_le32(b->offset);
+	b->hdr.length = cpu_to_le16(b->length);
+	b->hdr.end = 0;
+
+	spec.target_category = SSAM_SSH_TC_TCL;
+	spec.target_id = 0x01;
+	spec.command_id = 0x0c;
+	spec.instance_id = r->iid;
+	spec.flags = SSAM_REQUEST_HAS_RESPONSE;
+	spec.length = sizeof(b->hdr);
+	spec.payload = (u8 *)&b->hdr;
+
+	status = ssam_request_sync_init(b->rqst, spec.flags);
+	if (status)
+		return status;
+
+	b->rsp.capacity = sizeof(struct stcl_block_hdr) + b->length;
+	b->rsp.length = 0;
+	b->rsp.pointer = b->data;
+	ssam_request_sync_set_resp(b->rqst, &b->rsp);
+
+	len = ssam_request_write_data(&b->msgbuf, r->ctrl, &spec);
+	if (len < 0)
+		return len;
+
+	ssam_request_sync_set_data(b->rqst, b->msgbuf.ptr, len);
+
+	return ssam_request_sync_submit(r->ctrl, b->rqst);
+}
+
+static int stcl_reader_append(struct stcl_reader *r, const u8 *data, size_t len)
+{
+	size_t capacity;
+	u8 *buf;
+
+	if (r->size + len > STCL_MAX_SIZE)
+		return -EFBIG;
+
+	if (r->size + len > r->capacity) {
+		capacity = max3(r->capacity * 2, r->size + len, (size_t)PAGE_SIZE);
+		capacity = min_t(size_t, capacity, STCL_MAX_SIZE);
+
+		buf = vmalloc(capacity);
+		if (!buf)
+			return -ENOMEM;
+
+		if (r->data)
+			memcpy(buf, r->data, r->size);
+
+		vfree(r->data);
+		r->data = buf;
+		r->capacity = capacity;
+	}
+
+	memcpy(r->data + r->size, data, len);
+	r->size += len;
+	return 0;
+}
+
+/*
+ * Restart requesting blocks at the current end of the reassembled data.
+ * Blocks still in flight are discarded on completion.
+ */
+static void stcl_reader_rewind(struct stcl_reader *r)
+{
+	r->gen++;
+	r->next = r->size;
+}
+
+static int stcl_block_complete(struct stcl_reader *r, struct stcl_block *b, int status)
+{
+	const struct stcl_block_hdr *hdr = (const struct stcl_block_hdr *)b->data;
+	u16 length;
+
+	if (status) {
+		/*
+		 * The EC may reject or simply not respond to large blocks,
+		 * try again with smaller ones. Only give up once retries
+		 * with the minimum chunk size have been used up.
+		 */
+		if (r->chunk > STCL_CHUNK_MIN)
+			r->chunk = max_t(u16, r->chunk / 2, STCL_CHUNK_MIN);
+		else if (++r->tries >= STCL_RETRIES)
+			return status;
+
+		stcl_reader_rewind(r);
+		return 0;
+	}
+
+	r->tries = 0;
+
+	if (b->rsp.length < sizeof(*hdr))
+		return -EPROTO;
+
+	length = get_unaligned_le16(&hdr->length);
+	if (get_unaligned_le32(&hdr->offset) != b->offset || length > b->length ||
+	    length > b->rsp.length - sizeof(*hdr))
+		return -EPROTO;
+
+	status = stcl_reader_append(r, b->data + sizeof(*hdr), length);
+	if (status)
+		return status;
+
+	if (hdr->end) {
+		r->done = true;
+		return 0;
+	}
+
+	/* Guard against the EC not making any progress. */
+	if (length == 0)
+		return -EPROTO;
+
+	/*
+	 * The EC returned less data than requested. Subsequent blocks in
+	 * flight are thus based on a wrong offset. Restart with the chunk size
+	 * accepted by the EC.
+	 */
+	if (length < b->length) {
+		r->chunk = length;
+		stcl_reader_rewind(r);
+	}
+
+	return 0;
+}
+
+/*
+ * Read a full buffer. Block requests are pipelined, i.e. up to
+ * STCL_PIPELINE_DEPTH requests are kept in flight and completed in order.
+ */
+static int stcl_reader_run(struct stcl_reader *r)
+{
+	struct stcl_block *blocks;
+	unsigned int head = 0, n = 0;
+	int status = 0;
+	int i;
+
+	blocks = kcalloc(STCL_PIPELINE_DEPTH, sizeof(*blocks), GFP_KERNEL);
+	if (!blocks)
+		return -ENOMEM;
+
+	for (i = 0; i < STCL_PIPELINE_DEPTH; i++) {
+		status = ssam_request_sync_alloc(sizeof(struct stcl_block_hdr), GFP_KERNEL,
+						 &blocks[i].rqst, &blocks[i].msgbuf);
+		if (status)
+			goto out;
+	}
+
+	r->gen = 0;
+	r->next = 0;
+	r->chunk = STCL_CHUNK_MAX;
+	r->tries = 0;
+	r->done = false;
+
+	while (true) {
+		struct stcl_block *b;
+		int bstatus;
+
+		/* Fill pipeline. */
+		while (!r->done && !status && n < STCL_PIPELINE_DEPTH) {
+			b = &blocks[(head + n) % STCL_PIPELINE_DEPTH];
+
+			status = stcl_block_submit(r, b);
+			if (status)
+				break;
+
+			r->next += r->chunk;
+			n++;
+		}
+
+		if (n == 0)
+			break;
+
+		/* Complete oldest block. */
+		b = &blocks[head];
+		head = (head + 1) % STCL_PIPELINE_DEPTH;
+		n--;
+
+		bstatus = ssam_request_sync_wait(b->rqst);
+
+		/* Discard blocks after errors, end of data, or rewinding. */
+		if (status || r->done || b->gen != r->gen)
+			continue;
+
+		status = stcl_block_complete(r, b, bstatus);
+	}
+
+out:
+	for (i = 0; i < STCL_PIPELINE_DEPTH; i++)
+		ssam_request_sync_free(blocks[i].rqst);
+
+	kfree(blocks);
+	return status;
+}
+
+
+/* -- Debugfs interface. ---------------------------------------------------- */
+
+struct stcl_device {
+	struct ssam_controller *ctrl;
+	struct mutex lock;		/* Serializes buffer reads. */
+
+	struct dentry *dentry;
+	u8 iid;
+	u16 buf_id;
+};
+
+static int stcl_data_open(struct inode *inode, struct file *file)
+{
+	struct stcl_device *sdev = inode->i_private;
+	struct stcl_reader *r;
+	int status;
+
+	r = kzalloc(sizeof(*r), GFP_KERNEL);
+	if (!r)
+		return -ENOMEM;
+
+	r->ctrl = sdev->ctrl;
+
+	/* Read the full buffer on open, selected via iid and buffer_id files. */
+	mutex_lock(&sdev->lock);
+	r->iid = READ_ONCE(sdev->iid);
+	r->buf_id = READ_ONCE(sdev->buf_id);
+	status = stcl_reader_run(r);
+	mutex_unlock(&sdev->lock);
+
+	if (status) {
+		vfree(r->data);
+		kfree(r);
+		return status;
+	}
+
+	file->private_data = r;
+	return nonseekable_open(inode, file);
+}
+
+static int stcl_data_release(struct inode *inode, struct file *file)
+{
+	struct stcl_reader *r = file->private_data;
+
+	vfree(r->data);
+	kfree(r);
+	return 0;
+}
+
+static ssize_t stcl_data_read(struct file *file, char __user *buf, size_t count,
+			      loff_t *offs)
+{
+	struct stcl_reader *r = file->private_data;
+
+	return simple_read_from_buffer(buf, count, offs, r->data, r->size);
+}
+
+static const struct file_operations stcl_data_fops = {
+	.owner   = THIS_MODULE,
+	.open    = stcl_data_open,
+	.release = stcl_data_release,
+	.read    = stcl_data_read,
+	.llseek  = no_llseek,
+};
+
+
+/* -- Driver setup. --------------------------------------------------------- */
+
+static int stcl_probe(struct platform_device *pdev)
+{
+	struct ssam_controller *ctrl;
+	struct stcl_device *sdev;
+
+	ctrl = ssam_client_bind(&pdev->dev);
+	if (IS_ERR(ctrl))
+		return PTR_ERR(ctrl) == -ENODEV ? -EPROBE_DEFER : PTR_ERR(ctrl);
+
+	sdev = devm_kzalloc(&pdev->dev, sizeof(*sdev), GFP_KERNEL);
+	if (!sdev)
+		return -ENOMEM;
+
+	sdev->ctrl = ctrl;
+	mutex_init(&sdev->lock);
+
+	/* Debugfs is optional, thus we ignore any errors here. */
+	sdev->dentry = debugfs_create_dir("tcl", ssam_debugfs_dir());
+	debugfs_create_u8("iid", 0600, sdev->dentry, &sdev->iid);
+	debugfs_create_u16("buffer_id", 0600, sdev->dentry, &sdev->buf_id);
+	debugfs_create_file("data", 0400, sdev->dentry, sdev, &stcl_data_fops);
+
+	platform_set_drvdata(pdev, sdev);
+	return 0;
+}
+
+static int stcl_remove(struct platform_device *pdev)
+{
+	struct stcl_device *sdev = platform_get_drvdata(pdev);
+
+	/* Waits for any ongoing file operations. */
+	debugfs_remove_recursive(sdev->dentry);
+	mutex_destroy(&sdev->lock);
+	return 0;
+}
+
+static struct platform_device *stcl_device;
+
+static struct platform_driver stcl_driver = {
+	.probe = stcl_probe,
+	.remove = stcl_remove,
+	.driver = {
+		.name = STCL_DEVICE_NAME,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+	},
+};
+
+static int __init stcl_init(void)
+{
+	int status;
+
+	stcl_device = platform_device_alloc(STCL_DEVICE_NAME, PLATFORM_DEVID_NONE);
+	if (!stcl_device)
+		return -ENOMEM;
+
+	status = platform_device_add(stcl_device);
+	if (status)
+		goto err_device;
+
+	status = platform_driver_register(&stcl_driver);
+	if (status)
+		goto err_driver;
+
+	return 0;
+
+err_driver:
+	platform_device_del(stcl_device);
+err_device:
+	platform_device_put(stcl_device);
+	return status;
+}
+module_init(stcl_init);
+
+static void __exit stcl_exit(void)
+{
+	platform_driver_unregister(&stcl_driver);
+	platform_device_unregister(stcl_device);
+}
+module_exit(stcl_exit);
+
+MODULE_AUTHOR("Maximilian Luz <luzmaximilian@gmail.com>");
+MODULE_DESCRIPTION("Telemetry/crash-log buffer reader for Surface System Aggregator Module");
+MODULE_LICENSE("GPL");
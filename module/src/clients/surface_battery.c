@@ -102,6 +102,22 @@ SSAM_DEFINE_SYNC_REQUEST_CL_R(ssam_bat_get_bst, struct spwr_bst, {
 	.command_id      = 0x03,
 });
 
+/*
+ * Deferrable variants of the status requests, for background updates that
+ * nobody is actively waiting for. See SSAM_REQUEST_DEFERRABLE.
+ */
+SSAM_DEFINE_SYNC_REQUEST_CL_R(ssam_bat_get_sta_deferrable, __le32, {
+	.target_category = SSAM_SSH_TC_BAT,
+	.command_id      = 0x01,
+	.flags           = SSAM_REQUEST_DEFERRABLE,
+});
+
+SSAM_DEFINE_SYNC_REQUEST_CL_R(ssam_bat_get_bst_deferrable, struct spwr_bst, {
+	.target_category = SSAM_SSH_TC_BAT,
+	.command_id      = 0x03,
+	.flags           = SSAM_REQUEST_DEFERRABLE,
+});
+
 /* Set battery trip point (_BTP). */
 SSAM_DEFINE_SYNC_REQUEST_CL_W(ssam_bat_set_btp, __le32, {
 	.target_category = SSAM_SSH_TC_BAT,
@@ -162,10 +178,13 @@ static bool spwr_battery_present(struct spwr_battery_device *bat)
 	return le32_to_cpu(bat->sta) & SAM_BATTERY_STA_PRESENT;
 }
 
-static int spwr_battery_load_sta(struct spwr_battery_device *bat)
+static int spwr_battery_load_sta(struct spwr_battery_device *bat, bool deferrable)
 {
 	lockdep_assert_held(&bat->lock);
 
+	if (deferrable)
+		return ssam_retry(ssam_bat_get_sta_deferrable, bat->sdev, &bat->sta);
+
 	return ssam_retry(ssam_bat_get_sta, bat->sdev, &bat->sta);
 }
 
@@ -189,13 +208,16 @@ static int spwr_battery_load_bix(struct spwr_battery_device *bat)
 	return status;
 }
 
-static int spwr_battery_load_bst(struct spwr_battery_device *bat)
+static int spwr_battery_load_bst(struct spwr_battery_device *bat, bool deferrable)
 {
 	lockdep_assert_held(&bat->lock);
 
 	if (!spwr_battery_present(bat))
 		return 0;
 
+	if (deferrable)
+		return ssam_retry(ssam_bat_get_bst_deferrable, bat->sdev, &bat->bst);
+
 	return ssam_retry(ssam_bat_get_bst, bat->sdev, &bat->bst);
 }
 
@@ -209,7 +231,8 @@ static int spwr_battery_set_alarm_unlocked(struct spwr_battery_device *bat, u32
 	return ssam_retry(ssam_bat_set_btp, bat->sdev, &value_le);
 }
 
-static int spwr_battery_update_bst_unlocked(struct spwr_battery_device *bat, bool cached)
+static int spwr_battery_update_bst_unlocked(struct spwr_battery_device *bat, bool cached,
+					    bool deferrable)
 {
 	unsigned long cache_deadline = bat->timestamp + msecs_to_jiffies(cache_time);
 	int status;
@@ -219,11 +242,11 @@ static int spwr_battery_update_bst_unlocked(struct spwr_battery_device *bat, boo
 	if (cached && bat->timestamp && time_is_after_jiffies(cache_deadline))
 		return 0;
 
-	status = spwr_battery_load_sta(bat);
+	status = spwr_battery_load_sta(bat, deferrable);
 	if (status)
 		return status;
 
-	status = spwr_battery_load_bst(bat);
+	status = spwr_battery_load_bst(bat, deferrable);
 	if (status)
 		return status;
 
@@ -231,12 +254,13 @@ static int spwr_battery_update_bst_unlocked(struct spwr_battery_device *bat, boo
 	return 0;
 }
 
-static int spwr_battery_update_bst(struct spwr_battery_device *bat, bool cached)
+static int spwr_battery_update_bst(struct spwr_battery_device *bat, bool cached,
+				   bool deferrable)
 {
 	int status;
 
 	mutex_lock(&bat->lock);
-	status = spwr_battery_update_bst_unlocked(bat, cached);
+	status = spwr_battery_update_bst_unlocked(bat, cached, deferrable);
 	mutex_unlock(&bat->lock);
 
 	return status;
@@ -251,7 +275,7 @@ static int spwr_battery_update_bix_unlocked(struct spwr_battery_device *bat)
 	if (ssam_device_is_hot_removed(bat->sdev))
 		return 0;
 
-	status = spwr_battery_load_sta(bat);
+	status = spwr_battery_load_sta(bat, false);
 	if (status)
 		return status;
 
@@ -259,7 +283,7 @@ static int spwr_battery_update_bix_unlocked(struct spwr_battery_device *bat)
 	if (status)
 		return status;
 
-	status = spwr_battery_load_bst(bat);
+	status = spwr_battery_load_bst(bat, false);
 	if (status)
 		return status;
 
@@ -339,7 +363,7 @@ static int spwr_battery_recheck_status(struct spwr_battery_device *bat)
 {
 	int status;
 
-	status = spwr_battery_update_bst(bat, false);
+	status = spwr_battery_update_bst(bat, false, false);
 	if (!status)
 		power_supply_changed(bat->psy);
 
@@ -403,7 +427,8 @@ static void spwr_battery_update_bst_workfn(struct work_struct *work)
 
 	bat = container_of(dwork, struct spwr_battery_device, update_work);
 
-	status = spwr_battery_update_bst(bat, false);
+	/* Background update, may wait for the link to be woken up anyway. */
+	status = spwr_battery_update_bst(bat, false, true);
 	if (status) {
 		dev_err(&bat->sdev->dev, "failed to update battery state: %d\n", status);
 		return;
@@ -555,7 +580,7 @@ static int spwr_battery_get_property(struct power_supply *psy, enum power_supply
 
 	mutex_lock(&bat->lock);
 
-	status = spwr_battery_update_bst_unlocked(bat, true);
+	status = spwr_battery_update_bst_unlocked(bat, true, false);
 	if (status)
 		goto out;
 
@@ -739,6 +764,7 @@ static void spwr_battery_init(struct spwr_battery_device *bat, struct ssam_devic
 	bat->notif.event.id.instance = 0;	/* need to register with instance 0 */
 	bat->notif.event.mask = SSAM_EVENT_MASK_TARGET;
 	bat->notif.event.flags = SSAM_EVENT_SEQUENCED;
+	bat->notif.flags = SSAM_EVENT_NOTIFIER_MAY_BLOCK;	/* issues requests */
 
 	bat->psy_desc.name = bat->name;
 	bat->psy_desc.type = POWER_SUPPLY_TYPE_BATTERY;
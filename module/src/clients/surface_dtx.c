@@ -14,16 +14,20 @@
 #include <linux/fs.h>
 #include <linux/input.h>
 #include <linux/ioctl.h>
+#include <linux/jiffies.h>
 #include <linux/kernel.h>
 #include <linux/kfifo.h>
 #include <linux/kref.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/mutex.h>
 #include <linux/platform_device.h>
 #include <linux/poll.h>
 #include <linux/rwsem.h>
 #include <linux/slab.h>
+#include <linux/version.h>
 #include <linux/workqueue.h>
 
 #include "../../include/linux/surface_aggregator/controller.h"
@@ -162,11 +166,22 @@ struct sdtx_device {
 		u8 device_mode;
 		u8 latch_status;
 	} state;
+	struct sdtx_state_page *state_page;  /* Shared with user-space. */
 
 	struct delayed_work mode_work;
+	unsigned int mode_seq;            /* Guarded by write_lock. */
 	struct input_dev *mode_switch;
 
+	struct {
+		struct delayed_work work;
+		bool process;             /* Guarded by write_lock. */
+		bool active;              /* Guarded by write_lock. */
+		unsigned long start;
+		unsigned long next;
+	} heartbeat;
+
 	struct ssam_event_notifier notif;
+	struct ssam_diag overrun;
 };
 
 enum sdtx_client_state {
@@ -189,6 +204,7 @@ static void __sdtx_device_release(struct kref *kref)
 	struct sdtx_device *ddev = container_of(kref, struct sdtx_device, kref);
 
 	mutex_destroy(&ddev->write_lock);
+	free_page((unsigned long)ddev->state_page);
 	kfree(ddev);
 }
 
@@ -278,18 +294,37 @@ static u16 sdtx_translate_cancel_reason(struct sdtx_device *ddev, u8 reason)
 
 /* -- IOCTLs. --------------------------------------------------------------- */
 
+static void sdtx_heartbeat_stop(struct sdtx_device *ddev);
+
+/*
+ * The state queried by the functions below is maintained via EC events. As
+ * long as it is not marked as dirty, i.e. not being re-validated after
+ * resume or (for the device mode) while a mode update is pending, we can
+ * answer from it without sending a request to the EC.
+ */
+
 static int sdtx_ioctl_get_base_info(struct sdtx_device *ddev,
 				    struct sdtx_base_info __user *buf)
 {
 	struct ssam_bas_base_info raw;
 	struct sdtx_base_info info;
+	bool cached = false;
 	int status;
 
 	lockdep_assert_held_read(&ddev->lock);
 
-	status = ssam_retry(ssam_bas_get_base, ddev->ctrl, &raw);
-	if (status < 0)
-		return status;
+	mutex_lock(&ddev->write_lock);
+	if (!test_bit(SDTX_DEVICE_DIRTY_BASE_BIT, &ddev->flags)) {
+		raw = ddev->state.base;
+		cached = true;
+	}
+	mutex_unlock(&ddev->write_lock);
+
+	if (!cached) {
+		status = ssam_retry(ssam_bas_get_base, ddev->ctrl, &raw);
+		if (status < 0)
+			return status;
+	}
 
 	info.state = sdtx_translate_base_state(ddev, raw.state);
 	info.base_id = SDTX_BASE_TYPE_SSH(raw.base_id);
@@ -302,28 +337,48 @@ static int sdtx_ioctl_get_base_info(struct sdtx_device *ddev,
 
 static int sdtx_ioctl_get_device_mode(struct sdtx_device *ddev, u16 __user *buf)
 {
+	bool cached = false;
 	u8 mode;
 	int status;
 
 	lockdep_assert_held_read(&ddev->lock);
 
-	status = ssam_retry(ssam_bas_get_device_mode, ddev->ctrl, &mode);
-	if (status < 0)
-		return status;
+	mutex_lock(&ddev->write_lock);
+	if (!test_bit(SDTX_DEVICE_DIRTY_MODE_BIT, &ddev->flags)) {
+		mode = ddev->state.device_mode;
+		cached = true;
+	}
+	mutex_unlock(&ddev->write_lock);
+
+	if (!cached) {
+		status = ssam_retry(ssam_bas_get_device_mode, ddev->ctrl, &mode);
+		if (status < 0)
+			return status;
+	}
 
 	return put_user(mode, buf);
 }
 
 static int sdtx_ioctl_get_latch_status(struct sdtx_device *ddev, u16 __user *buf)
 {
+	bool cached = false;
 	u8 latch;
 	int status;
 
 	lockdep_assert_held_read(&ddev->lock);
 
-	status = ssam_retry(ssam_bas_get_latch_status, ddev->ctrl, &latch);
-	if (status < 0)
-		return status;
+	mutex_lock(&ddev->write_lock);
+	if (!test_bit(SDTX_DEVICE_DIRTY_LATCH_BIT, &ddev->flags)) {
+		latch = ddev->state.latch_status;
+		cached = true;
+	}
+	mutex_unlock(&ddev->write_lock);
+
+	if (!cached) {
+		status = ssam_retry(ssam_bas_get_latch_status, ddev->ctrl, &latch);
+		if (status < 0)
+			return status;
+	}
 
 	return put_user(sdtx_translate_latch_status(ddev, latch), buf);
 }
@@ -331,6 +386,7 @@ static int sdtx_ioctl_get_latch_status(struct sdtx_device *ddev, u16 __user *buf
 static long __surface_dtx_ioctl(struct sdtx_client *client, unsigned int cmd, unsigned long arg)
 {
 	struct sdtx_device *ddev = client->ddev;
+	int status;
 
 	lockdep_assert_held_read(&ddev->lock);
 
@@ -353,7 +409,10 @@ static long __surface_dtx_ioctl(struct sdtx_client *client, unsigned int cmd, un
 		return ssam_retry(ssam_bas_latch_request, ddev->ctrl);
 
 	case SDTX_IOCTL_LATCH_CONFIRM:
-		return ssam_retry(ssam_bas_latch_confirm, ddev->ctrl);
+		status = ssam_retry(ssam_bas_latch_confirm, ddev->ctrl);
+		if (!status)
+			sdtx_heartbeat_stop(ddev);
+		return status;
 
 	case SDTX_IOCTL_LATCH_HEARTBEAT:
 		return ssam_retry(ssam_bas_latch_heartbeat, ddev->ctrl);
@@ -546,6 +605,27 @@ static int surface_dtx_fasync(int fd, struct file *file, int on)
 	return fasync_helper(fd, file, on, &client->fasync);
 }
 
+static int surface_dtx_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct sdtx_client *client = file->private_data;
+	struct page *page = virt_to_page(client->ddev->state_page);
+
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+
+	/* The state page is read-only for user-space. */
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+	return vm_insert_page(vma, vma->vm_start, page);
+}
+
 static const struct file_operations surface_dtx_fops = {
 	.owner          = THIS_MODULE,
 	.open           = surface_dtx_open,
@@ -553,6 +633,7 @@ static const struct file_operations surface_dtx_fops = {
 	.read           = surface_dtx_read,
 	.poll           = surface_dtx_poll,
 	.fasync         = surface_dtx_fasync,
+	.mmap           = surface_dtx_mmap,
 	.unlocked_ioctl = surface_dtx_ioctl,
 	.compat_ioctl   = surface_dtx_ioctl,
 	.llseek         = no_llseek,
@@ -591,7 +672,27 @@ union sdtx_generic_event {
 	struct sdtx_base_info_event base;
 };
 
-static void sdtx_update_device_mode(struct sdtx_device *ddev, unsigned long delay);
+static void __sdtx_update_device_mode(struct sdtx_device *ddev, unsigned long delay);
+
+/* Must be executed with ddev->write_lock held. */
+static void sdtx_state_page_update(struct sdtx_device *ddev)
+{
+	struct sdtx_state_page *page = ddev->state_page;
+
+	lockdep_assert_held(&ddev->write_lock);
+
+	/* Writers are serialized via write_lock, readers are lockless. */
+	WRITE_ONCE(page->seq, page->seq + 1);
+	smp_wmb();
+
+	page->base.state = sdtx_translate_base_state(ddev, ddev->state.base.state);
+	page->base.base_id = SDTX_BASE_TYPE_SSH(ddev->state.base.base_id);
+	page->device_mode = ddev->state.device_mode;
+	page->latch_status = sdtx_translate_latch_status(ddev, ddev->state.latch_status);
+
+	smp_wmb();
+	WRITE_ONCE(page->seq, page->seq + 1);
+}
 
 /* Must be executed with ddev->write_lock held. */
 static void sdtx_push_event(struct sdtx_device *ddev, struct sdtx_event *evt)
@@ -609,7 +710,7 @@ static void sdtx_push_event(struct sdtx_device *ddev, struct sdtx_event *evt)
 		if (likely(kfifo_avail(&client->buffer) >= len))
 			kfifo_in(&client->buffer, (const u8 *)evt, len);
 		else
-			dev_warn(ddev->dev, "event buffer overrun\n");
+			ssam_diag_hit(&ddev->overrun);
 
 		kill_fasync(&client->fasync, SIGIO, POLL_IN);
 	}
@@ -618,6 +719,123 @@ static void sdtx_push_event(struct sdtx_device *ddev, struct sdtx_event *evt)
 	wake_up_interruptible(&ddev->waitq);
 }
 
+/*
+ * Automatic latch heartbeat. While a detachment process is in progress, the
+ * EC waits for a response from user-space and times out if none is received
+ * in time. User-space can delay this timeout by sending heartbeats. If
+ * enabled, this is done by the driver at a fixed interval instead, from the
+ * detachment request until the process is confirmed or canceled. Heartbeats
+ * sent too late or failing are reported as SDTX_EVENT_HEARTBEAT.
+ *
+ * A detachment request event (without a process in progress) starts the
+ * process, any further request event aborts it. Whether a process is in
+ * progress is tracked separately from the heartbeat, as the heartbeat stops
+ * once the detachment has been confirmed while the process only ends with
+ * the latch status or cancel event. Note that we consider the process over
+ * after SDTX_HEARTBEAT_TIMEOUT in case we missed its end, and on suspension,
+ * during which events may be lost.
+ */
+
+static unsigned int heartbeat_interval;
+module_param(heartbeat_interval, uint, 0644);
+MODULE_PARM_DESC(heartbeat_interval, "automatic latch heartbeat interval in milliseconds, 0 to disable [default: 0]");
+
+#define SDTX_HEARTBEAT_TIMEOUT		msecs_to_jiffies(5 * 60 * 1000)
+
+/* Must be executed with ddev->write_lock held. */
+static void __sdtx_heartbeat_start(struct sdtx_device *ddev)
+{
+	unsigned long interval = msecs_to_jiffies(READ_ONCE(heartbeat_interval));
+
+	lockdep_assert_held(&ddev->write_lock);
+
+	ddev->heartbeat.process = true;
+	ddev->heartbeat.active = true;
+	ddev->heartbeat.start = jiffies;
+	ddev->heartbeat.next = jiffies + interval;
+
+	if (interval)
+		schedule_delayed_work(&ddev->heartbeat.work, interval);
+}
+
+/* Must be executed with ddev->write_lock held. */
+static void __sdtx_heartbeat_stop(struct sdtx_device *ddev)
+{
+	lockdep_assert_held(&ddev->write_lock);
+
+	/* The work function checks the active flag, no need to sync here. */
+	ddev->heartbeat.active = false;
+	cancel_delayed_work(&ddev->heartbeat.work);
+}
+
+/* Must be executed with ddev->write_lock held. */
+static void __sdtx_process_end(struct sdtx_device *ddev)
+{
+	lockdep_assert_held(&ddev->write_lock);
+
+	ddev->heartbeat.process = false;
+	__sdtx_heartbeat_stop(ddev);
+}
+
+static void sdtx_heartbeat_stop(struct sdtx_device *ddev)
+{
+	mutex_lock(&ddev->write_lock);
+	__sdtx_heartbeat_stop(ddev);
+	mutex_unlock(&ddev->write_lock);
+}
+
+static void sdtx_heartbeat_workfn(struct work_struct *work)
+{
+	struct sdtx_device *ddev = container_of(work, struct sdtx_device, heartbeat.work.work);
+	unsigned long interval = msecs_to_jiffies(READ_ONCE(heartbeat_interval));
+	unsigned long now = jiffies;
+	struct sdtx_status_event event;
+	bool late;
+	int status;
+
+	mutex_lock(&ddev->write_lock);
+
+	if (!ddev->heartbeat.active || !interval) {
+		mutex_unlock(&ddev->write_lock);
+		return;
+	}
+
+	if (time_after(now, ddev->heartbeat.start + SDTX_HEARTBEAT_TIMEOUT)) {
+		dev_warn(ddev->dev, "detachment process timed out, stopping heartbeat\n");
+		ddev->heartbeat.process = false;
+		ddev->heartbeat.active = false;
+		mutex_unlock(&ddev->write_lock);
+		return;
+	}
+
+	/* Allow for some jitter before considering a heartbeat late. */
+	late = time_after(now, ddev->heartbeat.next + interval / 2);
+
+	ddev->heartbeat.next = now + interval;
+	schedule_delayed_work(&ddev->heartbeat.work, interval);
+
+	mutex_unlock(&ddev->write_lock);
+
+	/*
+	 * Note: If the process concludes concurrently, the heartbeat may be
+	 * sent after that. This is fine, as the EC silently ignores it.
+	 */
+	status = ssam_retry(ssam_bas_latch_heartbeat, ddev->ctrl);
+	if (status)
+		dev_err(ddev->dev, "failed to send latch heartbeat: %d\n", status);
+
+	if (!late && !status)
+		return;
+
+	event.e.length = sizeof(u16);
+	event.e.code = SDTX_EVENT_HEARTBEAT;
+	event.v = status ? SDTX_HEARTBEAT_FAILED : SDTX_HEARTBEAT_LATE;
+
+	mutex_lock(&ddev->write_lock);
+	sdtx_push_event(ddev, &event.e);
+	mutex_unlock(&ddev->write_lock);
+}
+
 static u32 sdtx_notifier(struct ssam_event_notifier *nf, const struct ssam_event *in)
 {
 	struct sdtx_device *ddev = container_of(nf, struct sdtx_device, notif);
@@ -667,6 +885,7 @@ static u32 sdtx_notifier(struct ssam_event_notifier *nf, const struct ssam_event
 
 		ddev->state.base.state = in->data[0];
 		ddev->state.base.base_id = in->data[1];
+		sdtx_state_page_update(ddev);
 
 		event.base.e.length = sizeof(struct sdtx_base_info);
 		event.base.e.code = SDTX_EVENT_BASE_CONNECTION;
@@ -675,17 +894,26 @@ static u32 sdtx_notifier(struct ssam_event_notifier *nf, const struct ssam_event
 		break;
 
 	case SAM_EVENT_CID_DTX_REQUEST:
+		if (ddev->heartbeat.process)
+			__sdtx_process_end(ddev);
+		else
+			__sdtx_heartbeat_start(ddev);
+
 		event.common.code = SDTX_EVENT_REQUEST;
 		event.common.length = 0;
 		break;
 
 	case SAM_EVENT_CID_DTX_CANCEL:
+		__sdtx_process_end(ddev);
+
 		event.status.e.length = sizeof(u16);
 		event.status.e.code = SDTX_EVENT_CANCEL;
 		event.status.v = sdtx_translate_cancel_reason(ddev, in->data[0]);
 		break;
 
 	case SAM_EVENT_CID_DTX_LATCH_STATUS:
+		/* The latch has been opened (or failed to), the process is over. */
+		__sdtx_process_end(ddev);
 		clear_bit(SDTX_DEVICE_DIRTY_LATCH_BIT, &ddev->flags);
 
 		/* If state has not changed: do not send new event. */
@@ -693,6 +921,7 @@ static u32 sdtx_notifier(struct ssam_event_notifier *nf, const struct ssam_event
 			goto out;
 
 		ddev->state.latch_status = in->data[0];
+		sdtx_state_page_update(ddev);
 
 		event.status.e.length = sizeof(u16);
 		event.status.e.code = SDTX_EVENT_LATCH_STATUS;
@@ -707,7 +936,7 @@ static u32 sdtx_notifier(struct ssam_event_notifier *nf, const struct ssam_event
 		unsigned long delay;
 
 		delay = in->data[0] ? SDTX_DEVICE_MODE_DELAY_CONNECT : 0;
-		sdtx_update_device_mode(ddev, delay);
+		__sdtx_update_device_mode(ddev, delay);
 	}
 
 out:
@@ -731,9 +960,18 @@ static void sdtx_device_mode_workfn(struct work_struct *work)
 	struct sdtx_device *ddev = container_of(work, struct sdtx_device, mode_work.work);
 	struct sdtx_status_event event;
 	struct ssam_bas_base_info base;
+	unsigned int seq;
 	int status, tablet;
 	u8 mode;
 
+	/*
+	 * Remember which update request we are handling. If another one is
+	 * made while we query the EC, our result may be outdated.
+	 */
+	mutex_lock(&ddev->write_lock);
+	seq = ddev->mode_seq;
+	mutex_unlock(&ddev->write_lock);
+
 	/* Get operation mode. */
 	status = ssam_retry(ssam_bas_get_device_mode, ddev->ctrl, &mode);
 	if (status) {
@@ -748,6 +986,14 @@ static void sdtx_device_mode_workfn(struct work_struct *work)
 		return;
 	}
 
+	mutex_lock(&ddev->write_lock);
+
+	/* A newer update has been requested and will run after us. */
+	if (ddev->mode_seq != seq) {
+		mutex_unlock(&ddev->write_lock);
+		return;
+	}
+
 	/*
 	 * In some cases (specifically when attaching the base), the device
 	 * mode isn't updated right away. Thus we check if the device mode
@@ -756,11 +1002,11 @@ static void sdtx_device_mode_workfn(struct work_struct *work)
 	 */
 	if (sdtx_device_mode_invalid(mode, base.state)) {
 		dev_dbg(ddev->dev, "device mode is invalid, trying again\n");
-		sdtx_update_device_mode(ddev, SDTX_DEVICE_MODE_DELAY_RECHECK);
+		__sdtx_update_device_mode(ddev, SDTX_DEVICE_MODE_DELAY_RECHECK);
+		mutex_unlock(&ddev->write_lock);
 		return;
 	}
 
-	mutex_lock(&ddev->write_lock);
 	clear_bit(SDTX_DEVICE_DIRTY_MODE_BIT, &ddev->flags);
 
 	/* Avoid sending duplicate device-mode events. */
@@ -770,6 +1016,7 @@ static void sdtx_device_mode_workfn(struct work_struct *work)
 	}
 
 	ddev->state.device_mode = mode;
+	sdtx_state_page_update(ddev);
 
 	event.e.length = sizeof(u16);
 	event.e.code = SDTX_EVENT_DEVICE_MODE;
@@ -785,8 +1032,19 @@ static void sdtx_device_mode_workfn(struct work_struct *work)
 	mutex_unlock(&ddev->write_lock);
 }
 
-static void sdtx_update_device_mode(struct sdtx_device *ddev, unsigned long delay)
+/* Must be executed with ddev->write_lock held. */
+static void __sdtx_update_device_mode(struct sdtx_device *ddev, unsigned long delay)
 {
+	lockdep_assert_held(&ddev->write_lock);
+
+	/*
+	 * The cached device mode may be outdated until the update has been
+	 * completed. Mark it as dirty to prevent it from being reported.
+	 * Bumping the sequence number makes a currently running update
+	 * discard its (possibly outdated) result.
+	 */
+	ddev->mode_seq++;
+	set_bit(SDTX_DEVICE_DIRTY_MODE_BIT, &ddev->flags);
 	schedule_delayed_work(&ddev->mode_work, delay);
 }
 
@@ -804,6 +1062,7 @@ static void __sdtx_device_state_update_base(struct sdtx_device *ddev,
 		return;
 
 	ddev->state.base = info;
+	sdtx_state_page_update(ddev);
 
 	event.e.length = sizeof(struct sdtx_base_info);
 	event.e.code = SDTX_EVENT_BASE_CONNECTION;
@@ -829,7 +1088,7 @@ static void __sdtx_device_state_update_mode(struct sdtx_device *ddev, u8 mode)
 
 	if (sdtx_device_mode_invalid(mode, ddev->state.base.state)) {
 		dev_dbg(ddev->dev, "device mode is invalid, trying again\n");
-		sdtx_update_device_mode(ddev, SDTX_DEVICE_MODE_DELAY_RECHECK);
+		__sdtx_update_device_mode(ddev, SDTX_DEVICE_MODE_DELAY_RECHECK);
 		return;
 	}
 
@@ -838,6 +1097,7 @@ static void __sdtx_device_state_update_mode(struct sdtx_device *ddev, u8 mode)
 		return;
 
 	ddev->state.device_mode = mode;
+	sdtx_state_page_update(ddev);
 
 	/* Send event. */
 	event.e.length = sizeof(u16);
@@ -864,6 +1124,7 @@ static void __sdtx_device_state_update_latch(struct sdtx_device *ddev, u8 status
 		return;
 
 	ddev->state.latch_status = status;
+	sdtx_state_page_update(ddev);
 
 	event.e.length = sizeof(struct sdtx_base_info);
 	event.e.code = SDTX_EVENT_BASE_CONNECTION;
@@ -971,6 +1232,7 @@ static int sdtx_device_init(struct sdtx_device *ddev, struct device *dev,
 
 	INIT_DELAYED_WORK(&ddev->mode_work, sdtx_device_mode_workfn);
 	INIT_DELAYED_WORK(&ddev->state_work, sdtx_device_state_workfn);
+	INIT_DELAYED_WORK(&ddev->heartbeat.work, sdtx_heartbeat_workfn);
 
 	/*
 	 * Get current device state. We want to guarantee that events are only
@@ -995,6 +1257,15 @@ static int sdtx_device_init(struct sdtx_device *ddev, struct device *dev,
 	if (status)
 		return status;
 
+	/* Set up state page, shared with user-space via mmap(). */
+	ddev->state_page = (struct sdtx_state_page *)get_zeroed_page(GFP_KERNEL);
+	if (!ddev->state_page)
+		return -ENOMEM;
+
+	mutex_lock(&ddev->write_lock);
+	sdtx_state_page_update(ddev);
+	mutex_unlock(&ddev->write_lock);
+
 	/* Set up tablet mode switch. */
 	ddev->mode_switch = input_allocate_device();
 	if (!ddev->mode_switch)
@@ -1015,6 +1286,8 @@ static int sdtx_device_init(struct sdtx_device *ddev, struct device *dev,
 		return status;
 	}
 
+	ssam_diag_init(&ddev->overrun, ddev->dev, "event buffer overrun");
+
 	/* Set up event notifier. */
 	status = ssam_notifier_register(ddev->ctrl, &ddev->notif);
 	if (status)
@@ -1035,7 +1308,10 @@ static int sdtx_device_init(struct sdtx_device *ddev, struct device *dev,
 err_notif:
 	ssam_notifier_unregister(ddev->ctrl, &ddev->notif);
 	cancel_delayed_work_sync(&ddev->mode_work);
+	sdtx_heartbeat_stop(ddev);
+	cancel_delayed_work_sync(&ddev->heartbeat.work);
 err_mdev:
+	ssam_diag_destroy(&ddev->overrun);
 	input_unregister_device(ddev->mode_switch);
 	return status;
 }
@@ -1077,6 +1353,13 @@ static void sdtx_device_destroy(struct sdtx_device *ddev)
 	/* Stop state_work. */
 	cancel_delayed_work_sync(&ddev->state_work);
 
+	/* Stop heartbeat. */
+	sdtx_heartbeat_stop(ddev);
+	cancel_delayed_work_sync(&ddev->heartbeat.work);
+
+	/* With notifier and workers stopped, no new events can be dropped. */
+	ssam_diag_destroy(&ddev->overrun);
+
 	/* With mode_work canceled, we can unregister the mode_switch. */
 	input_unregister_device(ddev->mode_switch);
 
@@ -1115,6 +1398,23 @@ static void sdtx_device_destroy(struct sdtx_device *ddev)
 
 #ifdef CONFIG_PM_SLEEP
 
+static int surface_dtx_pm_prepare(struct device *dev)
+{
+	struct sdtx_device *ddev = dev_get_drvdata(dev);
+
+	/*
+	 * Events may get lost while suspended, so we cannot rely on seeing
+	 * the end of a detachment process in progress. Stop sending
+	 * heartbeats for it.
+	 */
+	mutex_lock(&ddev->write_lock);
+	__sdtx_process_end(ddev);
+	mutex_unlock(&ddev->write_lock);
+
+	cancel_delayed_work_sync(&ddev->heartbeat.work);
+	return 0;
+}
+
 static void surface_dtx_pm_complete(struct device *dev)
 {
 	struct sdtx_device *ddev = dev_get_drvdata(dev);
@@ -1138,6 +1438,7 @@ static void surface_dtx_pm_complete(struct device *dev)
 }
 
 static const struct dev_pm_ops surface_dtx_pm_ops = {
+	.prepare = surface_dtx_pm_prepare,
 	.complete = surface_dtx_pm_complete,
 };
 
@@ -9,15 +9,20 @@
 #include <linux/atomic.h>
 #include <linux/completion.h>
 #include <linux/gpio/consumer.h>
+#include <linux/hash.h>
 #include <linux/interrupt.h>
 #include <linux/kref.h>
 #include <linux/limits.h>
 #include <linux/list.h>
 #include <linux/lockdep.h>
+#include <linux/math64.h>
+#include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/rculist.h>
+#include <linux/rcupdate.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/seq_file.h>
 #include <linux/serdev.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
@@ -129,8 +134,12 @@ static bool ssam_event_matches_notifier(const struct ssam_event_notifier *n,
 	return match;
 }
 
+static u32 ssam_nf_defer(struct ssam_cplt *cplt, struct ssam_event_notifier *n,
+			 const struct ssam_event *event);
+
 /**
  * ssam_nfblk_call_chain() - Call event notifier callbacks of the given chain.
+ * @cplt:  The completion system, used for deferring notifier callbacks.
  * @nh:    The notifier head for which the notifier callbacks should be called.
  * @event: The event data provided to the callbacks.
  *
@@ -139,23 +148,34 @@ static bool ssam_event_matches_notifier(const struct ssam_event_notifier *n,
  * %SSAM_NOTIF_STOP bit set. Note that this bit is automatically set via
  * ssam_notifier_from_errno() on any non-zero error value.
  *
+ * Callbacks of notifiers marked with %SSAM_EVENT_NOTIFIER_MAY_BLOCK are not
+ * called directly, but deferred via ssam_nf_defer(). Such notifiers always
+ * count as having handled the event and never stop the chain.
+ *
  * Return: Returns the notifier status value, which contains the notifier
  * status bits (%SSAM_NOTIF_HANDLED and %SSAM_NOTIF_STOP) as well as a
  * potential error value returned from the last executed notifier callback.
  * Use ssam_notifier_to_errno() to convert this value to the original error
  * value.
  */
-static int ssam_nfblk_call_chain(struct ssam_nf_head *nh, struct ssam_event *event)
+static int ssam_nfblk_call_chain(struct ssam_cplt *cplt, struct ssam_nf_head *nh,
+				 struct ssam_event *event)
 {
 	struct ssam_event_notifier *nf;
 	int ret = 0, idx;
+	u32 nf_ret;
 
 	idx = srcu_read_lock(&nh->srcu);
 
 	list_for_each_entry_rcu(nf, &nh->head, base.node,
 				srcu_read_lock_held(&nh->srcu)) {
 		if (ssam_event_matches_notifier(nf, event)) {
-			ret = (ret & SSAM_NOTIF_STATE_MASK) | nf->base.fn(nf, event);
+			if (nf->flags & SSAM_EVENT_NOTIFIER_MAY_BLOCK)
+				nf_ret = ssam_nf_defer(cplt, nf, event);
+			else
+				nf_ret = nf->base.fn(nf, event);
+
+			ret = (ret & SSAM_NOTIF_STATE_MASK) | nf_ret;
 			if (ret & SSAM_NOTIF_STOP)
 				break;
 		}
@@ -285,12 +305,25 @@ struct ssam_nf_refcount_key {
  * @node:     The node of this entry in the rb-tree.
  * @key:      The key of the event.
  * @refcount: The reference-count of the event.
+ * @users:    The number of parties currently operating on this entry outside
+ *            of ``nf->lock``. The entry is kept alive (and in the tree) as
+ *            long as this is non-zero.
+ * @lock:     Lock serializing EC requests enabling/disabling this event and
+ *            guarding @enabled and @flags. Must not be acquired while holding
+ *            ``nf->lock``, however, ``nf->lock`` may be acquired while holding
+ *            this lock.
+ * @enabled:  Whether the event is currently enabled on the EC.
  * @flags:    The flags used when enabling the event.
+ *
+ * Note: @refcount and @users are guarded by ``nf->lock``.
  */
 struct ssam_nf_refcount_entry {
 	struct rb_node node;
 	struct ssam_nf_refcount_key key;
 	int refcount;
+	int users;
+	struct mutex lock;
+	bool enabled;
 	u8 flags;
 };
 
@@ -303,7 +336,9 @@ struct ssam_nf_refcount_entry {
  *
  * Increments the reference-/activation-count associated with the specified
  * event type/ID, allocating a new entry for this event ID if necessary. A
- * newly allocated entry will have a refcount of one.
+ * newly allocated entry will have a refcount of one. Additionally, the
+ * returned entry is pinned for use outside of ``nf->lock``, the caller must
+ * release it via ssam_nf_refcount_put() once done.
  *
  * Note: ``nf->lock`` must be held when calling this function.
  *
@@ -337,6 +372,7 @@ ssam_nf_refcount_inc(struct ssam_nf *nf, struct ssam_event_registry reg,
 			link = &(*link)->rb_right;
 		} else if (entry->refcount < INT_MAX) {
 			entry->refcount++;
+			entry->users++;
 			return entry;
 		} else {
 			WARN_ON(1);
@@ -350,6 +386,8 @@ ssam_nf_refcount_inc(struct ssam_nf *nf, struct ssam_event_registry reg,
 
 	entry->key = key;
 	entry->refcount = 1;
+	entry->users = 1;
+	mutex_init(&entry->lock);
 
 	rb_link_node(&entry->node, parent, link);
 	rb_insert_color(&entry->node, &nf->refcount);
@@ -365,8 +403,9 @@ ssam_nf_refcount_inc(struct ssam_nf *nf, struct ssam_event_registry reg,
  * @id:  The event ID.
  *
  * Decrements the reference-/activation-count of the specified event,
- * returning its entry. If the returned entry has a refcount of zero, the
- * caller is responsible for freeing it using kfree().
+ * returning its entry. The returned entry is pinned for use outside of
+ * ``nf->lock``, the caller must release it via ssam_nf_refcount_put() once
+ * done.
  *
  * Note: ``nf->lock`` must be held when calling this function.
  *
@@ -395,12 +434,13 @@ ssam_nf_refcount_dec(struct ssam_nf *nf, struct ssam_event_registry reg,
 			node = node->rb_left;
 		} else if (cmp > 0) {
 			node = node->rb_right;
-		} else {
+		} else if (entry->refcount > 0) {
 			entry->refcount--;
-			if (entry->refcount == 0)
-				rb_erase(&entry->node, &nf->refcount);
-
+			entry->users++;
 			return entry;
+		} else {
+			/* Entry is only kept alive by in-flight operations. */
+			return NULL;
 		}
 	}
 
@@ -408,28 +448,28 @@ ssam_nf_refcount_dec(struct ssam_nf *nf, struct ssam_event_registry reg,
 }
 
 /**
- * ssam_nf_refcount_dec_free() - Decrement reference-/activation-count of the
- * given event and free its entry if the reference count reaches zero.
- * @nf:  The notifier system reference.
- * @reg: The registry used to enable/disable the event.
- * @id:  The event ID.
+ * ssam_nf_refcount_put() - Release a pinned reference count entry.
+ * @nf:    The notifier system reference.
+ * @entry: The entry to release.
  *
- * Decrements the reference-/activation-count of the specified event, freeing
- * its entry if it reaches zero.
+ * Releases an entry previously pinned via ssam_nf_refcount_inc() or
+ * ssam_nf_refcount_dec(). If the entry is no longer in use, i.e. its
+ * reference count is zero and no other party is operating on it, it will be
+ * removed from the tree and freed.
  *
  * Note: ``nf->lock`` must be held when calling this function.
  */
-static void ssam_nf_refcount_dec_free(struct ssam_nf *nf,
-				      struct ssam_event_registry reg,
-				      struct ssam_event_id id)
+static void ssam_nf_refcount_put(struct ssam_nf *nf,
+				 struct ssam_nf_refcount_entry *entry)
 {
-	struct ssam_nf_refcount_entry *entry;
-
 	lockdep_assert_held(&nf->lock);
 
-	entry = ssam_nf_refcount_dec(nf, reg, id);
-	if (entry && entry->refcount == 0)
+	entry->users--;
+	if (entry->refcount == 0 && entry->users == 0) {
+		rb_erase(&entry->node, &nf->refcount);
+		mutex_destroy(&entry->lock);
 		kfree(entry);
+	}
 }
 
 /**
@@ -444,8 +484,7 @@ static bool ssam_nf_refcount_empty(struct ssam_nf *nf)
 
 /**
  * ssam_nf_call() - Call notification callbacks for the provided event.
- * @nf:    The notifier system
- * @dev:   The associated device, only used for logging.
+ * @cplt:  The completion system containing the notifier system.
  * @rqid:  The request ID of the event.
  * @event: The event provided to the callbacks.
  *
@@ -461,9 +500,11 @@ static bool ssam_nf_refcount_empty(struct ssam_nf *nf)
  *
  * In case a callback failed, this function will emit an error message.
  */
-static void ssam_nf_call(struct ssam_nf *nf, struct device *dev, u16 rqid,
+static void ssam_nf_call(struct ssam_cplt *cplt, u16 rqid,
 			 struct ssam_event *event)
 {
+	struct ssam_nf *nf = &cplt->event.notif;
+	struct device *dev = cplt->dev;
 	struct ssam_nf_head *nf_head;
 	int status, nf_ret;
 
@@ -473,7 +514,7 @@ static void ssam_nf_call(struct ssam_nf *nf, struct device *dev, u16 rqid,
 	}
 
 	nf_head = &nf->head[ssh_rqid_to_event(rqid)];
-	nf_ret = ssam_nfblk_call_chain(nf_head, event);
+	nf_ret = ssam_nfblk_call_chain(cplt, nf_head, event);
 	status = ssam_notifier_to_errno(nf_ret);
 
 	if (status < 0) {
@@ -532,6 +573,7 @@ static void ssam_nf_destroy(struct ssam_nf *nf)
 /* -- Event/async request completion system. -------------------------------- */
 
 #define SSAM_CPLT_WQ_NAME	"ssam_cpltq"
+#define SSAM_CPLT_BLK_WQ_NAME	"ssam_cplt_blkq"
 
 /*
  * SSAM_CPLT_WQ_BATCH - Maximum number of event item completions executed per
@@ -631,6 +673,7 @@ static struct ssam_event_item *ssam_event_item_alloc(size_t len, gfp_t flags)
 	}
 
 	item->event.length = len;
+	item->event.replayed = false;
 
 	trace_ssam_event_item_alloc(item, len);
 	return item;
@@ -684,6 +727,307 @@ static bool ssam_event_queue_is_empty(struct ssam_event_queue *q)
 	return empty;
 }
 
+/*
+ * SSAM_EVENT_CACHE_PAYLOAD_LEN - Maximum payload length of cached events.
+ *
+ * Events with larger payloads (e.g. HID input reports) generally do not
+ * represent any state worth caching and are thus ignored.
+ */
+#define SSAM_EVENT_CACHE_PAYLOAD_LEN		SSAM_EVENT_ITEM_CACHE_PAYLOAD_LEN
+
+/**
+ * struct ssam_event_cache_entry - RB-tree entry for cached events.
+ * @node:  The node of this entry in the rb-tree.
+ * @key:   The key of this entry, see ssam_event_cache_key().
+ * @event: The cached event. Payload storage is always allocated for
+ *         %SSAM_EVENT_CACHE_PAYLOAD_LEN bytes.
+ */
+struct ssam_event_cache_entry {
+	struct rb_node node;
+	u32 key;
+	struct ssam_event event;	/* must be last */
+};
+
+static u32 ssam_event_cache_key(const struct ssam_event *event)
+{
+	return (u32)event->target_category << 24 | (u32)event->target_id << 16
+	       | (u32)event->command_id << 8 | event->instance_id;
+}
+
+/**
+ * struct ssam_event_replay - Request to replay cached events to a notifier.
+ * @node:  The node of this request in the replay list of the event queue.
+ * @n:     The notifier to replay the cached events to.
+ * @tidx:  The index of the target ID of the event queue. Only events handled
+ *         by the queue are replayed via this request.
+ * @count: The number of replayed events.
+ * @done:  Completion signaled once all events have been replayed.
+ */
+struct ssam_event_replay {
+	struct list_head node;
+	struct ssam_event_notifier *n;
+	u16 tidx;
+	unsigned int count;
+	struct completion done;
+};
+
+static u16 ssam_event_cache_tidx(u8 tid)
+{
+	return ssh_tid_is_valid(tid) ? ssh_tid_to_index(tid) : 0;
+}
+
+/**
+ * ssam_event_cache_update() - Store an event as most recent value.
+ * @cache: The event cache.
+ * @rqid:  The request ID of the event.
+ * @event: The event to store.
+ *
+ * Replaces the currently cached event with the same target category, target
+ * ID, command ID, and instance ID with the given event. Events for which no
+ * notifier with %SSAM_EVENT_NOTIFIER_REPLAY is registered and events with a
+ * payload larger than %SSAM_EVENT_CACHE_PAYLOAD_LEN are ignored without
+ * taking the cache lock.
+ */
+static void ssam_event_cache_update(struct ssam_event_cache *cache, u16 rqid,
+				    const struct ssam_event *event)
+{
+	struct rb_node **link = &cache->root.rb_node;
+	struct ssam_event_cache_entry *entry;
+	struct rb_node *parent = NULL;
+	u32 key = ssam_event_cache_key(event);
+	atomic_t *users;
+
+	if (!ssh_rqid_is_event(rqid))
+		return;
+
+	if (event->length > SSAM_EVENT_CACHE_PAYLOAD_LEN)
+		return;
+
+	users = &cache->users[ssh_rqid_to_event(rqid)];
+	if (!atomic_read(users))
+		return;
+
+	mutex_lock(&cache->lock);
+
+	/* Re-check, the last user may have gone away in the meantime. */
+	if (!atomic_read(users))
+		goto out;
+
+	while (*link) {
+		entry = rb_entry(*link, struct ssam_event_cache_entry, node);
+		parent = *link;
+
+		if (key < entry->key)
+			link = &(*link)->rb_left;
+		else if (key > entry->key)
+			link = &(*link)->rb_right;
+		else
+			goto store;
+	}
+
+	entry = kzalloc(struct_size(entry, event.data, SSAM_EVENT_CACHE_PAYLOAD_LEN),
+			GFP_KERNEL);
+	if (!entry)
+		goto out;
+
+	entry->key = key;
+	rb_link_node(&entry->node, parent, link);
+	rb_insert_color(&entry->node, &cache->root);
+
+store:
+	entry->event.target_category = event->target_category;
+	entry->event.target_id = event->target_id;
+	entry->event.command_id = event->command_id;
+	entry->event.instance_id = event->instance_id;
+	entry->event.length = event->length;
+	memcpy(&entry->event.data[0], &event->data[0], event->length);
+
+out:
+	mutex_unlock(&cache->lock);
+}
+
+static void __ssam_event_cache_invalidate(struct ssam_event_cache *cache, u8 tc)
+{
+	struct ssam_event_cache_entry *entry;
+	struct rb_node *node, *next;
+
+	lockdep_assert_held(&cache->lock);
+
+	for (node = rb_first(&cache->root); node; node = next) {
+		next = rb_next(node);
+		entry = rb_entry(node, struct ssam_event_cache_entry, node);
+
+		if (entry->event.target_category != tc)
+			continue;
+
+		rb_erase(&entry->node, &cache->root);
+		kfree(entry);
+	}
+}
+
+/**
+ * ssam_event_cache_invalidate() - Discard cached events of a target category.
+ * @cache: The event cache.
+ * @tc:    The target category of the events to discard.
+ *
+ * Discards all cached events of the given target category. Used when events
+ * are being disabled, i.e. when the cached values cannot be guaranteed to be
+ * up to date any more.
+ */
+static void ssam_event_cache_invalidate(struct ssam_event_cache *cache, u8 tc)
+{
+	mutex_lock(&cache->lock);
+	__ssam_event_cache_invalidate(cache, tc);
+	mutex_unlock(&cache->lock);
+}
+
+/**
+ * ssam_event_cache_get() - Start caching events of a target category.
+ * @cache: The event cache.
+ * @tc:    The target category for which to cache events.
+ *
+ * Increments the number of users with %SSAM_EVENT_NOTIFIER_REPLAY of the
+ * given target category. Events of that category are cached until the
+ * number of users drops back to zero via ssam_event_cache_put().
+ */
+static void ssam_event_cache_get(struct ssam_event_cache *cache, u8 tc)
+{
+	u16 event = ssh_rqid_to_event(ssh_tc_to_rqid(tc));
+
+	mutex_lock(&cache->lock);
+	atomic_inc(&cache->users[event]);
+	mutex_unlock(&cache->lock);
+}
+
+/**
+ * ssam_event_cache_put() - Stop caching events of a target category.
+ * @cache: The event cache.
+ * @tc:    The target category for which to stop caching events.
+ *
+ * Decrements the number of users with %SSAM_EVENT_NOTIFIER_REPLAY of the
+ * given target category. Discards all cached events of that category if this
+ * was the last user.
+ */
+static void ssam_event_cache_put(struct ssam_event_cache *cache, u8 tc)
+{
+	u16 event = ssh_rqid_to_event(ssh_tc_to_rqid(tc));
+
+	mutex_lock(&cache->lock);
+	if (atomic_dec_and_test(&cache->users[event]))
+		__ssam_event_cache_invalidate(cache, tc);
+	mutex_unlock(&cache->lock);
+}
+
+/**
+ * ssam_event_cache_clear() - Discard all cached events.
+ * @cache: The event cache.
+ */
+static void ssam_event_cache_clear(struct ssam_event_cache *cache)
+{
+	struct ssam_event_cache_entry *e, *n;
+
+	mutex_lock(&cache->lock);
+	rbtree_postorder_for_each_entry_safe(e, n, &cache->root, node)
+		kfree(e);
+	cache->root = RB_ROOT;
+	mutex_unlock(&cache->lock);
+}
+
+/**
+ * ssam_event_cache_replay() - Replay cached events to a notifier.
+ * @cplt: The completion system.
+ * @r:    The replay request, specifying notifier and event queue.
+ *
+ * Calls the callback of the notifier for each cached event matching it and
+ * handled by the event queue of the request. Must only be called from the
+ * work function of that event queue, which guarantees that no live event is
+ * delivered concurrently and that events received after the cached ones are
+ * delivered after them. Callbacks of notifiers marked with
+ * %SSAM_EVENT_NOTIFIER_MAY_BLOCK are deferred via ssam_nf_defer(), in the
+ * same way as for live events.
+ */
+static void ssam_event_cache_replay(struct ssam_cplt *cplt,
+				    struct ssam_event_replay *r)
+{
+	struct ssam_event_cache *cache = &cplt->event.cache;
+	struct ssam_event_notifier *n = r->n;
+	struct ssam_event_cache_entry *entry;
+	struct ssam_event_item *item, *tmp;
+	struct rb_node *node;
+	LIST_HEAD(items);
+	int status;
+
+	mutex_lock(&cache->lock);
+
+	for (node = rb_first(&cache->root); node; node = rb_next(node)) {
+		entry = rb_entry(node, struct ssam_event_cache_entry, node);
+
+		if (ssam_event_cache_tidx(entry->event.target_id) != r->tidx)
+			continue;
+
+		if (!ssam_event_matches_notifier(n, &entry->event))
+			continue;
+
+		item = ssam_event_item_alloc(entry->event.length, GFP_KERNEL);
+		if (!item)
+			break;
+
+		item->event.target_category = entry->event.target_category;
+		item->event.target_id = entry->event.target_id;
+		item->event.command_id = entry->event.command_id;
+		item->event.instance_id = entry->event.instance_id;
+		item->event.replayed = true;
+		memcpy(&item->event.data[0], &entry->event.data[0], entry->event.length);
+
+		list_add_tail(&item->node, &items);
+	}
+
+	mutex_unlock(&cache->lock);
+
+	list_for_each_entry_safe(item, tmp, &items, node) {
+		if (n->flags & SSAM_EVENT_NOTIFIER_MAY_BLOCK)
+			status = ssam_notifier_to_errno(ssam_nf_defer(cplt, n, &item->event));
+		else
+			status = ssam_notifier_to_errno(n->base.fn(n, &item->event));
+
+		if (status < 0) {
+			dev_err(cplt->dev,
+				"event: error replaying event: %d (tc: %#04x, tid: %#04x, cid: %#04x, iid: %#04x)\n",
+				status, item->event.target_category, item->event.target_id,
+				item->event.command_id, item->event.instance_id);
+		}
+
+		r->count++;
+		list_del(&item->node);
+		ssam_event_item_free(item);
+	}
+}
+
+/**
+ * ssam_event_cache_init() - Initialize the event cache.
+ * @cache: The event cache to initialize.
+ */
+static void ssam_event_cache_init(struct ssam_event_cache *cache)
+{
+	int i;
+
+	mutex_init(&cache->lock);
+	cache->root = RB_ROOT;
+
+	for (i = 0; i < SSH_NUM_EVENTS; i++)
+		atomic_set(&cache->users[i], 0);
+}
+
+/**
+ * ssam_event_cache_destroy() - Deinitialize the event cache.
+ * @cache: The event cache to deinitialize.
+ */
+static void ssam_event_cache_destroy(struct ssam_event_cache *cache)
+{
+	ssam_event_cache_clear(cache);
+	mutex_destroy(&cache->lock);
+}
+
 /**
  * ssam_cplt_get_event_queue() - Get the event queue for the given parameters.
  * @cplt: The completion system on which to look for the queue.
@@ -756,7 +1100,7 @@ static int ssam_cplt_submit_event(struct ssam_cplt *cplt,
  * @cplt: The completion system.
  *
  * Flush the completion system by waiting until all currently submitted work
- * items have been completed.
+ * items, including deferred notifier callbacks, have been completed.
  *
  * Note: This function does not guarantee that all events will have been
  * handled once this call terminates. In case of a larger number of
@@ -771,19 +1115,39 @@ static int ssam_cplt_submit_event(struct ssam_cplt *cplt,
 static void ssam_cplt_flush(struct ssam_cplt *cplt)
 {
 	flush_workqueue(cplt->wq);
+	flush_workqueue(cplt->blk_wq);
+}
+
+static struct ssam_event_replay *ssam_event_queue_pop_replay(struct ssam_event_queue *q)
+{
+	struct ssam_event_replay *r;
+
+	spin_lock(&q->lock);
+	r = list_first_entry_or_null(&q->replay, struct ssam_event_replay, node);
+	if (r)
+		list_del(&r->node);
+	spin_unlock(&q->lock);
+
+	return r;
 }
 
 static void ssam_event_queue_work_fn(struct work_struct *work)
 {
 	struct ssam_event_queue *queue;
+	struct ssam_event_replay *replay;
 	struct ssam_event_item *item;
-	struct ssam_nf *nf;
-	struct device *dev;
 	unsigned int iterations = SSAM_CPLT_WQ_BATCH;
 
 	queue = container_of(work, struct ssam_event_queue, work);
-	nf = &queue->cplt->event.notif;
-	dev = queue->cplt->dev;
+
+	/*
+	 * Replay cached events before handling queued events: Any event still
+	 * queued has been received after the cached ones.
+	 */
+	while ((replay = ssam_event_queue_pop_replay(queue))) {
+		ssam_event_cache_replay(queue->cplt, replay);
+		complete(&replay->done);
+	}
 
 	/* Limit number of processed events to avoid livelocking. */
 	do {
@@ -791,7 +1155,9 @@ static void ssam_event_queue_work_fn(struct work_struct *work)
 		if (!item)
 			return;
 
-		ssam_nf_call(nf, dev, item->rqid, &item->event);
+		ssam_event_cache_update(&queue->cplt->event.cache, item->rqid,
+					&item->event);
+		ssam_nf_call(queue->cplt, item->rqid, &item->event);
 		ssam_event_item_free(item);
 	} while (--iterations);
 
@@ -799,6 +1165,132 @@ static void ssam_event_queue_work_fn(struct work_struct *work)
 		ssam_cplt_submit(queue->cplt, &queue->work);
 }
 
+static struct ssam_event_item *ssam_nf_deferred_pop(struct ssam_event_notifier *n)
+{
+	struct ssam_event_item *item;
+
+	spin_lock(&n->deferred.lock);
+	item = list_first_entry_or_null(&n->deferred.queue,
+					struct ssam_event_item, node);
+	if (item)
+		list_del(&item->node);
+	spin_unlock(&n->deferred.lock);
+
+	return item;
+}
+
+static void ssam_nf_deferred_call(struct ssam_event_notifier *n,
+				  const struct ssam_event *event)
+{
+	int status;
+
+	/*
+	 * The event has already been accounted as handled on the notifier
+	 * chain, so the return value is only used for error reporting.
+	 */
+	status = ssam_notifier_to_errno(n->base.fn(n, event));
+	if (status < 0) {
+		dev_err(n->deferred.dev,
+			"event: error handling deferred event: %d (tc: %#04x, tid: %#04x, cid: %#04x, iid: %#04x)\n",
+			status, event->target_category, event->target_id,
+			event->command_id, event->instance_id);
+	}
+}
+
+static void ssam_nf_deferred_work_fn(struct work_struct *work)
+{
+	struct ssam_event_notifier *n;
+	struct ssam_event_item *item;
+
+	n = container_of(work, struct ssam_event_notifier, deferred.work);
+
+	/*
+	 * This runs on its own unbound workqueue, so there is no need to
+	 * limit the number of processed events here.
+	 */
+	while ((item = ssam_nf_deferred_pop(n))) {
+		ssam_nf_deferred_call(n, &item->event);
+		ssam_event_item_free(item);
+	}
+}
+
+/**
+ * ssam_nf_deferred_init() - Initialize deferred execution of a notifier.
+ * @cplt: The completion system on which the notifier is registered.
+ * @n:    The notifier.
+ */
+static void ssam_nf_deferred_init(struct ssam_cplt *cplt,
+				  struct ssam_event_notifier *n)
+{
+	INIT_WORK(&n->deferred.work, ssam_nf_deferred_work_fn);
+	spin_lock_init(&n->deferred.lock);
+	INIT_LIST_HEAD(&n->deferred.queue);
+	n->deferred.dev = cplt->dev;
+}
+
+/**
+ * ssam_nf_deferred_cancel() - Cancel deferred execution of a notifier.
+ * @n: The notifier.
+ *
+ * Waits for a currently running callback to finish and discards all events
+ * still pending delivery. Must only be called after the notifier has been
+ * removed from its notifier chain and SRCU has been synchronized, so that no
+ * new events can be queued.
+ */
+static void ssam_nf_deferred_cancel(struct ssam_event_notifier *n)
+{
+	struct ssam_event_item *item;
+
+	cancel_work_sync(&n->deferred.work);
+
+	while ((item = ssam_nf_deferred_pop(n)))
+		ssam_event_item_free(item);
+}
+
+/**
+ * ssam_nf_defer() - Defer execution of a notifier callback.
+ * @cplt:  The completion system.
+ * @n:     The notifier, marked with %SSAM_EVENT_NOTIFIER_MAY_BLOCK.
+ * @event: The event to deliver.
+ *
+ * Copies the event and queues it for delivery to the notifier on the
+ * blocking workqueue of the completion system. If the event cannot be
+ * copied, the callback is executed directly instead, as delivering the event
+ * late is preferable to dropping it.
+ *
+ * The return value of the callback is ignored in both cases, apart from
+ * reporting errors. This keeps the result independent of whether the event
+ * could be queued.
+ *
+ * Return: Always returns %SSAM_NOTIF_HANDLED.
+ */
+static u32 ssam_nf_defer(struct ssam_cplt *cplt, struct ssam_event_notifier *n,
+			 const struct ssam_event *event)
+{
+	struct ssam_event_item *item;
+
+	item = ssam_event_item_alloc(event->length, GFP_KERNEL);
+	if (!item) {
+		ssam_nf_deferred_call(n, event);
+		return SSAM_NOTIF_HANDLED;
+	}
+
+	item->rqid = 0;
+	item->event.target_category = event->target_category;
+	item->event.target_id = event->target_id;
+	item->event.command_id = event->command_id;
+	item->event.instance_id = event->instance_id;
+	item->event.replayed = event->replayed;
+	memcpy(&item->event.data[0], &event->data[0], event->length);
+
+	spin_lock(&n->deferred.lock);
+	list_add_tail(&item->node, &n->deferred.queue);
+	spin_unlock(&n->deferred.lock);
+
+	queue_work(cplt->blk_wq, &n->deferred.work);
+	return SSAM_NOTIF_HANDLED;
+}
+
 /**
  * ssam_event_queue_init() - Initialize an event queue.
  * @cplt: The completion system on which the queue resides.
@@ -810,6 +1302,7 @@ static void ssam_event_queue_init(struct ssam_cplt *cplt,
 	evq->cplt = cplt;
 	spin_lock_init(&evq->lock);
 	INIT_LIST_HEAD(&evq->head);
+	INIT_LIST_HEAD(&evq->replay);
 	INIT_WORK(&evq->work, ssam_event_queue_work_fn);
 }
 
@@ -829,6 +1322,12 @@ static int ssam_cplt_init(struct ssam_cplt *cplt, struct device *dev)
 	if (!cplt->wq)
 		return -ENOMEM;
 
+	cplt->blk_wq = alloc_workqueue(SSAM_CPLT_BLK_WQ_NAME, WQ_UNBOUND, 0);
+	if (!cplt->blk_wq) {
+		destroy_workqueue(cplt->wq);
+		return -ENOMEM;
+	}
+
 	for (c = 0; c < ARRAY_SIZE(cplt->event.target); c++) {
 		target = &cplt->event.target[c];
 
@@ -837,10 +1336,14 @@ static int ssam_cplt_init(struct ssam_cplt *cplt, struct device *dev)
 	}
 
 	status = ssam_nf_init(&cplt->event.notif);
-	if (status)
+	if (status) {
+		destroy_workqueue(cplt->blk_wq);
 		destroy_workqueue(cplt->wq);
+		return status;
+	}
 
-	return status;
+	ssam_event_cache_init(&cplt->event.cache);
+	return 0;
 }
 
 /**
@@ -856,13 +1359,280 @@ static void ssam_cplt_destroy(struct ssam_cplt *cplt)
 	 * Note: destroy_workqueue ensures that all currently queued work will
 	 * be fully completed and the workqueue drained. This means that this
 	 * call will inherently also free any queued ssam_event_items, thus we
-	 * don't have to take care of that here explicitly.
+	 * don't have to take care of that here explicitly. Deferred notifier
+	 * callbacks are only queued from the event workqueue, so destroy the
+	 * blocking workqueue afterwards.
 	 */
 	destroy_workqueue(cplt->wq);
+	destroy_workqueue(cplt->blk_wq);
+	ssam_event_cache_destroy(&cplt->event.cache);
 	ssam_nf_destroy(&cplt->event.notif);
 }
 
 
+/* -- Per-client request accounting. ---------------------------------------- */
+
+/*
+ * Resolving the client of a request requires a module address lookup and a
+ * search of the client list. To keep this off the request submission path,
+ * the result is cached per call site, i.e. per return address, in a small
+ * open-addressing hash table that is read under RCU only. Sites are inserted
+ * under the client lock and are never removed individually, so probe chains
+ * stay intact. As addresses of an unloaded module may be reused by the next
+ * one, all sites are evicted whenever a module goes away.
+ */
+
+/* Must be executed with clients.lock held. */
+static void __ssam_client_sites_evict(struct ssam_controller *ctrl)
+{
+	struct ssam_client_site *site;
+	unsigned int i;
+
+	for (i = 0; i < SSAM_CLIENT_SITES; i++) {
+		site = rcu_dereference_protected(ctrl->clients.sites[i],
+						 lockdep_is_held(&ctrl->clients.lock));
+		if (!site)
+			continue;
+
+		RCU_INIT_POINTER(ctrl->clients.sites[i], NULL);
+		kfree_rcu(site, rcu);
+	}
+}
+
+static int ssam_clients_module_notify(struct notifier_block *nb,
+				      unsigned long action, void *data)
+{
+	struct ssam_controller *ctrl;
+
+	if (action != MODULE_STATE_GOING)
+		return NOTIFY_DONE;
+
+	ctrl = container_of(nb, struct ssam_controller, clients.module_nb);
+
+	spin_lock(&ctrl->clients.lock);
+	__ssam_client_sites_evict(ctrl);
+	spin_unlock(&ctrl->clients.lock);
+
+	return NOTIFY_OK;
+}
+
+static int ssam_clients_init(struct ssam_controller *ctrl)
+{
+	spin_lock_init(&ctrl->clients.lock);
+	INIT_LIST_HEAD(&ctrl->clients.list);
+	memset(ctrl->clients.sites, 0, sizeof(ctrl->clients.sites));
+
+	ctrl->clients.module_nb.notifier_call = ssam_clients_module_notify;
+	return register_module_notifier(&ctrl->clients.module_nb);
+}
+
+static void ssam_clients_destroy(struct ssam_controller *ctrl)
+{
+	struct ssam_client_stats *stats, *n;
+
+	unregister_module_notifier(&ctrl->clients.module_nb);
+
+	spin_lock(&ctrl->clients.lock);
+	__ssam_client_sites_evict(ctrl);
+	spin_unlock(&ctrl->clients.lock);
+
+	/* Wait for evicted sites to be freed before dropping the stats. */
+	rcu_barrier();
+
+	list_for_each_entry_safe(stats, n, &ctrl->clients.list, node) {
+		list_del(&stats->node);
+		kfree(stats);
+	}
+}
+
+static struct ssam_client_stats *
+__ssam_controller_find_client(struct ssam_controller *ctrl, const char *name)
+{
+	struct ssam_client_stats *stats;
+
+	lockdep_assert_held(&ctrl->clients.lock);
+
+	list_for_each_entry(stats, &ctrl->clients.list, node) {
+		if (!strcmp(stats->name, name))
+			return stats;
+	}
+
+	return NULL;
+}
+
+/**
+ * ssam_controller_get_client() - Get the request statistics of a client.
+ * @ctrl: The controller.
+ * @name: The name of the client module, "kernel" for built-in code.
+ *
+ * Looks up the statistics entry of the given client, creating it if it does
+ * not exist yet. Entries are never removed while the controller is alive, so
+ * the returned pointer stays valid until the controller has been destroyed.
+ * May be called from atomic context.
+ *
+ * Return: Returns the statistics entry of the client or %NULL if it could not
+ * be allocated.
+ */
+struct ssam_client_stats *ssam_controller_get_client(struct ssam_controller *ctrl,
+						     const char *name)
+{
+	struct ssam_client_stats *stats;
+
+	spin_lock(&ctrl->clients.lock);
+
+	stats = __ssam_controller_find_client(ctrl, name);
+	if (!stats) {
+		/* If allocation fails, the client simply won't be accounted. */
+		stats = kzalloc(sizeof(*stats), GFP_ATOMIC);
+		if (stats) {
+			strscpy(stats->name, name, sizeof(stats->name));
+			list_add_tail(&stats->node, &ctrl->clients.list);
+		}
+	}
+
+	spin_unlock(&ctrl->clients.lock);
+	return stats;
+}
+
+static struct ssam_client_stats *ssam_client_stats_lookup(struct ssam_controller *ctrl,
+							   unsigned long caller)
+{
+	struct ssam_client_site *site, *cur;
+	struct ssam_client_stats *stats;
+	char name[MODULE_NAME_LEN];
+	struct module *mod;
+	unsigned int i, idx;
+
+	/* Attribute the request to the module containing the caller. */
+	preempt_disable();
+	mod = __module_address(caller);
+	strscpy(name, mod ? mod->name : "kernel", sizeof(name));
+	preempt_enable();
+
+	stats = ssam_controller_get_client(ctrl, name);
+	if (!stats)
+		return NULL;
+
+	/* If allocation fails, the site will simply be looked up again. */
+	site = kzalloc(sizeof(*site), GFP_ATOMIC);
+	if (!site)
+		return stats;
+
+	site->caller = caller;
+	site->stats = stats;
+
+	idx = hash_long(caller, SSAM_CLIENT_SITES_BITS);
+
+	spin_lock(&ctrl->clients.lock);
+
+	for (i = 0; i < SSAM_CLIENT_SITES; i++) {
+		unsigned int j = (idx + i) % SSAM_CLIENT_SITES;
+
+		cur = rcu_dereference_protected(ctrl->clients.sites[j],
+						lockdep_is_held(&ctrl->clients.lock));
+
+		/* Lost a race against another submission from this site. */
+		if (cur && cur->caller == caller)
+			break;
+
+		if (!cur) {
+			rcu_assign_pointer(ctrl->clients.sites[j], site);
+			site = NULL;
+			break;
+		}
+	}
+
+	spin_unlock(&ctrl->clients.lock);
+
+	/* Not inserted if already present or if the table is full. */
+	kfree(site);
+	return stats;
+}
+
+static struct ssam_client_stats *ssam_client_stats_get(struct ssam_controller *ctrl,
+						       unsigned long caller)
+{
+	struct ssam_client_stats *stats = NULL;
+	struct ssam_client_site *site;
+	unsigned int i, idx;
+
+	idx = hash_long(caller, SSAM_CLIENT_SITES_BITS);
+
+	rcu_read_lock();
+
+	for (i = 0; i < SSAM_CLIENT_SITES; i++) {
+		site = rcu_dereference(ctrl->clients.sites[(idx + i) % SSAM_CLIENT_SITES]);
+		if (!site)
+			break;
+
+		if (site->caller == caller) {
+			stats = site->stats;
+			break;
+		}
+	}
+
+	rcu_read_unlock();
+
+	if (likely(stats))
+		return stats;
+
+	return ssam_client_stats_lookup(ctrl, caller);
+}
+
+/**
+ * ssam_controller_show_clients() - Print per-client request statistics.
+ * @ctrl: The controller.
+ * @s:    The sequence file to print the statistics to.
+ *
+ * Prints one line per client module that has issued requests via this
+ * controller, in order of first use.
+ */
+void ssam_controller_show_clients(struct ssam_controller *ctrl,
+				  struct seq_file *s)
+{
+	struct ssam_client_stats *stats;
+
+	spin_lock(&ctrl->clients.lock);
+
+	list_for_each_entry(stats, &ctrl->clients.list, node) {
+		seq_printf(s, "%s: requests: %lld  tx: %lld  rx: %lld  timeouts: %lld  errors: %lld  request_time_us: %lld\n",
+			   stats->name,
+			   atomic64_read(&stats->requests),
+			   atomic64_read(&stats->tx_bytes),
+			   atomic64_read(&stats->rx_bytes),
+			   atomic64_read(&stats->timeouts),
+			   atomic64_read(&stats->errors),
+			   div_s64(atomic64_read(&stats->request_time_ns),
+				   NSEC_PER_USEC));
+	}
+
+	spin_unlock(&ctrl->clients.lock);
+}
+
+static void ssam_client_stats_account(const struct ssam_request_sync *rqst,
+				      const struct ssam_span *data)
+{
+	struct ssam_client_stats *stats = rqst->acct.stats;
+	size_t len = rqst->base.packet.data.len;
+
+	if (!stats)
+		return;
+
+	atomic64_inc(&stats->requests);
+	atomic64_add(len - SSH_COMMAND_MESSAGE_LENGTH(0), &stats->tx_bytes);
+	atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), rqst->acct.time)),
+		     &stats->request_time_ns);
+
+	if (data)
+		atomic64_add(data->len, &stats->rx_bytes);
+
+	if (rqst->status == -ETIMEDOUT)
+		atomic64_inc(&stats->timeouts);
+	else if (rqst->status)
+		atomic64_inc(&stats->errors);
+}
+
+
 /* -- Main SSAM device structures. ------------------------------------------ */
 
 /**
@@ -1166,6 +1936,7 @@ int ssam_controller_init(struct ssam_controller *ctrl,
 			 struct serdev_device *serdev)
 {
 	acpi_handle handle = ACPI_HANDLE(&serdev->dev);
+	u32 idle_timeout;
 	int status;
 
 	init_rwsem(&ctrl->lock);
@@ -1203,6 +1974,25 @@ int ssam_controller_init(struct ssam_controller *ctrl,
 		return status;
 	}
 
+	/*
+	 * Deferrable requests are sent without holding them back as long as
+	 * the EC UART is still awake, i.e. within its sleep idle timeout after
+	 * the last activity. As we don't track the screen state, use the
+	 * shorter of the two timeouts. If none is known, keep the default of
+	 * the request transport layer.
+	 */
+	idle_timeout = min(ctrl->caps.screen_on_sleep_idle_timeout,
+			   ctrl->caps.screen_off_sleep_idle_timeout);
+	if (idle_timeout != U32_MAX)
+		ctrl->rtl.defer.idle_timeout = msecs_to_jiffies(idle_timeout);
+
+	status = ssam_clients_init(ctrl);
+	if (status) {
+		ssh_rtl_destroy(&ctrl->rtl);
+		ssam_cplt_destroy(&ctrl->cplt);
+		return status;
+	}
+
 	/*
 	 * Set state via write_once even though we expect to be in an
 	 * exclusive context, due to smoke-testing in
@@ -1367,6 +2157,7 @@ void ssam_controller_destroy(struct ssam_controller *ctrl)
 	/* Actually free resources. */
 	ssam_cplt_destroy(&ctrl->cplt);
 	ssh_rtl_destroy(&ctrl->rtl);
+	ssam_clients_destroy(ctrl);
 
 	/*
 	 * Set state via write_once even though we expect to be locked/in an
@@ -1400,6 +2191,9 @@ int ssam_controller_suspend(struct ssam_controller *ctrl)
 
 	ssam_dbg(ctrl, "pm: suspending controller\n");
 
+	/* We may miss events while suspended, so drop any cached values. */
+	ssam_event_cache_clear(&ctrl->cplt.event.cache);
+
 	/*
 	 * Set state via write_once even though we're locked, due to
 	 * smoke-testing in ssam_request_sync_submit().
@@ -1488,14 +2282,12 @@ ssize_t ssam_request_write_data(struct ssam_span *buf,
 }
 EXPORT_SYMBOL_GPL(ssam_request_write_data);
 
-static void ssam_request_sync_complete(struct ssh_request *rqst,
-				       const struct ssh_command *cmd,
-				       const struct ssam_span *data, int status)
+static void __ssam_request_sync_complete(struct ssam_request_sync *r,
+					 const struct ssam_span *data,
+					 int status)
 {
-	struct ssh_rtl *rtl = ssh_request_rtl(rqst);
-	struct ssam_request_sync *r;
+	struct ssh_rtl *rtl = ssh_request_rtl(&r->base);
 
-	r = container_of(rqst, struct ssam_request_sync, base);
 	r->status = status;
 
 	if (r->resp)
@@ -1509,6 +2301,11 @@ static void ssam_request_sync_complete(struct ssh_request *rqst,
 	if (!data)	/* Handle requests without a response. */
 		return;
 
+	if (r->parse.fn) {
+		r->status = r->parse.fn(r->parse.ctx, data);
+		return;
+	}
+
 	if (!r->resp || !r->resp->pointer) {
 		if (data->len)
 			rtl_warn(rtl, "rsp: no response buffer provided, dropping data\n");
@@ -1527,6 +2324,18 @@ static void ssam_request_sync_complete(struct ssh_request *rqst,
 	memcpy(r->resp->pointer, data->ptr, data->len);
 }
 
+static void ssam_request_sync_complete(struct ssh_request *rqst,
+				       const struct ssh_command *cmd,
+				       const struct ssam_span *data, int status)
+{
+	struct ssam_request_sync *r;
+
+	r = container_of(rqst, struct ssam_request_sync, base);
+
+	__ssam_request_sync_complete(r, data, status);
+	ssam_client_stats_account(r, data);
+}
+
 static void ssam_request_sync_release(struct ssh_request *rqst)
 {
 	complete_all(&container_of(rqst, struct ssam_request_sync, base)->comp);
@@ -1618,12 +2427,43 @@ int ssam_request_sync_init(struct ssam_request_sync *rqst,
 
 	init_completion(&rqst->comp);
 	rqst->resp = NULL;
+	rqst->parse.fn = NULL;
+	rqst->parse.ctx = NULL;
 	rqst->status = 0;
+	rqst->acct.caller = 0;
+	rqst->acct.stats = NULL;
 
 	return 0;
 }
 EXPORT_SYMBOL_GPL(ssam_request_sync_init);
 
+#ifdef CONFIG_SURFACE_AGGREGATOR_CONTEXT_VALIDATION
+
+/**
+ * ssam_request_sync_validate_context() - Check the context of a request
+ * submission.
+ *
+ * Warns (once) if called from the event completion workqueue. Waiting for
+ * the request there delays all subsequent events of the same event queue.
+ * Notifiers issuing requests should be marked with
+ * %SSAM_EVENT_NOTIFIER_MAY_BLOCK instead.
+ */
+static void ssam_request_sync_validate_context(void)
+{
+	struct work_struct *work = current_work();
+
+	WARN_ONCE(work && work->func == ssam_event_queue_work_fn,
+		  "ssam: synchronous request submitted from event completion workqueue\n");
+}
+
+#else /* CONFIG_SURFACE_AGGREGATOR_CONTEXT_VALIDATION */
+
+static inline void ssam_request_sync_validate_context(void)
+{
+}
+
+#endif /* CONFIG_SURFACE_AGGREGATOR_CONTEXT_VALIDATION */
+
 /**
  * ssam_request_sync_submit() - Submit a synchronous request.
  * @ctrl: The controller with which to submit the request.
@@ -1641,12 +2481,18 @@ EXPORT_SYMBOL_GPL(ssam_request_sync_init);
  *
  * This function may only be used if the controller is active, i.e. has been
  * initialized and not suspended.
+ *
+ * The request is accounted to the module of the caller of this function,
+ * unless it has already been attributed by one of the higher-level request
+ * functions.
  */
 int ssam_request_sync_submit(struct ssam_controller *ctrl,
 			     struct ssam_request_sync *rqst)
 {
 	int status;
 
+	ssam_request_sync_validate_context();
+
 	/*
 	 * This is only a superficial check. In general, the caller needs to
 	 * ensure that the controller is initialized and is not (and does not
@@ -1666,6 +2512,15 @@ int ssam_request_sync_submit(struct ssam_controller *ctrl,
 		return -ENODEV;
 	}
 
+	/* Set up accounting before the request can complete. */
+	if (!rqst->acct.caller)
+		rqst->acct.caller = _RET_IP_;
+
+	if (!rqst->acct.stats)
+		rqst->acct.stats = ssam_client_stats_get(ctrl, rqst->acct.caller);
+
+	rqst->acct.time = ktime_get();
+
 	status = ssh_rtl_submit(&ctrl->rtl, &rqst->base);
 	ssh_request_put(&rqst->base);
 
@@ -1703,6 +2558,7 @@ int ssam_request_sync(struct ssam_controller *ctrl,
 	if (status)
 		return status;
 
+	rqst->acct.caller = _RET_IP_;
 	ssam_request_sync_set_resp(rqst, rsp);
 
 	len = ssam_request_write_data(&buf, ctrl, spec);
@@ -1756,6 +2612,7 @@ int ssam_request_sync_with_buffer(struct ssam_controller *ctrl,
 	if (status)
 		return status;
 
+	rqst.acct.caller = _RET_IP_;
 	ssam_request_sync_set_resp(&rqst, rsp);
 
 	len = ssam_request_write_data(buf, ctrl, spec);
@@ -1772,6 +2629,59 @@ int ssam_request_sync_with_buffer(struct ssam_controller *ctrl,
 }
 EXPORT_SYMBOL_GPL(ssam_request_sync_with_buffer);
 
+/**
+ * ssam_request_sync_with_parser() - Execute a synchronous request with the
+ * provided buffer as back-end for the message buffer, parsing the response in
+ * place.
+ * @ctrl: The controller via which the request will be submitted.
+ * @spec: The request specification and payload.
+ * @fn:   The callback parsing the response.
+ * @ctx:  The context passed to the callback.
+ * @buf:  The buffer for the request message data.
+ *
+ * Same as ssam_request_sync_with_buffer(), but instead of copying the
+ * response into a response buffer, the response is passed directly from the
+ * receive buffer to the given callback. This avoids both the copy and the
+ * need to size an intermediate buffer for the full response. The callback is
+ * executed on the receiver thread and must not sleep, see &typedef
+ * ssam_response_parse_fn_t.
+ *
+ * For split submission and waiting, use ssam_request_sync_set_parser() with
+ * ssam_request_sync_submit() and ssam_request_sync_wait() instead.
+ *
+ * Return: Returns the status of the request, the error returned by the
+ * parser, or any failure during setup.
+ */
+int ssam_request_sync_with_parser(struct ssam_controller *ctrl,
+				  const struct ssam_request *spec,
+				  ssam_response_parse_fn_t fn, void *ctx,
+				  struct ssam_span *buf)
+{
+	struct ssam_request_sync rqst;
+	ssize_t len;
+	int status;
+
+	status = ssam_request_sync_init(&rqst, spec->flags);
+	if (status)
+		return status;
+
+	rqst.acct.caller = _RET_IP_;
+	ssam_request_sync_set_parser(&rqst, fn, ctx);
+
+	len = ssam_request_write_data(buf, ctrl, spec);
+	if (len < 0)
+		return len;
+
+	ssam_request_sync_set_data(&rqst, buf->ptr, len);
+
+	status = ssam_request_sync_submit(ctrl, &rqst);
+	if (!status)
+		status = ssam_request_sync_wait(&rqst);
+
+	return status;
+}
+EXPORT_SYMBOL_GPL(ssam_request_sync_with_parser);
+
 
 /* -- Internal SAM requests. ------------------------------------------------ */
 
@@ -2151,19 +3061,20 @@ int ssam_ctrl_notif_d0_entry(struct ssam_controller *ctrl)
  * ssam_nf_refcount_enable() - Enable event for reference count entry if it has
  * not already been enabled.
  * @ctrl:  The controller to enable the event on.
- * @entry: The reference count entry for the event to be enabled.
+ * @entry: The (pinned) reference count entry for the event to be enabled.
  * @flags: The flags used for enabling the event on the EC.
  *
- * Enable the event associated with the given reference count entry if the
- * reference count equals one, i.e. the event has not previously been enabled.
- * If the event has already been enabled (i.e. reference count not equal to
- * one), check that the flags used for enabling match and warn about this if
- * they do not.
+ * Enable the event associated with the given reference count entry if it has
+ * not been enabled yet. If the event has already been enabled, check that the
+ * flags used for enabling match and warn about this if they do not.
+ *
+ * Enabling is serialized per event via the lock of the entry, so that
+ * enabling different events can proceed in parallel.
  *
  * This does not modify the reference count itself, which is done with
  * ssam_nf_refcount_inc() / ssam_nf_refcount_dec().
  *
- * Note: ``nf->lock`` must be held when calling this function.
+ * Note: ``nf->lock`` must not be held when calling this function.
  *
  * Return: Returns zero on success. If the event is enabled by this call,
  * returns the status of the event-enable EC command.
@@ -2173,20 +3084,21 @@ static int ssam_nf_refcount_enable(struct ssam_controller *ctrl,
 {
 	const struct ssam_event_registry reg = entry->key.reg;
 	const struct ssam_event_id id = entry->key.id;
-	struct ssam_nf *nf = &ctrl->cplt.event.notif;
-	int status;
+	int status = 0;
 
-	lockdep_assert_held(&nf->lock);
+	lockdep_assert_not_held(&ctrl->cplt.event.notif.lock);
 
-	ssam_dbg(ctrl, "enabling event (reg: %#04x, tc: %#04x, iid: %#04x, rc: %d)\n",
-		 reg.target_category, id.target_category, id.instance, entry->refcount);
+	mutex_lock(&entry->lock);
 
-	if (entry->refcount == 1) {
-		status = ssam_ssh_event_enable(ctrl, reg, id, flags);
-		if (status)
-			return status;
+	ssam_dbg(ctrl, "enabling event (reg: %#04x, tc: %#04x, iid: %#04x, en: %d)\n",
+		 reg.target_category, id.target_category, id.instance, entry->enabled);
 
-		entry->flags = flags;
+	if (!entry->enabled) {
+		status = ssam_ssh_event_enable(ctrl, reg, id, flags);
+		if (!status) {
+			entry->enabled = true;
+			entry->flags = flags;
+		}
 
 	} else if (entry->flags != flags) {
 		ssam_warn(ctrl,
@@ -2195,14 +3107,15 @@ static int ssam_nf_refcount_enable(struct ssam_controller *ctrl,
 			  id.instance);
 	}
 
-	return 0;
+	mutex_unlock(&entry->lock);
+	return status;
 }
 
 /**
- * ssam_nf_refcount_disable_free() - Disable event for reference count entry if
- * it is no longer in use and free the corresponding entry.
+ * ssam_nf_refcount_disable() - Disable event for reference count entry if it
+ * is no longer in use.
  * @ctrl:  The controller to disable the event on.
- * @entry: The reference count entry for the event to be disabled.
+ * @entry: The (pinned) reference count entry for the event to be disabled.
  * @flags: The flags used for enabling the event on the EC.
  * @ec:    Flag specifying if the event should actually be disabled on the EC.
  *
@@ -2216,9 +3129,9 @@ static int ssam_nf_refcount_enable(struct ssam_controller *ctrl,
  * hot-removable devices, where event disable requests may time out after the
  * device has been physically removed.
  *
- * In both cases, if the reference count equals zero, the corresponding
- * reference count entry will be freed. The reference count entry must not be
- * used any more after a call to this function.
+ * The reference count is re-checked under the lock of the entry, so that an
+ * event re-registered concurrently will not be disabled. The entry itself is
+ * freed by the subsequent call to ssam_nf_refcount_put().
  *
  * Also checks if the flags used for disabling the event match the flags used
  * for enabling the event and warns if they do not (regardless of reference
@@ -2227,24 +3140,31 @@ static int ssam_nf_refcount_enable(struct ssam_controller *ctrl,
  * This does not modify the reference count itself, which is done with
  * ssam_nf_refcount_inc() / ssam_nf_refcount_dec().
  *
- * Note: ``nf->lock`` must be held when calling this function.
+ * Note: ``nf->lock`` must not be held when calling this function.
  *
  * Return: Returns zero on success. If the event is disabled by this call,
- * returns the status of the event-enable EC command.
+ * returns the status of the event-disable EC command.
  */
-static int ssam_nf_refcount_disable_free(struct ssam_controller *ctrl,
-					 struct ssam_nf_refcount_entry *entry, u8 flags, bool ec)
+static int ssam_nf_refcount_disable(struct ssam_controller *ctrl,
+				    struct ssam_nf_refcount_entry *entry, u8 flags, bool ec)
 {
 	const struct ssam_event_registry reg = entry->key.reg;
 	const struct ssam_event_id id = entry->key.id;
 	struct ssam_nf *nf = &ctrl->cplt.event.notif;
 	int status = 0;
+	int refcount;
 
-	lockdep_assert_held(&nf->lock);
+	lockdep_assert_not_held(&nf->lock);
+
+	mutex_lock(&entry->lock);
+
+	mutex_lock(&nf->lock);
+	refcount = entry->refcount;
+	mutex_unlock(&nf->lock);
 
 	ssam_dbg(ctrl, "%s event (reg: %#04x, tc: %#04x, iid: %#04x, rc: %d)\n",
 		 ec ? "disabling" : "detaching", reg.target_category, id.target_category,
-		 id.instance, entry->refcount);
+		 id.instance, refcount);
 
 	if (entry->flags != flags) {
 		ssam_warn(ctrl,
@@ -2253,14 +3173,73 @@ static int ssam_nf_refcount_disable_free(struct ssam_controller *ctrl,
 			  id.instance);
 	}
 
-	if (ec && entry->refcount == 0) {
-		status = ssam_ssh_event_disable(ctrl, reg, id, flags);
-		kfree(entry);
+	if (refcount == 0 && entry->enabled) {
+		if (ec)
+			status = ssam_ssh_event_disable(ctrl, reg, id, flags);
+
+		entry->enabled = false;
+		ssam_event_cache_invalidate(&ctrl->cplt.event.cache, id.target_category);
 	}
 
+	mutex_unlock(&entry->lock);
 	return status;
 }
 
+/**
+ * ssam_notifier_replay() - Replay cached events to a newly registered notifier.
+ * @cplt: The completion system.
+ * @n:    The notifier, marked with %SSAM_EVENT_NOTIFIER_REPLAY.
+ *
+ * Queues a replay request on the event queue of each target for the event
+ * of the notifier and waits until all of them have been handled. This
+ * serializes replayed events with live events delivered by the same queue.
+ * Deferred callbacks of notifiers marked with %SSAM_EVENT_NOTIFIER_MAY_BLOCK
+ * are flushed before returning, so that all replayed events have been seen
+ * by the notifier once this function returns.
+ *
+ * Return: Returns the number of replayed events. Returns zero without
+ * replaying any events if called from the event workqueue, i.e. from a
+ * notifier callback, as waiting on the event queues would deadlock there.
+ */
+static unsigned int ssam_notifier_replay(struct ssam_cplt *cplt,
+					 struct ssam_event_notifier *n)
+{
+	u16 event = ssh_rqid_to_event(ssh_tc_to_rqid(n->event.id.target_category));
+	struct ssam_event_replay replay[SSH_NUM_TARGETS];
+	struct work_struct *work = current_work();
+	struct ssam_event_queue *evq;
+	unsigned int count = 0;
+	int i;
+
+	if (work && work->func == ssam_event_queue_work_fn)
+		return 0;
+
+	for (i = 0; i < SSH_NUM_TARGETS; i++) {
+		evq = &cplt->event.target[i].queue[event];
+
+		replay[i].n = n;
+		replay[i].tidx = i;
+		replay[i].count = 0;
+		init_completion(&replay[i].done);
+
+		spin_lock(&evq->lock);
+		list_add_tail(&replay[i].node, &evq->replay);
+		spin_unlock(&evq->lock);
+
+		ssam_cplt_submit(cplt, &evq->work);
+	}
+
+	for (i = 0; i < SSH_NUM_TARGETS; i++) {
+		wait_for_completion(&replay[i].done);
+		count += replay[i].count;
+	}
+
+	if (n->flags & SSAM_EVENT_NOTIFIER_MAY_BLOCK)
+		flush_work(&n->deferred.work);
+
+	return count;
+}
+
 /**
  * ssam_notifier_register() - Register an event notifier.
  * @ctrl: The controller to register the notifier on.
@@ -2276,6 +3255,13 @@ static int ssam_nf_refcount_disable_free(struct ssam_controller *ctrl,
  * event, i.e. as long as no event matching is performed, only the event target
  * category needs to be set.
  *
+ * If the notifier is marked with %SSAM_EVENT_NOTIFIER_REPLAY, the most
+ * recently received events matching the notifier will be replayed to it
+ * before this function returns and their number will be stored in
+ * ``n->replay_count``. Replayed events are delivered from the event
+ * workqueue and are ordered with respect to live events. When called from
+ * a notifier callback, no events are replayed.
+ *
  * Return: Returns zero on success, %-ENOSPC if there have already been
  * %INT_MAX notifiers for the event ID/type associated with the notifier block
  * registered, %-ENOMEM if the corresponding event entry could not be
@@ -2297,6 +3283,11 @@ int ssam_notifier_register(struct ssam_controller *ctrl, struct ssam_event_notif
 	nf = &ctrl->cplt.event.notif;
 	nf_head = &nf->head[ssh_rqid_to_event(rqid)];
 
+	n->replay_count = 0;
+
+	if (n->flags & SSAM_EVENT_NOTIFIER_MAY_BLOCK)
+		ssam_nf_deferred_init(&ctrl->cplt, n);
+
 	mutex_lock(&nf->lock);
 
 	if (!(n->flags & SSAM_EVENT_NOTIFIER_OBSERVER)) {
@@ -2309,25 +3300,53 @@ int ssam_notifier_register(struct ssam_controller *ctrl, struct ssam_event_notif
 
 	status = ssam_nfblk_insert(nf_head, &n->base);
 	if (status) {
-		if (entry)
-			ssam_nf_refcount_dec_free(nf, n->event.reg, n->event.id);
+		if (entry) {
+			entry->refcount--;
+			ssam_nf_refcount_put(nf, entry);
+		}
 
 		mutex_unlock(&nf->lock);
 		return status;
 	}
 
+	if (n->flags & SSAM_EVENT_NOTIFIER_REPLAY)
+		ssam_event_cache_get(&ctrl->cplt.event.cache, n->event.id.target_category);
+
+	mutex_unlock(&nf->lock);
+
 	if (entry) {
+		/*
+		 * Enable the event without holding nf->lock, so that
+		 * registration of notifiers for other events does not have to
+		 * wait on the EC.
+		 */
 		status = ssam_nf_refcount_enable(ctrl, entry, n->event.flags);
+
+		mutex_lock(&nf->lock);
 		if (status) {
 			ssam_nfblk_remove(&n->base);
-			ssam_nf_refcount_dec_free(nf, n->event.reg, n->event.id);
-			mutex_unlock(&nf->lock);
+			entry->refcount--;
+		}
+		ssam_nf_refcount_put(nf, entry);
+		mutex_unlock(&nf->lock);
+
+		if (status) {
 			synchronize_srcu(&nf_head->srcu);
+
+			if (n->flags & SSAM_EVENT_NOTIFIER_REPLAY)
+				ssam_event_cache_put(&ctrl->cplt.event.cache,
+						     n->event.id.target_category);
+
+			if (n->flags & SSAM_EVENT_NOTIFIER_MAY_BLOCK)
+				ssam_nf_deferred_cancel(n);
+
 			return status;
 		}
 	}
 
-	mutex_unlock(&nf->lock);
+	if (n->flags & SSAM_EVENT_NOTIFIER_REPLAY)
+		n->replay_count = ssam_notifier_replay(&ctrl->cplt, n);
+
 	return 0;
 }
 EXPORT_SYMBOL_GPL(ssam_notifier_register);
@@ -2355,7 +3374,7 @@ int __ssam_notifier_unregister(struct ssam_controller *ctrl, struct ssam_event_n
 			       bool disable)
 {
 	u16 rqid = ssh_tc_to_rqid(n->event.id.target_category);
-	struct ssam_nf_refcount_entry *entry;
+	struct ssam_nf_refcount_entry *entry = NULL;
 	struct ssam_nf_head *nf_head;
 	struct ssam_nf *nf;
 	int status = 0;
@@ -2387,17 +3406,28 @@ int __ssam_notifier_unregister(struct ssam_controller *ctrl, struct ssam_event_n
 			 * the notifier block anyways.
 			 */
 			status = -ENOENT;
-			goto remove;
 		}
-
-		status = ssam_nf_refcount_disable_free(ctrl, entry, n->event.flags, disable);
 	}
 
-remove:
 	ssam_nfblk_remove(&n->base);
 	mutex_unlock(&nf->lock);
+
+	if (n->flags & SSAM_EVENT_NOTIFIER_REPLAY)
+		ssam_event_cache_put(&ctrl->cplt.event.cache, n->event.id.target_category);
+
+	if (entry) {
+		status = ssam_nf_refcount_disable(ctrl, entry, n->event.flags, disable);
+
+		mutex_lock(&nf->lock);
+		ssam_nf_refcount_put(nf, entry);
+		mutex_unlock(&nf->lock);
+	}
+
 	synchronize_srcu(&nf_head->srcu);
 
+	if (n->flags & SSAM_EVENT_NOTIFIER_MAY_BLOCK)
+		ssam_nf_deferred_cancel(n);
+
 	return status;
 }
 EXPORT_SYMBOL_GPL(__ssam_notifier_unregister);
@@ -2436,22 +3466,21 @@ int ssam_controller_event_enable(struct ssam_controller *ctrl,
 		return -EINVAL;
 
 	mutex_lock(&nf->lock);
-
 	entry = ssam_nf_refcount_inc(nf, reg, id);
-	if (IS_ERR(entry)) {
-		mutex_unlock(&nf->lock);
+	mutex_unlock(&nf->lock);
+
+	if (IS_ERR(entry))
 		return PTR_ERR(entry);
-	}
 
 	status = ssam_nf_refcount_enable(ctrl, entry, flags);
-	if (status) {
-		ssam_nf_refcount_dec_free(nf, reg, id);
-		mutex_unlock(&nf->lock);
-		return status;
-	}
 
+	mutex_lock(&nf->lock);
+	if (status)
+		entry->refcount--;
+	ssam_nf_refcount_put(nf, entry);
 	mutex_unlock(&nf->lock);
-	return 0;
+
+	return status;
 }
 EXPORT_SYMBOL_GPL(ssam_controller_event_enable);
 
@@ -2487,16 +3516,18 @@ int ssam_controller_event_disable(struct ssam_controller *ctrl,
 		return -EINVAL;
 
 	mutex_lock(&nf->lock);
-
 	entry = ssam_nf_refcount_dec(nf, reg, id);
-	if (!entry) {
-		mutex_unlock(&nf->lock);
+	mutex_unlock(&nf->lock);
+
+	if (!entry)
 		return -ENOENT;
-	}
 
-	status = ssam_nf_refcount_disable_free(ctrl, entry, flags, true);
+	status = ssam_nf_refcount_disable(ctrl, entry, flags, true);
 
+	mutex_lock(&nf->lock);
+	ssam_nf_refcount_put(nf, entry);
 	mutex_unlock(&nf->lock);
+
 	return status;
 }
 EXPORT_SYMBOL_GPL(ssam_controller_event_disable);
@@ -2517,7 +3548,9 @@ EXPORT_SYMBOL_GPL(ssam_controller_event_disable);
  * Note that this function will not disable events for notifiers registered
  * after calling this function. It should thus be made sure that no new
  * notifiers are going to be added after this call and before the corresponding
- * call to ssam_notifier_restore_registered().
+ * call to ssam_notifier_restore_registered(). Likewise, this function must not
+ * run concurrently with notifier (un-)registration, as it relies on the
+ * enabled-state of the event entries to be stable.
  *
  * Return: Returns zero on success. In case of failure returns the error code
  * returned by the failed EC command to disable an event.
@@ -2528,11 +3561,16 @@ int ssam_notifier_disable_registered(struct ssam_controller *ctrl)
 	struct rb_node *n;
 	int status;
 
+	ssam_event_cache_clear(&ctrl->cplt.event.cache);
+
 	mutex_lock(&nf->lock);
 	for (n = rb_first(&nf->refcount); n; n = rb_next(n)) {
 		struct ssam_nf_refcount_entry *e;
 
 		e = rb_entry(n, struct ssam_nf_refcount_entry, node);
+		if (!e->enabled)
+			continue;
+
 		status = ssam_ssh_event_disable(ctrl, e->key.reg,
 						e->key.id, e->flags);
 		if (status)
@@ -2547,7 +3585,8 @@ err:
 		struct ssam_nf_refcount_entry *e;
 
 		e = rb_entry(n, struct ssam_nf_refcount_entry, node);
-		ssam_ssh_event_enable(ctrl, e->key.reg, e->key.id, e->flags);
+		if (e->enabled)
+			ssam_ssh_event_enable(ctrl, e->key.reg, e->key.id, e->flags);
 	}
 	mutex_unlock(&nf->lock);
 
@@ -2577,6 +3616,8 @@ void ssam_notifier_restore_registered(struct ssam_controller *ctrl)
 		struct ssam_nf_refcount_entry *e;
 
 		e = rb_entry(n, struct ssam_nf_refcount_entry, node);
+		if (!e->enabled)
+			continue;
 
 		/* Ignore errors, will get logged in call. */
 		ssam_ssh_event_enable(ctrl, e->key.reg, e->key.id, e->flags);
@@ -2620,7 +3661,10 @@ static void ssam_notifier_unregister_all(struct ssam_controller *ctrl)
 	mutex_lock(&nf->lock);
 	rbtree_postorder_for_each_entry_safe(e, n, &nf->refcount, node) {
 		/* Ignore errors, will get logged in call. */
-		ssam_ssh_event_disable(ctrl, e->key.reg, e->key.id, e->flags);
+		if (e->enabled)
+			ssam_ssh_event_disable(ctrl, e->key.reg, e->key.id, e->flags);
+
+		mutex_destroy(&e->lock);
 		kfree(e);
 	}
 	nf->refcount = RB_ROOT;
@@ -2803,3 +3847,7 @@ void ssam_irq_disarm_wakeup(struct ssam_controller *ctrl)
 	}
 	disable_irq(ctrl->irq.num);
 }
+
+#ifdef CONFIG_SURFACE_AGGREGATOR_KUNIT_TEST
+#include "controller_test.c"
+#endif
@@ -8,9 +8,13 @@
 #ifndef _SURFACE_AGGREGATOR_CONTROLLER_H
 #define _SURFACE_AGGREGATOR_CONTROLLER_H
 
+#include <linux/atomic.h>
 #include <linux/kref.h>
 #include <linux/list.h>
+#include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/notifier.h>
+#include <linux/rcupdate.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
 #include <linux/serdev.h>
@@ -58,9 +62,11 @@ struct ssam_nf_head {
 
 /**
  * struct ssam_nf - Notifier callback- and activation-registry for SSAM events.
- * @lock:     Lock guarding (de-)registration of notifier blocks. Note: This
- *            lock does not need to be held for notifier calls, only
- *            registration and deregistration.
+ * @lock:     Lock guarding (de-)registration of notifier blocks and the
+ *            reference-count tree. Note: This lock does not need to be held
+ *            for notifier calls, only registration and deregistration. It is
+ *            never held across EC requests, these are serialized per event
+ *            via the lock of the respective reference-count entry instead.
  * @refcount: The root of the RB-tree used for reference-counting enabled
  *            events/notifications.
  * @head:     The list of notifier heads for event/notification callbacks.
@@ -100,6 +106,9 @@ struct ssam_event_item {
  * @cplt: Reference to the completion system on which this queue is active.
  * @lock: The lock for any operation on the queue.
  * @head: The list-head of the queue.
+ * @replay: The list-head of pending event cache replay requests. Handled by
+ *          the queue work before any queued event, so that replayed events
+ *          are ordered with respect to live events.
  * @work: The &struct work_struct performing completion work for this queue.
  */
 struct ssam_event_queue {
@@ -107,6 +116,7 @@ struct ssam_event_queue {
 
 	spinlock_t lock;
 	struct list_head head;
+	struct list_head replay;
 	struct work_struct work;
 };
 
@@ -118,23 +128,44 @@ struct ssam_event_target {
 	struct ssam_event_queue queue[SSH_NUM_EVENTS];
 };
 
+/**
+ * struct ssam_event_cache - Last-value cache for received events.
+ * @lock: Lock guarding the cache.
+ * @root: Root of the RB-tree containing the most recently received event per
+ *        target category, target ID, command ID, and instance ID.
+ * @users: Number of registered notifiers with %SSAM_EVENT_NOTIFIER_REPLAY
+ *         per event ID. Only events with at least one such notifier are
+ *         cached. Modified while holding @lock.
+ */
+struct ssam_event_cache {
+	struct mutex lock;
+	struct rb_root root;
+	atomic_t users[SSH_NUM_EVENTS];
+};
+
 /**
  * struct ssam_cplt - SSAM event/async request completion system.
  * @dev:          The device with which this system is associated. Only used
  *                for logging.
  * @wq:           The &struct workqueue_struct on which all completion work
  *                items are queued.
+ * @blk_wq:       The &struct workqueue_struct on which callbacks of notifiers
+ *                marked with %SSAM_EVENT_NOTIFIER_MAY_BLOCK are executed.
  * @event:        Event completion management.
  * @event.target: Array of &struct ssam_event_target, one for each target.
  * @event.notif:  Notifier callbacks and event activation reference counting.
+ * @event.cache:  Cache of the most recently received events, used to seed
+ *                newly registered notifiers.
  */
 struct ssam_cplt {
 	struct device *dev;
 	struct workqueue_struct *wq;
+	struct workqueue_struct *blk_wq;
 
 	struct {
 		struct ssam_event_target target[SSH_NUM_TARGETS];
 		struct ssam_nf notif;
+		struct ssam_event_cache cache;
 	} event;
 };
 
@@ -180,6 +211,50 @@ struct ssam_controller_caps {
 	u32 d3_closes_handle:1;
 };
 
+/**
+ * struct ssam_client_stats - Request statistics of a single client.
+ * @node:       List node of the controller's client list.
+ * @name:       Name of the client module, "kernel" for built-in code.
+ * @requests:   Number of completed requests.
+ * @tx_bytes:   Number of command payload bytes sent.
+ * @rx_bytes:   Number of response payload bytes received.
+ * @timeouts:   Number of requests that have timed out.
+ * @errors:     Number of requests that have failed for other reasons.
+ * @request_time_ns: Cumulative time from submission to completion of
+ *                   requests. This includes time spent queued or held back
+ *                   in the transport layers and any retransmissions, not
+ *                   only the time taken by the EC to respond.
+ *
+ * Clients are identified by the module of the code issuing the request.
+ * Entries are created on first use and live as long as the controller.
+ */
+struct ssam_client_stats {
+	struct list_head node;
+	char name[MODULE_NAME_LEN];
+
+	atomic64_t requests;
+	atomic64_t tx_bytes;
+	atomic64_t rx_bytes;
+	atomic64_t timeouts;
+	atomic64_t errors;
+	atomic64_t request_time_ns;
+};
+
+#define SSAM_CLIENT_SITES_BITS	6
+#define SSAM_CLIENT_SITES	BIT(SSAM_CLIENT_SITES_BITS)
+
+/**
+ * struct ssam_client_site - Cached client lookup of a request call site.
+ * @caller: The return address identifying the call site.
+ * @stats:  The statistics entry of the client containing the call site.
+ * @rcu:    RCU head for freeing the site after it has been evicted.
+ */
+struct ssam_client_site {
+	unsigned long caller;
+	struct ssam_client_stats *stats;
+	struct rcu_head rcu;
+};
+
 /**
  * struct ssam_controller - SSAM controller device.
  * @kref:  Reference count of the controller.
@@ -194,6 +269,13 @@ struct ssam_controller_caps {
  * @irq.num:      The wakeup IRQ number.
  * @irq.wakeup_enabled: Whether wakeup by IRQ is enabled during suspend.
  * @caps: The controller device capabilities.
+ * @clients:      Per-client request accounting.
+ * @clients.lock: Lock guarding the list of client statistics and updates
+ *                to the call site cache.
+ * @clients.list: List of &struct ssam_client_stats entries.
+ * @clients.sites: Open-addressing hash table of &struct ssam_client_site,
+ *                 mapping request call sites to client statistics.
+ * @clients.module_nb: Notifier used to evict call sites on module unload.
  */
 struct ssam_controller {
 	struct kref kref;
@@ -215,6 +297,13 @@ struct ssam_controller {
 	} irq;
 
 	struct ssam_controller_caps caps;
+
+	struct {
+		spinlock_t lock;
+		struct list_head list;
+		struct ssam_client_site __rcu *sites[SSAM_CLIENT_SITES];
+		struct notifier_block module_nb;
+	} clients;
 };
 
 #define to_ssam_controller(ptr, member) \
@@ -270,6 +359,11 @@ void ssam_irq_disarm_wakeup(struct ssam_controller *ctrl);
 void ssam_controller_lock(struct ssam_controller *c);
 void ssam_controller_unlock(struct ssam_controller *c);
 
+struct ssam_client_stats *ssam_controller_get_client(struct ssam_controller *ctrl,
+						     const char *name);
+void ssam_controller_show_clients(struct ssam_controller *ctrl,
+				  struct seq_file *s);
+
 int ssam_get_firmware_version(struct ssam_controller *ctrl, u32 *version);
 int ssam_ctrl_notif_display_off(struct ssam_controller *ctrl);
 int ssam_ctrl_notif_display_on(struct ssam_controller *ctrl);
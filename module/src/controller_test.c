@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * KUnit tests for the SSH sequence and request ID counters.
+ *
+ * Included from controller.c when CONFIG_SURFACE_AGGREGATOR_KUNIT_TEST is
+ * defined.
+ *
+ * Copyright (C) 2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#include <kunit/test.h>
+
+static void ssam_test_seq_counter(struct kunit *test)
+{
+	struct ssh_seq_counter c;
+	unsigned int i;
+
+	ssh_seq_reset(&c);
+
+	/* Sequence IDs are handed out in order and wrap around at U8_MAX. */
+	for (i = 0; i <= 2 * U8_MAX; i++)
+		KUNIT_EXPECT_EQ(test, ssh_seq_next(&c), (u8)i);
+}
+
+static void ssam_test_rqid_counter(struct kunit *test)
+{
+	struct ssh_rqid_counter c;
+	u16 rqid, prev;
+	unsigned int i;
+
+	ssh_rqid_reset(&c);
+	prev = ssh_rqid_next(&c);
+
+	/*
+	 * Request IDs must never collide with the IDs reserved for events,
+	 * including after wrap-around, and otherwise increase by one.
+	 */
+	for (i = 0; i < 2 * (U16_MAX + 1); i++) {
+		rqid = ssh_rqid_next(&c);
+
+		KUNIT_EXPECT_FALSE(test, ssh_rqid_is_event(rqid));
+		if (prev == 0)
+			KUNIT_EXPECT_EQ(test, rqid, (u16)(SSH_NUM_EVENTS + 1));
+		else
+			KUNIT_EXPECT_EQ(test, rqid, (u16)(prev + 1));
+
+		prev = rqid;
+	}
+}
+
+static struct kunit_case ssam_test_cases[] = {
+	KUNIT_CASE(ssam_test_seq_counter),
+	KUNIT_CASE(ssam_test_rqid_counter),
+	{}
+};
+
+static struct kunit_suite ssam_test_suite = {
+	.name = "surface_aggregator_controller",
+	.test_cases = ssam_test_cases,
+};
+kunit_test_suite(ssam_test_suite);
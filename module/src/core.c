@@ -13,11 +13,13 @@
 #include <linux/acpi.h>
 #include <linux/atomic.h>
 #include <linux/completion.h>
+#include <linux/debugfs.h>
 #include <linux/gpio/consumer.h>
 #include <linux/kernel.h>
 #include <linux/kref.h>
 #include <linux/module.h>
 #include <linux/pm.h>
+#include <linux/seq_file.h>
 #include <linux/serdev.h>
 #include <linux/sysfs.h>
 
@@ -26,6 +28,7 @@
 
 #include "bus.h"
 #include "controller.h"
+#include "diag.h"
 
 #define CREATE_TRACE_POINTS
 #include "trace.h"
@@ -296,6 +299,162 @@ static const struct attribute_group ssam_sam_group = {
 };
 
 
+/* -- Debugfs. -------------------------------------------------------------- */
+
+static struct dentry *ssam_debugfs_root;
+
+static int ssam_debugfs_rtl_targets_show(struct seq_file *s, void *data)
+{
+	struct ssam_controller *ctrl = s->private;
+
+	ssh_rtl_show_target_stats(&ctrl->rtl, s);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ssam_debugfs_rtl_targets);
+
+static int ssam_debugfs_ptl_queues_show(struct seq_file *s, void *data)
+{
+	struct ssam_controller *ctrl = s->private;
+
+	ssh_ptl_show_queues(&ctrl->rtl.ptl, s);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ssam_debugfs_ptl_queues);
+
+static int ssam_debugfs_ptl_stats_show(struct seq_file *s, void *data)
+{
+	struct ssam_controller *ctrl = s->private;
+
+	ssh_ptl_show_stats(&ctrl->rtl.ptl, s);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ssam_debugfs_ptl_stats);
+
+static int ssam_debugfs_rtl_queues_show(struct seq_file *s, void *data)
+{
+	struct ssam_controller *ctrl = s->private;
+
+	ssh_rtl_show_queues(&ctrl->rtl, s);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ssam_debugfs_rtl_queues);
+
+static int ssam_debugfs_rtl_stats_show(struct seq_file *s, void *data)
+{
+	struct ssam_controller *ctrl = s->private;
+
+	ssh_rtl_show_stats(&ctrl->rtl, s);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ssam_debugfs_rtl_stats);
+
+static int ssam_debugfs_clients_show(struct seq_file *s, void *data)
+{
+	struct ssam_controller *ctrl = s->private;
+
+	ssam_controller_show_clients(ctrl, s);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ssam_debugfs_clients);
+
+static int ssam_debugfs_diag_show(struct seq_file *s, void *data)
+{
+	ssam_diag_show(s);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ssam_debugfs_diag);
+
+static int ssam_debugfs_flight_recorder_show(struct seq_file *s, void *data)
+{
+	struct ssam_controller *ctrl = s->private;
+
+	ssh_rec_show(&ctrl->rtl.ptl.rec, s);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ssam_debugfs_flight_recorder);
+
+static int ssam_debugfs_flight_recorder_frozen_get(void *data, u64 *val)
+{
+	struct ssam_controller *ctrl = data;
+
+	*val = atomic_read(&ctrl->rtl.ptl.rec.frozen);
+	return 0;
+}
+
+static int ssam_debugfs_flight_recorder_frozen_set(void *data, u64 val)
+{
+	struct ssam_controller *ctrl = data;
+
+	ssh_rec_set_frozen(&ctrl->rtl.ptl.rec, val);
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(ssam_debugfs_flight_recorder_frozen_fops,
+			 ssam_debugfs_flight_recorder_frozen_get,
+			 ssam_debugfs_flight_recorder_frozen_set, "%llu\n");
+
+static void ssam_debugfs_init(struct ssam_controller *ctrl)
+{
+	struct dentry *fault;
+
+	/* Debugfs is optional, thus we ignore any errors here. */
+	ssam_debugfs_root = debugfs_create_dir("surface_aggregator", NULL);
+
+	debugfs_create_file("rtl_targets", 0444, ssam_debugfs_root, ctrl,
+			    &ssam_debugfs_rtl_targets_fops);
+	debugfs_create_file("ptl_queues", 0444, ssam_debugfs_root, ctrl,
+			    &ssam_debugfs_ptl_queues_fops);
+	debugfs_create_file("ptl_stats", 0444, ssam_debugfs_root, ctrl,
+			    &ssam_debugfs_ptl_stats_fops);
+	debugfs_create_file("rtl_queues", 0444, ssam_debugfs_root, ctrl,
+			    &ssam_debugfs_rtl_queues_fops);
+	debugfs_create_file("rtl_stats", 0444, ssam_debugfs_root, ctrl,
+			    &ssam_debugfs_rtl_stats_fops);
+	debugfs_create_file("clients", 0444, ssam_debugfs_root, ctrl,
+			    &ssam_debugfs_clients_fops);
+	debugfs_create_file("diag", 0444, ssam_debugfs_root, NULL,
+			    &ssam_debugfs_diag_fops);
+
+	/*
+	 * The recorder freezes itself on error bursts. Writing zero to
+	 * "flight_recorder_frozen" re-arms it.
+	 */
+	debugfs_create_file("flight_recorder", 0444, ssam_debugfs_root, ctrl,
+			    &ssam_debugfs_flight_recorder_fops);
+	debugfs_create_file_unsafe("flight_recorder_frozen", 0644, ssam_debugfs_root,
+				   ctrl, &ssam_debugfs_flight_recorder_frozen_fops);
+
+	if (IS_ENABLED(CONFIG_SURFACE_AGGREGATOR_ERROR_INJECTION)) {
+		fault = debugfs_create_dir("fault_inject", ssam_debugfs_root);
+		ssh_ptl_fault_debugfs_init(fault);
+		ssh_rtl_fault_debugfs_init(fault);
+	}
+}
+
+static void ssam_debugfs_exit(void)
+{
+	debugfs_remove_recursive(ssam_debugfs_root);
+	ssam_debugfs_root = NULL;
+}
+
+/**
+ * ssam_debugfs_dir() - Get the debugfs directory of the SSAM subsystem.
+ *
+ * Returns the "surface_aggregator" debugfs directory, under which client
+ * drivers may create their own entries. Clients must be linked to the
+ * controller via ssam_client_link() or ssam_client_bind() and remove their
+ * entries when being unbound. This is guaranteed to happen before the
+ * directory itself is removed.
+ *
+ * Return: Returns the debugfs directory, or %NULL or an error pointer if it
+ * is not available.
+ */
+struct dentry *ssam_debugfs_dir(void)
+{
+	return ssam_debugfs_root;
+}
+EXPORT_SYMBOL_GPL(ssam_debugfs_dir);
+
+
 /* -- ACPI based device setup. ---------------------------------------------- */
 
 static acpi_status ssam_serdev_setup_via_acpi_crs(struct acpi_resource *rsc,
@@ -686,6 +845,8 @@ static int ssam_serial_hub_probe(struct serdev_device *serdev)
 	if (status)
 		goto err_initrq;
 
+	ssam_debugfs_init(ctrl);
+
 	/* Set up IRQ. */
 	status = ssam_irq_setup(ctrl);
 	if (status)
@@ -714,6 +875,7 @@ static int ssam_serial_hub_probe(struct serdev_device *serdev)
 err_mainref:
 	ssam_irq_free(ctrl);
 err_irq:
+	ssam_debugfs_exit();
 	sysfs_remove_group(&serdev->dev.kobj, &ssam_sam_group);
 err_initrq:
 	ssam_controller_lock(ctrl);
@@ -739,6 +901,7 @@ static void ssam_serial_hub_remove(struct serdev_device *serdev)
 	/* Disable and free IRQ. */
 	ssam_irq_free(ctrl);
 
+	ssam_debugfs_exit();
 	sysfs_remove_group(&serdev->dev.kobj, &ssam_sam_group);
 	ssam_controller_lock(ctrl);
 
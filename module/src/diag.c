@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Ratelimited, counter-backed diagnostics.
+ *
+ * Copyright (C) 2019-2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#include <linux/atomic.h>
+#include <linux/device.h>
+#include <linux/jiffies.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+
+#include "../include/linux/surface_aggregator/controller.h"
+
+#include "diag.h"
+
+/*
+ * SSAM_DIAG_INTERVAL_S - Minimum time between two summaries of the same
+ * diagnostic, in seconds.
+ */
+#define SSAM_DIAG_INTERVAL_S	5
+#define SSAM_DIAG_INTERVAL	(SSAM_DIAG_INTERVAL_S * HZ)
+
+static LIST_HEAD(ssam_diag_list);
+static DEFINE_MUTEX(ssam_diag_lock);
+
+static void ssam_diag_report_fn(struct work_struct *work)
+{
+	struct ssam_diag *d = container_of(work, struct ssam_diag, report.work);
+	int n;
+
+	WRITE_ONCE(d->last_report, jiffies);
+
+	n = atomic_xchg(&d->unreported, 0);
+	if (n)
+		dev_warn(d->dev, "%s: %d in last %d s (total: %lu)\n", d->what,
+			 n, SSAM_DIAG_INTERVAL_S,
+			 (unsigned long)atomic_long_read(&d->count));
+}
+
+/**
+ * ssam_diag_hit() - Record an occurrence of a diagnostic condition.
+ * @d: The diagnostic.
+ *
+ * Increments the counters of the given diagnostic. The first occurrence after
+ * a quiet period is reported right away, any further occurrences are
+ * collected and reported as a single summary once the report interval has
+ * passed. Printing is always done from a work item, thus this function is
+ * cheap and can be called from any context, including the receiver thread.
+ */
+void ssam_diag_hit(struct ssam_diag *d)
+{
+	unsigned long next;
+
+	atomic_long_inc(&d->count);
+
+	/* Only the first unreported occurrence needs to schedule a report. */
+	if (atomic_inc_return(&d->unreported) != 1)
+		return;
+
+	next = READ_ONCE(d->last_report) + SSAM_DIAG_INTERVAL;
+	if (time_after(next, jiffies))
+		schedule_delayed_work(&d->report, next - jiffies);
+	else
+		schedule_delayed_work(&d->report, 0);
+}
+EXPORT_SYMBOL_GPL(ssam_diag_hit);
+
+/**
+ * ssam_diag_init() - Initialize and register a diagnostic.
+ * @d:    The diagnostic to initialize.
+ * @dev:  The device to report the diagnostic on.
+ * @what: Short description of the condition, used in reports and debugfs.
+ *
+ * Initializes the given diagnostic and adds it to the global list of
+ * diagnostics, via which its counter is exposed in debugfs. Must be
+ * deinitialized via ssam_diag_destroy() once it is no longer used.
+ */
+void ssam_diag_init(struct ssam_diag *d, struct device *dev, const char *what)
+{
+	d->dev = dev;
+	d->what = what;
+	d->last_report = jiffies - SSAM_DIAG_INTERVAL;
+	atomic_long_set(&d->count, 0);
+	atomic_set(&d->unreported, 0);
+	INIT_DELAYED_WORK(&d->report, ssam_diag_report_fn);
+
+	mutex_lock(&ssam_diag_lock);
+	list_add_tail(&d->node, &ssam_diag_list);
+	mutex_unlock(&ssam_diag_lock);
+}
+EXPORT_SYMBOL_GPL(ssam_diag_init);
+
+/**
+ * ssam_diag_destroy() - Unregister and deinitialize a diagnostic.
+ * @d: The diagnostic to deinitialize.
+ *
+ * Removes the diagnostic from the global list and emits any outstanding
+ * summary. The caller must ensure that ssam_diag_hit() is not called
+ * concurrently or afterwards.
+ */
+void ssam_diag_destroy(struct ssam_diag *d)
+{
+	mutex_lock(&ssam_diag_lock);
+	list_del(&d->node);
+	mutex_unlock(&ssam_diag_lock);
+
+	flush_delayed_work(&d->report);
+}
+EXPORT_SYMBOL_GPL(ssam_diag_destroy);
+
+/**
+ * ssam_diag_show() - Print counters of all registered diagnostics.
+ * @s: The sequence file to print the counters to.
+ */
+void ssam_diag_show(struct seq_file *s)
+{
+	struct ssam_diag *d;
+
+	mutex_lock(&ssam_diag_lock);
+	list_for_each_entry(d, &ssam_diag_list, node) {
+		seq_printf(s, "%s: %s: %lu\n", dev_name(d->dev), d->what,
+			   (unsigned long)atomic_long_read(&d->count));
+	}
+	mutex_unlock(&ssam_diag_lock);
+}
@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Ratelimited, counter-backed diagnostics.
+ *
+ * Copyright (C) 2019-2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#ifndef _SURFACE_AGGREGATOR_DIAG_H
+#define _SURFACE_AGGREGATOR_DIAG_H
+
+#include <linux/seq_file.h>
+
+void ssam_diag_show(struct seq_file *s);
+
+#endif /* _SURFACE_AGGREGATOR_DIAG_H */
@@ -7,7 +7,11 @@
 
 #include <asm/unaligned.h>
 #include <linux/atomic.h>
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
 #include <linux/error-injection.h>
+#include <linux/fault-inject.h>
 #include <linux/jiffies.h>
 #include <linux/kfifo.h>
 #include <linux/kref.h>
@@ -16,6 +20,9 @@
 #include <linux/limits.h>
 #include <linux/list.h>
 #include <linux/lockdep.h>
+#include <linux/moduleparam.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/serdev.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
@@ -227,8 +234,46 @@
  */
 #define SSH_PTL_RX_FIFO_LEN			4096
 
+/*
+ * SSH_PTL_RX_NAK_HOLDOFF - Minimum time between NAKs of one resync episode.
+ *
+ * After sending a NAK due to invalid data, further NAKs are suppressed until
+ * either a valid frame has been parsed (ending the resync episode) or this
+ * time has passed. Each NAK causes the EC to re-transmit all outstanding
+ * data, so sending one per piece of invalid data would only multiply traffic.
+ */
+#define SSH_PTL_RX_NAK_HOLDOFF			msecs_to_jiffies(100)
+
+static int thread_sched;
+module_param(thread_sched, int, 0444);
+MODULE_PARM_DESC(thread_sched, "scheduling class of transport threads: 0 = normal, 1 = SCHED_FIFO (low priority), 2 = SCHED_FIFO [default: 0]");
+
+static char *thread_cpus;
+module_param(thread_cpus, charp, 0444);
+MODULE_PARM_DESC(thread_cpus, "list of CPUs to run transport threads on, e.g. \"0-1\" [default: all]");
+
 #ifdef CONFIG_SURFACE_AGGREGATOR_ERROR_INJECTION
 
+/*
+ * Fault attributes backing the error injection hooks below. These can be
+ * configured at runtime via debugfs (probability, interval, times, ...), see
+ * ssh_ptl_fault_debugfs_init() and Documentation/fault-injection/. The hooks
+ * can additionally be overridden via BPF as before.
+ */
+static DECLARE_FAULT_ATTR(ssh_ptl_fault_drop_ack);
+static DECLARE_FAULT_ATTR(ssh_ptl_fault_drop_nak);
+static DECLARE_FAULT_ATTR(ssh_ptl_fault_drop_dsq);
+static DECLARE_FAULT_ATTR(ssh_ptl_fault_fail_write);
+static DECLARE_FAULT_ATTR(ssh_ptl_fault_corrupt_tx_data);
+static DECLARE_FAULT_ATTR(ssh_ptl_fault_corrupt_rx_syn);
+static DECLARE_FAULT_ATTR(ssh_ptl_fault_corrupt_rx_data);
+static DECLARE_FAULT_ATTR(ssh_ptl_fault_tx_delay);
+static DECLARE_FAULT_ATTR(ssh_ptl_fault_rx_delay);
+
+/* Latency added when the respective delay fault triggers, in microseconds. */
+static u32 ssh_ptl_tx_delay_us;
+static u32 ssh_ptl_rx_delay_us;
+
 /**
  * ssh_ptl_should_drop_ack_packet() - Error injection hook to drop ACK packets.
  *
@@ -241,7 +286,7 @@
  */
 static noinline bool ssh_ptl_should_drop_ack_packet(void)
 {
-	return false;
+	return should_fail(&ssh_ptl_fault_drop_ack, 1);
 }
 ALLOW_ERROR_INJECTION(ssh_ptl_should_drop_ack_packet, TRUE);
 
@@ -254,7 +299,7 @@ ALLOW_ERROR_INJECTION(ssh_ptl_should_drop_ack_packet, TRUE);
  */
 static noinline bool ssh_ptl_should_drop_nak_packet(void)
 {
-	return false;
+	return should_fail(&ssh_ptl_fault_drop_nak, 1);
 }
 ALLOW_ERROR_INJECTION(ssh_ptl_should_drop_nak_packet, TRUE);
 
@@ -268,7 +313,7 @@ ALLOW_ERROR_INJECTION(ssh_ptl_should_drop_nak_packet, TRUE);
  */
 static noinline bool ssh_ptl_should_drop_dsq_packet(void)
 {
-	return false;
+	return should_fail(&ssh_ptl_fault_drop_dsq, 1);
 }
 ALLOW_ERROR_INJECTION(ssh_ptl_should_drop_dsq_packet, TRUE);
 
@@ -280,7 +325,7 @@ ALLOW_ERROR_INJECTION(ssh_ptl_should_drop_dsq_packet, TRUE);
  */
 static noinline int ssh_ptl_should_fail_write(void)
 {
-	return 0;
+	return should_fail(&ssh_ptl_fault_fail_write, 1) ? -EIO : 0;
 }
 ALLOW_ERROR_INJECTION(ssh_ptl_should_fail_write, ERRNO);
 
@@ -296,7 +341,7 @@ ALLOW_ERROR_INJECTION(ssh_ptl_should_fail_write, ERRNO);
  */
 static noinline bool ssh_ptl_should_corrupt_tx_data(void)
 {
-	return false;
+	return should_fail(&ssh_ptl_fault_corrupt_tx_data, 1);
 }
 ALLOW_ERROR_INJECTION(ssh_ptl_should_corrupt_tx_data, TRUE);
 
@@ -309,7 +354,7 @@ ALLOW_ERROR_INJECTION(ssh_ptl_should_corrupt_tx_data, TRUE);
  */
 static noinline bool ssh_ptl_should_corrupt_rx_syn(void)
 {
-	return false;
+	return should_fail(&ssh_ptl_fault_corrupt_rx_syn, 1);
 }
 ALLOW_ERROR_INJECTION(ssh_ptl_should_corrupt_rx_syn, TRUE);
 
@@ -322,7 +367,7 @@ ALLOW_ERROR_INJECTION(ssh_ptl_should_corrupt_rx_syn, TRUE);
  */
 static noinline bool ssh_ptl_should_corrupt_rx_data(void)
 {
-	return false;
+	return should_fail(&ssh_ptl_fault_corrupt_rx_data, 1);
 }
 ALLOW_ERROR_INJECTION(ssh_ptl_should_corrupt_rx_data, TRUE);
 
@@ -365,7 +410,7 @@ static bool __ssh_ptl_should_drop_dsq_packet(struct ssh_packet *packet)
 
 static bool ssh_ptl_should_drop_packet(struct ssh_packet *packet)
 {
-	/* Ignore packets that don't carry any data (i.e. flush). */
+	/* Ignore packets that don't carry any data. */
 	if (!packet->data.ptr || !packet->data.len)
 		return false;
 
@@ -404,7 +449,7 @@ static int ssh_ptl_write_buf(struct ssh_ptl *ptl, struct ssh_packet *packet,
 
 static void ssh_ptl_tx_inject_invalid_data(struct ssh_packet *packet)
 {
-	/* Ignore packets that don't carry any data (i.e. flush). */
+	/* Ignore packets that don't carry any data. */
 	if (!packet->data.ptr || !packet->data.len)
 		return;
 
@@ -476,6 +521,70 @@ static void ssh_ptl_rx_inject_invalid_data(struct ssh_ptl *ptl,
 	frame->ptr[frame->len - 2] = ~frame->ptr[frame->len - 2];
 }
 
+static void ssh_ptl_inject_delay(struct ssh_ptl *ptl, struct fault_attr *attr,
+				 u32 *delay_us, const char *dir)
+{
+	u32 delay = READ_ONCE(*delay_us);
+
+	if (likely(!delay) || !should_fail(attr, 1))
+		return;
+
+	ptl_dbg(ptl, "packet error injection: delaying %s by %u us\n", dir,
+		delay);
+
+	fsleep(delay);
+}
+
+static void ssh_ptl_tx_inject_delay(struct ssh_ptl *ptl)
+{
+	ssh_ptl_inject_delay(ptl, &ssh_ptl_fault_tx_delay,
+			     &ssh_ptl_tx_delay_us, "tx");
+}
+
+static void ssh_ptl_rx_inject_delay(struct ssh_ptl *ptl)
+{
+	ssh_ptl_inject_delay(ptl, &ssh_ptl_fault_rx_delay,
+			     &ssh_ptl_rx_delay_us, "rx");
+}
+
+/**
+ * ssh_ptl_fault_debugfs_init() - Create debugfs entries for packet layer
+ * fault injection.
+ * @parent: The debugfs directory to create the entries in.
+ *
+ * Creates one fault attribute directory per error injection hook, as well as
+ * for transmit and receive latency injection. The latter contain an
+ * additional ``delay_us`` file specifying the latency to add. Errors are
+ * ignored, as debugfs is optional.
+ */
+void ssh_ptl_fault_debugfs_init(struct dentry *parent)
+{
+	struct dentry *dir;
+
+	fault_create_debugfs_attr("ptl_drop_ack", parent,
+				  &ssh_ptl_fault_drop_ack);
+	fault_create_debugfs_attr("ptl_drop_nak", parent,
+				  &ssh_ptl_fault_drop_nak);
+	fault_create_debugfs_attr("ptl_drop_dsq", parent,
+				  &ssh_ptl_fault_drop_dsq);
+	fault_create_debugfs_attr("ptl_fail_write", parent,
+				  &ssh_ptl_fault_fail_write);
+	fault_create_debugfs_attr("ptl_corrupt_tx_data", parent,
+				  &ssh_ptl_fault_corrupt_tx_data);
+	fault_create_debugfs_attr("ptl_corrupt_rx_syn", parent,
+				  &ssh_ptl_fault_corrupt_rx_syn);
+	fault_create_debugfs_attr("ptl_corrupt_rx_data", parent,
+				  &ssh_ptl_fault_corrupt_rx_data);
+
+	dir = fault_create_debugfs_attr("ptl_tx_delay", parent,
+					&ssh_ptl_fault_tx_delay);
+	debugfs_create_u32("delay_us", 0600, dir, &ssh_ptl_tx_delay_us);
+
+	dir = fault_create_debugfs_attr("ptl_rx_delay", parent,
+					&ssh_ptl_fault_rx_delay);
+	debugfs_create_u32("delay_us", 0600, dir, &ssh_ptl_rx_delay_us);
+}
+
 #else /* CONFIG_SURFACE_AGGREGATOR_ERROR_INJECTION */
 
 static inline bool ssh_ptl_should_drop_packet(struct ssh_packet *packet)
@@ -505,6 +614,14 @@ static inline void ssh_ptl_rx_inject_invalid_data(struct ssh_ptl *ptl,
 {
 }
 
+static inline void ssh_ptl_tx_inject_delay(struct ssh_ptl *ptl)
+{
+}
+
+static inline void ssh_ptl_rx_inject_delay(struct ssh_ptl *ptl)
+{
+}
+
 #endif /* CONFIG_SURFACE_AGGREGATOR_ERROR_INJECTION */
 
 static void __ssh_ptl_packet_release(struct kref *kref)
@@ -556,6 +673,104 @@ static u8 ssh_packet_get_seq(struct ssh_packet *packet)
 	return packet->data.ptr[SSH_MSGOFFSET_FRAME(seq)];
 }
 
+/*
+ * SSH_PACKET_SF_EXCL_MASK - Mask of packet state flags that describe the
+ * lifecycle stage of a packet. Each of these flags may only be set while not
+ * already set, whereas the remaining state flags (locked, canceled,
+ * completed) can be raced for by multiple parties.
+ *
+ * The transmitted flag is not part of this mask: It is not cleared when a
+ * packet is re-submitted, as ssh_ptl_wait_until_transmitted() relies on it,
+ * and is thus set again by every successful retransmission.
+ */
+#define SSH_PACKET_SF_EXCL_MASK			\
+	(BIT(SSH_PACKET_SF_QUEUED_BIT)		\
+	 | BIT(SSH_PACKET_SF_PENDING_BIT)	\
+	 | BIT(SSH_PACKET_SF_TRANSMITTING_BIT)	\
+	 | BIT(SSH_PACKET_SF_ACKED_BIT))
+
+#ifdef CONFIG_SURFACE_AGGREGATOR_STATE_VALIDATION
+
+/**
+ * ssh_packet_state_validate() - Validate packet state transition.
+ * @p:   The packet undergoing the transition.
+ * @old: The state before the transition.
+ * @set: The state flags set by the transition.
+ * @clr: The state flags cleared by the transition.
+ *
+ * Checks that the transition only modifies state flags, only clears flags
+ * that are currently set, does not re-enter a lifecycle stage that is
+ * currently active, and does not result in an empty state. Warns (once) if
+ * any of these checks fails.
+ *
+ * Return: Returns %true if the transition is valid, %false otherwise.
+ */
+static bool ssh_packet_state_validate(struct ssh_packet *p, unsigned long old,
+				      unsigned long set, unsigned long clr)
+{
+	unsigned long new = (old & ~clr) | set;
+	bool valid = true;
+
+	valid &= !WARN_ONCE((set | clr) & ~SSH_PACKET_FLAGS_SF_MASK,
+			    "ptl: packet %p: transition modifies type flags (set: %#lx, clear: %#lx)\n",
+			    p, set, clr);
+
+	valid &= !WARN_ONCE(clr & ~old,
+			    "ptl: packet %p: transition clears unset flags (state: %#lx, clear: %#lx)\n",
+			    p, old, clr);
+
+	valid &= !WARN_ONCE(set & old & SSH_PACKET_SF_EXCL_MASK,
+			    "ptl: packet %p: transition re-enters state (state: %#lx, set: %#lx)\n",
+			    p, old, set);
+
+	valid &= !WARN_ONCE(!(new & SSH_PACKET_FLAGS_SF_MASK),
+			    "ptl: packet %p: transition results in empty state (state: %#lx)\n",
+			    p, old);
+
+	return valid;
+}
+
+#else /* CONFIG_SURFACE_AGGREGATOR_STATE_VALIDATION */
+
+static inline bool ssh_packet_state_validate(struct ssh_packet *p,
+					     unsigned long old,
+					     unsigned long set,
+					     unsigned long clr)
+{
+	return true;
+}
+
+#endif /* CONFIG_SURFACE_AGGREGATOR_STATE_VALIDATION */
+
+/**
+ * ssh_packet_state_transition() - Atomically set and clear packet state flags.
+ * @p:   The packet to transition.
+ * @set: The state flags to set.
+ * @clr: The state flags to clear.
+ *
+ * Performs the given transition with a single (fully ordered) compare and
+ * exchange operation on the packet state, i.e. the set and cleared flags
+ * change simultaneously. In contrast to a set_bit()/clear_bit() pair, this
+ * requires no additional barrier to ensure that the state never gets zero in
+ * between, and observers never see an intermediate state.
+ *
+ * Return: Returns the packet state before the transition.
+ */
+static unsigned long ssh_packet_state_transition(struct ssh_packet *p,
+						 unsigned long set,
+						 unsigned long clr)
+{
+	unsigned long old, cur = READ_ONCE(p->state);
+
+	do {
+		old = cur;
+		ssh_packet_state_validate(p, old, set, clr);
+		cur = cmpxchg(&p->state, old, (old & ~clr) | set);
+	} while (cur != old);
+
+	return old;
+}
+
 /**
  * ssh_packet_init() - Initialize SSH packet.
  * @packet:   The packet to initialize.
@@ -581,6 +796,7 @@ void ssh_packet_init(struct ssh_packet *packet, unsigned long type,
 	packet->state = type & SSH_PACKET_FLAGS_TY_MASK;
 	packet->priority = priority;
 	packet->timestamp = KTIME_MAX;
+	packet->submitted = KTIME_MAX;
 
 	packet->data.ptr = NULL;
 	packet->data.len = 0;
@@ -884,9 +1100,6 @@ static bool ssh_ptl_tx_can_process(struct ssh_packet *packet)
 {
 	struct ssh_ptl *ptl = packet->ptl;
 
-	if (test_bit(SSH_PACKET_TY_FLUSH_BIT, &packet->state))
-		return !atomic_read(&ptl->pending.count);
-
 	/* We can always process non-blocking packets. */
 	if (!test_bit(SSH_PACKET_TY_BLOCKING_BIT, &packet->state))
 		return true;
@@ -930,10 +1143,9 @@ static struct ssh_packet *ssh_ptl_tx_pop(struct ssh_ptl *ptl)
 
 		list_del(&p->queue_node);
 
-		set_bit(SSH_PACKET_SF_TRANSMITTING_BIT, &p->state);
-		/* Ensure that state never gets zero. */
-		smp_mb__before_atomic();
-		clear_bit(SSH_PACKET_SF_QUEUED_BIT, &p->state);
+		ssh_packet_state_transition(p,
+					    BIT(SSH_PACKET_SF_TRANSMITTING_BIT),
+					    BIT(SSH_PACKET_SF_QUEUED_BIT));
 
 		/*
 		 * Update number of tries. This directly influences the
@@ -975,16 +1187,22 @@ static void ssh_ptl_tx_compl_success(struct ssh_packet *packet)
 	struct ssh_ptl *ptl = packet->ptl;
 
 	ptl_dbg(ptl, "ptl: successfully transmitted packet %p\n", packet);
+	trace_ssam_packet_transmit(packet);
 
-	/* Transition state to "transmitted". */
-	set_bit(SSH_PACKET_SF_TRANSMITTED_BIT, &packet->state);
-	/* Ensure that state never gets zero. */
-	smp_mb__before_atomic();
-	clear_bit(SSH_PACKET_SF_TRANSMITTING_BIT, &packet->state);
+	/*
+	 * Transition state to "transmitted". If the packet is unsequenced,
+	 * we're done: Lock it in the same transition and complete it.
+	 */
+	if (test_bit(SSH_PACKET_TY_SEQUENCED_BIT, &packet->state)) {
+		ssh_packet_state_transition(packet,
+					    BIT(SSH_PACKET_SF_TRANSMITTED_BIT),
+					    BIT(SSH_PACKET_SF_TRANSMITTING_BIT));
+	} else {
+		ssh_packet_state_transition(packet,
+					    BIT(SSH_PACKET_SF_TRANSMITTED_BIT)
+					    | BIT(SSH_PACKET_SF_LOCKED_BIT),
+					    BIT(SSH_PACKET_SF_TRANSMITTING_BIT));
 
-	/* If the packet is unsequenced, we're done: Lock and complete. */
-	if (!test_bit(SSH_PACKET_TY_SEQUENCED_BIT, &packet->state)) {
-		set_bit(SSH_PACKET_SF_LOCKED_BIT, &packet->state);
 		ssh_ptl_remove_and_complete(packet, 0);
 	}
 
@@ -998,10 +1216,8 @@ static void ssh_ptl_tx_compl_success(struct ssh_packet *packet)
 static void ssh_ptl_tx_compl_error(struct ssh_packet *packet, int status)
 {
 	/* Transmission failure: Lock the packet and try to complete it. */
-	set_bit(SSH_PACKET_SF_LOCKED_BIT, &packet->state);
-	/* Ensure that state never gets zero. */
-	smp_mb__before_atomic();
-	clear_bit(SSH_PACKET_SF_TRANSMITTING_BIT, &packet->state);
+	ssh_packet_state_transition(packet, BIT(SSH_PACKET_SF_LOCKED_BIT),
+				    BIT(SSH_PACKET_SF_TRANSMITTING_BIT));
 
 	ptl_err(packet->ptl, "ptl: transmission error: %d\n", status);
 	ptl_dbg(packet->ptl, "ptl: failed to transmit packet: %p\n", packet);
@@ -1053,10 +1269,6 @@ static int ssh_ptl_tx_packet(struct ssh_ptl *ptl, struct ssh_packet *packet)
 	long timeout = SSH_PTL_TX_TIMEOUT;
 	size_t offset = 0;
 
-	/* Note: Flush-packets don't have any data. */
-	if (unlikely(!packet->data.ptr))
-		return 0;
-
 	/* Error injection: drop packet to simulate transmission problem. */
 	if (ssh_ptl_should_drop_packet(packet))
 		return 0;
@@ -1114,7 +1326,11 @@ static int ssh_ptl_tx_threadfn(void *data)
 		}
 
 		/* Transfer and complete packet. */
+		ssh_ptl_tx_inject_delay(ptl);
+
 		status = ssh_ptl_tx_packet(ptl, packet);
+		ssh_rec_log_packet(&ptl->rec, SSH_REC_TX, packet, status);
+
 		if (status)
 			ssh_ptl_tx_compl_error(packet, status);
 		else
@@ -1143,6 +1359,61 @@ static void ssh_ptl_tx_wakeup_packet(struct ssh_ptl *ptl)
 	complete(&ptl->tx.thread_cplt_pkt);
 }
 
+/**
+ * ssh_ptl_thread_setup() - Apply scheduling parameters to transport thread.
+ * @ptl:    The packet transport layer.
+ * @thread: The newly created (not yet running) thread.
+ *
+ * Applies scheduling class and CPU affinity as specified via the
+ * ``thread_sched`` and ``thread_cpus`` module parameters. Failures are only
+ * reported, the thread will run with default parameters in that case.
+ *
+ * Note that the real-time priority itself is not configurable: Modules are
+ * restricted to the sched_set_fifo() and sched_set_fifo_low() interfaces.
+ */
+static void ssh_ptl_thread_setup(struct ssh_ptl *ptl, struct task_struct *thread)
+{
+	cpumask_var_t mask;
+	int status;
+
+	switch (thread_sched) {
+	case 0:
+		break;
+
+	case 1:
+		sched_set_fifo_low(thread);
+		break;
+
+	case 2:
+		sched_set_fifo(thread);
+		break;
+
+	default:
+		ptl_warn(ptl, "ptl: invalid thread scheduling class: %d\n",
+			 thread_sched);
+		break;
+	}
+
+	if (!thread_cpus || !*thread_cpus)
+		return;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return;
+
+	status = cpulist_parse(thread_cpus, mask);
+	if (!status && !cpumask_intersects(mask, cpu_online_mask))
+		status = -EINVAL;
+	if (!status)
+		status = set_cpus_allowed_ptr(thread, mask);
+
+	if (status) {
+		ptl_warn(ptl, "ptl: failed to set CPU affinity '%s': %d\n",
+			 thread_cpus, status);
+	}
+
+	free_cpumask_var(mask);
+}
+
 /**
  * ssh_ptl_tx_start() - Start packet transmitter thread.
  * @ptl: The packet transport layer.
@@ -1153,10 +1424,14 @@ int ssh_ptl_tx_start(struct ssh_ptl *ptl)
 {
 	atomic_set_release(&ptl->tx.running, 1);
 
-	ptl->tx.thread = kthread_run(ssh_ptl_tx_threadfn, ptl, "ssam_serial_hub-tx");
+	ptl->tx.thread = kthread_create(ssh_ptl_tx_threadfn, ptl,
+					"ssam_serial_hub-tx");
 	if (IS_ERR(ptl->tx.thread))
 		return PTR_ERR(ptl->tx.thread);
 
+	ssh_ptl_thread_setup(ptl, ptl->tx.thread);
+	wake_up_process(ptl->tx.thread);
+
 	return 0;
 }
 
@@ -1218,10 +1493,8 @@ static struct ssh_packet *ssh_ptl_ack_pop(struct ssh_ptl *ptl, u8 seq_id)
 		 * Mark the packet as ACKed and remove it from pending by
 		 * removing its node and decrementing the pending counter.
 		 */
-		set_bit(SSH_PACKET_SF_ACKED_BIT, &p->state);
-		/* Ensure that state never gets zero. */
-		smp_mb__before_atomic();
-		clear_bit(SSH_PACKET_SF_PENDING_BIT, &p->state);
+		ssh_packet_state_transition(p, BIT(SSH_PACKET_SF_ACKED_BIT),
+					    BIT(SSH_PACKET_SF_PENDING_BIT));
 
 		atomic_dec(&ptl->pending.count);
 		list_del(&p->pending_node);
@@ -1317,12 +1590,8 @@ int ssh_ptl_submit(struct ssh_ptl *ptl, struct ssh_packet *p)
 	trace_ssam_packet_submit(p);
 
 	/* Validate packet fields. */
-	if (test_bit(SSH_PACKET_TY_FLUSH_BIT, &p->state)) {
-		if (p->data.ptr || test_bit(SSH_PACKET_TY_SEQUENCED_BIT, &p->state))
-			return -EINVAL;
-	} else if (!p->data.ptr) {
+	if (!p->data.ptr)
 		return -EINVAL;
-	}
 
 	/*
 	 * The ptl reference only gets set on or before the first submission.
@@ -1337,6 +1606,8 @@ int ssh_ptl_submit(struct ssh_ptl *ptl, struct ssh_packet *p)
 	else if (WARN_ON(ptl_old != ptl))
 		return -EALREADY;	/* Submitted on different PTL. */
 
+	WRITE_ONCE(p->submitted, ktime_get_coarse_boottime());
+
 	status = ssh_ptl_queue_push(p);
 	if (status)
 		return status;
@@ -1533,6 +1804,7 @@ static void ssh_ptl_timeout_reap(struct work_struct *work)
 		}
 
 		trace_ssam_packet_timeout(p);
+		ssh_rec_log_packet(&ptl->rec, SSH_REC_TIMEOUT, p, -ETIMEDOUT);
 
 		status = __ssh_ptl_resubmit(p);
 
@@ -1678,6 +1950,40 @@ static void ssh_ptl_send_nak(struct ssh_ptl *ptl)
 	ssh_packet_put(packet);
 }
 
+static bool ssh_ptl_rx_resync_should_nak(struct ssh_ptl *ptl)
+{
+	unsigned long now = jiffies;
+
+	if (ptl->rx.resync.active &&
+	    time_before(now, ptl->rx.resync.nak_time + SSH_PTL_RX_NAK_HOLDOFF)) {
+		WRITE_ONCE(ptl->rx.resync.naks_suppressed,
+			   ptl->rx.resync.naks_suppressed + 1);
+		return false;
+	}
+
+	ptl->rx.resync.active = true;
+	ptl->rx.resync.nak_time = now;
+	WRITE_ONCE(ptl->rx.resync.naks, ptl->rx.resync.naks + 1);
+	return true;
+}
+
+static void ssh_ptl_rx_diag_parse_error(struct ssh_ptl *ptl, int status)
+{
+	switch (status) {
+	case -ENOMSG:
+		ssam_diag_hit(&ptl->rx.diag.sof);
+		break;
+
+	case -EBADMSG:
+		ssam_diag_hit(&ptl->rx.diag.crc);
+		break;
+
+	case -EMSGSIZE:
+		ssam_diag_hit(&ptl->rx.diag.size);
+		break;
+	}
+}
+
 static size_t ssh_ptl_rx_eval(struct ssh_ptl *ptl, struct ssam_span *source)
 {
 	struct ssh_frame *frame;
@@ -1704,21 +2010,19 @@ static size_t ssh_ptl_rx_eval(struct ssh_ptl *ptl, struct ssam_span *source)
 		 * (via the call to sshp_find_syn() above), or the first bytes
 		 * of a message got dropped or corrupted.
 		 *
-		 * In any case, we issue a warning, send a NAK to the EC to
+		 * In any case, we record a diagnostic, send a NAK to the EC to
 		 * request re-transmission of any data we haven't acknowledged
 		 * yet, and finally, skip everything up to the next SYN
-		 * sequence.
+		 * sequence. NAKs are debounced per resync episode, i.e. only
+		 * one is sent until we have parsed a valid frame again or the
+		 * hold-off time has passed.
 		 */
 
-		ptl_warn(ptl, "rx: parser: invalid start of frame, skipping\n");
+		ssam_diag_hit(&ptl->rx.diag.sof);
+		ssh_rec_log(&ptl->rec, SSH_REC_ERROR, 0, 0, 0, 0, -EBADMSG);
 
 		/*
 		 * Notes:
-		 * - This might send multiple NAKs in case the communication
-		 *   starts with an invalid SYN and is broken down into multiple
-		 *   pieces. This should generally be handled fine, we just
-		 *   might receive duplicate data in this case, which is
-		 *   detected when handling data frames.
 		 * - This path will also be executed on invalid CRCs: When an
 		 *   invalid CRC is encountered, the code below will skip data
 		 *   until directly after the SYN. This causes the search for
@@ -1730,7 +2034,8 @@ static size_t ssh_ptl_rx_eval(struct ssh_ptl *ptl, struct ssam_span *source)
 		 *   implementation) or should we drop that frame without
 		 *   telling the EC?
 		 */
-		ssh_ptl_send_nak(ptl);
+		if (ssh_ptl_rx_resync_should_nak(ptl))
+			ssh_ptl_send_nak(ptl);
 	}
 
 	if (unlikely(!syn_found))
@@ -1742,19 +2047,26 @@ static size_t ssh_ptl_rx_eval(struct ssh_ptl *ptl, struct ssam_span *source)
 	/* Parse and validate frame. */
 	status = sshp_parse_frame(&ptl->serdev->dev, &aligned, &frame, &payload,
 				  SSH_PTL_RX_BUF_LEN);
-	if (status)	/* Invalid frame: skip to next SYN. */
+	if (status) {	/* Invalid frame: skip to next SYN. */
+		ssh_ptl_rx_diag_parse_error(ptl, status);
 		return aligned.ptr - source->ptr + sizeof(u16);
+	}
 	if (!frame)	/* Not enough data. */
 		return aligned.ptr - source->ptr;
 
 	trace_ssam_rx_frame_received(frame);
 
+	/* We have parsed a valid frame, thus any resync episode has ended. */
+	ptl->rx.resync.active = false;
+
 	switch (frame->type) {
 	case SSH_FRAME_TYPE_ACK:
+		ssh_rec_log(&ptl->rec, SSH_REC_ACK, frame->seq, 0, 0, 0, 0);
 		ssh_ptl_acknowledge(ptl, frame->seq);
 		break;
 
 	case SSH_FRAME_TYPE_NAK:
+		ssh_rec_log(&ptl->rec, SSH_REC_NAK, frame->seq, 0, 0, 0, 0);
 		ssh_ptl_resubmit_pending(ptl);
 		break;
 
@@ -1790,6 +2102,8 @@ static int ssh_ptl_rx_threadfn(void *data)
 		if (kthread_should_stop())
 			break;
 
+		ssh_ptl_rx_inject_delay(ptl);
+
 		/* Copy from fifo to evaluation buffer. */
 		n = sshp_buf_read_from_fifo(&ptl->rx.buf, &ptl->rx.fifo);
 
@@ -1831,11 +2145,14 @@ int ssh_ptl_rx_start(struct ssh_ptl *ptl)
 	if (ptl->rx.thread)
 		return 0;
 
-	ptl->rx.thread = kthread_run(ssh_ptl_rx_threadfn, ptl,
-				     "ssam_serial_hub-rx");
+	ptl->rx.thread = kthread_create(ssh_ptl_rx_threadfn, ptl,
+					"ssam_serial_hub-rx");
 	if (IS_ERR(ptl->rx.thread))
 		return PTR_ERR(ptl->rx.thread);
 
+	ssh_ptl_thread_setup(ptl, ptl->rx.thread);
+	wake_up_process(ptl->rx.thread);
+
 	return 0;
 }
 
@@ -1950,10 +2267,8 @@ void ssh_ptl_shutdown(struct ssh_ptl *ptl)
 	/* Mark queued packets as locked and move them to complete_q. */
 	spin_lock(&ptl->queue.lock);
 	list_for_each_entry_safe(p, n, &ptl->queue.head, queue_node) {
-		set_bit(SSH_PACKET_SF_LOCKED_BIT, &p->state);
-		/* Ensure that state does not get zero. */
-		smp_mb__before_atomic();
-		clear_bit(SSH_PACKET_SF_QUEUED_BIT, &p->state);
+		ssh_packet_state_transition(p, BIT(SSH_PACKET_SF_LOCKED_BIT),
+					    BIT(SSH_PACKET_SF_QUEUED_BIT));
 
 		list_move_tail(&p->queue_node, &complete_q);
 	}
@@ -1962,10 +2277,8 @@ void ssh_ptl_shutdown(struct ssh_ptl *ptl)
 	/* Mark pending packets as locked and move them to complete_p. */
 	spin_lock(&ptl->pending.lock);
 	list_for_each_entry_safe(p, n, &ptl->pending.head, pending_node) {
-		set_bit(SSH_PACKET_SF_LOCKED_BIT, &p->state);
-		/* Ensure that state does not get zero. */
-		smp_mb__before_atomic();
-		clear_bit(SSH_PACKET_SF_PENDING_BIT, &p->state);
+		ssh_packet_state_transition(p, BIT(SSH_PACKET_SF_LOCKED_BIT),
+					    BIT(SSH_PACKET_SF_PENDING_BIT));
 
 		list_move_tail(&p->pending_node, &complete_q);
 	}
@@ -1994,6 +2307,108 @@ void ssh_ptl_shutdown(struct ssh_ptl *ptl)
 	 */
 }
 
+static void ssh_ptl_show_packet(struct seq_file *s, struct ssh_packet *p,
+				ktime_t now)
+{
+	const u8 *data = p->data.ptr;
+	size_t len = p->data.len;
+	u8 prio = READ_ONCE(p->priority);
+	ktime_t ts = READ_ONCE(p->timestamp);
+	ktime_t submitted = READ_ONCE(p->submitted);
+
+	seq_printf(s, "  %p  state: %#06lx  base: %u  try: %u",
+		   p, READ_ONCE(p->state), ssh_packet_priority_get_base(prio),
+		   ssh_packet_priority_get_try(prio));
+
+	if (data && len >= SSH_MESSAGE_LENGTH(0))
+		seq_printf(s, "  seq: %#04x", data[SSH_MSGOFFSET_FRAME(seq)]);
+
+	if (data && len >= SSH_COMMAND_MESSAGE_LENGTH(0)) {
+		seq_printf(s, "  rqid: %#06x  tc: %#04x  cid: %#04x",
+			   get_unaligned_le16(&data[SSH_MSGOFFSET_COMMAND(rqid)]),
+			   data[SSH_MSGOFFSET_COMMAND(tc)],
+			   data[SSH_MSGOFFSET_COMMAND(cid)]);
+	}
+
+	if (submitted != KTIME_MAX)
+		seq_printf(s, "  age: %lldms", ktime_ms_delta(now, submitted));
+
+	if (ts != KTIME_MAX)
+		seq_printf(s, "  tx: %lldms", ktime_ms_delta(now, ts));
+
+	seq_puts(s, "\n");
+}
+
+/**
+ * ssh_ptl_show_queues() - Print snapshot of packet queue and pending set.
+ * @ptl: The packet transport layer.
+ * @s:   The sequence file to print the snapshot to.
+ *
+ * Prints all packets currently in the submission queue and the pending set,
+ * in list order, including state flags, priority, tries, and identifying
+ * message fields, as well as the time since submission as age. For packets
+ * currently being transmitted or awaiting an ACK, the time since the latest
+ * transmission attempt has been started is printed as tx. Also prints the
+ * time until the timeout reaper is next scheduled to run.
+ *
+ * Each list is snapshotted while holding its respective lock, thus the
+ * output is consistent per list, but not necessarily across lists.
+ */
+void ssh_ptl_show_queues(struct ssh_ptl *ptl, struct seq_file *s)
+{
+	ktime_t now = ktime_get_coarse_boottime();
+	struct ssh_packet *p;
+	ktime_t expires;
+
+	spin_lock(&ptl->rtx_timeout.lock);
+	expires = ptl->rtx_timeout.expires;
+	spin_unlock(&ptl->rtx_timeout.lock);
+
+	seq_printf(s, "state: %#lx\n", READ_ONCE(ptl->state));
+
+	if (expires != KTIME_MAX)
+		seq_printf(s, "reaper: in %lldms\n", ktime_ms_delta(expires, now));
+	else
+		seq_puts(s, "reaper: idle\n");
+
+	seq_puts(s, "queue:\n");
+	spin_lock(&ptl->queue.lock);
+	list_for_each_entry(p, &ptl->queue.head, queue_node)
+		ssh_ptl_show_packet(s, p, now);
+	spin_unlock(&ptl->queue.lock);
+
+	seq_printf(s, "pending (%d):\n", atomic_read(&ptl->pending.count));
+	spin_lock(&ptl->pending.lock);
+	list_for_each_entry(p, &ptl->pending.head, pending_node)
+		ssh_ptl_show_packet(s, p, now);
+	spin_unlock(&ptl->pending.lock);
+}
+
+static void ssh_ptl_rx_diag_destroy(struct ssh_ptl *ptl)
+{
+	ssam_diag_destroy(&ptl->rx.diag.sof);
+	ssam_diag_destroy(&ptl->rx.diag.crc);
+	ssam_diag_destroy(&ptl->rx.diag.size);
+}
+
+/**
+ * ssh_ptl_show_stats() - Print packet transport layer statistics.
+ * @ptl: The packet transport layer.
+ * @s:   The sequence file to print the statistics to.
+ */
+void ssh_ptl_show_stats(struct ssh_ptl *ptl, struct seq_file *s)
+{
+	seq_printf(s, "rx_naks_sent: %lu\n", READ_ONCE(ptl->rx.resync.naks));
+	seq_printf(s, "rx_naks_suppressed: %lu\n",
+		   READ_ONCE(ptl->rx.resync.naks_suppressed));
+	seq_printf(s, "rx_invalid_sof: %lu\n",
+		   ssam_diag_count(&ptl->rx.diag.sof));
+	seq_printf(s, "rx_invalid_crc: %lu\n",
+		   ssam_diag_count(&ptl->rx.diag.crc));
+	seq_printf(s, "rx_frame_too_large: %lu\n",
+		   ssam_diag_count(&ptl->rx.diag.size));
+}
+
 /**
  * ssh_ptl_init() - Initialize packet transport layer.
  * @ptl:    The packet transport layer to initialize.
@@ -2036,6 +2451,8 @@ int ssh_ptl_init(struct ssh_ptl *ptl, struct serdev_device *serdev,
 	ptl->rtx_timeout.expires = KTIME_MAX;
 	INIT_DELAYED_WORK(&ptl->rtx_timeout.reaper, ssh_ptl_timeout_reap);
 
+	ssh_rec_init(&ptl->rec, &serdev->dev);
+
 	ptl->ops = *ops;
 
 	/* Initialize list of recent/blocked SEQs with invalid sequence IDs. */
@@ -2043,14 +2460,32 @@ int ssh_ptl_init(struct ssh_ptl *ptl, struct serdev_device *serdev,
 		ptl->rx.blocked.seqs[i] = U16_MAX;
 	ptl->rx.blocked.offset = 0;
 
+	ptl->rx.resync.active = false;
+	ptl->rx.resync.nak_time = jiffies;
+	ptl->rx.resync.naks = 0;
+	ptl->rx.resync.naks_suppressed = 0;
+
+	ssam_diag_init(&ptl->rx.diag.sof, &serdev->dev,
+		       "rx: invalid start of frame, data skipped");
+	ssam_diag_init(&ptl->rx.diag.crc, &serdev->dev,
+		       "rx: invalid CRC, frame dropped");
+	ssam_diag_init(&ptl->rx.diag.size, &serdev->dev,
+		       "rx: frame too large, frame dropped");
+
 	status = kfifo_alloc(&ptl->rx.fifo, SSH_PTL_RX_FIFO_LEN, GFP_KERNEL);
 	if (status)
-		return status;
+		goto err_fifo;
 
 	status = sshp_buf_alloc(&ptl->rx.buf, SSH_PTL_RX_BUF_LEN, GFP_KERNEL);
 	if (status)
-		kfifo_free(&ptl->rx.fifo);
+		goto err_buf;
+
+	return 0;
 
+err_buf:
+	kfifo_free(&ptl->rx.fifo);
+err_fifo:
+	ssh_ptl_rx_diag_destroy(ptl);
 	return status;
 }
 
@@ -2067,4 +2502,9 @@ void ssh_ptl_destroy(struct ssh_ptl *ptl)
 {
 	kfifo_free(&ptl->rx.fifo);
 	sshp_buf_free(&ptl->rx.buf);
+	ssh_ptl_rx_diag_destroy(ptl);
 }
+
+#ifdef CONFIG_SURFACE_AGGREGATOR_KUNIT_TEST
+#include "ssh_packet_layer_test.c"
+#endif
@@ -9,9 +9,11 @@
 #define _SURFACE_AGGREGATOR_SSH_PACKET_LAYER_H
 
 #include <linux/atomic.h>
+#include <linux/debugfs.h>
 #include <linux/kfifo.h>
 #include <linux/ktime.h>
 #include <linux/list.h>
+#include <linux/seq_file.h>
 #include <linux/serdev.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
@@ -19,7 +21,9 @@
 #include <linux/workqueue.h>
 
 #include "../include/linux/surface_aggregator/serial_hub.h"
+#include "../include/linux/surface_aggregator/controller.h"
 #include "ssh_parser.h"
+#include "ssh_recorder.h"
 
 /**
  * enum ssh_ptl_state_flags - State-flags for &struct ssh_ptl.
@@ -67,11 +71,22 @@ struct ssh_ptl_ops {
  * @rx.blocked:    List of recent/blocked sequence IDs to detect retransmission.
  * @rx.blocked.seqs:   Array of blocked sequence IDs.
  * @rx.blocked.offset: Offset indicating where a new ID should be inserted.
+ * @rx.resync:     State for resynchronization after invalid data.
+ * @rx.resync.active:   Flag indicating whether we are currently resyncing,
+ *                      i.e. have not parsed a valid frame since the last NAK.
+ * @rx.resync.nak_time: Time (in jiffies) at which the last NAK has been sent.
+ * @rx.resync.naks:     Number of NAKs sent due to invalid data.
+ * @rx.resync.naks_suppressed: Number of NAKs suppressed due to debouncing.
+ * @rx.diag:       Diagnostics for invalid received data.
+ * @rx.diag.sof:   Data skipped due to an invalid start of frame.
+ * @rx.diag.crc:   Frames dropped due to an invalid frame or payload CRC.
+ * @rx.diag.size:  Frames dropped due to exceeding the maximum frame length.
  * @rtx_timeout:   Retransmission timeout subsystem.
  * @rtx_timeout.lock:    Lock for modifying the retransmission timeout reaper.
  * @rtx_timeout.timeout: Timeout interval for retransmission.
  * @rtx_timeout.expires: Time specifying when the reaper work is next scheduled.
  * @rtx_timeout.reaper:  Work performing timeout checks and subsequent actions.
+ * @rec:           Protocol flight recorder.
  * @ops:           Packet layer operations.
  */
 struct ssh_ptl {
@@ -107,6 +122,19 @@ struct ssh_ptl {
 			u16 seqs[8];
 			u16 offset;
 		} blocked;
+
+		struct {
+			bool active;
+			unsigned long nak_time;
+			unsigned long naks;
+			unsigned long naks_suppressed;
+		} resync;
+
+		struct {
+			struct ssam_diag sof;
+			struct ssam_diag crc;
+			struct ssam_diag size;
+		} diag;
 	} rx;
 
 	struct {
@@ -116,6 +144,8 @@ struct ssh_ptl {
 		struct delayed_work reaper;
 	} rtx_timeout;
 
+	struct ssh_recorder rec;
+
 	struct ssh_ptl_ops ops;
 };
 
@@ -164,6 +194,9 @@ void ssh_ptl_cancel(struct ssh_packet *p);
 
 int ssh_ptl_rx_rcvbuf(struct ssh_ptl *ptl, const u8 *buf, size_t n);
 
+void ssh_ptl_show_queues(struct ssh_ptl *ptl, struct seq_file *s);
+void ssh_ptl_show_stats(struct ssh_ptl *ptl, struct seq_file *s);
+
 /**
  * ssh_ptl_tx_wakeup_transfer() - Wake up packet transmitter thread for
  * transfer.
@@ -187,4 +220,10 @@ void ssh_packet_init(struct ssh_packet *packet, unsigned long type,
 int ssh_ctrl_packet_cache_init(void);
 void ssh_ctrl_packet_cache_destroy(void);
 
+#ifdef CONFIG_SURFACE_AGGREGATOR_ERROR_INJECTION
+void ssh_ptl_fault_debugfs_init(struct dentry *parent);
+#else /* CONFIG_SURFACE_AGGREGATOR_ERROR_INJECTION */
+static inline void ssh_ptl_fault_debugfs_init(struct dentry *parent) {}
+#endif /* CONFIG_SURFACE_AGGREGATOR_ERROR_INJECTION */
+
 #endif /* _SURFACE_AGGREGATOR_SSH_PACKET_LAYER_H */
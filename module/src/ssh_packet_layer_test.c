@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * KUnit tests for the SSH packet transport layer.
+ *
+ * Included from ssh_packet_layer.c when CONFIG_SURFACE_AGGREGATOR_KUNIT_TEST
+ * is defined. Tests operate on a bare packet transport layer, i.e. without
+ * serial device and transmitter/receiver threads.
+ *
+ * Copyright (C) 2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#include <kunit/test.h>
+
+static void ssh_ptl_test_packet_release(struct ssh_packet *p)
+{
+	/* Packets are managed by the test. */
+}
+
+static const struct ssh_packet_ops ssh_ptl_test_packet_ops = {
+	.release = ssh_ptl_test_packet_release,
+};
+
+static struct ssh_ptl *ssh_ptl_test_init(struct kunit *test)
+{
+	struct ssh_ptl *ptl;
+
+	ptl = kunit_kzalloc(test, sizeof(*ptl), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ptl);
+
+	spin_lock_init(&ptl->queue.lock);
+	INIT_LIST_HEAD(&ptl->queue.head);
+	spin_lock_init(&ptl->pending.lock);
+	INIT_LIST_HEAD(&ptl->pending.head);
+
+	return ptl;
+}
+
+static struct ssh_packet *ssh_ptl_test_packet(struct kunit *test,
+					      struct ssh_ptl *ptl, u8 priority)
+{
+	struct ssh_packet *p;
+
+	p = kunit_kzalloc(test, sizeof(*p), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, p);
+
+	ssh_packet_init(p, BIT(SSH_PACKET_TY_SEQUENCED_BIT), priority,
+			&ssh_ptl_test_packet_ops);
+	p->ptl = ptl;
+
+	return p;
+}
+
+static void ssh_ptl_test_queue_clear(struct ssh_ptl *ptl)
+{
+	struct ssh_packet *p, *n;
+
+	list_for_each_entry_safe(p, n, &ptl->queue.head, queue_node) {
+		list_del(&p->queue_node);
+		ssh_packet_put(p);
+	}
+}
+
+static void ssh_ptl_test_queue_order(struct kunit *test)
+{
+	static const u8 prio[] = {
+		SSH_PACKET_PRIORITY(DATA, 0),
+		SSH_PACKET_PRIORITY(DATA, 0),
+		SSH_PACKET_PRIORITY(ACK, 0),
+		SSH_PACKET_PRIORITY(NAK, 0),
+		SSH_PACKET_PRIORITY(DATA, 1),
+		SSH_PACKET_PRIORITY(ACK, 0),
+		SSH_PACKET_PRIORITY(DATA, 2),
+		SSH_PACKET_PRIORITY(DATA, 0),
+	};
+
+	/* Higher priority first, submission order for equal priority. */
+	static const unsigned int expected[] = { 2, 5, 3, 6, 4, 0, 1, 7 };
+
+	struct ssh_packet *packets[ARRAY_SIZE(prio)];
+	struct ssh_ptl *ptl = ssh_ptl_test_init(test);
+	struct ssh_packet *p;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(prio); i++) {
+		packets[i] = ssh_ptl_test_packet(test, ptl, prio[i]);
+		KUNIT_ASSERT_EQ(test, ssh_ptl_queue_push(packets[i]), 0);
+	}
+
+	i = 0;
+	list_for_each_entry(p, &ptl->queue.head, queue_node) {
+		KUNIT_ASSERT_LT(test, i, ARRAY_SIZE(expected));
+		KUNIT_EXPECT_PTR_EQ(test, p, packets[expected[i]]);
+		i++;
+	}
+	KUNIT_EXPECT_EQ(test, i, ARRAY_SIZE(expected));
+
+	ssh_ptl_test_queue_clear(ptl);
+}
+
+static void ssh_ptl_test_queue_reject(struct kunit *test)
+{
+	struct ssh_ptl *ptl = ssh_ptl_test_init(test);
+	struct ssh_packet *p;
+
+	/* Packets can only be queued once. */
+	p = ssh_ptl_test_packet(test, ptl, SSH_PACKET_PRIORITY(DATA, 0));
+	KUNIT_EXPECT_EQ(test, ssh_ptl_queue_push(p), 0);
+	KUNIT_EXPECT_EQ(test, ssh_ptl_queue_push(p), -EALREADY);
+
+	/* Locked packets are not queued. */
+	p = ssh_ptl_test_packet(test, ptl, SSH_PACKET_PRIORITY(DATA, 0));
+	set_bit(SSH_PACKET_SF_LOCKED_BIT, &p->state);
+	KUNIT_EXPECT_EQ(test, ssh_ptl_queue_push(p), -EINVAL);
+
+	/* Nothing gets queued after shutdown. */
+	p = ssh_ptl_test_packet(test, ptl, SSH_PACKET_PRIORITY(DATA, 0));
+	set_bit(SSH_PTL_SF_SHUTDOWN_BIT, &ptl->state);
+	KUNIT_EXPECT_EQ(test, ssh_ptl_queue_push(p), -ESHUTDOWN);
+
+	KUNIT_EXPECT_TRUE(test, list_is_singular(&ptl->queue.head));
+	ssh_ptl_test_queue_clear(ptl);
+}
+
+#ifdef CONFIG_SURFACE_AGGREGATOR_STATE_VALIDATION
+
+static void ssh_ptl_test_state_retransmit(struct kunit *test)
+{
+	/* Lifecycle of a sequenced packet that is retransmitted once. */
+	static const struct {
+		unsigned long set;
+		unsigned long clr;
+	} transitions[] = {
+		/* Submission. */
+		{ BIT(SSH_PACKET_SF_QUEUED_BIT), 0 },
+		/* First transmission. */
+		{ BIT(SSH_PACKET_SF_TRANSMITTING_BIT), BIT(SSH_PACKET_SF_QUEUED_BIT) },
+		{ BIT(SSH_PACKET_SF_PENDING_BIT), 0 },
+		{ BIT(SSH_PACKET_SF_TRANSMITTED_BIT), BIT(SSH_PACKET_SF_TRANSMITTING_BIT) },
+		/* Re-submission after timeout, packet stays pending. */
+		{ BIT(SSH_PACKET_SF_QUEUED_BIT), 0 },
+		/* Retransmission. */
+		{ BIT(SSH_PACKET_SF_TRANSMITTING_BIT), BIT(SSH_PACKET_SF_QUEUED_BIT) },
+		{ BIT(SSH_PACKET_SF_TRANSMITTED_BIT), BIT(SSH_PACKET_SF_TRANSMITTING_BIT) },
+		/* ACK and completion. */
+		{ BIT(SSH_PACKET_SF_ACKED_BIT), BIT(SSH_PACKET_SF_PENDING_BIT) },
+		{ BIT(SSH_PACKET_SF_LOCKED_BIT), 0 },
+		{ BIT(SSH_PACKET_SF_COMPLETED_BIT), 0 },
+	};
+
+	struct ssh_ptl *ptl = ssh_ptl_test_init(test);
+	struct ssh_packet *p;
+	unsigned int i;
+
+	p = ssh_ptl_test_packet(test, ptl, SSH_PACKET_PRIORITY(DATA, 0));
+
+	for (i = 0; i < ARRAY_SIZE(transitions); i++) {
+		KUNIT_EXPECT_TRUE_MSG(test,
+				      ssh_packet_state_validate(p, p->state,
+								transitions[i].set,
+								transitions[i].clr),
+				      "transition %u", i);
+
+		p->state = (p->state & ~transitions[i].clr) | transitions[i].set;
+	}
+}
+
+#endif /* CONFIG_SURFACE_AGGREGATOR_STATE_VALIDATION */
+
+static struct kunit_case ssh_ptl_test_cases[] = {
+	KUNIT_CASE(ssh_ptl_test_queue_order),
+	KUNIT_CASE(ssh_ptl_test_queue_reject),
+#ifdef CONFIG_SURFACE_AGGREGATOR_STATE_VALIDATION
+	KUNIT_CASE(ssh_ptl_test_state_retransmit),
+#endif
+	{}
+};
+
+static struct kunit_suite ssh_ptl_test_suite = {
+	.name = "surface_aggregator_ssh_ptl",
+	.test_cases = ssh_ptl_test_cases,
+};
+kunit_test_suite(ssh_ptl_test_suite);
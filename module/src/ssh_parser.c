@@ -127,7 +127,7 @@ int sshp_parse_frame(const struct device *dev, const struct ssam_span *source,
 	payload->len = 0;
 
 	if (!sshp_starts_with_syn(source)) {
-		dev_warn(dev, "rx: parser: invalid start of frame\n");
+		dev_dbg(dev, "rx: parser: invalid start of frame\n");
 		return -ENOMSG;
 	}
 
@@ -143,15 +143,15 @@ int sshp_parse_frame(const struct device *dev, const struct ssam_span *source,
 
 	/* Validate frame CRC. */
 	if (unlikely(!sshp_validate_crc(&sf, sf.ptr + sf.len))) {
-		dev_warn(dev, "rx: parser: invalid frame CRC\n");
+		dev_dbg(dev, "rx: parser: invalid frame CRC\n");
 		return -EBADMSG;
 	}
 
 	/* Ensure packet does not exceed maximum length. */
 	sp.len = get_unaligned_le16(&((struct ssh_frame *)sf.ptr)->len);
 	if (unlikely(SSH_MESSAGE_LENGTH(sp.len) > maxlen)) {
-		dev_warn(dev, "rx: parser: frame too large: %llu bytes\n",
-			 SSH_MESSAGE_LENGTH(sp.len));
+		dev_dbg(dev, "rx: parser: frame too large: %llu bytes\n",
+			SSH_MESSAGE_LENGTH(sp.len));
 		return -EMSGSIZE;
 	}
 
@@ -166,7 +166,7 @@ int sshp_parse_frame(const struct device *dev, const struct ssam_span *source,
 
 	/* Validate payload CRC. */
 	if (unlikely(!sshp_validate_crc(&sp, sp.ptr + sp.len))) {
-		dev_warn(dev, "rx: parser: invalid payload CRC\n");
+		dev_dbg(dev, "rx: parser: invalid payload CRC\n");
 		return -EBADMSG;
 	}
 
@@ -226,3 +226,7 @@ int sshp_parse_command(const struct device *dev, const struct ssam_span *source,
 
 	return 0;
 }
+
+#ifdef CONFIG_SURFACE_AGGREGATOR_KUNIT_TEST
+#include "ssh_parser_test.c"
+#endif
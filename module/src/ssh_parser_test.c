@@ -0,0 +1,463 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * KUnit tests and benchmarks for SSH message building and parsing.
+ *
+ * Included from ssh_parser.c when CONFIG_SURFACE_AGGREGATOR_KUNIT_TEST is
+ * defined. Covers the message builder functions in ssh_msgb.h and the parser
+ * functions in ssh_parser.c, which do not depend on any hardware.
+ *
+ * Copyright (C) 2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#include <kunit/test.h>
+#include <linux/ktime.h>
+
+#include "ssh_msgb.h"
+
+#define SSHP_TEST_BUF_LEN	SSH_COMMAND_MESSAGE_LENGTH(64)
+#define SSHP_TEST_MAXLEN	SSH_COMMAND_MESSAGE_LENGTH(SSH_COMMAND_MAX_PAYLOAD_SIZE)
+#define SSHP_BENCH_ITERATIONS	10000
+
+
+/* -- Helpers. -------------------------------------------------------------- */
+
+static const u8 sshp_test_payload[] = {
+	0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+	0xaa, 0x55, 0xaa, 0x55, 0x00, 0xff, 0x10, 0x20,
+};
+
+static size_t sshp_test_build_cmd(u8 *buf, size_t cap, u8 seq, u16 rqid,
+				  const u8 *payload, u16 len)
+{
+	const struct ssam_request rqst = {
+		.target_category = 0x02,
+		.target_id = 0x01,
+		.command_id = 0x0d,
+		.instance_id = 0x00,
+		.flags = SSAM_REQUEST_HAS_RESPONSE,
+		.length = len,
+		.payload = payload,
+	};
+	struct msgbuf msgb;
+
+	msgb_init(&msgb, buf, cap);
+	msgb_push_cmd(&msgb, seq, rqid, &rqst);
+
+	return msgb_bytes_used(&msgb);
+}
+
+static size_t sshp_test_build_ack(u8 *buf, size_t cap, u8 seq)
+{
+	struct msgbuf msgb;
+
+	msgb_init(&msgb, buf, cap);
+	msgb_push_ack(&msgb, seq);
+
+	return msgb_bytes_used(&msgb);
+}
+
+/*
+ * Consume messages from the given buffer the same way the packet layer
+ * receiver does (see ssh_ptl_rx_eval()): Skip to the next SYN, and on parser
+ * errors skip past that SYN to resynchronize. Returns the number of valid
+ * frames found and stores the sequence ID of the last one in @seq.
+ */
+static unsigned int sshp_test_rx(const u8 *buf, size_t len, u8 *seq)
+{
+	struct ssam_span source = { .ptr = (u8 *)buf, .len = len };
+	struct ssam_span aligned, payload;
+	struct ssh_frame *frame;
+	unsigned int n = 0;
+	size_t used;
+	int status;
+
+	while (source.len >= 2) {
+		if (!sshp_find_syn(&source, &aligned))
+			break;
+
+		status = sshp_parse_frame(NULL, &aligned, &frame, &payload,
+					  SSHP_TEST_MAXLEN);
+		if (status) {
+			used = aligned.ptr - source.ptr + sizeof(u16);
+		} else if (!frame) {
+			break;
+		} else {
+			used = aligned.ptr - source.ptr
+			       + SSH_MESSAGE_LENGTH(payload.len);
+			*seq = frame->seq;
+			n++;
+		}
+
+		source.ptr += used;
+		source.len -= used;
+	}
+
+	return n;
+}
+
+
+/* -- Message builder. ------------------------------------------------------ */
+
+static void sshp_test_msgb_ack(struct kunit *test)
+{
+	u8 buf[SSH_MSG_LEN_CTRL];
+	size_t len;
+
+	len = sshp_test_build_ack(buf, sizeof(buf), 0x42);
+	KUNIT_ASSERT_EQ(test, len, (size_t)SSH_MSG_LEN_CTRL);
+
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&buf[0]), SSH_MSG_SYN);
+	KUNIT_EXPECT_EQ(test, buf[2], (u8)SSH_FRAME_TYPE_ACK);
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&buf[3]), 0);
+	KUNIT_EXPECT_EQ(test, buf[5], 0x42);
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&buf[6]), ssh_crc(&buf[2], 4));
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&buf[8]), ssh_crc(NULL, 0));
+}
+
+static void sshp_test_msgb_nak(struct kunit *test)
+{
+	u8 buf[SSH_MSG_LEN_CTRL];
+	struct msgbuf msgb;
+
+	msgb_init(&msgb, buf, sizeof(buf));
+	msgb_push_nak(&msgb);
+
+	KUNIT_ASSERT_EQ(test, msgb_bytes_used(&msgb), (size_t)SSH_MSG_LEN_CTRL);
+	KUNIT_EXPECT_EQ(test, buf[2], (u8)SSH_FRAME_TYPE_NAK);
+	KUNIT_EXPECT_EQ(test, buf[5], 0x00);
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&buf[6]), ssh_crc(&buf[2], 4));
+}
+
+static void sshp_test_msgb_cmd(struct kunit *test)
+{
+	const u16 plen = sizeof(sshp_test_payload);
+	u8 buf[SSHP_TEST_BUF_LEN];
+	size_t len;
+
+	len = sshp_test_build_cmd(buf, sizeof(buf), 0x07, 0x1234,
+				  sshp_test_payload, plen);
+	KUNIT_ASSERT_EQ(test, len, (size_t)SSH_COMMAND_MESSAGE_LENGTH(plen));
+
+	/* Frame header. */
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&buf[0]), SSH_MSG_SYN);
+	KUNIT_EXPECT_EQ(test, buf[2], (u8)SSH_FRAME_TYPE_DATA_SEQ);
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&buf[3]),
+			sizeof(struct ssh_command) + plen);
+	KUNIT_EXPECT_EQ(test, buf[5], 0x07);
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&buf[6]), ssh_crc(&buf[2], 4));
+
+	/* Command header. */
+	KUNIT_EXPECT_EQ(test, buf[8], (u8)SSH_PLD_TYPE_CMD);
+	KUNIT_EXPECT_EQ(test, buf[9], 0x02);
+	KUNIT_EXPECT_EQ(test, buf[10], 0x01);
+	KUNIT_EXPECT_EQ(test, buf[11], 0x00);
+	KUNIT_EXPECT_EQ(test, buf[12], 0x00);
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&buf[13]), 0x1234);
+	KUNIT_EXPECT_EQ(test, buf[15], 0x0d);
+
+	/* Payload and payload CRC. */
+	KUNIT_EXPECT_EQ(test, memcmp(&buf[16], sshp_test_payload, plen), 0);
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&buf[16 + plen]),
+			ssh_crc(&buf[8], sizeof(struct ssh_command) + plen));
+}
+
+
+/* -- Parser. --------------------------------------------------------------- */
+
+static void sshp_test_roundtrip_cmd(struct kunit *test)
+{
+	const u16 plen = sizeof(sshp_test_payload);
+	u8 buf[SSHP_TEST_BUF_LEN];
+	struct ssam_span source, payload, data;
+	struct ssh_command *cmd;
+	struct ssh_frame *frame;
+	int status;
+
+	source.ptr = buf;
+	source.len = sshp_test_build_cmd(buf, sizeof(buf), 0x07, 0x1234,
+					 sshp_test_payload, plen);
+
+	status = sshp_parse_frame(NULL, &source, &frame, &payload,
+				  SSHP_TEST_MAXLEN);
+	KUNIT_ASSERT_EQ(test, status, 0);
+	KUNIT_ASSERT_NOT_NULL(test, frame);
+	KUNIT_EXPECT_EQ(test, frame->type, (u8)SSH_FRAME_TYPE_DATA_SEQ);
+	KUNIT_EXPECT_EQ(test, frame->seq, 0x07);
+	KUNIT_EXPECT_EQ(test, payload.len, sizeof(struct ssh_command) + plen);
+
+	status = sshp_parse_command(NULL, &payload, &cmd, &data);
+	KUNIT_ASSERT_EQ(test, status, 0);
+	KUNIT_EXPECT_EQ(test, cmd->type, (u8)SSH_PLD_TYPE_CMD);
+	KUNIT_EXPECT_EQ(test, cmd->tc, 0x02);
+	KUNIT_EXPECT_EQ(test, cmd->tid_out, 0x01);
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&cmd->rqid), 0x1234);
+	KUNIT_EXPECT_EQ(test, cmd->cid, 0x0d);
+	KUNIT_EXPECT_EQ(test, data.len, (size_t)plen);
+	KUNIT_EXPECT_EQ(test, memcmp(data.ptr, sshp_test_payload, plen), 0);
+}
+
+static void sshp_test_roundtrip_ack(struct kunit *test)
+{
+	u8 buf[SSH_MSG_LEN_CTRL];
+	struct ssam_span source, payload;
+	struct ssh_frame *frame;
+	int status;
+
+	source.ptr = buf;
+	source.len = sshp_test_build_ack(buf, sizeof(buf), 0xff);
+
+	status = sshp_parse_frame(NULL, &source, &frame, &payload,
+				  SSHP_TEST_MAXLEN);
+	KUNIT_ASSERT_EQ(test, status, 0);
+	KUNIT_ASSERT_NOT_NULL(test, frame);
+	KUNIT_EXPECT_EQ(test, frame->type, (u8)SSH_FRAME_TYPE_ACK);
+	KUNIT_EXPECT_EQ(test, frame->seq, 0xff);
+	KUNIT_EXPECT_EQ(test, payload.len, (size_t)0);
+}
+
+static void sshp_test_partial(struct kunit *test)
+{
+	u8 buf[SSHP_TEST_BUF_LEN];
+	struct ssam_span source, payload;
+	struct ssh_frame *frame;
+	size_t len;
+	int status;
+
+	len = sshp_test_build_cmd(buf, sizeof(buf), 0x01, 0x0100,
+				  sshp_test_payload, sizeof(sshp_test_payload));
+
+	/* Any proper prefix starting with SYN is incomplete, not invalid. */
+	for (source.len = 2; source.len < len; source.len++) {
+		source.ptr = buf;
+
+		status = sshp_parse_frame(NULL, &source, &frame, &payload,
+					  SSHP_TEST_MAXLEN);
+		KUNIT_EXPECT_EQ(test, status, 0);
+		KUNIT_EXPECT_NULL(test, frame);
+		KUNIT_EXPECT_EQ(test, payload.len, (size_t)0);
+	}
+}
+
+static void sshp_test_corrupt(struct kunit *test)
+{
+	u8 buf[SSHP_TEST_BUF_LEN];
+	struct ssam_span source, payload;
+	struct ssh_frame *frame;
+	size_t len, i;
+	int status;
+
+	len = sshp_test_build_cmd(buf, sizeof(buf), 0x01, 0x0100,
+				  sshp_test_payload, sizeof(sshp_test_payload));
+
+	/*
+	 * Corrupting any byte after the SYN must be detected by a CRC. Note
+	 * that the frame CRC is checked before the length field is used.
+	 */
+	for (i = 2; i < len; i++) {
+		buf[i] ^= 0x10;
+
+		source.ptr = buf;
+		source.len = len;
+
+		status = sshp_parse_frame(NULL, &source, &frame, &payload,
+					  SSHP_TEST_MAXLEN);
+
+		KUNIT_EXPECT_EQ(test, status, -EBADMSG);
+		KUNIT_EXPECT_NULL(test, frame);
+
+		buf[i] ^= 0x10;
+	}
+}
+
+static void sshp_test_invalid(struct kunit *test)
+{
+	u8 buf[SSHP_TEST_BUF_LEN];
+	struct ssam_span source, payload;
+	struct ssh_command *cmd;
+	struct ssh_frame *frame;
+	int status;
+
+	source.ptr = buf;
+	source.len = sshp_test_build_cmd(buf, sizeof(buf), 0x01, 0x0100,
+					 sshp_test_payload,
+					 sizeof(sshp_test_payload));
+
+	/* Frames larger than the maximum length are rejected. */
+	status = sshp_parse_frame(NULL, &source, &frame, &payload,
+				  source.len - 1);
+	KUNIT_EXPECT_EQ(test, status, -EMSGSIZE);
+	KUNIT_EXPECT_NULL(test, frame);
+
+	/* Data not starting with SYN is rejected. */
+	buf[0] = 0x00;
+	status = sshp_parse_frame(NULL, &source, &frame, &payload,
+				  SSHP_TEST_MAXLEN);
+	KUNIT_EXPECT_EQ(test, status, -ENOMSG);
+	KUNIT_EXPECT_NULL(test, frame);
+
+	/* Command payloads shorter than the command header are rejected. */
+	source.len = sizeof(struct ssh_command) - 1;
+	status = sshp_parse_command(NULL, &source, &cmd, &payload);
+	KUNIT_EXPECT_EQ(test, status, -ENOMSG);
+	KUNIT_EXPECT_NULL(test, cmd);
+}
+
+static void sshp_test_find_syn(struct kunit *test)
+{
+	u8 buf[] = { 0x00, 0x12, 0xaa, 0x34, 0xaa, 0x55, 0x01, 0xaa };
+	struct ssam_span source = { .ptr = buf, .len = sizeof(buf) };
+	struct ssam_span rem;
+
+	/* SYN in the middle, preceded by a lone first SYN byte. */
+	KUNIT_EXPECT_TRUE(test, sshp_find_syn(&source, &rem));
+	KUNIT_EXPECT_PTR_EQ(test, rem.ptr, &buf[4]);
+	KUNIT_EXPECT_EQ(test, rem.len, sizeof(buf) - 4);
+
+	/* Partial SYN at the end is kept for the next pass. */
+	source.ptr = &buf[6];
+	source.len = 2;
+	KUNIT_EXPECT_FALSE(test, sshp_find_syn(&source, &rem));
+	KUNIT_EXPECT_PTR_EQ(test, rem.ptr, &buf[7]);
+	KUNIT_EXPECT_EQ(test, rem.len, (size_t)1);
+
+	/* No SYN at all: Everything can be dropped. */
+	source.ptr = buf;
+	source.len = 4;
+	KUNIT_EXPECT_FALSE(test, sshp_find_syn(&source, &rem));
+	KUNIT_EXPECT_PTR_EQ(test, rem.ptr, &buf[4]);
+	KUNIT_EXPECT_EQ(test, rem.len, (size_t)0);
+}
+
+static void sshp_test_resync(struct kunit *test)
+{
+	static const u8 garbage[] = { 0x13, 0x37, 0xaa, 0x55, 0xaa, 0x00 };
+	u8 buf[3 * SSHP_TEST_BUF_LEN];
+	size_t len = 0, bad;
+	u8 seq = 0;
+
+	/* Garbage, including a stray SYN without valid frame. */
+	memcpy(buf, garbage, sizeof(garbage));
+	len += sizeof(garbage);
+
+	/* A frame with corrupt payload. */
+	bad = len;
+	len += sshp_test_build_cmd(buf + len, sizeof(buf) - len, 0x01, 0x0100,
+				   sshp_test_payload, sizeof(sshp_test_payload));
+	buf[bad + 20] ^= 0xff;
+
+	/* A valid frame, which must be found again. */
+	len += sshp_test_build_cmd(buf + len, sizeof(buf) - len, 0x02, 0x0101,
+				   sshp_test_payload, sizeof(sshp_test_payload));
+
+	KUNIT_EXPECT_EQ(test, sshp_test_rx(buf, len, &seq), 1u);
+	KUNIT_EXPECT_EQ(test, seq, 0x02);
+
+	/* Back-to-back valid frames are all found. */
+	len = sshp_test_build_ack(buf, sizeof(buf), 0x03);
+	len += sshp_test_build_cmd(buf + len, sizeof(buf) - len, 0x04, 0x0102,
+				   NULL, 0);
+	len += sshp_test_build_ack(buf + len, sizeof(buf) - len, 0x05);
+
+	KUNIT_EXPECT_EQ(test, sshp_test_rx(buf, len, &seq), 3u);
+	KUNIT_EXPECT_EQ(test, seq, 0x05);
+}
+
+
+/* -- Benchmarks. ----------------------------------------------------------- */
+
+static void sshp_bench_build(struct kunit *test)
+{
+	u8 buf[SSHP_TEST_BUF_LEN];
+	unsigned int i;
+	u64 t;
+
+	t = ktime_get_ns();
+	for (i = 0; i < SSHP_BENCH_ITERATIONS; i++)
+		sshp_test_build_cmd(buf, sizeof(buf), i, i, sshp_test_payload,
+				    sizeof(sshp_test_payload));
+	t = ktime_get_ns() - t;
+
+	kunit_info(test, "build: %llu ns/frame (%zu byte payload)\n",
+		   div_u64(t, SSHP_BENCH_ITERATIONS), sizeof(sshp_test_payload));
+}
+
+static void sshp_bench_crc(struct kunit *test)
+{
+	u8 buf[SSHP_TEST_BUF_LEN];
+	u16 crc_frame = 0, crc_pld = 0;
+	unsigned int i;
+	size_t len, pld;
+	u64 t;
+
+	len = sshp_test_build_cmd(buf, sizeof(buf), 0x01, 0x0100,
+				  sshp_test_payload, sizeof(sshp_test_payload));
+	pld = len - SSH_MSG_LEN_BASE;
+
+	/* Both CRCs of a command message: frame header and frame payload. */
+	t = ktime_get_ns();
+	for (i = 0; i < SSHP_BENCH_ITERATIONS; i++) {
+		crc_frame = ssh_crc(buf + 2, sizeof(struct ssh_frame));
+		crc_pld = ssh_crc(buf + 8, pld);
+	}
+	t = ktime_get_ns() - t;
+
+	KUNIT_EXPECT_EQ(test, crc_frame, get_unaligned_le16(buf + 6));
+	KUNIT_EXPECT_EQ(test, crc_pld, get_unaligned_le16(buf + len - 2));
+	kunit_info(test, "crc: %llu ns/frame (%zu bytes)\n",
+		   div_u64(t, SSHP_BENCH_ITERATIONS),
+		   sizeof(struct ssh_frame) + pld);
+}
+
+static void sshp_bench_parse(struct kunit *test)
+{
+	u8 buf[SSHP_TEST_BUF_LEN];
+	struct ssam_span source, payload, data;
+	struct ssh_command *cmd;
+	struct ssh_frame *frame;
+	unsigned int i;
+	int status = 0;
+	u64 t;
+
+	source.ptr = buf;
+	source.len = sshp_test_build_cmd(buf, sizeof(buf), 0x01, 0x0100,
+					 sshp_test_payload,
+					 sizeof(sshp_test_payload));
+
+	t = ktime_get_ns();
+	for (i = 0; i < SSHP_BENCH_ITERATIONS; i++) {
+		status |= sshp_parse_frame(NULL, &source, &frame, &payload,
+					   SSHP_TEST_MAXLEN);
+		status |= sshp_parse_command(NULL, &payload, &cmd, &data);
+	}
+	t = ktime_get_ns() - t;
+
+	KUNIT_EXPECT_EQ(test, status, 0);
+	kunit_info(test, "parse: %llu ns/frame (%zu bytes)\n",
+		   div_u64(t, SSHP_BENCH_ITERATIONS), source.len);
+}
+
+
+/* -- Test suite. ----------------------------------------------------------- */
+
+static struct kunit_case sshp_test_cases[] = {
+	KUNIT_CASE(sshp_test_msgb_ack),
+	KUNIT_CASE(sshp_test_msgb_nak),
+	KUNIT_CASE(sshp_test_msgb_cmd),
+	KUNIT_CASE(sshp_test_roundtrip_cmd),
+	KUNIT_CASE(sshp_test_roundtrip_ack),
+	KUNIT_CASE(sshp_test_partial),
+	KUNIT_CASE(sshp_test_corrupt),
+	KUNIT_CASE(sshp_test_invalid),
+	KUNIT_CASE(sshp_test_find_syn),
+	KUNIT_CASE(sshp_test_resync),
+	KUNIT_CASE(sshp_bench_build),
+	KUNIT_CASE(sshp_bench_crc),
+	KUNIT_CASE(sshp_bench_parse),
+	{}
+};
+
+static struct kunit_suite sshp_test_suite = {
+	.name = "surface_aggregator_ssh_parser",
+	.test_cases = sshp_test_cases,
+};
+kunit_test_suite(sshp_test_suite);
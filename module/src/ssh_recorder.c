@@ -0,0 +1,222 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * SSH protocol flight recorder.
+ *
+ * Copyright (C) 2019-2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#include <asm/unaligned.h>
+#include <linux/atomic.h>
+#include <linux/device.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
+#include <linux/types.h>
+
+#include "../include/linux/surface_aggregator/serial_hub.h"
+
+#include "ssh_recorder.h"
+
+/*
+ * SSH_REC_ERROR_THRESHOLD - Number of errors within one error window after
+ * which the recorder freezes itself.
+ */
+#define SSH_REC_ERROR_THRESHOLD		8
+
+/*
+ * SSH_REC_ERROR_WINDOW - Length of the error window, in jiffies.
+ */
+#define SSH_REC_ERROR_WINDOW		(10 * HZ)
+
+static const char * const ssh_rec_type_names[] = {
+	[SSH_REC_SUBMIT]  = "submit",
+	[SSH_REC_TX]      = "tx",
+	[SSH_REC_ACK]     = "ack",
+	[SSH_REC_NAK]     = "nak",
+	[SSH_REC_RSP]     = "rsp",
+	[SSH_REC_EVENT]   = "event",
+	[SSH_REC_TIMEOUT] = "timeout",
+	[SSH_REC_ERROR]   = "error",
+};
+
+static bool ssh_rec_type_is_error(enum ssh_rec_type type)
+{
+	return type == SSH_REC_NAK || type == SSH_REC_TIMEOUT || type == SSH_REC_ERROR;
+}
+
+/**
+ * ssh_rec_init() - Initialize flight recorder.
+ * @rec: The flight recorder to initialize.
+ * @dev: The device used for logging.
+ */
+void ssh_rec_init(struct ssh_recorder *rec, struct device *dev)
+{
+	rec->dev = dev;
+	atomic_set(&rec->head, 0);
+	atomic_set(&rec->frozen, 0);
+	atomic_set(&rec->errors, 0);
+	atomic_long_set(&rec->error_window, jiffies);
+}
+
+static void ssh_rec_account_error(struct ssh_recorder *rec)
+{
+	unsigned long now = jiffies;
+	unsigned long start = atomic_long_read(&rec->error_window);
+
+	/* Start a new window if the current one has expired. */
+	if (time_after(now, start + SSH_REC_ERROR_WINDOW)) {
+		if (atomic_long_cmpxchg(&rec->error_window, start, now) == start)
+			atomic_set(&rec->errors, 0);
+	}
+
+	if (atomic_inc_return(&rec->errors) < SSH_REC_ERROR_THRESHOLD)
+		return;
+
+	if (atomic_cmpxchg(&rec->frozen, 0, 1) == 0) {
+		dev_warn(rec->dev,
+			 "rec: %d protocol errors within %u seconds, flight recorder frozen\n",
+			 SSH_REC_ERROR_THRESHOLD, SSH_REC_ERROR_WINDOW / HZ);
+	}
+}
+
+/**
+ * ssh_rec_set_frozen() - Freeze or re-arm the flight recorder.
+ * @rec:    The flight recorder.
+ * @frozen: Whether to freeze (%true) or re-arm (%false) the recorder.
+ *
+ * Re-arming the recorder starts a new error window, so that errors recorded
+ * before freezing do not count towards the next freeze.
+ */
+void ssh_rec_set_frozen(struct ssh_recorder *rec, bool frozen)
+{
+	if (frozen) {
+		atomic_set(&rec->frozen, 1);
+		return;
+	}
+
+	atomic_set(&rec->errors, 0);
+	atomic_long_set(&rec->error_window, jiffies);
+
+	/* Reset the error window before recording any new entries. */
+	smp_mb__before_atomic();
+	atomic_set(&rec->frozen, 0);
+}
+
+/**
+ * ssh_rec_log() - Record an entry.
+ * @rec:    The flight recorder.
+ * @type:   The type of the entry.
+ * @seq:    The sequence ID of the corresponding frame.
+ * @rqid:   The request ID of the corresponding command.
+ * @tc:     The target category of the corresponding command.
+ * @cid:    The command ID of the corresponding command.
+ * @status: The status associated with the entry.
+ *
+ * Records the given entry unless the recorder is frozen. Entries of error
+ * type (NAK, timeout, error) are accounted and may cause the recorder to
+ * freeze after this entry has been written. May be called from any context.
+ */
+void ssh_rec_log(struct ssh_recorder *rec, enum ssh_rec_type type, u8 seq,
+		 u16 rqid, u8 tc, u8 cid, int status)
+{
+	struct ssh_rec_entry *e;
+	unsigned int idx;
+
+	if (atomic_read(&rec->frozen))
+		return;
+
+	idx = (unsigned int)atomic_inc_return(&rec->head) - 1;
+	e = &rec->entries[idx % SSH_REC_SIZE];
+
+	e->ts = ktime_get_boottime_ns();
+	e->type = type;
+	e->seq = seq;
+	e->rqid = rqid;
+	e->tc = tc;
+	e->cid = cid;
+	e->status = clamp_t(int, status, S16_MIN, S16_MAX);
+
+	if (ssh_rec_type_is_error(type))
+		ssh_rec_account_error(rec);
+}
+
+/**
+ * ssh_rec_log_packet() - Record an entry for the given packet.
+ * @rec:    The flight recorder.
+ * @type:   The type of the entry.
+ * @packet: The packet to record.
+ * @status: The status associated with the entry.
+ *
+ * Extracts sequence ID and, if the packet contains a command, request ID,
+ * target category, and command ID from the packet message data.
+ */
+void ssh_rec_log_packet(struct ssh_recorder *rec, enum ssh_rec_type type,
+			const struct ssh_packet *packet, int status)
+{
+	const u8 *data = packet->data.ptr;
+	size_t len = packet->data.len;
+	u16 rqid = 0;
+	u8 seq = 0, tc = 0, cid = 0;
+
+	if (data && len >= SSH_MESSAGE_LENGTH(0))
+		seq = data[SSH_MSGOFFSET_FRAME(seq)];
+
+	if (data && len >= SSH_COMMAND_MESSAGE_LENGTH(0)) {
+		rqid = get_unaligned_le16(&data[SSH_MSGOFFSET_COMMAND(rqid)]);
+		tc = data[SSH_MSGOFFSET_COMMAND(tc)];
+		cid = data[SSH_MSGOFFSET_COMMAND(cid)];
+	}
+
+	ssh_rec_log(rec, type, seq, rqid, tc, cid, status);
+}
+
+/**
+ * ssh_rec_log_command() - Record an entry for the given received command.
+ * @rec:    The flight recorder.
+ * @type:   The type of the entry.
+ * @cmd:    The command to record.
+ * @status: The status associated with the entry.
+ */
+void ssh_rec_log_command(struct ssh_recorder *rec, enum ssh_rec_type type,
+			 const struct ssh_command *cmd, int status)
+{
+	ssh_rec_log(rec, type, 0, get_unaligned_le16(&cmd->rqid), cmd->tc,
+		    cmd->cid, status);
+}
+
+/**
+ * ssh_rec_show() - Print the recorded entries.
+ * @rec: The flight recorder.
+ * @s:   The sequence file to print the entries to.
+ *
+ * Prints all recorded entries, oldest first. While the recorder is not
+ * frozen, entries may be overwritten concurrently and the output is only a
+ * best-effort snapshot.
+ */
+void ssh_rec_show(struct ssh_recorder *rec, struct seq_file *s)
+{
+	unsigned int head = atomic_read(&rec->head);
+	unsigned int n = min_t(unsigned int, head, SSH_REC_SIZE);
+	unsigned int i;
+
+	seq_printf(s, "frozen: %d, errors: %d, entries: %u\n",
+		   atomic_read(&rec->frozen), atomic_read(&rec->errors), head);
+
+	for (i = head - n; i != head; i++) {
+		const struct ssh_rec_entry *e = &rec->entries[i % SSH_REC_SIZE];
+		const char *type = "<unknown>";
+		u32 nsec;
+		u64 sec;
+
+		sec = div_u64_rem(e->ts, NSEC_PER_SEC, &nsec);
+
+		if (e->type < ARRAY_SIZE(ssh_rec_type_names))
+			type = ssh_rec_type_names[e->type];
+
+		seq_printf(s, "%llu.%09u  %-7s  seq: %#04x  rqid: %#06x  tc: %#04x  cid: %#04x  status: %d\n",
+			   sec, nsec, type,
+			   e->seq, e->rqid, e->tc, e->cid, e->status);
+	}
+}
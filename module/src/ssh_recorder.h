@@ -0,0 +1,104 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * SSH protocol flight recorder.
+ *
+ * Copyright (C) 2019-2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#ifndef _SURFACE_AGGREGATOR_SSH_RECORDER_H
+#define _SURFACE_AGGREGATOR_SSH_RECORDER_H
+
+#include <linux/atomic.h>
+#include <linux/device.h>
+#include <linux/seq_file.h>
+#include <linux/types.h>
+
+#include "../include/linux/surface_aggregator/serial_hub.h"
+
+/*
+ * SSH_REC_SIZE - Number of entries kept by the flight recorder. Must be a
+ * power of two.
+ */
+#define SSH_REC_SIZE			512
+
+/**
+ * enum ssh_rec_type - Type of a flight recorder entry.
+ * @SSH_REC_SUBMIT:  Request submitted to the request transport layer.
+ * @SSH_REC_TX:      Packet transmitted (or transmission failed).
+ * @SSH_REC_ACK:     ACK received.
+ * @SSH_REC_NAK:     NAK received.
+ * @SSH_REC_RSP:     Response received.
+ * @SSH_REC_EVENT:   Event received.
+ * @SSH_REC_TIMEOUT: Packet or request timed out.
+ * @SSH_REC_ERROR:   Other protocol error (e.g. invalid frame, response
+ *                   received before ACK).
+ */
+enum ssh_rec_type {
+	SSH_REC_SUBMIT,
+	SSH_REC_TX,
+	SSH_REC_ACK,
+	SSH_REC_NAK,
+	SSH_REC_RSP,
+	SSH_REC_EVENT,
+	SSH_REC_TIMEOUT,
+	SSH_REC_ERROR,
+};
+
+/**
+ * struct ssh_rec_entry - Flight recorder entry.
+ * @ts:     Time stamp of the entry, in nanoseconds (boot time).
+ * @type:   Type of the entry, see &enum ssh_rec_type.
+ * @seq:    Sequence ID of the corresponding frame, if applicable.
+ * @rqid:   Request ID of the corresponding command, if applicable.
+ * @tc:     Target category of the corresponding command, if applicable.
+ * @cid:    Command ID of the corresponding command, if applicable.
+ * @status: Status or error code associated with the entry.
+ */
+struct ssh_rec_entry {
+	u64 ts;
+	u8 type;
+	u8 seq;
+	u16 rqid;
+	u8 tc;
+	u8 cid;
+	s16 status;
+};
+
+/**
+ * struct ssh_recorder - SSH protocol flight recorder.
+ * @dev:          Device used for logging.
+ * @head:         Number of entries written so far. The next entry is written
+ *                at index ``head % SSH_REC_SIZE``.
+ * @frozen:       Whether the recorder has been frozen. No new entries are
+ *                recorded while frozen.
+ * @errors:       Number of errors recorded in the current error window.
+ * @error_window: Start of the current error window, in jiffies.
+ * @entries:      The ring buffer holding the recorded entries.
+ *
+ * Lock-free ring buffer of compact protocol entries. Writers claim a slot
+ * via an atomic increment of @head. The recorder freezes itself once the
+ * number of errors within an error window crosses a threshold, so that the
+ * sequence leading up to the errors is retained for post-mortem analysis.
+ */
+struct ssh_recorder {
+	struct device *dev;
+	atomic_t head;
+	atomic_t frozen;
+	atomic_t errors;
+	atomic_long_t error_window;
+	struct ssh_rec_entry entries[SSH_REC_SIZE];
+};
+
+void ssh_rec_init(struct ssh_recorder *rec, struct device *dev);
+void ssh_rec_set_frozen(struct ssh_recorder *rec, bool frozen);
+
+void ssh_rec_log(struct ssh_recorder *rec, enum ssh_rec_type type, u8 seq,
+		 u16 rqid, u8 tc, u8 cid, int status);
+void ssh_rec_log_packet(struct ssh_recorder *rec, enum ssh_rec_type type,
+			const struct ssh_packet *packet, int status);
+void ssh_rec_log_command(struct ssh_recorder *rec, enum ssh_rec_type type,
+			 const struct ssh_command *cmd, int status);
+
+void ssh_rec_show(struct ssh_recorder *rec, struct seq_file *s);
+
+#endif /* _SURFACE_AGGREGATOR_SSH_RECORDER_H */
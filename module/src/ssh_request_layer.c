@@ -7,14 +7,18 @@
 
 #include <asm/unaligned.h>
 #include <linux/atomic.h>
-#include <linux/completion.h>
 #include <linux/error-injection.h>
+#include <linux/fault-inject.h>
 #include <linux/ktime.h>
 #include <linux/limits.h>
 #include <linux/list.h>
+#include <linux/lockdep.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
+#include <linux/wait.h>
 #include <linux/workqueue.h>
 
 #include "../include/linux/surface_aggregator/serial_hub.h"
@@ -52,6 +56,18 @@
  */
 #define SSH_RTL_MAX_PENDING		3
 
+/*
+ * SSH_RTL_MAX_PENDING_PER_TARGET - Maximum number of pending requests per
+ * target.
+ *
+ * Share of the request window (see %SSH_RTL_MAX_PENDING) a single target may
+ * occupy. Chosen smaller than the full window so that requests to one
+ * non-responding target (e.g. a detached base) always leave a slot free for
+ * requests to other targets, which would otherwise have to wait until the
+ * blocking requests time out.
+ */
+#define SSH_RTL_MAX_PENDING_PER_TARGET	(SSH_RTL_MAX_PENDING - 1)
+
 /*
  * SSH_RTL_TX_BATCH - Maximum number of requests processed per work execution.
  * Used to prevent livelocking of the workqueue. Value chosen via educated
@@ -59,8 +75,39 @@
  */
 #define SSH_RTL_TX_BATCH		10
 
+/*
+ * SSH_RTL_DEFER_MAX_DELAY - Maximum delay for deferrable requests.
+ *
+ * Maximum time a deferrable request is held back while waiting for other
+ * traffic to piggyback on. All requests held at that point are released
+ * together.
+ */
+#define SSH_RTL_DEFER_MAX_DELAY		msecs_to_jiffies(1000)
+
+/*
+ * SSH_RTL_DEFER_IDLE_TIMEOUT - Default idle timeout of the link.
+ *
+ * Time after the last activity during which the EC UART is assumed to still
+ * be awake, used when the device does not provide its sleep idle timeouts.
+ * Chosen conservatively short, so that requests following closely on other
+ * traffic (e.g. events) are not held back.
+ */
+#define SSH_RTL_DEFER_IDLE_TIMEOUT	msecs_to_jiffies(100)
+
+/*
+ * SSH_RTL_EPOCH_NONE - Epoch slot of requests that have not been accounted
+ * for flushing, i.e. have not been submitted.
+ */
+#define SSH_RTL_EPOCH_NONE		U8_MAX
+
 #ifdef CONFIG_SURFACE_AGGREGATOR_ERROR_INJECTION
 
+/*
+ * Fault attribute backing the error injection hook below, configurable via
+ * debugfs. See ssh_rtl_fault_debugfs_init().
+ */
+static DECLARE_FAULT_ATTR(ssh_rtl_fault_drop_response);
+
 /**
  * ssh_rtl_should_drop_response() - Error injection hook to drop request
  * responses.
@@ -70,10 +117,21 @@
  */
 static noinline bool ssh_rtl_should_drop_response(void)
 {
-	return false;
+	return should_fail(&ssh_rtl_fault_drop_response, 1);
 }
 ALLOW_ERROR_INJECTION(ssh_rtl_should_drop_response, TRUE);
 
+/**
+ * ssh_rtl_fault_debugfs_init() - Create debugfs entries for request layer
+ * fault injection.
+ * @parent: The debugfs directory to create the entries in.
+ */
+void ssh_rtl_fault_debugfs_init(struct dentry *parent)
+{
+	fault_create_debugfs_attr("rtl_drop_response", parent,
+				  &ssh_rtl_fault_drop_response);
+}
+
 #else
 
 static inline bool ssh_rtl_should_drop_response(void)
@@ -97,6 +155,71 @@ static u32 ssh_request_get_rqid_safe(struct ssh_request *rqst)
 	return ssh_request_get_rqid(rqst);
 }
 
+static u8 ssh_request_get_tidx(struct ssh_request *rqst)
+{
+	u8 tid;
+
+	/* Requests without message data are not accounted. */
+	if (!rqst->packet.data.ptr)
+		return SSH_NUM_TARGETS;
+
+	tid = rqst->packet.data.ptr[SSH_MSGOFFSET_COMMAND(tid_out)];
+	if (!ssh_tid_is_valid(tid))
+		return SSH_NUM_TARGETS;
+
+	return ssh_tid_to_index(tid);
+}
+
+static struct ssh_rtl_target_stats *ssh_rtl_target(struct ssh_rtl *rtl,
+						   struct ssh_request *rqst)
+{
+	u8 tidx = ssh_request_get_tidx(rqst);
+
+	return tidx < SSH_NUM_TARGETS ? &rtl->target[tidx] : NULL;
+}
+
+static void ssh_rtl_queued_inc(struct ssh_rtl *rtl, struct ssh_request *rqst)
+{
+	struct ssh_rtl_target_stats *t = ssh_rtl_target(rtl, rqst);
+	int n;
+
+	lockdep_assert_held(&rtl->queue.lock);
+
+	if (!t)
+		return;
+
+	/* Only ever updated under the queue lock, no need for cmpxchg. */
+	n = atomic_inc_return(&t->queued);
+	if (n > atomic_read(&t->queued_max))
+		atomic_set(&t->queued_max, n);
+}
+
+static void ssh_rtl_queued_dec(struct ssh_rtl *rtl, struct ssh_request *rqst)
+{
+	struct ssh_rtl_target_stats *t = ssh_rtl_target(rtl, rqst);
+
+	if (t)
+		atomic_dec(&t->queued);
+}
+
+static void ssh_rtl_pending_inc(struct ssh_rtl *rtl, struct ssh_request *rqst)
+{
+	struct ssh_rtl_target_stats *t = ssh_rtl_target(rtl, rqst);
+
+	atomic_inc(&rtl->pending.count);
+	if (t)
+		atomic_inc(&t->pending);
+}
+
+static void ssh_rtl_pending_dec(struct ssh_rtl *rtl, struct ssh_request *rqst)
+{
+	struct ssh_rtl_target_stats *t = ssh_rtl_target(rtl, rqst);
+
+	atomic_dec(&rtl->pending.count);
+	if (t)
+		atomic_dec(&t->pending);
+}
+
 static void ssh_rtl_queue_remove(struct ssh_request *rqst)
 {
 	struct ssh_rtl *rtl = ssh_request_rtl(rqst);
@@ -108,6 +231,7 @@ static void ssh_rtl_queue_remove(struct ssh_request *rqst)
 		return;
 	}
 
+	ssh_rtl_queued_dec(rtl, rqst);
 	list_del(&rqst->node);
 
 	spin_unlock(&rtl->queue.lock);
@@ -136,7 +260,7 @@ static void ssh_rtl_pending_remove(struct ssh_request *rqst)
 		return;
 	}
 
-	atomic_dec(&rtl->pending.count);
+	ssh_rtl_pending_dec(rtl, rqst);
 	list_del(&rqst->node);
 
 	spin_unlock(&rtl->pending.lock);
@@ -160,16 +284,34 @@ static int ssh_rtl_tx_pending_push(struct ssh_request *rqst)
 		return -EALREADY;
 	}
 
-	atomic_inc(&rtl->pending.count);
+	ssh_rtl_pending_inc(rtl, rqst);
 	list_add_tail(&ssh_request_get(rqst)->node, &rtl->pending.head);
 
 	spin_unlock(&rtl->pending.lock);
 	return 0;
 }
 
+static void ssh_rtl_epoch_get(struct ssh_rtl *rtl, struct ssh_request *rqst)
+{
+	lockdep_assert_held(&rtl->queue.lock);
+
+	rqst->epoch = rtl->flush.epoch & 1;
+	atomic_inc(&rtl->flush.outstanding[rqst->epoch]);
+}
+
+static void ssh_rtl_epoch_put(struct ssh_rtl *rtl, u8 epoch)
+{
+	if (epoch == SSH_RTL_EPOCH_NONE)
+		return;
+
+	if (atomic_dec_and_test(&rtl->flush.outstanding[epoch]))
+		wake_up_all(&rtl->flush.wq);
+}
+
 static void ssh_rtl_complete_with_status(struct ssh_request *rqst, int status)
 {
 	struct ssh_rtl *rtl = ssh_request_rtl(rqst);
+	u8 epoch = rqst->epoch;
 
 	trace_ssam_request_complete(rqst, status);
 
@@ -178,6 +320,10 @@ static void ssh_rtl_complete_with_status(struct ssh_request *rqst, int status)
 		     ssh_request_get_rqid_safe(rqst), status);
 
 	rqst->ops->complete(rqst, NULL, NULL, status);
+
+	/* Only submitted requests can have been accounted. */
+	if (rtl)
+		ssh_rtl_epoch_put(rtl, epoch);
 }
 
 static void ssh_rtl_complete_with_rsp(struct ssh_request *rqst,
@@ -185,6 +331,7 @@ static void ssh_rtl_complete_with_rsp(struct ssh_request *rqst,
 				      const struct ssam_span *data)
 {
 	struct ssh_rtl *rtl = ssh_request_rtl(rqst);
+	u8 epoch = rqst->epoch;
 
 	trace_ssam_request_complete(rqst, 0);
 
@@ -192,26 +339,98 @@ static void ssh_rtl_complete_with_rsp(struct ssh_request *rqst,
 		ssh_request_get_rqid(rqst));
 
 	rqst->ops->complete(rqst, cmd, data, 0);
+
+	ssh_rtl_epoch_put(rtl, epoch);
 }
 
 static bool ssh_rtl_tx_can_process(struct ssh_request *rqst)
 {
 	struct ssh_rtl *rtl = ssh_request_rtl(rqst);
 
-	if (test_bit(SSH_REQUEST_TY_FLUSH_BIT, &rqst->state))
-		return !atomic_read(&rtl->pending.count);
-
 	return atomic_read(&rtl->pending.count) < SSH_RTL_MAX_PENDING;
 }
 
+static bool ssh_rtl_tx_target_can_process(struct ssh_request *rqst)
+{
+	struct ssh_rtl *rtl = ssh_request_rtl(rqst);
+	struct ssh_rtl_target_stats *t = ssh_rtl_target(rtl, rqst);
+
+	return !t || atomic_read(&t->pending) < SSH_RTL_MAX_PENDING_PER_TARGET;
+}
+
+static bool ssh_rtl_link_awake(struct ssh_rtl *rtl)
+{
+	unsigned long last = READ_ONCE(rtl->defer.last_activity);
+
+	if (atomic_read(&rtl->pending.count))
+		return true;
+
+	return time_before(jiffies, last + rtl->defer.idle_timeout);
+}
+
+static void ssh_rtl_mark_activity(struct ssh_rtl *rtl)
+{
+	WRITE_ONCE(rtl->defer.last_activity, jiffies);
+}
+
+static bool ssh_rtl_tx_should_defer(struct ssh_rtl *rtl,
+				    struct ssh_request *rqst, bool awake)
+{
+	lockdep_assert_held(&rtl->queue.lock);
+
+	if (likely(!test_bit(SSH_REQUEST_TY_DEFERRABLE_BIT, &rqst->state)))
+		return false;
+
+	/*
+	 * Deadline reached: Release all requests held back up to now, not
+	 * just the current one. Requests submitted afterwards are held back
+	 * until the next deadline.
+	 */
+	if (rtl->defer.armed && time_after_eq(jiffies, rtl->defer.deadline)) {
+		rtl->defer.armed = false;
+		rtl->defer.cutoff = ktime_get_coarse_boottime();
+	}
+
+	if (rqst->submitted <= rtl->defer.cutoff) {
+		atomic_inc(&rtl->defer.expired);
+		return false;
+	}
+
+	/* Link is awake anyway: Send request along with other traffic. */
+	if (awake) {
+		atomic_inc(&rtl->defer.piggybacked);
+		return false;
+	}
+
+	/* Hold request back and make sure we get woken at the deadline. */
+	if (!rtl->defer.armed) {
+		rtl->defer.armed = true;
+		rtl->defer.deadline = jiffies + rtl->defer.max_delay;
+		mod_delayed_work(system_wq, &rtl->defer.work,
+				 rtl->defer.max_delay);
+	}
+
+	return true;
+}
+
 static struct ssh_request *ssh_rtl_tx_next(struct ssh_rtl *rtl)
 {
 	struct ssh_request *rqst = ERR_PTR(-ENOENT);
 	struct ssh_request *p, *n;
+	bool awake;
 
 	spin_lock(&rtl->queue.lock);
 
-	/* Find first non-locked request and remove it. */
+	awake = ssh_rtl_link_awake(rtl);
+
+	/*
+	 * Find first non-locked request whose target has not used up its
+	 * share of the request window and remove it. Skipping requests of
+	 * throttled targets preserves ordering per target, as all subsequent
+	 * requests for the same target are skipped as well. Deferrable
+	 * requests are skipped while being held back, see
+	 * ssh_rtl_tx_should_defer().
+	 */
 	list_for_each_entry_safe(p, n, &rtl->queue.head, node) {
 		if (unlikely(test_bit(SSH_REQUEST_SF_LOCKED_BIT, &p->state)))
 			continue;
@@ -221,12 +440,38 @@ static struct ssh_request *ssh_rtl_tx_next(struct ssh_rtl *rtl)
 			break;
 		}
 
+		if (!ssh_rtl_tx_target_can_process(p)) {
+			if (!p->throttled) {
+				p->throttled = true;
+				atomic_inc(&ssh_rtl_target(rtl, p)->throttled);
+			}
+
+			rqst = ERR_PTR(-EBUSY);
+			continue;
+		}
+
+		if (ssh_rtl_tx_should_defer(rtl, p, awake)) {
+			rqst = ERR_PTR(-EBUSY);
+			continue;
+		}
+
+		/*
+		 * Account for wake-ups of the EC UART. Note that after this,
+		 * the link is awake, so any further deferrable requests will
+		 * be sent along with this one.
+		 */
+		if (!awake)
+			atomic_inc(&rtl->defer.wakes);
+
+		ssh_rtl_mark_activity(rtl);
+
 		/* Remove from queue and mark as transmitting. */
 		set_bit(SSH_REQUEST_SF_TRANSMITTING_BIT, &p->state);
 		/* Ensure state never gets zero. */
 		smp_mb__before_atomic();
 		clear_bit(SSH_REQUEST_SF_QUEUED_BIT, &p->state);
 
+		ssh_rtl_queued_dec(rtl, p);
 		list_del(&p->node);
 
 		rqst = p;
@@ -345,6 +590,24 @@ static void ssh_rtl_tx_work_fn(struct work_struct *work)
 	ssh_rtl_tx_schedule(rtl);
 }
 
+static void ssh_rtl_defer_work_fn(struct work_struct *work)
+{
+	struct ssh_rtl *rtl = to_ssh_rtl(work, defer.work.work);
+
+	/* Deadline reached, held requests will be released on next tx. */
+	ssh_rtl_tx_schedule(rtl);
+}
+
+static void ssh_rtl_defer_expedite(struct ssh_rtl *rtl)
+{
+	spin_lock(&rtl->queue.lock);
+	rtl->defer.armed = true;
+	rtl->defer.deadline = jiffies;
+	spin_unlock(&rtl->queue.lock);
+
+	ssh_rtl_tx_schedule(rtl);
+}
+
 /**
  * ssh_rtl_submit() - Submit a request to the transport layer.
  * @rtl:  The request transport layer.
@@ -414,11 +677,16 @@ int ssh_rtl_submit(struct ssh_rtl *rtl, struct ssh_request *rqst)
 		return -EINVAL;
 	}
 
+	WRITE_ONCE(rqst->submitted, ktime_get_coarse_boottime());
 	set_bit(SSH_REQUEST_SF_QUEUED_BIT, &rqst->state);
+	ssh_rtl_queued_inc(rtl, rqst);
+	ssh_rtl_epoch_get(rtl, rqst);
 	list_add_tail(&ssh_request_get(rqst)->node, &rtl->queue.head);
 
 	spin_unlock(&rtl->queue.lock);
 
+	ssh_rec_log_packet(&rtl->ptl.rec, SSH_REC_SUBMIT, &rqst->packet, 0);
+
 	ssh_rtl_tx_schedule(rtl);
 	return 0;
 }
@@ -473,6 +741,7 @@ static void ssh_rtl_complete(struct ssh_rtl *rtl,
 	u16 rqid = get_unaligned_le16(&command->rqid);
 
 	trace_ssam_rx_response_received(command, command_data->len);
+	ssh_rec_log_command(&rtl->ptl.rec, SSH_REC_RSP, command, 0);
 
 	/*
 	 * Get request from pending based on request ID and mark it as response
@@ -504,7 +773,7 @@ static void ssh_rtl_complete(struct ssh_rtl *rtl,
 		smp_mb__before_atomic();
 		clear_bit(SSH_REQUEST_SF_PENDING_BIT, &p->state);
 
-		atomic_dec(&rtl->pending.count);
+		ssh_rtl_pending_dec(rtl, p);
 		list_del(&p->node);
 
 		r = p;
@@ -513,8 +782,10 @@ static void ssh_rtl_complete(struct ssh_rtl *rtl,
 	spin_unlock(&rtl->pending.lock);
 
 	if (!r) {
-		rtl_warn(rtl, "rtl: dropping unexpected command message (rqid = %#06x)\n",
-			 rqid);
+		rtl_dbg(rtl, "rtl: dropping unexpected command message (rqid = %#06x)\n",
+			rqid);
+		ssam_diag_hit(&rtl->diag.unexpected);
+		ssh_rec_log_command(&rtl->ptl.rec, SSH_REC_ERROR, command, -EPROTO);
 		return;
 	}
 
@@ -548,6 +819,7 @@ static void ssh_rtl_complete(struct ssh_rtl *rtl,
 	if (!test_bit(SSH_REQUEST_SF_TRANSMITTED_BIT, &r->state)) {
 		rtl_err(rtl, "rtl: received response before ACK for request (rqid = %#06x)\n",
 			rqid);
+		ssh_rec_log_command(&rtl->ptl.rec, SSH_REC_ERROR, command, -EREMOTEIO);
 
 		/*
 		 * NB: Timeout has already been canceled, request already been
@@ -641,6 +913,7 @@ static bool ssh_rtl_cancel_nonpending(struct ssh_request *r)
 	}
 
 	set_bit(SSH_REQUEST_SF_LOCKED_BIT, &r->state);
+	ssh_rtl_queued_dec(rtl, r);
 	list_del(&r->node);
 
 	spin_unlock(&rtl->queue.lock);
@@ -862,7 +1135,7 @@ static void ssh_rtl_timeout_reap(struct work_struct *work)
 
 		clear_bit(SSH_REQUEST_SF_PENDING_BIT, &r->state);
 
-		atomic_dec(&rtl->pending.count);
+		ssh_rtl_pending_dec(rtl, r);
 		list_move_tail(&r->node, &claimed);
 	}
 	spin_unlock(&rtl->pending.lock);
@@ -870,6 +1143,8 @@ static void ssh_rtl_timeout_reap(struct work_struct *work)
 	/* Cancel and complete the request. */
 	list_for_each_entry_safe(r, n, &claimed, node) {
 		trace_ssam_request_timeout(r);
+		ssh_rec_log_packet(&rtl->ptl.rec, SSH_REC_TIMEOUT, &r->packet,
+				   -ETIMEDOUT);
 
 		/*
 		 * At this point we've removed the packet from pending. This
@@ -899,6 +1174,11 @@ static void ssh_rtl_rx_event(struct ssh_rtl *rtl, const struct ssh_command *cmd,
 			     const struct ssam_span *data)
 {
 	trace_ssam_rx_event_received(cmd, data->len);
+	ssh_rec_log_command(&rtl->ptl.rec, SSH_REC_EVENT, cmd, 0);
+
+	/* The EC has woken up the link itself, allow deferred requests. */
+	ssh_rtl_mark_activity(rtl);
+	ssh_rtl_tx_schedule(rtl);
 
 	rtl_dbg(rtl, "rtl: handling event (rqid: %#06x)\n",
 		get_unaligned_le16(&cmd->rqid));
@@ -988,7 +1268,13 @@ int ssh_request_init(struct ssh_request *rqst, enum ssam_request_flags flags,
 	if (flags & SSAM_REQUEST_HAS_RESPONSE)
 		rqst->state |= BIT(SSH_REQUEST_TY_HAS_RESPONSE_BIT);
 
+	if (flags & SSAM_REQUEST_DEFERRABLE)
+		rqst->state |= BIT(SSH_REQUEST_TY_DEFERRABLE_BIT);
+
 	rqst->timestamp = KTIME_MAX;
+	rqst->submitted = KTIME_MAX;
+	rqst->epoch = SSH_RTL_EPOCH_NONE;
+	rqst->throttled = false;
 	rqst->ops = ops;
 
 	return 0;
@@ -1012,6 +1298,7 @@ int ssh_rtl_init(struct ssh_rtl *rtl, struct serdev_device *serdev,
 {
 	struct ssh_ptl_ops ptl_ops;
 	int status;
+	int i;
 
 	ptl_ops.data_received = ssh_rtl_rx_data;
 
@@ -1026,6 +1313,32 @@ int ssh_rtl_init(struct ssh_rtl *rtl, struct serdev_device *serdev,
 	INIT_LIST_HEAD(&rtl->pending.head);
 	atomic_set_release(&rtl->pending.count, 0);
 
+	for (i = 0; i < SSH_NUM_TARGETS; i++) {
+		atomic_set(&rtl->target[i].queued, 0);
+		atomic_set(&rtl->target[i].queued_max, 0);
+		atomic_set(&rtl->target[i].pending, 0);
+		atomic_set(&rtl->target[i].throttled, 0);
+	}
+
+	mutex_init(&rtl->flush.lock);
+	rtl->flush.epoch = 0;
+	atomic_set(&rtl->flush.outstanding[0], 0);
+	atomic_set(&rtl->flush.outstanding[1], 0);
+	init_waitqueue_head(&rtl->flush.wq);
+
+	rtl->defer.idle_timeout = SSH_RTL_DEFER_IDLE_TIMEOUT;
+	rtl->defer.max_delay = SSH_RTL_DEFER_MAX_DELAY;
+	rtl->defer.last_activity = jiffies;
+	rtl->defer.armed = false;
+	rtl->defer.cutoff = 0;
+	INIT_DELAYED_WORK(&rtl->defer.work, ssh_rtl_defer_work_fn);
+	atomic_set(&rtl->defer.piggybacked, 0);
+	atomic_set(&rtl->defer.expired, 0);
+	atomic_set(&rtl->defer.wakes, 0);
+
+	ssam_diag_init(&rtl->diag.unexpected, &serdev->dev,
+		       "rtl: unexpected command message, dropped");
+
 	INIT_WORK(&rtl->tx.work, ssh_rtl_tx_work_fn);
 
 	spin_lock_init(&rtl->rtx_timeout.lock);
@@ -1049,9 +1362,123 @@ int ssh_rtl_init(struct ssh_rtl *rtl, struct serdev_device *serdev,
  */
 void ssh_rtl_destroy(struct ssh_rtl *rtl)
 {
+	mutex_destroy(&rtl->flush.lock);
+	ssam_diag_destroy(&rtl->diag.unexpected);
 	ssh_ptl_destroy(&rtl->ptl);
 }
 
+/**
+ * ssh_rtl_show_target_stats() - Print per-target request statistics.
+ * @rtl: The request transport layer.
+ * @s:   The sequence file to print the statistics to.
+ *
+ * Prints the current queue depth, its high-water mark, the number of pending
+ * requests, and the number of throttling occurrences for each target.
+ */
+void ssh_rtl_show_target_stats(struct ssh_rtl *rtl, struct seq_file *s)
+{
+	int i;
+
+	seq_printf(s, "tid  queued  queued_max  pending  throttled\n");
+
+	for (i = 0; i < SSH_NUM_TARGETS; i++) {
+		struct ssh_rtl_target_stats *t = &rtl->target[i];
+
+		seq_printf(s, "%3d  %6d  %10d  %7d  %9d\n", i + 1,
+			   atomic_read(&t->queued), atomic_read(&t->queued_max),
+			   atomic_read(&t->pending), atomic_read(&t->throttled));
+	}
+}
+
+static void ssh_rtl_show_request(struct seq_file *s, struct ssh_request *r,
+				 ktime_t now)
+{
+	const u8 *data = r->packet.data.ptr;
+	ktime_t ts = READ_ONCE(r->timestamp);
+	ktime_t submitted = READ_ONCE(r->submitted);
+
+	seq_printf(s, "  %p  state: %#06lx", r, READ_ONCE(r->state));
+
+	if (data && r->packet.data.len >= SSH_COMMAND_MESSAGE_LENGTH(0)) {
+		seq_printf(s, "  rqid: %#06x  tid: %#04x  tc: %#04x  cid: %#04x",
+			   ssh_request_get_rqid(r),
+			   data[SSH_MSGOFFSET_COMMAND(tid_out)],
+			   data[SSH_MSGOFFSET_COMMAND(tc)],
+			   data[SSH_MSGOFFSET_COMMAND(cid)]);
+	}
+
+	if (submitted != KTIME_MAX)
+		seq_printf(s, "  age: %lldms", ktime_ms_delta(now, submitted));
+
+	if (ts != KTIME_MAX)
+		seq_printf(s, "  wait: %lldms", ktime_ms_delta(now, ts));
+
+	seq_puts(s, "\n");
+}
+
+/**
+ * ssh_rtl_show_stats() - Print request transport layer statistics.
+ * @rtl: The request transport layer.
+ * @s:   The sequence file to print the statistics to.
+ */
+void ssh_rtl_show_stats(struct ssh_rtl *rtl, struct seq_file *s)
+{
+	seq_printf(s, "defer_idle_timeout_ms: %u\n",
+		   jiffies_to_msecs(rtl->defer.idle_timeout));
+	seq_printf(s, "defer_max_delay_ms: %u\n",
+		   jiffies_to_msecs(rtl->defer.max_delay));
+	seq_printf(s, "defer_piggybacked: %d\n",
+		   atomic_read(&rtl->defer.piggybacked));
+	seq_printf(s, "defer_expired: %d\n", atomic_read(&rtl->defer.expired));
+	seq_printf(s, "wakes: %d\n", atomic_read(&rtl->defer.wakes));
+	seq_printf(s, "unexpected_commands: %lu\n",
+		   ssam_diag_count(&rtl->diag.unexpected));
+}
+
+/**
+ * ssh_rtl_show_queues() - Print snapshot of request queue and pending set.
+ * @rtl: The request transport layer.
+ * @s:   The sequence file to print the snapshot to.
+ *
+ * Prints all requests currently in the submission queue and the pending set,
+ * in list order, including state flags and identifying command fields, as
+ * well as the time since submission as age. For requests awaiting a
+ * response, the time since we started waiting is printed as wait. Also
+ * prints the time until the timeout reaper is next scheduled to run.
+ *
+ * Each list is snapshotted while holding its respective lock, thus the
+ * output is consistent per list, but not necessarily across lists.
+ */
+void ssh_rtl_show_queues(struct ssh_rtl *rtl, struct seq_file *s)
+{
+	ktime_t now = ktime_get_coarse_boottime();
+	struct ssh_request *r;
+	ktime_t expires;
+
+	spin_lock(&rtl->rtx_timeout.lock);
+	expires = rtl->rtx_timeout.expires;
+	spin_unlock(&rtl->rtx_timeout.lock);
+
+	seq_printf(s, "state: %#lx\n", READ_ONCE(rtl->state));
+
+	if (expires != KTIME_MAX)
+		seq_printf(s, "reaper: in %lldms\n", ktime_ms_delta(expires, now));
+	else
+		seq_puts(s, "reaper: idle\n");
+
+	seq_puts(s, "queue:\n");
+	spin_lock(&rtl->queue.lock);
+	list_for_each_entry(r, &rtl->queue.head, node)
+		ssh_rtl_show_request(s, r, now);
+	spin_unlock(&rtl->queue.lock);
+
+	seq_printf(s, "pending (%d):\n", atomic_read(&rtl->pending.count));
+	spin_lock(&rtl->pending.lock);
+	list_for_each_entry(r, &rtl->pending.head, node)
+		ssh_rtl_show_request(s, r, now);
+	spin_unlock(&rtl->pending.lock);
+}
+
 /**
  * ssh_rtl_start() - Start request transmitter and receiver.
  * @rtl: The request transport layer.
@@ -1078,51 +1505,32 @@ int ssh_rtl_start(struct ssh_rtl *rtl)
 	return 0;
 }
 
-struct ssh_flush_request {
-	struct ssh_request base;
-	struct completion completion;
-	int status;
-};
-
-static void ssh_rtl_flush_request_complete(struct ssh_request *r,
-					   const struct ssh_command *cmd,
-					   const struct ssam_span *data,
-					   int status)
+static long ssh_rtl_flush_wait_epoch(struct ssh_rtl *rtl, unsigned int slot,
+				     long timeout)
 {
-	struct ssh_flush_request *rqst;
+	/* Don't wait for deferrable requests to be released on their own. */
+	ssh_rtl_defer_expedite(rtl);
 
-	rqst = container_of(r, struct ssh_flush_request, base);
-	rqst->status = status;
+	return wait_event_timeout(rtl->flush.wq,
+				  !atomic_read(&rtl->flush.outstanding[slot]),
+				  timeout);
 }
 
-static void ssh_rtl_flush_request_release(struct ssh_request *r)
-{
-	struct ssh_flush_request *rqst;
-
-	rqst = container_of(r, struct ssh_flush_request, base);
-	complete_all(&rqst->completion);
-}
-
-static const struct ssh_request_ops ssh_rtl_flush_request_ops = {
-	.complete = ssh_rtl_flush_request_complete,
-	.release = ssh_rtl_flush_request_release,
-};
-
 /**
  * ssh_rtl_flush() - Flush the request transport layer.
  * @rtl:     request transport layer
  * @timeout: timeout for the flush operation in jiffies
  *
- * Queue a special flush request and wait for its completion. This request
- * will be completed after all other currently queued and pending requests
- * have been completed. Instead of a normal data packet, this request submits
- * a special flush packet, meaning that upon completion, also the underlying
- * packet transport layer has been flushed.
+ * Wait until all requests submitted before this call have been completed.
  *
- * Flushing the request layer guarantees that all previously submitted
- * requests have been fully completed before this call returns. Additionally,
- * flushing blocks execution of all later submitted requests until the flush
- * has been completed.
+ * Flushing is implemented via epochs: Each request is accounted in the slot
+ * of the epoch current at its submission. A flush first waits for any
+ * requests remaining from older epochs (e.g. left over from a previous
+ * timed-out flush), then advances the epoch and waits for the requests
+ * accounted in the now previous one. Requests submitted after this call has
+ * advanced the epoch are accounted in the other slot, are not waited on, and
+ * are not blocked by the flush, i.e. new traffic keeps flowing while the
+ * flush is in progress. Concurrent flushes are serialized.
  *
  * If the caller ensures that no new requests are submitted after a call to
  * this function, the request transport layer is guaranteed to have no
@@ -1130,40 +1538,44 @@ static const struct ssh_request_ops ssh_rtl_flush_request_ops = {
  * for the packet layer, on which control packets may still be queued after
  * this call.
  *
- * Return: Returns zero on success, %-ETIMEDOUT if the flush timed out and has
- * been canceled as a result of the timeout, or %-ESHUTDOWN if the packet
- * and/or request transport layer has been shut down before this call. May
- * also return %-EINTR if the underlying packet transmission has been
- * interrupted.
+ * Return: Returns zero on success, %-ETIMEDOUT if the flush timed out, or
+ * %-ESHUTDOWN if the request transport layer has been shut down before this
+ * call. Requests are not canceled on timeout.
  */
 int ssh_rtl_flush(struct ssh_rtl *rtl, unsigned long timeout)
 {
-	const unsigned int init_flags = SSAM_REQUEST_UNSEQUENCED;
-	struct ssh_flush_request rqst;
-	int status;
+	long remaining = timeout;
+	unsigned int slot;
 
-	ssh_request_init(&rqst.base, init_flags, &ssh_rtl_flush_request_ops);
-	rqst.base.packet.state |= BIT(SSH_PACKET_TY_FLUSH_BIT);
-	rqst.base.packet.priority = SSH_PACKET_PRIORITY(FLUSH, 0);
-	rqst.base.state |= BIT(SSH_REQUEST_TY_FLUSH_BIT);
+	mutex_lock(&rtl->flush.lock);
 
-	init_completion(&rqst.completion);
+	/* Wait for leftovers in the slot that the next epoch will use. */
+	spin_lock(&rtl->queue.lock);
+	slot = (rtl->flush.epoch + 1) & 1;
+	spin_unlock(&rtl->queue.lock);
 
-	status = ssh_rtl_submit(rtl, &rqst.base);
-	if (status)
-		return status;
+	remaining = ssh_rtl_flush_wait_epoch(rtl, slot, remaining);
+	if (!remaining) {
+		mutex_unlock(&rtl->flush.lock);
+		return -ETIMEDOUT;
+	}
 
-	ssh_request_put(&rqst.base);
+	/* Advance epoch and wait for all requests of the previous one. */
+	spin_lock(&rtl->queue.lock);
 
-	if (!wait_for_completion_timeout(&rqst.completion, timeout)) {
-		ssh_rtl_cancel(&rqst.base, true);
-		wait_for_completion(&rqst.completion);
+	if (test_bit(SSH_RTL_SF_SHUTDOWN_BIT, &rtl->state)) {
+		spin_unlock(&rtl->queue.lock);
+		mutex_unlock(&rtl->flush.lock);
+		return -ESHUTDOWN;
 	}
 
-	WARN_ON(rqst.status != 0 && rqst.status != -ECANCELED &&
-		rqst.status != -ESHUTDOWN && rqst.status != -EINTR);
+	slot = rtl->flush.epoch++ & 1;
+	spin_unlock(&rtl->queue.lock);
+
+	remaining = ssh_rtl_flush_wait_epoch(rtl, slot, remaining);
 
-	return rqst.status == -ECANCELED ? -ETIMEDOUT : rqst.status;
+	mutex_unlock(&rtl->flush.lock);
+	return remaining ? 0 : -ETIMEDOUT;
 }
 
 /**
@@ -1202,6 +1614,7 @@ void ssh_rtl_shutdown(struct ssh_rtl *rtl)
 		smp_mb__before_atomic();
 		clear_bit(SSH_REQUEST_SF_QUEUED_BIT, &r->state);
 
+		ssh_rtl_queued_dec(rtl, r);
 		list_move_tail(&r->node, &claimed);
 	}
 	spin_unlock(&rtl->queue.lock);
@@ -1216,6 +1629,7 @@ void ssh_rtl_shutdown(struct ssh_rtl *rtl)
 	 * we can also shut that down.
 	 */
 
+	cancel_delayed_work_sync(&rtl->defer.work);
 	cancel_work_sync(&rtl->tx.work);
 	ssh_ptl_shutdown(&rtl->ptl);
 	cancel_delayed_work_sync(&rtl->rtx_timeout.reaper);
@@ -11,7 +11,10 @@
 #include <linux/atomic.h>
 #include <linux/ktime.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
 #include <linux/spinlock.h>
+#include <linux/wait.h>
 #include <linux/workqueue.h>
 
 #include "../include/linux/surface_aggregator/serial_hub.h"
@@ -30,6 +33,25 @@ enum ssh_rtl_state_flags {
 	SSH_RTL_SF_SHUTDOWN_BIT,
 };
 
+/**
+ * struct ssh_rtl_target_stats - Per-target request statistics.
+ * @queued:     Number of requests for this target currently in the submission
+ *              queue.
+ * @queued_max: Maximum number of queued requests for this target observed so
+ *              far (high-water mark of the queue depth).
+ * @pending:    Number of requests for this target currently pending, i.e.
+ *              occupying a slot of the request window.
+ * @throttled:  Number of requests for this target that have been held back
+ *              in the queue due to the target exceeding its share of the
+ *              request window.
+ */
+struct ssh_rtl_target_stats {
+	atomic_t queued;
+	atomic_t queued_max;
+	atomic_t pending;
+	atomic_t throttled;
+};
+
 /**
  * struct ssh_rtl_ops - Callback operations for request transport layer.
  * @handle_event: Function called when a SSH event has been received. The
@@ -55,6 +77,38 @@ struct ssh_rtl_ops {
  * @pending.count: Number of currently pending requests.
  * @tx:            Transmitter subsystem.
  * @tx.work:       Transmitter work item.
+ * @target:        Per-target request accounting, indexed via
+ *                 ssh_tid_to_index().
+ * @flush:         Flush barrier subsystem.
+ * @flush.lock:    Mutex serializing flush operations.
+ * @flush.epoch:   Current flush epoch. Requests are accounted in the slot
+ *                 of the epoch they have been submitted in. Must only be
+ *                 accessed while holding the queue lock.
+ * @flush.outstanding: Number of submitted but not yet completed requests,
+ *                 per epoch slot.
+ * @flush.wq:      Waitqueue-head for flush operations waiting on requests.
+ * @defer:         Subsystem for holding back deferrable requests.
+ * @defer.idle_timeout:  Time (in jiffies) after the last activity during which
+ *                       the link is considered awake.
+ * @defer.max_delay:     Maximum time (in jiffies) deferrable requests are held.
+ * @defer.last_activity: Time (in jiffies) of the last transmission or event.
+ * @defer.deadline:      Time (in jiffies) at which held requests are released.
+ *                       Must only be accessed while holding the queue lock.
+ * @defer.armed:         Whether the deadline is armed. Must only be accessed
+ *                       while holding the queue lock.
+ * @defer.cutoff:        Time at which the deadline has last been reached.
+ *                       Deferrable requests submitted up to this point are
+ *                       released. Must only be accessed while holding the
+ *                       queue lock.
+ * @defer.work:          Work releasing held requests at the deadline.
+ * @defer.piggybacked:   Number of deferrable requests sent while awake.
+ * @defer.expired:       Number of deferrable requests released because they
+ *                       have been held back until the deadline.
+ * @defer.wakes:         Number of transmissions started while the link was
+ *                       considered idle, i.e. likely waking the EC UART.
+ * @diag:          Diagnostics for unexpected received data.
+ * @diag.unexpected:     Command messages dropped due to not matching any
+ *                       pending request.
  * @rtx_timeout:   Retransmission timeout subsystem.
  * @rtx_timeout.lock:    Lock for modifying the retransmission timeout reaper.
  * @rtx_timeout.timeout: Timeout interval for retransmission.
@@ -81,6 +135,32 @@ struct ssh_rtl {
 		struct work_struct work;
 	} tx;
 
+	struct ssh_rtl_target_stats target[SSH_NUM_TARGETS];
+
+	struct {
+		struct mutex lock;
+		unsigned int epoch;
+		atomic_t outstanding[2];
+		struct wait_queue_head wq;
+	} flush;
+
+	struct {
+		unsigned long idle_timeout;
+		unsigned long max_delay;
+		unsigned long last_activity;
+		unsigned long deadline;
+		bool armed;
+		ktime_t cutoff;
+		struct delayed_work work;
+		atomic_t piggybacked;
+		atomic_t expired;
+		atomic_t wakes;
+	} defer;
+
+	struct {
+		struct ssam_diag unexpected;
+	} diag;
+
 	struct {
 		spinlock_t lock;
 		ktime_t timeout;
@@ -137,7 +217,17 @@ int ssh_rtl_flush(struct ssh_rtl *rtl, unsigned long timeout);
 void ssh_rtl_shutdown(struct ssh_rtl *rtl);
 void ssh_rtl_destroy(struct ssh_rtl *rtl);
 
+void ssh_rtl_show_target_stats(struct ssh_rtl *rtl, struct seq_file *s);
+void ssh_rtl_show_queues(struct ssh_rtl *rtl, struct seq_file *s);
+void ssh_rtl_show_stats(struct ssh_rtl *rtl, struct seq_file *s);
+
 int ssh_request_init(struct ssh_request *rqst, enum ssam_request_flags flags,
 		     const struct ssh_request_ops *ops);
 
+#ifdef CONFIG_SURFACE_AGGREGATOR_ERROR_INJECTION
+void ssh_rtl_fault_debugfs_init(struct dentry *parent);
+#else /* CONFIG_SURFACE_AGGREGATOR_ERROR_INJECTION */
+static inline void ssh_rtl_fault_debugfs_init(struct dentry *parent) {}
+#endif /* CONFIG_SURFACE_AGGREGATOR_ERROR_INJECTION */
+
 #endif /* _SURFACE_AGGREGATOR_SSH_REQUEST_LAYER_H */
@@ -30,7 +30,6 @@ TRACE_DEFINE_ENUM(SSH_PACKET_SF_ACKED_BIT);
 TRACE_DEFINE_ENUM(SSH_PACKET_SF_CANCELED_BIT);
 TRACE_DEFINE_ENUM(SSH_PACKET_SF_COMPLETED_BIT);
 
-TRACE_DEFINE_ENUM(SSH_PACKET_TY_FLUSH_BIT);
 TRACE_DEFINE_ENUM(SSH_PACKET_TY_SEQUENCED_BIT);
 TRACE_DEFINE_ENUM(SSH_PACKET_TY_BLOCKING_BIT);
 
@@ -46,8 +45,8 @@ TRACE_DEFINE_ENUM(SSH_REQUEST_SF_RSPRCVD_BIT);
 TRACE_DEFINE_ENUM(SSH_REQUEST_SF_CANCELED_BIT);
 TRACE_DEFINE_ENUM(SSH_REQUEST_SF_COMPLETED_BIT);
 
-TRACE_DEFINE_ENUM(SSH_REQUEST_TY_FLUSH_BIT);
 TRACE_DEFINE_ENUM(SSH_REQUEST_TY_HAS_RESPONSE_BIT);
+TRACE_DEFINE_ENUM(SSH_REQUEST_TY_DEFERRABLE_BIT);
 
 TRACE_DEFINE_ENUM(SSH_REQUEST_FLAGS_SF_MASK);
 TRACE_DEFINE_ENUM(SSH_REQUEST_FLAGS_TY_MASK);
@@ -119,7 +118,7 @@ static inline void ssam_trace_ptr_uid(const void *ptr, char *uid_str)
  * @p: The packet.
  *
  * Return: Returns the packet's sequence ID (SEQ) field if present, or
- * %SSAM_SEQ_NOT_APPLICABLE if not (e.g. flush packet).
+ * %SSAM_SEQ_NOT_APPLICABLE if not.
  */
 static inline u16 ssam_trace_get_packet_seq(const struct ssh_packet *p)
 {
@@ -182,7 +181,6 @@ static inline u32 ssam_trace_get_request_tc(const struct ssh_packet *p)
 
 #define ssam_show_packet_type(type)					\
 	__print_flags(flags & SSH_PACKET_FLAGS_TY_MASK, "",		\
-		{ BIT(SSH_PACKET_TY_FLUSH_BIT),		"F" },		\
 		{ BIT(SSH_PACKET_TY_SEQUENCED_BIT),	"S" },		\
 		{ BIT(SSH_PACKET_TY_BLOCKING_BIT),	"B" }		\
 	)
@@ -206,8 +204,8 @@ static inline u32 ssam_trace_get_request_tc(const struct ssh_packet *p)
 
 #define ssam_show_request_type(flags)					\
 	__print_flags((flags) & SSH_REQUEST_FLAGS_TY_MASK, "",		\
-		{ BIT(SSH_REQUEST_TY_FLUSH_BIT),	"F" },		\
-		{ BIT(SSH_REQUEST_TY_HAS_RESPONSE_BIT),	"R" }		\
+		{ BIT(SSH_REQUEST_TY_HAS_RESPONSE_BIT),	"R" },		\
+		{ BIT(SSH_REQUEST_TY_DEFERRABLE_BIT),	"D" }		\
 	)
 
 #define ssam_show_request_state(flags)					\
@@ -593,6 +591,7 @@ DEFINE_SSAM_COMMAND_EVENT(rx_event_received);
 
 DEFINE_SSAM_PACKET_EVENT(packet_release);
 DEFINE_SSAM_PACKET_EVENT(packet_submit);
+DEFINE_SSAM_PACKET_EVENT(packet_transmit);
 DEFINE_SSAM_PACKET_EVENT(packet_resubmit);
 DEFINE_SSAM_PACKET_EVENT(packet_timeout);
 DEFINE_SSAM_PACKET_EVENT(packet_cancel);
@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#ifndef _SSAM_TOOLS_COMPAT_ASM_UNALIGNED_H
+#define _SSAM_TOOLS_COMPAT_ASM_UNALIGNED_H
+
+#include <endian.h>
+#include <linux/types.h>
+
+static inline u16 get_unaligned_le16(const void *p)
+{
+	u16 v;
+
+	memcpy(&v, p, sizeof(v));
+	return le16toh(v);
+}
+
+static inline u32 get_unaligned_le32(const void *p)
+{
+	u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return le32toh(v);
+}
+
+#endif /* _SSAM_TOOLS_COMPAT_ASM_UNALIGNED_H */
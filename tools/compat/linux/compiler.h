@@ -0,0 +1,11 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#ifndef _SSAM_TOOLS_COMPAT_LINUX_COMPILER_H
+#define _SSAM_TOOLS_COMPAT_LINUX_COMPILER_H
+
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+#define __packed	__attribute__((__packed__))
+
+#endif /* _SSAM_TOOLS_COMPAT_LINUX_COMPILER_H */
@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#ifndef _SSAM_TOOLS_COMPAT_LINUX_CRC_CCITT_H
+#define _SSAM_TOOLS_COMPAT_LINUX_CRC_CCITT_H
+
+#include <linux/types.h>
+
+/* CRC-CCITT (polynomial 0x1021, MSB first), as computed by the kernel. */
+static inline u16 crc_ccitt_false(u16 crc, const u8 *buffer, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= (u16)*buffer++ << 8;
+
+		for (i = 0; i < 8; i++)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+}
+
+#endif /* _SSAM_TOOLS_COMPAT_LINUX_CRC_CCITT_H */
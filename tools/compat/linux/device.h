@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#ifndef _SSAM_TOOLS_COMPAT_LINUX_DEVICE_H
+#define _SSAM_TOOLS_COMPAT_LINUX_DEVICE_H
+
+#include <linux/types.h>
+
+struct device;
+
+/* Parser diagnostics are reported via return codes, drop the messages. */
+#define dev_dbg(dev, fmt, ...)	((void)(dev))
+#define dev_err(dev, fmt, ...)	((void)(dev))
+
+#endif /* _SSAM_TOOLS_COMPAT_LINUX_DEVICE_H */
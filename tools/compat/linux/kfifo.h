@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#ifndef _SSAM_TOOLS_COMPAT_LINUX_KFIFO_H
+#define _SSAM_TOOLS_COMPAT_LINUX_KFIFO_H
+
+#include <linux/types.h>
+
+/* Not used by the tools, only declared for sshp_buf_read_from_fifo(). */
+struct kfifo;
+
+static inline size_t kfifo_out(struct kfifo *fifo, u8 *buf, size_t n)
+{
+	(void)fifo;
+	(void)buf;
+	(void)n;
+	return 0;
+}
+
+#endif /* _SSAM_TOOLS_COMPAT_LINUX_KFIFO_H */
@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#ifndef _SSAM_TOOLS_COMPAT_LINUX_KREF_H
+#define _SSAM_TOOLS_COMPAT_LINUX_KREF_H
+
+struct kref {
+	int refcount;
+};
+
+#endif /* _SSAM_TOOLS_COMPAT_LINUX_KREF_H */
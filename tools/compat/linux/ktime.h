@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#ifndef _SSAM_TOOLS_COMPAT_LINUX_KTIME_H
+#define _SSAM_TOOLS_COMPAT_LINUX_KTIME_H
+
+#include <linux/types.h>
+
+typedef s64 ktime_t;
+
+#endif /* _SSAM_TOOLS_COMPAT_LINUX_KTIME_H */
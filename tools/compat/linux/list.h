@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#ifndef _SSAM_TOOLS_COMPAT_LINUX_LIST_H
+#define _SSAM_TOOLS_COMPAT_LINUX_LIST_H
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#endif /* _SSAM_TOOLS_COMPAT_LINUX_LIST_H */
@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#ifndef _SSAM_TOOLS_COMPAT_LINUX_SLAB_H
+#define _SSAM_TOOLS_COMPAT_LINUX_SLAB_H
+
+#include <stdlib.h>
+#include <linux/types.h>
+
+#define GFP_KERNEL	0
+
+static inline void *kzalloc(size_t size, gfp_t flags)
+{
+	(void)flags;
+	return calloc(1, size);
+}
+
+static inline void kfree(const void *ptr)
+{
+	free((void *)ptr);
+}
+
+#endif /* _SSAM_TOOLS_COMPAT_LINUX_SLAB_H */
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Minimal userspace stand-ins for kernel types, used to build the shared SSH
+ * protocol code (serial_hub.h, ssh_parser.c) as part of the tools.
+ */
+
+#ifndef _SSAM_TOOLS_COMPAT_LINUX_TYPES_H
+#define _SSAM_TOOLS_COMPAT_LINUX_TYPES_H
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+typedef int64_t  s64;
+
+typedef uint16_t __le16;
+typedef uint32_t __le32;
+
+typedef unsigned int gfp_t;
+
+#define U8_MAX		((u8)~0U)
+#define U16_MAX		((u16)~0U)
+
+#define BIT(nr)		(1UL << (nr))
+
+#ifndef container_of
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#endif
+
+#include <linux/compiler.h>
+
+#endif /* _SSAM_TOOLS_COMPAT_LINUX_TYPES_H */
@@ -0,0 +1,896 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Compact binary recorder and query tool for SSAM events.
+ *
+ * Drains events from the SSAM user-space EC interface (/dev/surface/aggregator)
+ * into a compact binary log with a per-block time/target-category index (see
+ * ssam-evlog.h), and allows querying such logs by time range, target category
+ * and command ID.
+ *
+ * Copyright (C) 2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#define _GNU_SOURCE
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../module/include/uapi/linux/surface_aggregator/cdev.h"
+
+#include "ssam-evlog.h"
+
+#define PATH_CDEV		"/dev/surface/aggregator"
+
+#define READ_BUFFER_SIZE	(64 * 1024)
+#define BLOCK_SIZE_MAX		(64 * 1024)
+#define BLOCK_INTERVAL_DEFAULT	10
+
+#define NSEC_PER_USEC		1000ull
+#define NSEC_PER_SEC		1000000000ull
+
+/* Keep relative record time stamps well within their 32 bit range. */
+#define BLOCK_SPAN_MAX		(3600ull * NSEC_PER_SEC)
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static char *idx_path(const char *path)
+{
+	size_t len = strlen(path) + sizeof(".idx");
+	char *p = malloc(len);
+
+	if (p)
+		snprintf(p, len, "%s.idx", path);
+
+	return p;
+}
+
+static bool tc_test(const uint8_t *tcs, uint8_t tc)
+{
+	return tcs[tc / 8] & (1 << (tc % 8));
+}
+
+static void tc_set(uint8_t *tcs, uint8_t tc)
+{
+	tcs[tc / 8] |= 1 << (tc % 8);
+}
+
+/* Parses a comma-separated list of hexadecimal target categories. */
+static int parse_tcs(const char *str, uint8_t *tcs)
+{
+	char *end;
+
+	memset(tcs, 0, 32);
+
+	do {
+		unsigned long tc = strtoul(str, &end, 16);
+
+		if (end == str || tc > 0xff || (*end && *end != ','))
+			return -EINVAL;
+
+		tc_set(tcs, tc);
+		str = end + 1;
+	} while (*end);
+
+	return 0;
+}
+
+
+/* -- Recording. ------------------------------------------------------------ */
+
+struct recorder {
+	FILE *log;
+	FILE *idx;
+	uint64_t offset;
+
+	uint64_t interval;
+
+	uint8_t block[BLOCK_SIZE_MAX + sizeof(struct ssam_evlog_record) + UINT16_MAX];
+	size_t block_len;
+	struct ssam_evlog_index entry;
+
+	uint64_t events;
+	uint64_t blocks;
+};
+
+static void header_init(struct ssam_evlog_header *hdr, const char *magic,
+			uint64_t start)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, magic, sizeof(hdr->magic));
+	hdr->version = htole32(SSAM_EVLOG_VERSION);
+	hdr->start = htole64(start);
+}
+
+static int recorder_flush(struct recorder *r)
+{
+	struct ssam_evlog_index *e = &r->entry;
+	struct ssam_evlog_block blk;
+	struct ssam_evlog_index le;
+
+	if (!e->count)
+		return 0;
+
+	blk.magic = htole32(SSAM_EVLOG_BLOCK_MAGIC);
+	blk.count = htole32(e->count);
+	blk.len = htole32(r->block_len);
+	blk.base = htole64(e->first);
+
+	e->offset = r->offset;
+	e->len = sizeof(blk) + r->block_len;
+
+	if (fwrite(&blk, sizeof(blk), 1, r->log) != 1)
+		return -errno;
+	if (fwrite(r->block, r->block_len, 1, r->log) != 1)
+		return -errno;
+	if (fflush(r->log))
+		return -errno;
+
+	le = *e;
+	le.offset = htole64(e->offset);
+	le.first = htole64(e->first);
+	le.last = htole64(e->last);
+	le.count = htole32(e->count);
+	le.len = htole32(e->len);
+
+	/* Write the index entry only once the block is complete. */
+	if (fwrite(&le, sizeof(le), 1, r->idx) != 1)
+		return -errno;
+	if (fflush(r->idx))
+		return -errno;
+
+	r->offset += e->len;
+	r->blocks++;
+
+	memset(e, 0, sizeof(*e));
+	r->block_len = 0;
+	return 0;
+}
+
+static int recorder_add(struct recorder *r, uint64_t ts,
+			const struct ssam_cdev_event *event)
+{
+	struct ssam_evlog_index *e = &r->entry;
+	struct ssam_evlog_record rec;
+	int status;
+
+	if (e->count && (r->block_len >= BLOCK_SIZE_MAX || ts - e->first >= BLOCK_SPAN_MAX)) {
+		status = recorder_flush(r);
+		if (status)
+			return status;
+	}
+
+	if (!e->count)
+		e->first = ts;
+
+	rec.ts = htole32((uint32_t)((ts - e->first) / NSEC_PER_USEC));
+	rec.tc = event->target_category;
+	rec.tid = event->target_id;
+	rec.cid = event->command_id;
+	rec.iid = event->instance_id;
+	rec.length = htole16(event->length);
+
+	memcpy(r->block + r->block_len, &rec, sizeof(rec));
+	memcpy(r->block + r->block_len + sizeof(rec), event->data, event->length);
+	r->block_len += sizeof(rec) + event->length;
+
+	/* Stored with microsecond resolution, keep the index consistent. */
+	e->last = e->first + (ts - e->first) / NSEC_PER_USEC * NSEC_PER_USEC;
+	e->count++;
+	tc_set(e->tcs, event->target_category);
+
+	r->events++;
+	return 0;
+}
+
+static int cmd_record(int argc, char **argv)
+{
+	static uint8_t buf[READ_BUFFER_SIZE];
+	static struct recorder r;
+	struct ssam_cdev_notifier_desc desc;
+	struct ssam_evlog_header hdr;
+	const char *path = NULL;
+	struct sigaction sa;
+	struct pollfd pfd;
+	uint8_t tcs[32];
+	size_t len = 0;
+	int status = 1;
+	char *ipath;
+	int opt;
+	int fd;
+	int tc;
+
+	r.interval = BLOCK_INTERVAL_DEFAULT * NSEC_PER_SEC;
+
+	while ((opt = getopt(argc, argv, "o:i:")) != -1) {
+		switch (opt) {
+		case 'o':
+			path = optarg;
+			break;
+
+		case 'i':
+			r.interval = strtoull(optarg, NULL, 10) * NSEC_PER_SEC;
+			if (!r.interval || r.interval > BLOCK_SPAN_MAX)
+				return -EINVAL;
+			break;
+
+		default:
+			return -EINVAL;
+		}
+	}
+
+	if (!path || optind != argc - 1 || parse_tcs(argv[optind], tcs))
+		return -EINVAL;
+
+	fd = open(PATH_CDEV, O_RDWR | O_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "error: Could not open '%s': %s\n", PATH_CDEV,
+			strerror(errno));
+		return 1;
+	}
+
+	ipath = idx_path(path);
+	if (!ipath)
+		goto out_close;
+
+	r.log = fopen(path, "wb");
+	r.idx = fopen(ipath, "wb");
+	if (!r.log || !r.idx) {
+		fprintf(stderr, "error: Could not create '%s': %s\n",
+			r.log ? ipath : path, strerror(errno));
+		goto out_files;
+	}
+
+	header_init(&hdr, SSAM_EVLOG_MAGIC, now_ns());
+	fwrite(&hdr, sizeof(hdr), 1, r.log);
+
+	header_init(&hdr, SSAM_EVLOG_IDX_MAGIC, le64toh(hdr.start));
+	fwrite(&hdr, sizeof(hdr), 1, r.idx);
+
+	r.offset = sizeof(hdr);
+
+	for (tc = 0; tc < 256; tc++) {
+		if (!tc_test(tcs, tc))
+			continue;
+
+		desc.priority = 0;
+		desc.target_category = tc;
+
+		if (ioctl(fd, SSAM_CDEV_NOTIF_REGISTER, &desc)) {
+			fprintf(stderr, "error: Could not register notifier for tc %#04x: %s\n",
+				tc, strerror(errno));
+			goto out_files;
+		}
+	}
+
+	/* No SA_RESTART: Interrupt blocking calls on Ctrl-C. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (!stop) {
+		const struct ssam_cdev_event *event;
+		uint64_t ts = now_ns();
+		int timeout = -1;
+		size_t pos = 0;
+		ssize_t n;
+
+		/* Close blocks periodically so that the index stays fine-grained. */
+		if (r.entry.count) {
+			uint64_t deadline = r.entry.first + r.interval;
+
+			if (ts >= deadline) {
+				if (recorder_flush(&r))
+					break;
+			} else {
+				timeout = (int)((deadline - ts + 999999) / 1000000);
+			}
+		}
+
+		n = poll(&pfd, 1, timeout);
+		if (n <= 0)
+			continue;
+
+		n = read(fd, buf + len, sizeof(buf) - len);
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			continue;
+		if (n <= 0) {
+			fprintf(stderr, "error: read failed: %s\n",
+				n ? strerror(errno) : "end of file");
+			break;
+		}
+
+		/* All events drained by a single read share the same time stamp. */
+		ts = now_ns();
+		len += n;
+
+		while (len - pos >= sizeof(*event)) {
+			event = (const struct ssam_cdev_event *)(buf + pos);
+
+			if (len - pos < sizeof(*event) + event->length)
+				break;
+
+			if (recorder_add(&r, ts, event)) {
+				stop = 1;
+				break;
+			}
+
+			pos += sizeof(*event) + event->length;
+		}
+
+		/* Events may be split across reads. */
+		memmove(buf, buf + pos, len - pos);
+		len -= pos;
+	}
+
+	if (recorder_flush(&r))
+		fprintf(stderr, "error: Could not write log: %s\n", strerror(errno));
+	else
+		status = 0;
+
+	fprintf(stderr, "recorded %llu events in %llu blocks\n",
+		(unsigned long long)r.events, (unsigned long long)r.blocks);
+
+out_files:
+	if (r.idx)
+		fclose(r.idx);
+	if (r.log)
+		fclose(r.log);
+	free(ipath);
+out_close:
+	/* Closing the device unregisters all notifiers. */
+	close(fd);
+	return status;
+}
+
+
+/* -- Index. ---------------------------------------------------------------- */
+
+struct index {
+	uint64_t start;
+	struct ssam_evlog_index *entries;
+	size_t len;
+};
+
+static int index_push(struct index *idx, const struct ssam_evlog_index *e)
+{
+	if ((idx->len & (idx->len - 1)) == 0) {
+		size_t cap = idx->len ? 2 * idx->len : 64;
+		void *p = realloc(idx->entries, cap * sizeof(*e));
+
+		if (!p)
+			return -ENOMEM;
+
+		idx->entries = p;
+	}
+
+	idx->entries[idx->len++] = *e;
+	return 0;
+}
+
+static int header_read(FILE *f, const char *magic, uint64_t *start)
+{
+	struct ssam_evlog_header hdr;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1)
+		return -EIO;
+
+	if (memcmp(hdr.magic, magic, sizeof(hdr.magic)))
+		return -EINVAL;
+
+	if (le32toh(hdr.version) != SSAM_EVLOG_VERSION)
+		return -EINVAL;
+
+	*start = le64toh(hdr.start);
+	return 0;
+}
+
+static int index_load(struct index *idx, const char *path)
+{
+	struct ssam_evlog_index e;
+	char *ipath;
+	FILE *f;
+	int status;
+
+	ipath = idx_path(path);
+	if (!ipath)
+		return -ENOMEM;
+
+	f = fopen(ipath, "rb");
+	free(ipath);
+	if (!f)
+		return -errno;
+
+	status = header_read(f, SSAM_EVLOG_IDX_MAGIC, &idx->start);
+
+	while (!status && fread(&e, sizeof(e), 1, f) == 1) {
+		e.offset = le64toh(e.offset);
+		e.first = le64toh(e.first);
+		e.last = le64toh(e.last);
+		e.count = le32toh(e.count);
+		e.len = le32toh(e.len);
+
+		status = index_push(idx, &e);
+	}
+
+	fclose(f);
+	return status;
+}
+
+/* Rebuilds the index by walking the block headers of the log. */
+static int index_scan(struct index *idx, FILE *log)
+{
+	struct ssam_evlog_block blk;
+	struct ssam_evlog_record rec;
+	struct ssam_evlog_index e;
+	uint64_t offset;
+	uint32_t i;
+	int status;
+
+	if (fseeko(log, 0, SEEK_SET))
+		return -errno;
+
+	status = header_read(log, SSAM_EVLOG_MAGIC, &idx->start);
+	if (status)
+		return status;
+
+	offset = ftello(log);
+
+	while (fread(&blk, sizeof(blk), 1, log) == 1) {
+		if (le32toh(blk.magic) != SSAM_EVLOG_BLOCK_MAGIC) {
+			fprintf(stderr, "warning: invalid block at offset %llu, stopping\n",
+				(unsigned long long)offset);
+			break;
+		}
+
+		memset(&e, 0, sizeof(e));
+		e.offset = offset;
+		e.first = le64toh(blk.base);
+		e.last = e.first;
+		e.count = le32toh(blk.count);
+		e.len = sizeof(blk) + le32toh(blk.len);
+
+		for (i = 0; i < e.count; i++) {
+			if (fread(&rec, sizeof(rec), 1, log) != 1)
+				return 0;	/* Truncated block, e.g. after a crash. */
+
+			tc_set(e.tcs, rec.tc);
+			e.last = e.first + le32toh(rec.ts) * NSEC_PER_USEC;
+
+			if (fseeko(log, le16toh(rec.length), SEEK_CUR))
+				return -errno;
+		}
+
+		status = index_push(idx, &e);
+		if (status)
+			return status;
+
+		offset += e.len;
+	}
+
+	return 0;
+}
+
+
+/* -- Queries. -------------------------------------------------------------- */
+
+struct query {
+	uint64_t start;
+	uint64_t end;
+	uint8_t tcs[32];
+	bool tc_filter;
+	int cid;
+	bool json;
+};
+
+/* Parses seconds since the epoch, "+<seconds>" relative to the log start, or local "YYYY-MM-DD HH:MM:SS". */
+static int parse_time(const char *str, uint64_t base, uint64_t *out)
+{
+	struct tm tm;
+	const char *end;
+	char *fend;
+	double v;
+
+	memset(&tm, 0, sizeof(tm));
+	end = strptime(str, "%Y-%m-%d %H:%M:%S", &tm);
+	if (!end)
+		end = strptime(str, "%Y-%m-%dT%H:%M:%S", &tm);
+
+	if (end && !*end) {
+		time_t t;
+
+		tm.tm_isdst = -1;
+		t = mktime(&tm);
+		if (t == (time_t)-1)
+			return -EINVAL;
+
+		*out = (uint64_t)t * NSEC_PER_SEC;
+		return 0;
+	}
+
+	v = strtod(str[0] == '+' ? str + 1 : str, &fend);
+	if (fend == str || *fend || v < 0)
+		return -EINVAL;
+
+	*out = (uint64_t)(v * NSEC_PER_SEC) + (str[0] == '+' ? base : 0);
+	return 0;
+}
+
+static void print_event(const struct query *q, uint64_t ts,
+			const struct ssam_evlog_record *rec, const uint8_t *data)
+{
+	uint16_t len = le16toh(rec->length);
+	time_t sec = ts / NSEC_PER_SEC;
+	char tstr[32];
+	struct tm tm;
+	uint16_t i;
+
+	localtime_r(&sec, &tm);
+	strftime(tstr, sizeof(tstr), "%Y-%m-%d %H:%M:%S", &tm);
+
+	if (q->json) {
+		printf("{\"time\": \"%s.%06llu\", \"ts\": %llu, \"tc\": %u, \"tid\": %u, "
+		       "\"cid\": %u, \"iid\": %u, \"data\": [",
+		       tstr, (unsigned long long)(ts % NSEC_PER_SEC / NSEC_PER_USEC),
+		       (unsigned long long)ts, rec->tc, rec->tid, rec->cid, rec->iid);
+
+		for (i = 0; i < len; i++)
+			printf(i ? ", %u" : "%u", data[i]);
+
+		printf("]}\n");
+	} else {
+		printf("Event { time=%s.%06llu, tc=%02x, tid=%02x, cid=%02x, iid=%02x, data=[",
+		       tstr, (unsigned long long)(ts % NSEC_PER_SEC / NSEC_PER_USEC),
+		       rec->tc, rec->tid, rec->cid, rec->iid);
+
+		for (i = 0; i < len; i++)
+			printf(i ? ", %02x" : "%02x", data[i]);
+
+		printf("] }\n");
+	}
+}
+
+static bool query_match_block(const struct query *q, const struct ssam_evlog_index *e)
+{
+	int i;
+
+	if (e->last < q->start || e->first > q->end)
+		return false;
+
+	if (!q->tc_filter)
+		return true;
+
+	for (i = 0; i < 32; i++) {
+		if (e->tcs[i] & q->tcs[i])
+			return true;
+	}
+
+	return false;
+}
+
+static int query_block(const struct query *q, FILE *log, const struct ssam_evlog_index *e,
+		       uint8_t *buf)
+{
+	struct ssam_evlog_block blk;
+	size_t pos = 0, len;
+	uint32_t i;
+
+	if (fseeko(log, e->offset, SEEK_SET))
+		return -errno;
+
+	if (fread(&blk, sizeof(blk), 1, log) != 1 ||
+	    le32toh(blk.magic) != SSAM_EVLOG_BLOCK_MAGIC)
+		return -EINVAL;
+
+	len = le32toh(blk.len);
+	if (len > BLOCK_SIZE_MAX + sizeof(struct ssam_evlog_record) + UINT16_MAX)
+		return -EINVAL;
+
+	/* Truncated blocks (e.g. after a crash) are processed up to their end. */
+	len = fread(buf, 1, len, log);
+
+	for (i = 0; i < le32toh(blk.count); i++) {
+		struct ssam_evlog_record rec;
+		uint64_t ts;
+
+		if (len - pos < sizeof(rec))
+			break;
+
+		memcpy(&rec, buf + pos, sizeof(rec));
+		if (len - pos - sizeof(rec) < le16toh(rec.length))
+			break;
+
+		ts = le64toh(blk.base) + le32toh(rec.ts) * NSEC_PER_USEC;
+
+		if (ts >= q->start && ts <= q->end &&
+		    (!q->tc_filter || tc_test(q->tcs, rec.tc)) &&
+		    (q->cid < 0 || q->cid == rec.cid))
+			print_event(q, ts, &rec, buf + pos + sizeof(rec));
+
+		pos += sizeof(rec) + le16toh(rec.length);
+	}
+
+	return 0;
+}
+
+static int log_open(const char *path, FILE **log, struct index *idx)
+{
+	int status;
+
+	*log = fopen(path, "rb");
+	if (!*log) {
+		fprintf(stderr, "error: Could not open '%s': %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	status = index_load(idx, path);
+	if (status) {
+		fprintf(stderr, "warning: no usable index, scanning log\n");
+
+		idx->len = 0;
+		status = index_scan(idx, *log);
+	}
+
+	if (status) {
+		fprintf(stderr, "error: Could not read '%s': %s\n", path, strerror(-status));
+		fclose(*log);
+	}
+
+	return status;
+}
+
+static int cmd_query(int argc, char **argv)
+{
+	static uint8_t buf[BLOCK_SIZE_MAX + sizeof(struct ssam_evlog_record) + UINT16_MAX];
+	const char *start = NULL, *end = NULL;
+	struct index idx = { 0 };
+	struct query q;
+	size_t i;
+	FILE *log;
+	int opt;
+
+	memset(&q, 0, sizeof(q));
+	q.end = UINT64_MAX;
+	q.cid = -1;
+
+	while ((opt = getopt(argc, argv, "s:e:t:c:j")) != -1) {
+		switch (opt) {
+		case 's':
+			start = optarg;
+			break;
+
+		case 'e':
+			end = optarg;
+			break;
+
+		case 't':
+			if (parse_tcs(optarg, q.tcs))
+				return -EINVAL;
+			q.tc_filter = true;
+			break;
+
+		case 'c':
+			q.cid = (int)strtoul(optarg, NULL, 16);
+			break;
+
+		case 'j':
+			q.json = true;
+			break;
+
+		default:
+			return -EINVAL;
+		}
+	}
+
+	if (optind != argc - 1)
+		return -EINVAL;
+
+	if (log_open(argv[optind], &log, &idx))
+		return 1;
+
+	if ((start && parse_time(start, idx.start, &q.start)) ||
+	    (end && parse_time(end, idx.start, &q.end))) {
+		fclose(log);
+		free(idx.entries);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < idx.len; i++) {
+		if (!query_match_block(&q, &idx.entries[i]))
+			continue;
+
+		if (query_block(&q, log, &idx.entries[i], buf)) {
+			fprintf(stderr, "warning: invalid block at offset %llu\n",
+				(unsigned long long)idx.entries[i].offset);
+		}
+	}
+
+	fclose(log);
+	free(idx.entries);
+	return 0;
+}
+
+static int cmd_info(int argc, char **argv)
+{
+	struct index idx = { 0 };
+	uint64_t events = 0;
+	uint8_t tcs[32] = { 0 };
+	time_t sec;
+	FILE *log;
+	size_t i;
+	int tc;
+
+	if (argc != 2)
+		return -EINVAL;
+
+	if (log_open(argv[1], &log, &idx))
+		return 1;
+
+	for (i = 0; i < idx.len; i++) {
+		events += idx.entries[i].count;
+
+		for (tc = 0; tc < 32; tc++)
+			tcs[tc] |= idx.entries[i].tcs[tc];
+	}
+
+	sec = idx.start / NSEC_PER_SEC;
+	printf("started:  %s", ctime(&sec));
+	printf("blocks:   %zu\n", idx.len);
+	printf("events:   %llu\n", (unsigned long long)events);
+
+	if (idx.len) {
+		printf("span:     %.3f s\n",
+		       (double)(idx.entries[idx.len - 1].last - idx.entries[0].first) /
+		       NSEC_PER_SEC);
+	}
+
+	printf("tcs:     ");
+	for (tc = 0; tc < 256; tc++) {
+		if (tc_test(tcs, tc))
+			printf(" %02x", tc);
+	}
+	printf("\n");
+
+	fclose(log);
+	free(idx.entries);
+	return 0;
+}
+
+static int cmd_reindex(int argc, char **argv)
+{
+	struct ssam_evlog_header hdr;
+	struct index idx = { 0 };
+	int status = 1;
+	char *ipath;
+	FILE *log, *f;
+	size_t i;
+
+	if (argc != 2)
+		return -EINVAL;
+
+	log = fopen(argv[1], "rb");
+	if (!log) {
+		fprintf(stderr, "error: Could not open '%s': %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+
+	if (index_scan(&idx, log)) {
+		fprintf(stderr, "error: Could not read '%s'\n", argv[1]);
+		goto out;
+	}
+
+	ipath = idx_path(argv[1]);
+	f = ipath ? fopen(ipath, "wb") : NULL;
+	free(ipath);
+	if (!f) {
+		fprintf(stderr, "error: Could not create index: %s\n", strerror(errno));
+		goto out;
+	}
+
+	header_init(&hdr, SSAM_EVLOG_IDX_MAGIC, idx.start);
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	for (i = 0; i < idx.len; i++) {
+		struct ssam_evlog_index le = idx.entries[i];
+
+		le.offset = htole64(le.offset);
+		le.first = htole64(le.first);
+		le.last = htole64(le.last);
+		le.count = htole32(le.count);
+		le.len = htole32(le.len);
+
+		fwrite(&le, sizeof(le), 1, f);
+	}
+
+	status = fclose(f) ? 1 : 0;
+out:
+	fclose(log);
+	free(idx.entries);
+	return status;
+}
+
+
+/* -- Main. ----------------------------------------------------------------- */
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage:\n"
+		"  %s <command> [args...]\n"
+		"\n"
+		"Commands:\n"
+		"  record -o <log> [-i <seconds>] <tc>[,<tc>...]\n"
+		"    record events of the given (hexadecimal) target categories until\n"
+		"    interrupted, closing index blocks at least every <seconds> [default: %d]\n"
+		"\n"
+		"  query [-s <time>] [-e <time>] [-t <tc>[,<tc>...]] [-c <cid>] [-j] <log>\n"
+		"    print recorded events, optionally filtered by time range, target\n"
+		"    category and command ID, as text or (-j) JSON lines; <time> can be\n"
+		"    seconds since the epoch, '+<seconds>' since the start of the log, or\n"
+		"    local 'YYYY-MM-DD HH:MM:SS'\n"
+		"\n"
+		"  info <log>\n"
+		"    show a summary of the log\n"
+		"\n"
+		"  reindex <log>\n"
+		"    rebuild the index of the log, e.g. after a crash\n",
+		prog, BLOCK_INTERVAL_DEFAULT);
+}
+
+int main(int argc, char **argv)
+{
+	int status;
+
+	if (argc < 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!strcmp(argv[1], "record"))
+		status = cmd_record(argc - 1, argv + 1);
+	else if (!strcmp(argv[1], "query"))
+		status = cmd_query(argc - 1, argv + 1);
+	else if (!strcmp(argv[1], "info"))
+		status = cmd_info(argc - 1, argv + 1);
+	else if (!strcmp(argv[1], "reindex"))
+		status = cmd_reindex(argc - 1, argv + 1);
+	else
+		status = -EINVAL;
+
+	if (status == -EINVAL) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	return status ? 1 : 0;
+}
@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Compact binary log format for SSAM events.
+ *
+ * An event log consists of two files: The log itself and an index, stored
+ * next to it with an additional ".idx" suffix. All fields are little-endian.
+ *
+ * The log starts with a &struct ssam_evlog_header, followed by blocks. Each
+ * block consists of a &struct ssam_evlog_block header and ``count`` records,
+ * each of which is a &struct ssam_evlog_record followed by ``length`` bytes
+ * of event payload. Record time stamps are relative to the block base time,
+ * so the log is self-describing and the index can be rebuilt from it.
+ *
+ * The index contains one &struct ssam_evlog_index entry per block, allowing
+ * queries to seek directly to the blocks covering a given time range and/or
+ * containing events of a given target category.
+ *
+ * Copyright (C) 2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#ifndef _SSAM_TOOLS_EVLOG_H
+#define _SSAM_TOOLS_EVLOG_H
+
+#include <stdint.h>
+
+#define SSAM_EVLOG_MAGIC	"SSAMEVL\0"
+#define SSAM_EVLOG_IDX_MAGIC	"SSAMEVI\0"
+#define SSAM_EVLOG_VERSION	1
+
+#define SSAM_EVLOG_BLOCK_MAGIC	0x4b4c4245	/* "EBLK" */
+
+/**
+ * struct ssam_evlog_header - Log and index file header.
+ * @magic:   Magic bytes, %SSAM_EVLOG_MAGIC for the log and
+ *           %SSAM_EVLOG_IDX_MAGIC for the index.
+ * @version: Format version, %SSAM_EVLOG_VERSION.
+ * @flags:   Reserved, zero.
+ * @start:   Start of the recording, in nanoseconds since the epoch.
+ */
+struct ssam_evlog_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint64_t start;
+} __attribute__((__packed__));
+
+/**
+ * struct ssam_evlog_block - Block header.
+ * @magic: Block magic, %SSAM_EVLOG_BLOCK_MAGIC.
+ * @count: Number of records in this block.
+ * @len:   Length of all records in this block, in bytes.
+ * @base:  Base time of this block, in nanoseconds since the epoch.
+ */
+struct ssam_evlog_block {
+	uint32_t magic;
+	uint32_t count;
+	uint32_t len;
+	uint64_t base;
+} __attribute__((__packed__));
+
+/**
+ * struct ssam_evlog_record - Event record header.
+ * @ts:     Time at which the event has been read, in microseconds relative to
+ *          the base time of the enclosing block.
+ * @tc:     Target category of the event.
+ * @tid:    Target ID of the event.
+ * @cid:    Command ID of the event.
+ * @iid:    Instance ID of the event.
+ * @length: Length of the event payload following this header.
+ */
+struct ssam_evlog_record {
+	uint32_t ts;
+	uint8_t tc;
+	uint8_t tid;
+	uint8_t cid;
+	uint8_t iid;
+	uint16_t length;
+} __attribute__((__packed__));
+
+/**
+ * struct ssam_evlog_index - Index entry, describing a single block.
+ * @offset: Offset of the block header in the log file.
+ * @first:  Time of the first record in the block, in nanoseconds since the
+ *          epoch.
+ * @last:   Time of the last record in the block, in nanoseconds since the
+ *          epoch.
+ * @count:  Number of records in the block.
+ * @len:    Length of the block, including its header.
+ * @tcs:    Bitmap of target categories of the events in the block.
+ */
+struct ssam_evlog_index {
+	uint64_t offset;
+	uint64_t first;
+	uint64_t last;
+	uint32_t count;
+	uint32_t len;
+	uint8_t tcs[32];
+} __attribute__((__packed__));
+
+#endif /* _SSAM_TOOLS_EVLOG_H */
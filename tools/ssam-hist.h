@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Latency histogram shared by the SSAM tools.
+ *
+ * Log-linear histogram over microseconds: Values below HIST_SUB are stored
+ * exactly, larger values with HIST_SUB sub-buckets per power of two, i.e.
+ * with a relative error of at most 1/HIST_SUB.
+ *
+ * Copyright (C) 2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#ifndef _SSAM_TOOLS_HIST_H
+#define _SSAM_TOOLS_HIST_H
+
+#include <stdint.h>
+
+#define HIST_SUB_SHIFT		6
+#define HIST_SUB		(1u << HIST_SUB_SHIFT)
+#define HIST_BUCKETS		(HIST_SUB * (64 - HIST_SUB_SHIFT + 1))
+
+/**
+ * struct hist - Latency histogram.
+ * @count:   Number of recorded values.
+ * @sum:     Sum of all recorded values, in microseconds.
+ * @max:     Largest recorded value, in microseconds.
+ * @buckets: Number of values per bucket, see hist_index().
+ */
+struct hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+/* Returns the index of the bucket containing the given value. */
+static inline unsigned int hist_index(uint64_t us)
+{
+	unsigned int e;
+
+	if (us < HIST_SUB)
+		return us;
+
+	e = 63 - __builtin_clzll(us);
+	return (e - HIST_SUB_SHIFT + 1) * HIST_SUB
+		+ ((us >> (e - HIST_SUB_SHIFT)) & (HIST_SUB - 1));
+}
+
+/* Returns the largest value contained in the given bucket. */
+static inline uint64_t hist_bucket_max(unsigned int idx)
+{
+	unsigned int e;
+
+	if (idx < HIST_SUB)
+		return idx;
+
+	e = idx / HIST_SUB + HIST_SUB_SHIFT - 1;
+	return (((uint64_t)(idx % HIST_SUB + HIST_SUB + 1)) << (e - HIST_SUB_SHIFT)) - 1;
+}
+
+/* Records a value given in nanoseconds. */
+static inline void hist_add(struct hist *h, uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+
+	h->buckets[hist_index(us)]++;
+	h->count++;
+	h->sum += us;
+	if (us > h->max)
+		h->max = us;
+}
+
+/*
+ * Returns an upper bound for the given percentile (0 < p <= 1), in
+ * microseconds.
+ */
+static inline uint64_t hist_percentile(const struct hist *h, double p)
+{
+	uint64_t target = (uint64_t)(p * h->count);
+	uint64_t acc = 0;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+
+	if (target < p * h->count)
+		target++;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		acc += h->buckets[i];
+		if (acc >= target)
+			return hist_bucket_max(i) < h->max ? hist_bucket_max(i) : h->max;
+	}
+
+	return h->max;
+}
+
+#endif /* _SSAM_TOOLS_HIST_H */
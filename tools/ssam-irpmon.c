@@ -0,0 +1,695 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Streaming converter for IRPMon captures of the SSH UART.
+ *
+ * Reads the text export of an IRPMon capture (Read/Write IRPs on the serial
+ * device of the EC), reassembles the SSH messages of both directions using
+ * the driver's own parser (ssh_parser.c), and writes them as JSON Lines
+ * and/or in the binary capture format described in ssh-capture.h. Optionally
+ * prints summary statistics for inter-frame gaps, ACK latency and
+ * re-transmissions, which can be compared to the same statistics of our
+ * driver on identical workloads.
+ *
+ * Unlike scripts/irpmon/irpmon_to_json.py, the input is processed in a
+ * single pass with bounded memory, so multi-hour captures can be converted.
+ *
+ * Copyright (C) 2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#include <asm/unaligned.h>
+#include <linux/types.h>
+
+#include <endian.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../module/include/linux/surface_aggregator/serial_hub.h"
+#include "../module/src/ssh_parser.h"
+
+#include "ssam-hist.h"
+#include "ssh-capture.h"
+
+#define SSH_MAX_MESSAGE_LEN	SSH_MESSAGE_LENGTH(SSH_FRAME_MAX_PAYLOAD_SIZE)
+#define MAX_SEGMENTS		4096
+
+#define NSEC_PER_USEC		1000ull
+#define NSEC_PER_SEC		1000000000ull
+
+static const char *const dir_names[2] = {
+	[SSH_CAPTURE_DIR_TX] = "tx",
+	[SSH_CAPTURE_DIR_RX] = "rx",
+};
+
+/* Time stamp of the IRP that delivered the data starting at @start. */
+struct segment {
+	uint64_t start;
+	uint64_t ts;
+	char time[40];
+};
+
+struct stream {
+	enum ssh_capture_dir dir;
+	struct sshp_buf buf;
+
+	/* Absolute stream offset of the first byte in @buf. */
+	uint64_t offset;
+
+	struct segment seg[MAX_SEGMENTS];
+	size_t seg_head;
+	size_t seg_len;
+
+	/* Sequenced frames sent in this direction and not yet ACKed. */
+	bool pending[256];
+	uint64_t pending_ts[256];
+
+	uint64_t last_frame_ts;
+
+	uint64_t frames;
+	uint64_t data_frames;
+	uint64_t acks;
+	uint64_t naks;
+	uint64_t retransmits;
+	uint64_t invalid;
+	uint64_t dropped;
+
+	struct hist gap;
+	struct hist ack_latency;
+};
+
+struct converter {
+	struct stream stream[2];
+
+	FILE *json;
+	FILE *capture;
+};
+
+
+/* -- Statistics. ----------------------------------------------------------- */
+
+static void hist_print(const char *name, const struct hist *h)
+{
+	if (!h->count) {
+		printf("    %-12s -\n", name);
+		return;
+	}
+
+	printf("    %-12s n=%llu, avg %llu us, p50 <= %llu us, p99 <= %llu us, max %llu us\n",
+	       name, (unsigned long long)h->count,
+	       (unsigned long long)(h->sum / h->count),
+	       (unsigned long long)hist_percentile(h, 0.5),
+	       (unsigned long long)hist_percentile(h, 0.99),
+	       (unsigned long long)h->max);
+}
+
+static void stats_print(const struct converter *c)
+{
+	int d;
+
+	for (d = 0; d < 2; d++) {
+		const struct stream *s = &c->stream[d];
+
+		printf("%s (%s):\n", dir_names[d],
+		       d == SSH_CAPTURE_DIR_TX ? "host to EC" : "EC to host");
+		printf("    frames       %llu (data: %llu, ACK: %llu, NAK: %llu)\n",
+		       (unsigned long long)s->frames,
+		       (unsigned long long)s->data_frames,
+		       (unsigned long long)s->acks,
+		       (unsigned long long)s->naks);
+		printf("    retransmits  %llu\n", (unsigned long long)s->retransmits);
+		printf("    invalid      %llu messages, %llu bytes dropped\n",
+		       (unsigned long long)s->invalid,
+		       (unsigned long long)s->dropped);
+
+		hist_print("gap", &s->gap);
+		hist_print("ACK latency", &s->ack_latency);
+	}
+}
+
+
+/* -- Output. --------------------------------------------------------------- */
+
+static void json_time(FILE *f, const struct segment *seg)
+{
+	fprintf(f, "\"time\": ");
+	if (seg && seg->time[0])
+		fprintf(f, "\"%s\", ", seg->time);
+	else
+		fprintf(f, "null, ");
+
+	fprintf(f, "\"ts\": %llu", seg ? (unsigned long long)seg->ts : 0ull);
+}
+
+static void json_frame(FILE *f, const struct stream *s, const struct segment *seg,
+		       const struct ssh_frame *frame, const struct ssam_span *payload)
+{
+	struct ssh_command *cmd;
+	u16 len = get_unaligned_le16(&frame->len);
+	size_t i;
+
+	fprintf(f, "{\"dir\": \"%s\", ", dir_names[s->dir]);
+	json_time(f, seg);
+	fprintf(f, ", \"ctrl\": {\"type\": %u, \"len\": %u, \"pad\": %u, \"seq\": %u}",
+		frame->type, len & 0xff, len >> 8, frame->seq);
+
+	if (frame->type == SSH_FRAME_TYPE_DATA_SEQ || frame->type == SSH_FRAME_TYPE_DATA_NSQ) {
+		struct ssam_span data;
+
+		if (sshp_parse_command(NULL, payload, &cmd, &data)) {
+			data = *payload;
+			cmd = NULL;
+		}
+
+		if (cmd) {
+			u16 rqid = get_unaligned_le16(&cmd->rqid);
+
+			fprintf(f, ", \"cmd\": {\"type\": %u, \"tc\": %u, \"outgoing\": %u, "
+				"\"incoming\": %u, \"iid\": %u, \"rqid_lo\": %u, \"rqid_hi\": %u, "
+				"\"cid\": %u}",
+				cmd->type, cmd->tc, cmd->tid_out, cmd->tid_in, cmd->iid,
+				rqid & 0xff, rqid >> 8, cmd->cid);
+		}
+
+		fprintf(f, ", \"payload\": [");
+		for (i = 0; i < data.len; i++)
+			fprintf(f, i ? ", %u" : "%u", data.ptr[i]);
+		fprintf(f, "]");
+	}
+
+	fprintf(f, "}\n");
+}
+
+static void json_invalid(FILE *f, const struct stream *s, const struct segment *seg,
+			 size_t n)
+{
+	fprintf(f, "{\"dir\": \"%s\", ", dir_names[s->dir]);
+	json_time(f, seg);
+	fprintf(f, ", \"invalid\": %zu}\n", n);
+}
+
+static void capture_header(FILE *f)
+{
+	struct ssh_capture_header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SSH_CAPTURE_MAGIC, sizeof(hdr.magic));
+	hdr.version = htole32(SSH_CAPTURE_VERSION);
+
+	fwrite(&hdr, sizeof(hdr), 1, f);
+}
+
+static void capture_record(FILE *f, const struct stream *s, const struct segment *seg,
+			   u8 flags, const u8 *data, size_t len)
+{
+	struct ssh_capture_record rec;
+
+	rec.ts = htole64(seg ? seg->ts : 0);
+	rec.dir = s->dir;
+	rec.flags = flags;
+	rec.reserved = 0;
+	rec.len = htole32((u32)len);
+
+	fwrite(&rec, sizeof(rec), 1, f);
+	fwrite(data, len, 1, f);
+}
+
+
+/* -- Stream reassembly. ---------------------------------------------------- */
+
+/* Returns the segment containing the given absolute stream offset. */
+static const struct segment *stream_segment(const struct stream *s, uint64_t off)
+{
+	const struct segment *found = NULL;
+	size_t i;
+
+	for (i = 0; i < s->seg_len; i++) {
+		const struct segment *seg = &s->seg[(s->seg_head + i) % MAX_SEGMENTS];
+
+		if (seg->start > off)
+			break;
+
+		found = seg;
+	}
+
+	return found;
+}
+
+static void stream_drop(struct stream *s, size_t n)
+{
+	sshp_buf_drop(&s->buf, n);
+	s->offset += n;
+
+	/* Drop segments that end before the new start of the buffer. */
+	while (s->seg_len > 1) {
+		const struct segment *next = &s->seg[(s->seg_head + 1) % MAX_SEGMENTS];
+
+		if (next->start > s->offset)
+			break;
+
+		s->seg_head = (s->seg_head + 1) % MAX_SEGMENTS;
+		s->seg_len--;
+	}
+}
+
+static void stream_skip(struct converter *c, struct stream *s, size_t n)
+{
+	const struct segment *seg = stream_segment(s, s->offset);
+
+	if (!n)
+		return;
+
+	s->invalid++;
+	s->dropped += n;
+
+	if (c->json)
+		json_invalid(c->json, s, seg, n);
+	if (c->capture)
+		capture_record(c->capture, s, seg, SSH_CAPTURE_F_INVALID, s->buf.ptr, n);
+
+	stream_drop(s, n);
+}
+
+static void stream_frame(struct converter *c, struct stream *s,
+			 const struct segment *seg, const struct ssh_frame *frame,
+			 const struct ssam_span *payload)
+{
+	struct stream *other = &c->stream[!s->dir];
+	uint64_t ts = seg ? seg->ts : 0;
+
+	s->frames++;
+
+	if (s->last_frame_ts && ts >= s->last_frame_ts)
+		hist_add(&s->gap, ts - s->last_frame_ts);
+	s->last_frame_ts = ts;
+
+	switch (frame->type) {
+	case SSH_FRAME_TYPE_DATA_SEQ:
+		/* Same SEQ while still waiting for an ACK: re-transmission. */
+		if (s->pending[frame->seq])
+			s->retransmits++;
+
+		s->pending[frame->seq] = true;
+		s->pending_ts[frame->seq] = ts;
+		s->data_frames++;
+		break;
+
+	case SSH_FRAME_TYPE_DATA_NSQ:
+		s->data_frames++;
+		break;
+
+	case SSH_FRAME_TYPE_ACK:
+		/* ACKs refer to frames sent in the other direction. */
+		if (other->pending[frame->seq]) {
+			if (ts >= other->pending_ts[frame->seq])
+				hist_add(&other->ack_latency, ts - other->pending_ts[frame->seq]);
+
+			other->pending[frame->seq] = false;
+		}
+		s->acks++;
+		break;
+
+	case SSH_FRAME_TYPE_NAK:
+		s->naks++;
+		break;
+	}
+
+	if (c->json)
+		json_frame(c->json, s, seg, frame, payload);
+	if (c->capture)
+		capture_record(c->capture, s, seg, 0, s->buf.ptr,
+			       SSH_MESSAGE_LENGTH(payload->len));
+}
+
+/* Process all complete messages in the buffer, see ssh_ptl_rx_eval(). */
+static void stream_eval(struct converter *c, struct stream *s)
+{
+	struct ssam_span src, aligned, payload;
+	struct ssh_frame *frame;
+	bool syn_found;
+	int status;
+
+	while (s->buf.len) {
+		sshp_buf_span_from(&s->buf, 0, &src);
+
+		syn_found = sshp_find_syn(&src, &aligned);
+		stream_skip(c, s, aligned.ptr - src.ptr);
+
+		if (!syn_found)
+			return;
+
+		sshp_buf_span_from(&s->buf, 0, &aligned);
+
+		status = sshp_parse_frame(NULL, &aligned, &frame, &payload,
+					  SSH_MAX_MESSAGE_LEN);
+		if (status) {
+			/* Invalid message: Skip SYN and search for the next one. */
+			stream_skip(c, s, sizeof(u16));
+			continue;
+		}
+
+		/* Incomplete message, wait for more data. */
+		if (!frame)
+			return;
+
+		stream_frame(c, s, stream_segment(s, s->offset), frame, &payload);
+		stream_drop(s, SSH_MESSAGE_LENGTH(payload.len));
+	}
+}
+
+static void stream_push_segment(struct stream *s, uint64_t ts, const char *time)
+{
+	uint64_t start = s->offset + s->buf.len;
+	struct segment *seg;
+
+	/* Many tiny IRPs for the same message: Keep the oldest stamps. */
+	if (s->seg_len == MAX_SEGMENTS)
+		return;
+
+	seg = &s->seg[(s->seg_head + s->seg_len++) % MAX_SEGMENTS];
+	seg->start = start;
+	seg->ts = ts;
+	snprintf(seg->time, sizeof(seg->time), "%s", time);
+}
+
+static void stream_push(struct converter *c, struct stream *s, const u8 *data,
+			size_t len)
+{
+	while (len) {
+		size_t n = s->buf.cap - s->buf.len;
+
+		if (n > len)
+			n = len;
+
+		memcpy(s->buf.ptr + s->buf.len, data, n);
+		s->buf.len += n;
+		data += n;
+		len -= n;
+
+		stream_eval(c, s);
+	}
+}
+
+
+/* -- IRPMon input. --------------------------------------------------------- */
+
+/*
+ * Parses the "Time = ..." value of an IRP into nanoseconds since the epoch.
+ * Accepts "M/D/Y", "D.M.Y" and "Y-M-D" dates, 12h or 24h times, and optional
+ * fractional seconds. Returns zero if the time stamp could not be parsed.
+ */
+static uint64_t parse_time(const char *str)
+{
+	unsigned int a, b, y, h, m, sec;
+	uint64_t frac = 0;
+	int digits = 0;
+	struct tm tm;
+	char sep;
+	int n = 0;
+	time_t t;
+
+	if (sscanf(str, "%u%c%u%*c%u %u:%u:%u%n", &a, &sep, &b, &y, &h, &m, &sec, &n) < 7)
+		return 0;
+
+	str += n;
+	if (*str == '.' || *str == ',') {
+		for (str++; *str >= '0' && *str <= '9'; str++) {
+			if (digits++ < 9)
+				frac = frac * 10 + (*str - '0');
+		}
+	}
+	for (; digits < 9; digits++)
+		frac *= 10;
+
+	while (*str == ' ')
+		str++;
+
+	if (!strncasecmp(str, "PM", 2) && h < 12)
+		h += 12;
+	else if (!strncasecmp(str, "AM", 2) && h == 12)
+		h = 0;
+
+	memset(&tm, 0, sizeof(tm));
+
+	switch (sep) {
+	case '/':
+		tm.tm_mon = a - 1;
+		tm.tm_mday = b;
+		tm.tm_year = y - 1900;
+		break;
+
+	case '.':
+		tm.tm_mday = a;
+		tm.tm_mon = b - 1;
+		tm.tm_year = y - 1900;
+		break;
+
+	case '-':
+		tm.tm_year = a - 1900;
+		tm.tm_mon = b - 1;
+		tm.tm_mday = y;
+		break;
+
+	default:
+		return 0;
+	}
+
+	tm.tm_hour = h;
+	tm.tm_min = m;
+	tm.tm_sec = sec;
+
+	t = timegm(&tm);
+	if (t == (time_t)-1)
+		return 0;
+
+	return (uint64_t)t * NSEC_PER_SEC + frac;
+}
+
+/* Parses a "Data (Hexer)" line, i.e. "<offset>\t<hex bytes>[\t<ascii>]". */
+static size_t parse_hex_line(const char *line, u8 *out, size_t cap)
+{
+	const char *p = strchr(line, '\t');
+	size_t n = 0;
+	char *end;
+
+	if (!p)
+		return 0;
+
+	for (p++; *p && *p != '\t' && *p != '\n' && n < cap; p = end) {
+		unsigned long v;
+
+		while (*p == ' ')
+			p++;
+
+		v = strtoul(p, &end, 16);
+		if (end == p || v > 0xff)
+			break;
+
+		out[n++] = (u8)v;
+	}
+
+	return n;
+}
+
+static int convert(struct converter *c, FILE *in)
+{
+	enum { FN_OTHER, FN_READ, FN_WRITE } fn = FN_OTHER;
+	char time[40] = "";
+	uint64_t ts = 0;
+	bool in_data = false;
+	bool pushed = false;
+	char *line = NULL;
+	size_t cap = 0;
+	u8 bytes[256];
+
+	while (getline(&line, &cap, in) >= 0) {
+		if (in_data && !strncmp(line, "  ", 2)) {
+			struct stream *s;
+			size_t n;
+
+			if (fn == FN_OTHER)
+				continue;
+
+			s = &c->stream[fn == FN_WRITE ? SSH_CAPTURE_DIR_TX : SSH_CAPTURE_DIR_RX];
+
+			if (!pushed) {
+				stream_push_segment(s, ts, time);
+				pushed = true;
+			}
+
+			n = parse_hex_line(line, bytes, sizeof(bytes));
+			stream_push(c, s, bytes, n);
+			continue;
+		}
+
+		in_data = false;
+
+		if (!strncmp(line, "Major function =", 16)) {
+			const char *v = line + 16;
+
+			while (*v == ' ')
+				v++;
+
+			if (!strncmp(v, "Read", 4))
+				fn = FN_READ;
+			else if (!strncmp(v, "Write", 5))
+				fn = FN_WRITE;
+			else
+				fn = FN_OTHER;
+
+		} else if (!strncmp(line, "Time = ", 7)) {
+			snprintf(time, sizeof(time), "%.*s", (int)strcspn(line + 7, "\r\n"),
+				 line + 7);
+			ts = parse_time(time);
+
+		} else if (!strncmp(line, "Data (Hexer)", 12)) {
+			in_data = true;
+			pushed = false;
+		}
+	}
+
+	free(line);
+	return ferror(in) ? -1 : 0;
+}
+
+
+/* -- Main. ----------------------------------------------------------------- */
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-j <file>] [-c <file>] [-s] <irpmon-export>\n"
+		"\n"
+		"Convert an IRPMon text export of the SSH UART to JSON Lines and/or\n"
+		"the binary capture format. Use '-' to read from stdin or write to\n"
+		"stdout. Without -j, -c or -s, JSON Lines are written to stdout.\n"
+		"\n"
+		"Options:\n"
+		"    -j <file>  write one JSON object per frame to <file>\n"
+		"    -c <file>  write binary capture (see ssh-capture.h) to <file>\n"
+		"    -s         print summary statistics (gaps, ACK latency, re-transmits)\n"
+		"    -h         show this help\n",
+		prog);
+}
+
+static FILE *open_output(const char *path, const char *mode)
+{
+	FILE *f;
+
+	if (!strcmp(path, "-"))
+		return stdout;
+
+	f = fopen(path, mode);
+	if (!f)
+		fprintf(stderr, "error: Could not open '%s': %s\n", path, strerror(errno));
+
+	return f;
+}
+
+int main(int argc, char **argv)
+{
+	static struct converter c;
+	const char *path_json = NULL;
+	const char *path_capture = NULL;
+	bool summary = false;
+	int status = 1;
+	FILE *in;
+	int opt;
+	int d;
+
+	while ((opt = getopt(argc, argv, "j:c:sh")) != -1) {
+		switch (opt) {
+		case 'j':
+			path_json = optarg;
+			break;
+
+		case 'c':
+			path_capture = optarg;
+			break;
+
+		case 's':
+			summary = true;
+			break;
+
+		case 'h':
+			usage(argv[0]);
+			return 0;
+
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!path_json && !path_capture && !summary)
+		path_json = "-";
+
+	for (d = 0; d < 2; d++) {
+		c.stream[d].dir = d;
+
+		if (sshp_buf_alloc(&c.stream[d].buf, SSH_MAX_MESSAGE_LEN, GFP_KERNEL)) {
+			fprintf(stderr, "error: Out of memory\n");
+			goto out;
+		}
+	}
+
+	if (!strcmp(argv[optind], "-")) {
+		in = stdin;
+	} else {
+		in = fopen(argv[optind], "r");
+		if (!in) {
+			fprintf(stderr, "error: Could not open '%s': %s\n", argv[optind],
+				strerror(errno));
+			goto out;
+		}
+	}
+
+	if (path_json) {
+		c.json = open_output(path_json, "w");
+		if (!c.json)
+			goto out_close;
+	}
+
+	if (path_capture) {
+		c.capture = open_output(path_capture, "wb");
+		if (!c.capture)
+			goto out_close;
+
+		capture_header(c.capture);
+	}
+
+	if (convert(&c, in)) {
+		fprintf(stderr, "error: Could not read input: %s\n", strerror(errno));
+		goto out_close;
+	}
+
+	/* Anything left in the buffers is an incomplete message. */
+	for (d = 0; d < 2; d++)
+		stream_skip(&c, &c.stream[d], c.stream[d].buf.len);
+
+	if (summary)
+		stats_print(&c);
+
+	status = 0;
+
+out_close:
+	if (c.capture && c.capture != stdout)
+		fclose(c.capture);
+	if (c.json && c.json != stdout)
+		fclose(c.json);
+	if (in != stdin)
+		fclose(in);
+out:
+	for (d = 0; d < 2; d++)
+		sshp_buf_free(&c.stream[d].buf);
+
+	return status;
+}
@@ -0,0 +1,748 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Latency analyzer for the surface_aggregator tracepoints.
+ *
+ * Reads the text output of the surface_aggregator trace events (e.g. from
+ * /sys/kernel/tracing/trace_pipe or a saved copy of it), correlates
+ * requests with their packets and responses, and splits the time from
+ * submission to completion of each request into four stages:
+ *
+ *   queue wait   ssam_request_submit  -> first ssam_packet_transmit
+ *   wire         last ssam_packet_transmit -> ssam_packet_complete (ACK)
+ *   EC service   ACK (or transmit)    -> ssam_rx_response_received
+ *   dispatch     response (or ACK)    -> ssam_request_complete
+ *
+ * Requests are matched to packets via the packet UID (which the request
+ * events report as well) and to responses via their request ID. Statistics
+ * are collected per target category and command ID.
+ *
+ * Copyright (C) 2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ssam-hist.h"
+
+#define PATH_TRACE_PIPE		"/sys/kernel/tracing/trace_pipe"
+
+#define MAX_PENDING		256
+#define LINE_BUFFER_SIZE	(64 * 1024)
+
+#define NSEC_PER_USEC		1000ull
+#define NSEC_PER_SEC		1000000000ull
+
+enum stage {
+	STAGE_QUEUE,
+	STAGE_WIRE,
+	STAGE_SERVICE,
+	STAGE_DISPATCH,
+	__STAGE_MAX,
+};
+
+static const char *const stage_names[__STAGE_MAX] = {
+	[STAGE_QUEUE]    = "queue wait",
+	[STAGE_WIRE]     = "wire",
+	[STAGE_SERVICE]  = "EC service",
+	[STAGE_DISPATCH] = "dispatch",
+};
+
+struct key_stats {
+	char tc[8];
+	unsigned int cid;
+
+	uint64_t completed;
+	uint64_t failed;
+	uint64_t retransmits;
+
+	struct hist stage[__STAGE_MAX];
+};
+
+struct pending {
+	bool used;
+
+	uint32_t uid;
+	uint32_t rqid;
+	char tc[8];
+	unsigned int cid;
+	unsigned int transmits;
+
+	uint64_t t_submit;
+	uint64_t t_tx_first;
+	uint64_t t_tx_last;
+	uint64_t t_ack;
+	uint64_t t_rsp;
+};
+
+struct state {
+	struct pending pending[MAX_PENDING];
+
+	struct key_stats *keys;
+	size_t num_keys;
+	size_t cap_keys;
+
+	uint64_t events;
+	uint64_t unmatched;
+	uint64_t t_first;
+	uint64_t t_last;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+
+/* -- Histograms. ----------------------------------------------------------- */
+
+/*
+ * Prints the histogram with one row per power of two: Row 0 is [0, 1), row n
+ * is [2^(n-1), 2^n).
+ */
+static void hist_print(const struct hist *h)
+{
+	uint64_t rows[65] = { 0 };
+	uint64_t peak = 0;
+	int lo = -1, hi = -1;
+	unsigned int i;
+	int r;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		uint64_t max = hist_bucket_max(i);
+
+		r = max ? 64 - __builtin_clzll(max) : 0;
+		rows[r] += h->buckets[i];
+	}
+
+	for (r = 0; r < 65; r++) {
+		if (!rows[r])
+			continue;
+
+		if (lo < 0)
+			lo = r;
+		hi = r;
+
+		if (rows[r] > peak)
+			peak = rows[r];
+	}
+
+	for (r = lo; r >= 0 && r <= hi; r++) {
+		uint64_t from = r ? 1ull << (r - 1) : 0;
+		int width = (int)(rows[r] * 40 / peak);
+
+		printf("      [%8llu, %8llu) %8llu |%-40.*s|\n",
+		       (unsigned long long)from,
+		       (unsigned long long)(r < 64 ? 1ull << r : UINT64_MAX),
+		       (unsigned long long)rows[r], width,
+		       "@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@");
+	}
+}
+
+
+/* -- Correlation. ---------------------------------------------------------- */
+
+static struct key_stats *state_get_key(struct state *s, const char *tc,
+				       unsigned int cid)
+{
+	struct key_stats *k;
+	size_t i;
+
+	for (i = 0; i < s->num_keys; i++) {
+		k = &s->keys[i];
+
+		if (k->cid == cid && !strcmp(k->tc, tc))
+			return k;
+	}
+
+	if (s->num_keys == s->cap_keys) {
+		size_t cap = s->cap_keys ? 2 * s->cap_keys : 32;
+
+		k = realloc(s->keys, cap * sizeof(*k));
+		if (!k)
+			return NULL;
+
+		s->keys = k;
+		s->cap_keys = cap;
+	}
+
+	k = &s->keys[s->num_keys++];
+	memset(k, 0, sizeof(*k));
+	snprintf(k->tc, sizeof(k->tc), "%s", tc);
+	k->cid = cid;
+
+	return k;
+}
+
+static struct pending *state_find_uid(struct state *s, uint32_t uid)
+{
+	int i;
+
+	for (i = 0; i < MAX_PENDING; i++) {
+		if (s->pending[i].used && s->pending[i].uid == uid)
+			return &s->pending[i];
+	}
+
+	return NULL;
+}
+
+static struct pending *state_find_rqid(struct state *s, uint32_t rqid)
+{
+	int i;
+
+	for (i = 0; i < MAX_PENDING; i++) {
+		struct pending *p = &s->pending[i];
+
+		if (p->used && p->rqid == rqid && !p->t_rsp)
+			return p;
+	}
+
+	return NULL;
+}
+
+static struct pending *state_alloc(struct state *s, uint32_t uid)
+{
+	struct pending *oldest = NULL;
+	struct pending *p;
+	int i;
+
+	/* Packet memory may be re-used: A new submission replaces the old entry. */
+	p = state_find_uid(s, uid);
+	if (p)
+		goto out;
+
+	for (i = 0; i < MAX_PENDING; i++) {
+		p = &s->pending[i];
+
+		if (!p->used)
+			goto out;
+
+		if (!oldest || p->t_submit < oldest->t_submit)
+			oldest = p;
+	}
+
+	/* Lost completion events (e.g. due to trace buffer overruns). */
+	p = oldest;
+	s->unmatched++;
+
+out:
+	memset(p, 0, sizeof(*p));
+	p->used = true;
+	p->uid = uid;
+	return p;
+}
+
+static void state_complete(struct state *s, struct pending *p, uint64_t ts,
+			   int status)
+{
+	struct key_stats *k;
+	uint64_t t_prev;
+
+	p->used = false;
+
+	k = state_get_key(s, p->tc, p->cid);
+	if (!k)
+		return;
+
+	if (p->transmits > 1)
+		k->retransmits += p->transmits - 1;
+
+	if (status) {
+		k->failed++;
+		return;
+	}
+
+	k->completed++;
+
+	if (p->t_tx_first)
+		hist_add(&k->stage[STAGE_QUEUE], p->t_tx_first - p->t_submit);
+
+	if (p->t_tx_last && p->t_ack)
+		hist_add(&k->stage[STAGE_WIRE], p->t_ack - p->t_tx_last);
+
+	/* The response may be received before the ACK has been processed. */
+	if (p->t_rsp) {
+		t_prev = p->t_ack && p->t_ack < p->t_rsp ? p->t_ack : p->t_tx_last;
+		if (t_prev && t_prev <= p->t_rsp)
+			hist_add(&k->stage[STAGE_SERVICE], p->t_rsp - t_prev);
+	}
+
+	t_prev = p->t_rsp > p->t_ack ? p->t_rsp : p->t_ack;
+	if (t_prev && t_prev <= ts)
+		hist_add(&k->stage[STAGE_DISPATCH], ts - t_prev);
+}
+
+
+/* -- Parsing. -------------------------------------------------------------- */
+
+/* Returns the value of the given "name=value" field, or NULL if not present. */
+static const char *field(const char *args, const char *name)
+{
+	size_t len = strlen(name);
+	const char *p = args;
+
+	while (p) {
+		if (!strncmp(p, name, len) && p[len] == '=')
+			return p + len + 1;
+
+		p = strstr(p, ", ");
+		if (p)
+			p += 2;
+	}
+
+	return NULL;
+}
+
+static bool field_u32(const char *args, const char *name, int base,
+		      uint32_t *value)
+{
+	const char *v = field(args, name);
+	char *end;
+
+	if (!v)
+		return false;
+
+	*value = (uint32_t)strtoul(v, &end, base);
+	return end != v;
+}
+
+static bool field_str(const char *args, const char *name, char *buf,
+		      size_t len)
+{
+	const char *v = field(args, name);
+	size_t n;
+
+	if (!v)
+		return false;
+
+	n = strcspn(v, ", ");
+	if (n >= len)
+		n = len - 1;
+
+	memcpy(buf, v, n);
+	buf[n] = '\0';
+	return true;
+}
+
+/* Parses "<sec>.<frac>" into nanoseconds. */
+static uint64_t parse_timestamp(const char *str)
+{
+	uint64_t sec, frac = 0;
+	const char *p;
+	char *end;
+	int digits = 0;
+
+	sec = strtoull(str, &end, 10);
+	if (*end != '.')
+		return sec;
+
+	for (p = end + 1; *p >= '0' && *p <= '9' && digits < 9; p++, digits++)
+		frac = frac * 10 + (*p - '0');
+
+	for (; digits < 9; digits++)
+		frac *= 10;
+
+	return sec * NSEC_PER_SEC + frac;
+}
+
+static void process_line(struct state *s, char *line)
+{
+	struct pending *p;
+	char *event, *args, *ts_str, *sep;
+	uint32_t uid, rqid;
+	uint32_t status = 0;
+	uint64_t ts;
+
+	/* Format: "<task>-<pid> [<cpu>] <flags> <ts>: ssam_<event>: <args>" */
+	sep = strstr(line, ": ssam_");
+	if (!sep)
+		return;
+
+	event = sep + strlen(": ssam_");
+	args = strstr(event, ": ");
+	if (!args)
+		return;
+
+	*args = '\0';
+	args += 2;
+
+	*sep = '\0';
+	ts_str = strrchr(line, ' ');
+	ts_str = ts_str ? ts_str + 1 : line;
+	ts = parse_timestamp(ts_str);
+
+	s->events++;
+	if (!s->t_first)
+		s->t_first = ts;
+	s->t_last = ts;
+
+	if (!strcmp(event, "request_submit")) {
+		if (!field_u32(args, "uid", 16, &uid))
+			return;
+
+		p = state_alloc(s, uid);
+		p->t_submit = ts;
+
+		if (!field_u32(args, "rqid", 0, &p->rqid))
+			p->rqid = UINT32_MAX;
+		if (!field_str(args, "tc", p->tc, sizeof(p->tc)))
+			strcpy(p->tc, "N/A");
+		if (!field_u32(args, "cid", 0, &p->cid))
+			p->cid = 0;
+
+	} else if (!strcmp(event, "packet_transmit")) {
+		if (!field_u32(args, "uid", 16, &uid))
+			return;
+
+		p = state_find_uid(s, uid);
+		if (!p)
+			return;
+
+		if (!p->t_tx_first)
+			p->t_tx_first = ts;
+		p->t_tx_last = ts;
+		p->transmits++;
+
+	} else if (!strcmp(event, "packet_complete")) {
+		if (!field_u32(args, "uid", 16, &uid))
+			return;
+
+		field_u32(args, "status", 0, &status);
+
+		p = state_find_uid(s, uid);
+		if (p && !status)
+			p->t_ack = ts;
+
+	} else if (!strcmp(event, "rx_response_received")) {
+		if (!field_u32(args, "rqid", 0, &rqid))
+			return;
+
+		p = state_find_rqid(s, rqid);
+		if (p)
+			p->t_rsp = ts;
+		else
+			s->unmatched++;
+
+	} else if (!strcmp(event, "request_complete")) {
+		if (!field_u32(args, "uid", 16, &uid))
+			return;
+
+		field_u32(args, "status", 0, &status);
+
+		p = state_find_uid(s, uid);
+		if (p)
+			state_complete(s, p, ts, (int)status);
+		else
+			s->unmatched++;
+	}
+
+}
+
+
+/* -- Output. --------------------------------------------------------------- */
+
+static int key_cmp_count(const void *a, const void *b)
+{
+	const struct key_stats *ka = *(const struct key_stats * const *)a;
+	const struct key_stats *kb = *(const struct key_stats * const *)b;
+	uint64_t na = ka->completed + ka->failed;
+	uint64_t nb = kb->completed + kb->failed;
+
+	return na < nb ? 1 : na > nb ? -1 : 0;
+}
+
+static struct key_stats **state_sorted_keys(const struct state *s)
+{
+	struct key_stats **sorted;
+	size_t i;
+
+	sorted = calloc(s->num_keys ? s->num_keys : 1, sizeof(*sorted));
+	if (!sorted)
+		return NULL;
+
+	for (i = 0; i < s->num_keys; i++)
+		sorted[i] = &s->keys[i];
+
+	qsort(sorted, s->num_keys, sizeof(*sorted), key_cmp_count);
+	return sorted;
+}
+
+static size_t state_num_pending(const struct state *s)
+{
+	size_t n = 0;
+	int i;
+
+	for (i = 0; i < MAX_PENDING; i++)
+		n += s->pending[i].used;
+
+	return n;
+}
+
+static void print_top(const struct state *s)
+{
+	struct key_stats **sorted;
+	size_t i;
+	int j;
+
+	sorted = state_sorted_keys(s);
+	if (!sorted)
+		return;
+
+	printf("\033[H\033[2J");
+	printf("ssam-latency: %.1f s, %llu events, %zu pending, %llu unmatched\n\n",
+	       (double)(s->t_last - s->t_first) / NSEC_PER_SEC,
+	       (unsigned long long)s->events, state_num_pending(s),
+	       (unsigned long long)s->unmatched);
+
+	printf("%-4s %-5s %8s %6s %6s", "TC", "CID", "COUNT", "ERR", "RETX");
+	for (j = 0; j < __STAGE_MAX; j++)
+		printf(" %21s", stage_names[j]);
+	printf("\n%-4s %-5s %8s %6s %6s", "", "", "", "", "");
+	for (j = 0; j < __STAGE_MAX; j++)
+		printf(" %10s %10s", "avg us", "p99 us");
+	printf("\n");
+
+	for (i = 0; i < s->num_keys; i++) {
+		const struct key_stats *k = sorted[i];
+
+		printf("%-4s %#04x  %8llu %6llu %6llu", k->tc, k->cid,
+		       (unsigned long long)(k->completed + k->failed),
+		       (unsigned long long)k->failed,
+		       (unsigned long long)k->retransmits);
+
+		for (j = 0; j < __STAGE_MAX; j++) {
+			const struct hist *h = &k->stage[j];
+
+			if (!h->count) {
+				printf(" %10s %10s", "-", "-");
+				continue;
+			}
+
+			printf(" %10llu %10llu",
+			       (unsigned long long)(h->sum / h->count),
+			       (unsigned long long)hist_percentile(h, 0.99));
+		}
+		printf("\n");
+	}
+
+	fflush(stdout);
+	free(sorted);
+}
+
+static void print_report(const struct state *s)
+{
+	struct key_stats **sorted;
+	size_t i;
+	int j;
+
+	sorted = state_sorted_keys(s);
+	if (!sorted)
+		return;
+
+	printf("%llu events over %.3f s, %zu requests pending, %llu unmatched\n",
+	       (unsigned long long)s->events,
+	       (double)(s->t_last - s->t_first) / NSEC_PER_SEC,
+	       state_num_pending(s), (unsigned long long)s->unmatched);
+
+	for (i = 0; i < s->num_keys; i++) {
+		const struct key_stats *k = sorted[i];
+
+		printf("\ntc=%s, cid=%#04x: %llu completed, %llu failed, %llu re-transmissions\n",
+		       k->tc, k->cid, (unsigned long long)k->completed,
+		       (unsigned long long)k->failed,
+		       (unsigned long long)k->retransmits);
+
+		for (j = 0; j < __STAGE_MAX; j++) {
+			const struct hist *h = &k->stage[j];
+
+			if (!h->count)
+				continue;
+
+			printf("    %s (us): avg %llu, p50 <= %llu, p99 <= %llu, max %llu\n",
+			       stage_names[j],
+			       (unsigned long long)(h->sum / h->count),
+			       (unsigned long long)hist_percentile(h, 0.5),
+			       (unsigned long long)hist_percentile(h, 0.99),
+			       (unsigned long long)h->max);
+
+			hist_print(h);
+		}
+	}
+
+	free(sorted);
+}
+
+
+/* -- Main loop. ------------------------------------------------------------ */
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-t] [-i <interval>] [<file>]\n"
+		"\n"
+		"Correlate surface_aggregator trace events and print per-TC/CID\n"
+		"latency histograms. Reads from %s by default,\n"
+		"use '-' for stdin. Requires the events to be enabled, e.g. via\n"
+		"\n"
+		"    echo 1 > /sys/kernel/tracing/events/surface_aggregator/enable\n"
+		"\n"
+		"Options:\n"
+		"    -t             live mode: periodically redraw a summary table\n"
+		"    -i <interval>  redraw interval in milliseconds [default: 1000]\n"
+		"    -h             show this help\n",
+		prog, PATH_TRACE_PIPE);
+}
+
+int main(int argc, char **argv)
+{
+	static char buf[LINE_BUFFER_SIZE];
+	static struct state s;
+	const char *path = PATH_TRACE_PIPE;
+	unsigned long interval = 1000;
+	uint64_t next_draw = 0;
+	struct sigaction sa;
+	struct pollfd pfd;
+	bool top = false;
+	size_t len = 0;
+	int status = 0;
+	int opt;
+	int fd;
+
+	while ((opt = getopt(argc, argv, "ti:h")) != -1) {
+		switch (opt) {
+		case 't':
+			top = true;
+			break;
+
+		case 'i':
+			interval = strtoul(optarg, NULL, 10);
+			if (!interval) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+
+		case 'h':
+			usage(argv[0]);
+			return 0;
+
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc)
+		path = argv[optind];
+
+	if (!strcmp(path, "-")) {
+		fd = STDIN_FILENO;
+	} else {
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, "error: Could not open '%s': %s\n", path,
+				strerror(errno));
+			return 1;
+		}
+	}
+
+	/* No SA_RESTART: Interrupt blocking reads on Ctrl-C. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	if (top)
+		next_draw = now_ms() + interval;
+
+	while (!stop) {
+		int timeout = -1;
+		ssize_t n;
+		char *line, *nl;
+
+		if (top) {
+			uint64_t now = now_ms();
+
+			if (now >= next_draw) {
+				print_top(&s);
+				next_draw = now + interval;
+			}
+
+			timeout = (int)(next_draw - now);
+		}
+
+		n = poll(&pfd, 1, timeout);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			fprintf(stderr, "error: poll failed: %s\n", strerror(errno));
+			status = 1;
+			break;
+		}
+		if (n == 0)
+			continue;
+
+		n = read(fd, buf + len, sizeof(buf) - len - 1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			fprintf(stderr, "error: read failed: %s\n", strerror(errno));
+			status = 1;
+			break;
+		}
+		if (n == 0)
+			break;
+
+		len += n;
+		buf[len] = '\0';
+
+		line = buf;
+		while ((nl = strchr(line, '\n'))) {
+			*nl = '\0';
+			process_line(&s, line);
+			line = nl + 1;
+		}
+
+		len -= line - buf;
+		memmove(buf, line, len);
+
+		/* Drop overlong lines, they can't be ours anyway. */
+		if (len == sizeof(buf) - 1)
+			len = 0;
+	}
+
+	if (fd != STDIN_FILENO)
+		close(fd);
+
+	if (top)
+		print_top(&s);
+	else
+		print_report(&s);
+
+	free(s.keys);
+	return status;
+}
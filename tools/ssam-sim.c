@@ -0,0 +1,1676 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Discrete-event simulator for the SSH transport timeout behavior.
+ *
+ * Models the time-out, re-transmission and reaper logic of the packet and
+ * request transport layers (see ssh_packet_layer.c and ssh_request_layer.c)
+ * on a virtual clock, driven by a configurable EC model. Hours of simulated
+ * traffic run in seconds, which allows evaluating window sizes and timeouts
+ * against EC latency distributions, packet loss and EC stalls.
+ *
+ * The model follows the driver as closely as reasonable:
+ *
+ * - Requests are submitted to the request transport layer (RTL), which
+ *   forwards at most --rtl-pending of them to the packet transport layer
+ *   (PTL) at a time. A single target may only occupy --rtl-target-pending
+ *   of these slots.
+ *
+ * - Deferrable requests (see --deferrable) are held back in the RTL while the
+ *   link is idle, i.e. no request is pending and the last transmission lies
+ *   more than --idle-timeout in the past. Once the first held request has
+ *   waited --defer-delay, all requests held back up to that point are
+ *   released.
+ *
+ * - The PTL transmits data packets one at a time, ACKs for received
+ *   responses first and re-submitted packets before new ones. New packets are
+ *   only transmitted while less than --ptl-pending packets are waiting for an
+ *   ACK. The packet timeout starts when the packet is taken for
+ *   transmission. Once a packet times out after --ptl-tries transmissions, the
+ *   request fails.
+ *
+ * - The request timeout starts once the packet has been ACKed. Requests
+ *   that do not receive a response within it fail.
+ *
+ * - Both timeouts are checked by reaper work items, scheduled with jiffy
+ *   granularity, using the coarse clock and the same re-scheduling
+ *   resolution as the driver.
+ *
+ * - The EC ACKs each received data packet after the ACK latency, executes a
+ *   request once (re-transmitted packets are only ACKed again), and sends the
+ *   response after the service latency. It re-transmits responses that have
+ *   not been ACKed by the host.
+ *
+ * Simplifications: Each request has a response, and a response received
+ * before the ACK of the request packet completes the packet as well. Events
+ * (EC-initiated messages) are not modeled, thus the link is only ever woken
+ * up by requests. Request flushing is not modeled.
+ *
+ * EC behavior can be changed over time via a script. Each line of the script
+ * has the form "<time> <command> [<args>]", with the time in seconds:
+ *
+ *   <time> stall <duration>        EC drops all traffic for <duration> s
+ *   <time> stall <duration> <tgt>  EC ACKs but doesn't respond to requests
+ *                                  for target "sam" or "kip" (e.g. a
+ *                                  detached base) for <duration> s
+ *   <time> set rate <req/s>        change request rate
+ *   <time> set loss-tx <p>         change host-to-EC loss probability
+ *   <time> set loss-rx <p>         change EC-to-host loss probability
+ *   <time> set ack <dist>          change EC ACK latency distribution
+ *   <time> set service <dist>      change EC service latency distribution
+ *
+ * Latency distributions are given in milliseconds as one of "<value>",
+ * "const:<value>", "uniform:<min>:<max>", "exp:<mean>",
+ * "lognorm:<median>:<sigma>", or "pareto:<min>:<alpha>".
+ *
+ * Transport defaults are taken from the driver. Their definitions below are
+ * kept textually identical to the ones in the driver sources, which is
+ * checked by the "check-sim" make target.
+ *
+ * Copyright (C) 2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ssam-hist.h"
+
+#define NSEC_PER_USEC		1000ull
+#define NSEC_PER_MSEC		1000000ull
+#define NSEC_PER_SEC		1000000000ull
+
+#define T_MAX			UINT64_MAX
+
+/* Durations are kept in nanoseconds and converted to jiffies when used. */
+#define ms_to_ktime(ms)		((uint64_t)(ms) * NSEC_PER_MSEC)
+#define msecs_to_jiffies(ms)	ms_to_ktime(ms)
+
+/* Driver constants, see ssh_packet_layer.c and ssh_request_layer.c. */
+#define SSH_PTL_MAX_PACKET_TRIES		3
+#define SSH_PTL_PACKET_TIMEOUT			ms_to_ktime(1000)
+#define SSH_PTL_MAX_PENDING			1
+#define SSH_RTL_REQUEST_TIMEOUT			ms_to_ktime(3000)
+#define SSH_RTL_MAX_PENDING		3
+#define SSH_RTL_MAX_PENDING_PER_TARGET	(SSH_RTL_MAX_PENDING - 1)
+#define SSH_RTL_DEFER_MAX_DELAY		msecs_to_jiffies(1000)
+#define SSH_RTL_DEFER_IDLE_TIMEOUT	msecs_to_jiffies(100)
+
+/* See serial_hub.h. */
+#define SSH_NUM_TARGETS		2
+
+/* Message sizes, see SSH_COMMAND_MESSAGE_LENGTH() and SSH_MSG_LEN_CTRL. */
+#define SSH_CTRL_LEN		10
+#define SSH_COMMAND_LEN(n)	(18 + (n))
+
+#define REQUEST_SLOTS		(1u << 16)
+#define MAX_STALLS		256
+
+
+/* -- Random numbers and latency distributions. ----------------------------- */
+
+static uint64_t rng_state = 0x853c49e6748fea9bull;
+
+static uint64_t rng_next(void)
+{
+	/* xorshift64* */
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+/* Uniform in (0, 1]. */
+static double rng_uniform(void)
+{
+	return ((rng_next() >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static bool rng_chance(double p)
+{
+	return p > 0.0 && rng_uniform() <= p;
+}
+
+enum dist_kind {
+	DIST_CONST,
+	DIST_UNIFORM,
+	DIST_EXP,
+	DIST_LOGNORM,
+	DIST_PARETO,
+};
+
+struct dist {
+	enum dist_kind kind;
+	double a;
+	double b;
+};
+
+static int dist_parse(const char *str, struct dist *d)
+{
+	char kind[16];
+	int n;
+
+	d->a = 0.0;
+	d->b = 0.0;
+
+	if (sscanf(str, "%lf%n", &d->a, &n) == 1 && str[n] == '\0') {
+		d->kind = DIST_CONST;
+		return d->a >= 0.0 ? 0 : -EINVAL;
+	}
+
+	n = sscanf(str, "%15[a-z]:%lf:%lf", kind, &d->a, &d->b);
+	if (n < 2)
+		return -EINVAL;
+
+	if (!strcmp(kind, "const") && n == 2)
+		d->kind = DIST_CONST;
+	else if (!strcmp(kind, "uniform") && n == 3 && d->b >= d->a)
+		d->kind = DIST_UNIFORM;
+	else if (!strcmp(kind, "exp") && n == 2)
+		d->kind = DIST_EXP;
+	else if (!strcmp(kind, "lognorm") && n == 3 && d->b >= 0.0)
+		d->kind = DIST_LOGNORM;
+	else if (!strcmp(kind, "pareto") && n == 3 && d->b > 0.0)
+		d->kind = DIST_PARETO;
+	else
+		return -EINVAL;
+
+	return d->a >= 0.0 ? 0 : -EINVAL;
+}
+
+/* Returns a sample of the given distribution in nanoseconds. */
+static uint64_t dist_sample(const struct dist *d)
+{
+	double ms, u, v;
+
+	switch (d->kind) {
+	case DIST_UNIFORM:
+		ms = d->a + (d->b - d->a) * rng_uniform();
+		break;
+
+	case DIST_EXP:
+		ms = -d->a * log(rng_uniform());
+		break;
+
+	case DIST_LOGNORM:
+		u = rng_uniform();
+		v = rng_uniform();
+		ms = d->a * exp(d->b * sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v));
+		break;
+
+	case DIST_PARETO:
+		ms = d->a / pow(rng_uniform(), 1.0 / d->b);
+		break;
+
+	case DIST_CONST:
+	default:
+		ms = d->a;
+		break;
+	}
+
+	/* Cap at one hour to avoid overflows with heavy tails. */
+	if (ms > 3600.0 * 1000.0)
+		ms = 3600.0 * 1000.0;
+
+	return (uint64_t)(ms * NSEC_PER_MSEC);
+}
+
+
+/* -- Queues of request IDs. ------------------------------------------------ */
+
+struct idq {
+	uint64_t *ids;
+	size_t cap;
+	size_t head;
+	size_t len;
+};
+
+static void idq_grow(struct idq *q)
+{
+	size_t cap = q->cap ? q->cap * 2 : 64;
+	uint64_t *ids;
+	size_t i;
+
+	ids = malloc(cap * sizeof(*ids));
+	if (!ids) {
+		perror("malloc");
+		exit(1);
+	}
+
+	for (i = 0; i < q->len; i++)
+		ids[i] = q->ids[(q->head + i) % q->cap];
+
+	free(q->ids);
+	q->ids = ids;
+	q->cap = cap;
+	q->head = 0;
+}
+
+static uint64_t *idq_at(struct idq *q, size_t i)
+{
+	return &q->ids[(q->head + i) % q->cap];
+}
+
+static void idq_push_back(struct idq *q, uint64_t id)
+{
+	if (q->len == q->cap)
+		idq_grow(q);
+
+	*idq_at(q, q->len++) = id;
+}
+
+static void idq_push_front(struct idq *q, uint64_t id)
+{
+	if (q->len == q->cap)
+		idq_grow(q);
+
+	q->head = (q->head + q->cap - 1) % q->cap;
+	q->ids[q->head] = id;
+	q->len++;
+}
+
+static uint64_t idq_pop_front(struct idq *q)
+{
+	uint64_t id = q->ids[q->head];
+
+	q->head = (q->head + 1) % q->cap;
+	q->len--;
+	return id;
+}
+
+static bool idq_remove(struct idq *q, uint64_t id)
+{
+	size_t i;
+
+	for (i = 0; i < q->len; i++) {
+		if (*idq_at(q, i) != id)
+			continue;
+
+		for (; i + 1 < q->len; i++)
+			*idq_at(q, i) = *idq_at(q, i + 1);
+
+		q->len--;
+		return true;
+	}
+
+	return false;
+}
+
+
+/* -- Event queue. ---------------------------------------------------------- */
+
+enum ev_type {
+	EV_ARRIVAL,		/* new request submitted */
+	EV_HOST_TX_DATA,	/* host finished transmitting data packet */
+	EV_HOST_TX_ACK,		/* host finished transmitting ACK */
+	EV_EC_RX_DATA,		/* EC received data packet */
+	EV_EC_RX_ACK,		/* EC received ACK for its response */
+	EV_EC_TX_ACK,		/* EC starts transmitting ACK */
+	EV_EC_TX_RSP,		/* EC starts transmitting response */
+	EV_EC_RSP_TIMEOUT,	/* EC response re-transmission timeout */
+	EV_HOST_RX_ACK,		/* host received ACK */
+	EV_HOST_RX_RSP,		/* host received response */
+	EV_PTL_REAP,		/* packet timeout reaper */
+	EV_RTL_REAP,		/* request timeout reaper */
+	EV_RTL_DEFER,		/* deferred request deadline */
+	EV_SCRIPT,		/* scripted EC behavior change */
+	EV_REPORT,		/* periodic report */
+};
+
+struct event {
+	uint64_t time;
+	uint64_t seq;
+	enum ev_type type;
+	uint64_t arg;
+	uint32_t aux;
+};
+
+struct evq {
+	struct event *heap;
+	size_t cap;
+	size_t len;
+	uint64_t seq;
+};
+
+static bool event_before(const struct event *a, const struct event *b)
+{
+	if (a->time != b->time)
+		return a->time < b->time;
+
+	return a->seq < b->seq;
+}
+
+static void evq_push(struct evq *q, uint64_t time, enum ev_type type,
+		     uint64_t arg, uint32_t aux)
+{
+	struct event ev = { time, q->seq++, type, arg, aux };
+	size_t i, p;
+
+	if (q->len == q->cap) {
+		q->cap = q->cap ? q->cap * 2 : 1024;
+		q->heap = realloc(q->heap, q->cap * sizeof(*q->heap));
+		if (!q->heap) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	for (i = q->len++; i > 0; i = p) {
+		p = (i - 1) / 2;
+		if (!event_before(&ev, &q->heap[p]))
+			break;
+
+		q->heap[i] = q->heap[p];
+	}
+
+	q->heap[i] = ev;
+}
+
+static struct event evq_pop(struct evq *q)
+{
+	struct event top = q->heap[0];
+	struct event last = q->heap[--q->len];
+	size_t i = 0, c;
+
+	while ((c = 2 * i + 1) < q->len) {
+		if (c + 1 < q->len && event_before(&q->heap[c + 1], &q->heap[c]))
+			c++;
+
+		if (!event_before(&q->heap[c], &last))
+			break;
+
+		q->heap[i] = q->heap[c];
+		i = c;
+	}
+
+	q->heap[i] = last;
+	return top;
+}
+
+
+/* -- Simulation state. ----------------------------------------------------- */
+
+struct params {
+	uint64_t ptl_timeout;
+	uint64_t ptl_resolution;
+	unsigned int ptl_tries;
+	unsigned int ptl_pending;
+
+	uint64_t rtl_timeout;
+	uint64_t rtl_resolution;
+	unsigned int rtl_pending;
+	unsigned int rtl_target_pending;
+
+	uint64_t idle_timeout;
+	uint64_t defer_delay;
+
+	unsigned int hz;
+	unsigned int baud;
+	unsigned int tx_len;
+	unsigned int rx_len;
+
+	double rate;
+	double kip_share;
+	double deferrable;
+	double loss_tx;
+	double loss_rx;
+	struct dist ack;
+	struct dist service;
+	uint64_t ec_rtx_timeout;
+	unsigned int ec_rtx_tries;
+
+	uint64_t duration;
+	uint64_t interval;
+};
+
+enum request_state {
+	RQ_FREE,
+	RQ_QUEUED,
+	RQ_PENDING,
+	RQ_DONE,
+};
+
+struct request {
+	uint64_t id;
+	enum request_state state;
+	uint64_t submitted;
+	unsigned int target;
+	bool deferrable;
+	bool throttled;
+
+	/* Host packet state. */
+	unsigned int tries;
+	bool pkt_pending;
+	uint64_t pkt_ts;
+
+	/* Host request state. */
+	uint64_t rtl_ts;
+
+	/* EC state. */
+	bool ec_received;
+	bool ec_done;
+	unsigned int ec_rsp_tries;
+};
+
+struct reaper {
+	uint64_t expires;
+	uint32_t gen;
+};
+
+struct script_entry {
+	uint64_t time;
+	char cmd[16];
+	char name[16];
+	char value[64];
+};
+
+struct stall {
+	int target;
+	uint64_t start;
+	uint64_t end;
+	uint64_t recovered;
+	uint64_t failed;
+};
+
+struct stats {
+	uint64_t events;
+	uint64_t submitted;
+	uint64_t completed;
+	uint64_t failed_ptl;
+	uint64_t failed_rtl;
+	uint64_t retransmits;
+	uint64_t ec_retransmits;
+	uint64_t dup_responses;
+	uint64_t lost;
+	uint64_t throttled;
+	uint64_t piggybacked;
+	uint64_t expired;
+	uint64_t wakes;
+	struct hist latency;
+};
+
+struct sim {
+	struct params p;
+	struct evq events;
+	uint64_t now;
+	uint64_t tick;
+
+	struct request *requests;
+	uint64_t next_id;
+	uint32_t arrival_gen;
+
+	/* Request transport layer. */
+	struct idq rtl_queue;
+	struct idq rtl_pending;
+	struct reaper rtl_reaper;
+	unsigned int target_pending[SSH_NUM_TARGETS];
+
+	struct {
+		uint64_t last_activity;
+		bool armed;
+		uint64_t deadline;
+		int64_t cutoff;
+		uint32_t gen;
+	} defer;
+
+	/* Packet transport layer. */
+	struct idq ptl_queue;
+	struct idq ptl_acks;
+	struct idq ptl_pending;
+	struct reaper ptl_reaper;
+	bool tx_busy;
+
+	/* EC. */
+	uint64_t ec_busy;
+	uint64_t ec_stall_end;
+	uint64_t ec_target_stall_end[SSH_NUM_TARGETS];
+
+	struct script_entry *script;
+	size_t script_len;
+
+	struct stall stalls[MAX_STALLS];
+	size_t nstalls;
+
+	struct stats total;
+	struct stats interval;
+};
+
+static struct request *request_get(struct sim *s, uint64_t id)
+{
+	struct request *r = &s->requests[id % REQUEST_SLOTS];
+
+	return r->id == id && r->state != RQ_FREE ? r : NULL;
+}
+
+static uint64_t coarse(const struct sim *s, uint64_t t)
+{
+	return t - t % s->tick;
+}
+
+static uint64_t wire_time(const struct sim *s, unsigned int len)
+{
+	/* 8N1: ten bits per byte. */
+	return (uint64_t)len * 10 * NSEC_PER_SEC / s->p.baud;
+}
+
+static uint64_t jiffies_now(const struct sim *s)
+{
+	return s->now / s->tick;
+}
+
+/* Converts a delay to jiffies via milliseconds, like msecs_to_jiffies(). */
+static uint64_t to_jiffies(const struct sim *s, uint64_t delay)
+{
+	return (delay / NSEC_PER_MSEC * s->p.hz + 999) / 1000;
+}
+
+static bool ec_stalled(const struct sim *s)
+{
+	return s->now < s->ec_stall_end;
+}
+
+static bool ec_target_stalled(const struct sim *s, const struct request *r)
+{
+	return s->now < s->ec_target_stall_end[r->target];
+}
+
+/*
+ * Schedule a reaper, mirroring ssh_ptl_timeout_reaper_mod() and
+ * ssh_rtl_timeout_reaper_mod(). The delay is converted to jiffies via
+ * milliseconds; the delayed work then runs on a tick boundary.
+ */
+static void reaper_mod(struct sim *s, struct reaper *rp, enum ev_type type,
+		       uint64_t now, uint64_t expires, uint64_t resolution)
+{
+	uint64_t jiffies;
+
+	if (expires + resolution >= rp->expires)
+		return;
+
+	rp->expires = expires;
+	rp->gen++;
+
+	jiffies = to_jiffies(s, expires > now ? expires - now : 0);
+
+	if (jiffies)
+		evq_push(&s->events, coarse(s, s->now) + jiffies * s->tick, type, 0, rp->gen);
+	else
+		evq_push(&s->events, s->now, type, 0, rp->gen);
+}
+
+
+/* -- Host side. ------------------------------------------------------------ */
+
+static void stats_record(struct sim *s, struct request *r, int status)
+{
+	struct stats *st[] = { &s->total, &s->interval };
+	size_t i, k;
+
+	for (k = 0; k < 2; k++) {
+		if (status == 0) {
+			st[k]->completed++;
+			hist_add(&st[k]->latency, s->now - r->submitted);
+		} else if (status == -ECANCELED) {
+			st[k]->failed_ptl++;
+		} else {
+			st[k]->failed_rtl++;
+		}
+	}
+
+	for (i = 0; i < s->nstalls; i++) {
+		struct stall *sl = &s->stalls[i];
+
+		if (s->now < sl->start || sl->recovered != T_MAX)
+			continue;
+
+		if (sl->target >= 0 && (unsigned int)sl->target != r->target)
+			continue;
+
+		if (status)
+			sl->failed++;
+		else if (s->now >= sl->end)
+			sl->recovered = s->now;
+	}
+}
+
+static void ptl_tx_kick(struct sim *s);
+static void rtl_kick(struct sim *s);
+
+/* Completes the request, canceling its packet if still in flight. */
+static void request_complete(struct sim *s, struct request *r, int status)
+{
+	if (r->pkt_pending) {
+		r->pkt_pending = false;
+		idq_remove(&s->ptl_pending, r->id);
+	}
+
+	idq_remove(&s->ptl_queue, r->id);
+	if (idq_remove(&s->rtl_pending, r->id))
+		s->target_pending[r->target]--;
+
+	r->state = RQ_DONE;
+	stats_record(s, r, status);
+
+	rtl_kick(s);
+	ptl_tx_kick(s);
+}
+
+static void ptl_tx_kick(struct sim *s)
+{
+	struct request *r;
+	uint64_t id;
+
+	if (s->tx_busy)
+		return;
+
+	/* Control packets have the highest priority. */
+	if (s->ptl_acks.len) {
+		id = idq_pop_front(&s->ptl_acks);
+
+		s->tx_busy = true;
+		evq_push(&s->events, s->now + wire_time(s, SSH_CTRL_LEN),
+			 EV_HOST_TX_ACK, id, 0);
+		return;
+	}
+
+	if (!s->ptl_queue.len)
+		return;
+
+	/* New packets block while the pending limit is reached. */
+	id = *idq_at(&s->ptl_queue, 0);
+	r = request_get(s, id);
+
+	if (!r->pkt_pending && s->ptl_pending.len >= s->p.ptl_pending)
+		return;
+
+	idq_pop_front(&s->ptl_queue);
+
+	/* ssh_ptl_pending_push(): (Re-)start packet timeout. */
+	r->pkt_ts = coarse(s, s->now);
+	if (!r->pkt_pending) {
+		r->pkt_pending = true;
+		idq_push_back(&s->ptl_pending, id);
+	}
+
+	reaper_mod(s, &s->ptl_reaper, EV_PTL_REAP, r->pkt_ts,
+		   r->pkt_ts + s->p.ptl_timeout, s->p.ptl_resolution);
+
+	s->tx_busy = true;
+	evq_push(&s->events, s->now + wire_time(s, SSH_COMMAND_LEN(s->p.tx_len)),
+		 EV_HOST_TX_DATA, id, 0);
+}
+
+/* Mirrors ssh_rtl_tx_target_can_process(). */
+static bool rtl_target_can_process(const struct sim *s, const struct request *r)
+{
+	return s->target_pending[r->target] < s->p.rtl_target_pending;
+}
+
+/* Mirrors ssh_rtl_link_awake(). */
+static bool rtl_link_awake(const struct sim *s)
+{
+	if (s->rtl_pending.len)
+		return true;
+
+	return jiffies_now(s) < s->defer.last_activity + to_jiffies(s, s->p.idle_timeout);
+}
+
+/* Mirrors ssh_rtl_tx_should_defer(). */
+static bool rtl_should_defer(struct sim *s, const struct request *r, bool awake)
+{
+	uint64_t delay;
+
+	if (!r->deferrable)
+		return false;
+
+	/* Deadline reached: Release all requests held back up to now. */
+	if (s->defer.armed && jiffies_now(s) >= s->defer.deadline) {
+		s->defer.armed = false;
+		s->defer.cutoff = coarse(s, s->now);
+	}
+
+	if ((int64_t)coarse(s, r->submitted) <= s->defer.cutoff) {
+		s->total.expired++;
+		s->interval.expired++;
+		return false;
+	}
+
+	if (awake) {
+		s->total.piggybacked++;
+		s->interval.piggybacked++;
+		return false;
+	}
+
+	if (!s->defer.armed) {
+		delay = to_jiffies(s, s->p.defer_delay);
+
+		s->defer.armed = true;
+		s->defer.deadline = jiffies_now(s) + delay;
+		s->defer.gen++;
+
+		evq_push(&s->events, coarse(s, s->now) + delay * s->tick,
+			 EV_RTL_DEFER, 0, s->defer.gen);
+	}
+
+	return true;
+}
+
+/* Mirrors ssh_rtl_tx_next(). */
+static struct request *rtl_tx_next(struct sim *s)
+{
+	bool awake = rtl_link_awake(s);
+	struct request *r;
+	size_t i;
+
+	for (i = 0; i < s->rtl_queue.len; i++) {
+		r = request_get(s, *idq_at(&s->rtl_queue, i));
+
+		if (s->rtl_pending.len >= s->p.rtl_pending)
+			return NULL;
+
+		if (!rtl_target_can_process(s, r)) {
+			if (!r->throttled) {
+				r->throttled = true;
+				s->total.throttled++;
+				s->interval.throttled++;
+			}
+			continue;
+		}
+
+		if (rtl_should_defer(s, r, awake))
+			continue;
+
+		if (!awake) {
+			s->total.wakes++;
+			s->interval.wakes++;
+		}
+
+		s->defer.last_activity = jiffies_now(s);
+
+		idq_remove(&s->rtl_queue, r->id);
+		return r;
+	}
+
+	return NULL;
+}
+
+static void rtl_kick(struct sim *s)
+{
+	struct request *r;
+
+	while ((r = rtl_tx_next(s))) {
+		r->state = RQ_PENDING;
+		s->target_pending[r->target]++;
+		idq_push_back(&s->rtl_pending, r->id);
+		idq_push_back(&s->ptl_queue, r->id);
+	}
+
+	ptl_tx_kick(s);
+}
+
+static void handle_rtl_defer(struct sim *s, const struct event *ev)
+{
+	/* Deadline reached, held requests will be released on next tx. */
+	if (ev->aux == s->defer.gen)
+		rtl_kick(s);
+}
+
+static void schedule_arrival(struct sim *s)
+{
+	uint64_t delta;
+
+	if (s->p.rate <= 0.0)
+		return;
+
+	delta = (uint64_t)(-log(rng_uniform()) / s->p.rate * NSEC_PER_SEC);
+	evq_push(&s->events, s->now + delta, EV_ARRIVAL, 0, s->arrival_gen);
+}
+
+static void handle_arrival(struct sim *s, const struct event *ev)
+{
+	struct request *r;
+	uint64_t id;
+
+	if (ev->aux != s->arrival_gen)
+		return;
+
+	id = ++s->next_id;
+	r = &s->requests[id % REQUEST_SLOTS];
+
+	if (r->state == RQ_QUEUED || r->state == RQ_PENDING) {
+		fprintf(stderr, "error: more than %u outstanding requests, system overloaded\n",
+			REQUEST_SLOTS);
+		exit(1);
+	}
+
+	memset(r, 0, sizeof(*r));
+	r->id = id;
+	r->state = RQ_QUEUED;
+	r->submitted = s->now;
+	r->pkt_ts = T_MAX;
+	r->rtl_ts = T_MAX;
+	r->target = rng_chance(s->p.kip_share) ? 1 : 0;
+	r->deferrable = rng_chance(s->p.deferrable);
+
+	s->total.submitted++;
+	s->interval.submitted++;
+
+	idq_push_back(&s->rtl_queue, id);
+	rtl_kick(s);
+
+	schedule_arrival(s);
+}
+
+static void deliver(struct sim *s, uint64_t time, double loss,
+		    enum ev_type type, uint64_t id)
+{
+	if (rng_chance(loss)) {
+		s->total.lost++;
+		s->interval.lost++;
+		return;
+	}
+
+	evq_push(&s->events, time, type, id, 0);
+}
+
+static void handle_host_tx_data(struct sim *s, const struct event *ev)
+{
+	s->tx_busy = false;
+
+	deliver(s, s->now, s->p.loss_tx, EV_EC_RX_DATA, ev->arg);
+	ptl_tx_kick(s);
+}
+
+static void handle_host_tx_ack(struct sim *s, const struct event *ev)
+{
+	s->tx_busy = false;
+
+	deliver(s, s->now, s->p.loss_tx, EV_EC_RX_ACK, ev->arg);
+	ptl_tx_kick(s);
+}
+
+static void handle_host_rx_ack(struct sim *s, const struct event *ev)
+{
+	struct request *r = request_get(s, ev->arg);
+
+	if (!r || !r->pkt_pending)
+		return;
+
+	/* Packet completed: Remove from pending set and start request timeout. */
+	r->pkt_pending = false;
+	idq_remove(&s->ptl_pending, r->id);
+	idq_remove(&s->ptl_queue, r->id);
+
+	if (r->state == RQ_PENDING) {
+		r->rtl_ts = coarse(s, s->now);
+		reaper_mod(s, &s->rtl_reaper, EV_RTL_REAP, r->rtl_ts,
+			   r->rtl_ts + s->p.rtl_timeout, s->p.rtl_resolution);
+	}
+
+	ptl_tx_kick(s);
+}
+
+static void handle_host_rx_rsp(struct sim *s, const struct event *ev)
+{
+	struct request *r = request_get(s, ev->arg);
+
+	/* Always ACK, even repeated messages. */
+	idq_push_back(&s->ptl_acks, ev->arg);
+
+	if (!r || r->state != RQ_PENDING) {
+		s->total.dup_responses++;
+		s->interval.dup_responses++;
+		ptl_tx_kick(s);
+		return;
+	}
+
+	request_complete(s, r, 0);
+}
+
+/* Mirrors ssh_ptl_timeout_reap(). */
+static void handle_ptl_reap(struct sim *s, const struct event *ev)
+{
+	uint64_t now = coarse(s, s->now);
+	uint64_t next = T_MAX;
+	struct request *r;
+	uint64_t expires;
+	size_t i;
+
+	if (ev->aux != s->ptl_reaper.gen)
+		return;
+
+	s->ptl_reaper.expires = T_MAX;
+
+	for (i = 0; i < s->ptl_pending.len;) {
+		r = request_get(s, *idq_at(&s->ptl_pending, i));
+		expires = r->pkt_ts != T_MAX ? r->pkt_ts + s->p.ptl_timeout : T_MAX;
+
+		if (expires > now) {
+			next = expires < next ? expires : next;
+			i++;
+			continue;
+		}
+
+		/* Re-submit unless out of tries. */
+		if (r->tries + 1 < s->p.ptl_tries) {
+			r->tries++;
+			r->pkt_ts = T_MAX;
+			idq_push_front(&s->ptl_queue, r->id);
+
+			s->total.retransmits++;
+			s->interval.retransmits++;
+			i++;
+			continue;
+		}
+
+		/* Removes the packet from the pending set. */
+		request_complete(s, r, -ECANCELED);
+	}
+
+	if (next != T_MAX) {
+		if (next < now + s->p.ptl_resolution)
+			next = now + s->p.ptl_resolution;
+
+		reaper_mod(s, &s->ptl_reaper, EV_PTL_REAP, now, next,
+			   s->p.ptl_resolution);
+	}
+
+	ptl_tx_kick(s);
+}
+
+/* Mirrors ssh_rtl_timeout_reap(). */
+static void handle_rtl_reap(struct sim *s, const struct event *ev)
+{
+	uint64_t now = coarse(s, s->now);
+	uint64_t next = T_MAX;
+	struct request *r;
+	uint64_t expires;
+	size_t i;
+
+	if (ev->aux != s->rtl_reaper.gen)
+		return;
+
+	s->rtl_reaper.expires = T_MAX;
+
+	for (i = 0; i < s->rtl_pending.len;) {
+		r = request_get(s, *idq_at(&s->rtl_pending, i));
+		expires = r->rtl_ts != T_MAX ? r->rtl_ts + s->p.rtl_timeout : T_MAX;
+
+		if (expires > now) {
+			next = expires < next ? expires : next;
+			i++;
+			continue;
+		}
+
+		/* Removes the request from the pending set. */
+		request_complete(s, r, -ETIMEDOUT);
+	}
+
+	if (next != T_MAX) {
+		if (next < now + s->p.rtl_resolution)
+			next = now + s->p.rtl_resolution;
+
+		reaper_mod(s, &s->rtl_reaper, EV_RTL_REAP, now, next,
+			   s->p.rtl_resolution);
+	}
+}
+
+
+/* -- EC side. -------------------------------------------------------------- */
+
+static uint64_t ec_transmit(struct sim *s, unsigned int len)
+{
+	uint64_t start = s->ec_busy > s->now ? s->ec_busy : s->now;
+
+	s->ec_busy = start + wire_time(s, len);
+	return s->ec_busy;
+}
+
+static void handle_ec_rx_data(struct sim *s, const struct event *ev)
+{
+	struct request *r = request_get(s, ev->arg);
+	uint64_t ack;
+
+	if (!r || ec_stalled(s))
+		return;
+
+	ack = s->now + dist_sample(&s->p.ack);
+	evq_push(&s->events, ack, EV_EC_TX_ACK, r->id, 0);
+
+	/* Repeated packets are only ACKed again. */
+	if (r->ec_received)
+		return;
+
+	/* Requests for a stalled target are dropped after the ACK. */
+	if (ec_target_stalled(s, r))
+		return;
+
+	r->ec_received = true;
+	evq_push(&s->events, ack + dist_sample(&s->p.service), EV_EC_TX_RSP, r->id, 0);
+}
+
+static void handle_ec_rx_ack(struct sim *s, const struct event *ev)
+{
+	struct request *r = request_get(s, ev->arg);
+
+	if (r && !ec_stalled(s))
+		r->ec_done = true;
+}
+
+static void handle_ec_tx_ack(struct sim *s, const struct event *ev)
+{
+	uint64_t end;
+
+	if (ec_stalled(s))
+		return;
+
+	end = ec_transmit(s, SSH_CTRL_LEN);
+	deliver(s, end, s->p.loss_rx, EV_HOST_RX_ACK, ev->arg);
+}
+
+static void handle_ec_tx_rsp(struct sim *s, const struct event *ev)
+{
+	struct request *r = request_get(s, ev->arg);
+	uint64_t end = s->now;
+
+	if (!r || r->ec_done)
+		return;
+
+	/* A stalled EC doesn't send anything, but still re-tries later. */
+	if (!ec_stalled(s)) {
+		end = ec_transmit(s, SSH_COMMAND_LEN(s->p.rx_len));
+		deliver(s, end, s->p.loss_rx, EV_HOST_RX_RSP, r->id);
+	}
+
+	evq_push(&s->events, end + s->p.ec_rtx_timeout, EV_EC_RSP_TIMEOUT,
+		 r->id, r->ec_rsp_tries);
+}
+
+static void handle_ec_rsp_timeout(struct sim *s, const struct event *ev)
+{
+	struct request *r = request_get(s, ev->arg);
+
+	if (!r || r->ec_done || ev->aux != r->ec_rsp_tries)
+		return;
+
+	if (++r->ec_rsp_tries >= s->p.ec_rtx_tries) {
+		r->ec_done = true;
+		return;
+	}
+
+	s->total.ec_retransmits++;
+	s->interval.ec_retransmits++;
+	evq_push(&s->events, s->now, EV_EC_TX_RSP, r->id, 0);
+}
+
+
+/* -- Script. --------------------------------------------------------------- */
+
+static int script_load(struct sim *s, const char *path)
+{
+	struct script_entry *e;
+	char line[256];
+	double time;
+	FILE *f;
+	int n, lineno = 0;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -errno;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct script_entry entry = {};
+
+		lineno++;
+
+		if (line[strspn(line, " \t")] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+
+		n = sscanf(line, "%lf %15s %15s %63s", &time, entry.cmd, entry.name, entry.value);
+		entry.time = (uint64_t)(time * NSEC_PER_SEC);
+
+		if (n == 3 && !strcmp(entry.cmd, "stall")) {
+			/* Duration is stored as name. */
+		} else if (n == 4 && !strcmp(entry.cmd, "stall") &&
+			   (!strcmp(entry.value, "sam") || !strcmp(entry.value, "kip"))) {
+			/* Target is stored as value. */
+		} else if (n == 4 && !strcmp(entry.cmd, "set")) {
+			/* Validated on execution. */
+		} else {
+			fprintf(stderr, "%s:%d: invalid script line\n", path, lineno);
+			fclose(f);
+			return -EINVAL;
+		}
+
+		e = realloc(s->script, (s->script_len + 1) * sizeof(*e));
+		if (!e) {
+			perror("realloc");
+			exit(1);
+		}
+
+		s->script = e;
+		s->script[s->script_len++] = entry;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void handle_script(struct sim *s, const struct event *ev)
+{
+	const struct script_entry *e = &s->script[ev->arg];
+	struct stall *st;
+	uint64_t *end;
+	int status = 0;
+
+	if (!strcmp(e->cmd, "stall")) {
+		if (s->nstalls == MAX_STALLS) {
+			fprintf(stderr, "error: too many stalls\n");
+			exit(1);
+		}
+
+		st = &s->stalls[s->nstalls++];
+		st->start = s->now;
+		st->end = s->now + (uint64_t)(atof(e->name) * NSEC_PER_SEC);
+		st->recovered = T_MAX;
+		st->target = -1;
+
+		if (e->value[0])
+			st->target = !strcmp(e->value, "kip") ? 1 : 0;
+
+		if (st->target >= 0)
+			end = &s->ec_target_stall_end[st->target];
+		else
+			end = &s->ec_stall_end;
+
+		if (st->end > *end)
+			*end = st->end;
+
+		return;
+	}
+
+	if (!strcmp(e->name, "rate")) {
+		s->p.rate = atof(e->value);
+		s->arrival_gen++;
+		schedule_arrival(s);
+	} else if (!strcmp(e->name, "loss-tx")) {
+		s->p.loss_tx = atof(e->value);
+	} else if (!strcmp(e->name, "loss-rx")) {
+		s->p.loss_rx = atof(e->value);
+	} else if (!strcmp(e->name, "ack")) {
+		status = dist_parse(e->value, &s->p.ack);
+	} else if (!strcmp(e->name, "service")) {
+		status = dist_parse(e->value, &s->p.service);
+	} else {
+		status = -EINVAL;
+	}
+
+	if (status) {
+		fprintf(stderr, "error: invalid script command 'set %s %s'\n",
+			e->name, e->value);
+		exit(1);
+	}
+}
+
+
+/* -- Reports. -------------------------------------------------------------- */
+
+static void print_ms(const char *label, uint64_t us)
+{
+	printf("  %s %.1f ms", label, us / 1000.0);
+}
+
+static void print_latency(const struct hist *h)
+{
+	print_ms("p50", hist_percentile(h, 0.5));
+	print_ms("p90", hist_percentile(h, 0.9));
+	print_ms("p99", hist_percentile(h, 0.99));
+	print_ms("p99.9", hist_percentile(h, 0.999));
+	print_ms("max", h->max);
+	printf("\n");
+}
+
+static void handle_report(struct sim *s)
+{
+	struct stats *st = &s->interval;
+
+	printf("%10.3f s  submitted %6llu  completed %6llu  failed %4llu  rtx %4llu ",
+	       (double)s->now / NSEC_PER_SEC,
+	       (unsigned long long)st->submitted,
+	       (unsigned long long)st->completed,
+	       (unsigned long long)(st->failed_ptl + st->failed_rtl),
+	       (unsigned long long)st->retransmits);
+
+	print_ms("p99", hist_percentile(&st->latency, 0.99));
+	printf("\n");
+
+	memset(st, 0, sizeof(*st));
+	evq_push(&s->events, s->now + s->p.interval, EV_REPORT, 0, 0);
+}
+
+static void print_summary(const struct sim *s, double wall)
+{
+	const struct stats *st = &s->total;
+	double secs = (double)s->p.duration / NSEC_PER_SEC;
+	size_t i;
+
+	printf("simulated:    %.3f s (%llu events, %.2f s wall time)\n", secs,
+	       (unsigned long long)st->events, wall);
+	printf("requests:     %llu submitted, %llu completed, %llu failed (%llu packet timeout, %llu request timeout), %zu outstanding\n",
+	       (unsigned long long)st->submitted,
+	       (unsigned long long)st->completed,
+	       (unsigned long long)(st->failed_ptl + st->failed_rtl),
+	       (unsigned long long)st->failed_ptl,
+	       (unsigned long long)st->failed_rtl,
+	       s->rtl_queue.len + s->rtl_pending.len);
+	printf("throughput:   %.3f req/s\n", st->completed / secs);
+	printf("latency:    ");
+	print_latency(&st->latency);
+	printf("retransmits:  %llu packets, %llu EC responses, %llu repeated responses, %llu messages lost\n",
+	       (unsigned long long)st->retransmits,
+	       (unsigned long long)st->ec_retransmits,
+	       (unsigned long long)st->dup_responses,
+	       (unsigned long long)st->lost);
+	printf("throttling:   %llu requests held back by the per-target limit\n",
+	       (unsigned long long)st->throttled);
+	printf("deferral:     %llu piggybacked, %llu released at deadline, %llu link wake-ups\n",
+	       (unsigned long long)st->piggybacked,
+	       (unsigned long long)st->expired,
+	       (unsigned long long)st->wakes);
+
+	if (!s->nstalls)
+		return;
+
+	printf("stalls:\n");
+	for (i = 0; i < s->nstalls; i++) {
+		const struct stall *sl = &s->stalls[i];
+
+		printf("  at %.3f s for %.3f s", (double)sl->start / NSEC_PER_SEC,
+		       (double)(sl->end - sl->start) / NSEC_PER_SEC);
+
+		if (sl->target >= 0)
+			printf(" (%s)", sl->target ? "kip" : "sam");
+
+		printf(": ");
+
+		if (sl->recovered != T_MAX)
+			printf("recovered after %.3f s", (double)(sl->recovered - sl->end) / NSEC_PER_SEC);
+		else
+			printf("not recovered");
+
+		printf(", %llu requests failed\n", (unsigned long long)sl->failed);
+	}
+}
+
+
+/* -- Main. ----------------------------------------------------------------- */
+
+static void run(struct sim *s)
+{
+	struct event ev;
+	size_t i;
+
+	schedule_arrival(s);
+
+	for (i = 0; i < s->script_len; i++)
+		evq_push(&s->events, s->script[i].time, EV_SCRIPT, i, 0);
+
+	if (s->p.interval)
+		evq_push(&s->events, s->p.interval, EV_REPORT, 0, 0);
+
+	while (s->events.len) {
+		ev = evq_pop(&s->events);
+		if (ev.time > s->p.duration)
+			break;
+
+		s->now = ev.time;
+		s->total.events++;
+
+		switch (ev.type) {
+		case EV_ARRIVAL:
+			handle_arrival(s, &ev);
+			break;
+
+		case EV_HOST_TX_DATA:
+			handle_host_tx_data(s, &ev);
+			break;
+
+		case EV_HOST_TX_ACK:
+			handle_host_tx_ack(s, &ev);
+			break;
+
+		case EV_EC_RX_DATA:
+			handle_ec_rx_data(s, &ev);
+			break;
+
+		case EV_EC_RX_ACK:
+			handle_ec_rx_ack(s, &ev);
+			break;
+
+		case EV_EC_TX_ACK:
+			handle_ec_tx_ack(s, &ev);
+			break;
+
+		case EV_EC_TX_RSP:
+			handle_ec_tx_rsp(s, &ev);
+			break;
+
+		case EV_EC_RSP_TIMEOUT:
+			handle_ec_rsp_timeout(s, &ev);
+			break;
+
+		case EV_HOST_RX_ACK:
+			handle_host_rx_ack(s, &ev);
+			break;
+
+		case EV_HOST_RX_RSP:
+			handle_host_rx_rsp(s, &ev);
+			break;
+
+		case EV_PTL_REAP:
+			handle_ptl_reap(s, &ev);
+			break;
+
+		case EV_RTL_REAP:
+			handle_rtl_reap(s, &ev);
+			break;
+
+		case EV_RTL_DEFER:
+			handle_rtl_defer(s, &ev);
+			break;
+
+		case EV_SCRIPT:
+			handle_script(s, &ev);
+			break;
+
+		case EV_REPORT:
+			handle_report(s);
+			break;
+		}
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] [<script>]\n"
+		"\n"
+		"Simulate SSH transport timeout behavior on a virtual clock.\n"
+		"\n"
+		"Workload and EC model:\n"
+		"  -d, --duration <s>        simulated time [3600]\n"
+		"  -r, --rate <req/s>        request rate (Poisson) [20]\n"
+		"      --kip-share <p>       share of requests for the KIP target [0]\n"
+		"      --deferrable <p>      share of deferrable requests [0]\n"
+		"      --idle-timeout <ms>   EC UART sleep idle timeout [%llu]\n"
+		"  -a, --ack <dist>          EC ACK latency [exp:2]\n"
+		"  -s, --service <dist>      EC service latency [lognorm:5:0.5]\n"
+		"      --loss-tx <p>         host-to-EC message loss probability [0]\n"
+		"      --loss-rx <p>         EC-to-host message loss probability [0]\n"
+		"      --ec-timeout <ms>     EC response re-transmission timeout [1000]\n"
+		"      --ec-tries <n>        EC response transmission attempts [3]\n"
+		"      --tx-len <bytes>      request payload length [8]\n"
+		"      --rx-len <bytes>      response payload length [8]\n"
+		"      --baud <rate>         UART baud rate [3000000]\n"
+		"\n"
+		"Transport parameters:\n"
+		"      --ptl-timeout <ms>    packet timeout [%llu]\n"
+		"      --ptl-tries <n>       packet transmission attempts [%u]\n"
+		"      --ptl-pending <n>     packets awaiting ACK [%u]\n"
+		"      --rtl-timeout <ms>    request timeout [%llu]\n"
+		"      --rtl-pending <n>     requests in flight [%u]\n"
+		"      --rtl-target-pending <n>\n"
+		"                            requests in flight per target [%u]\n"
+		"      --defer-delay <ms>    maximum delay of deferrable requests [%llu]\n"
+		"      --hz <n>              kernel tick rate [250]\n"
+		"\n"
+		"Output:\n"
+		"  -i, --interval <s>        print per-interval statistics\n"
+		"  -S, --seed <n>            random seed\n"
+		"  -h, --help                show this help\n",
+		prog,
+		(unsigned long long)(SSH_RTL_DEFER_IDLE_TIMEOUT / NSEC_PER_MSEC),
+		(unsigned long long)(SSH_PTL_PACKET_TIMEOUT / NSEC_PER_MSEC),
+		SSH_PTL_MAX_PACKET_TRIES, SSH_PTL_MAX_PENDING,
+		(unsigned long long)(SSH_RTL_REQUEST_TIMEOUT / NSEC_PER_MSEC),
+		SSH_RTL_MAX_PENDING, SSH_RTL_MAX_PENDING_PER_TARGET,
+		(unsigned long long)(SSH_RTL_DEFER_MAX_DELAY / NSEC_PER_MSEC));
+}
+
+enum {
+	OPT_LOSS_TX = 0x100,
+	OPT_LOSS_RX,
+	OPT_EC_TIMEOUT,
+	OPT_EC_TRIES,
+	OPT_TX_LEN,
+	OPT_RX_LEN,
+	OPT_BAUD,
+	OPT_PTL_TIMEOUT,
+	OPT_PTL_TRIES,
+	OPT_PTL_PENDING,
+	OPT_RTL_TIMEOUT,
+	OPT_RTL_PENDING,
+	OPT_RTL_TARGET_PENDING,
+	OPT_DEFER_DELAY,
+	OPT_IDLE_TIMEOUT,
+	OPT_KIP_SHARE,
+	OPT_DEFERRABLE,
+	OPT_HZ,
+};
+
+static const struct option options[] = {
+	{ "duration",    required_argument, NULL, 'd' },
+	{ "rate",        required_argument, NULL, 'r' },
+	{ "ack",         required_argument, NULL, 'a' },
+	{ "service",     required_argument, NULL, 's' },
+	{ "loss-tx",     required_argument, NULL, OPT_LOSS_TX },
+	{ "loss-rx",     required_argument, NULL, OPT_LOSS_RX },
+	{ "ec-timeout",  required_argument, NULL, OPT_EC_TIMEOUT },
+	{ "ec-tries",    required_argument, NULL, OPT_EC_TRIES },
+	{ "tx-len",      required_argument, NULL, OPT_TX_LEN },
+	{ "rx-len",      required_argument, NULL, OPT_RX_LEN },
+	{ "baud",        required_argument, NULL, OPT_BAUD },
+	{ "ptl-timeout", required_argument, NULL, OPT_PTL_TIMEOUT },
+	{ "ptl-tries",   required_argument, NULL, OPT_PTL_TRIES },
+	{ "ptl-pending", required_argument, NULL, OPT_PTL_PENDING },
+	{ "rtl-timeout", required_argument, NULL, OPT_RTL_TIMEOUT },
+	{ "rtl-pending", required_argument, NULL, OPT_RTL_PENDING },
+	{ "rtl-target-pending", required_argument, NULL, OPT_RTL_TARGET_PENDING },
+	{ "defer-delay", required_argument, NULL, OPT_DEFER_DELAY },
+	{ "idle-timeout", required_argument, NULL, OPT_IDLE_TIMEOUT },
+	{ "kip-share",   required_argument, NULL, OPT_KIP_SHARE },
+	{ "deferrable",  required_argument, NULL, OPT_DEFERRABLE },
+	{ "hz",          required_argument, NULL, OPT_HZ },
+	{ "interval",    required_argument, NULL, 'i' },
+	{ "seed",        required_argument, NULL, 'S' },
+	{ "help",        no_argument,       NULL, 'h' },
+	{ },
+};
+
+static uint64_t ms_to_ns(const char *arg)
+{
+	return (uint64_t)(atof(arg) * NSEC_PER_MSEC);
+}
+
+int main(int argc, char **argv)
+{
+	static struct sim s;
+	struct timespec t0, t1;
+	unsigned int res;
+	int opt;
+
+	s.p = (struct params) {
+		.ptl_timeout = SSH_PTL_PACKET_TIMEOUT,
+		.ptl_tries = SSH_PTL_MAX_PACKET_TRIES,
+		.ptl_pending = SSH_PTL_MAX_PENDING,
+		.rtl_timeout = SSH_RTL_REQUEST_TIMEOUT,
+		.rtl_pending = SSH_RTL_MAX_PENDING,
+		.rtl_target_pending = SSH_RTL_MAX_PENDING_PER_TARGET,
+		.defer_delay = SSH_RTL_DEFER_MAX_DELAY,
+		.idle_timeout = SSH_RTL_DEFER_IDLE_TIMEOUT,
+		.hz = 250,
+		.baud = 3000000,
+		.tx_len = 8,
+		.rx_len = 8,
+		.rate = 20.0,
+		.ack = { DIST_EXP, 2.0, 0.0 },
+		.service = { DIST_LOGNORM, 5.0, 0.5 },
+		.ec_rtx_timeout = 1000 * NSEC_PER_MSEC,
+		.ec_rtx_tries = 3,
+		.duration = 3600 * NSEC_PER_SEC,
+	};
+
+	while ((opt = getopt_long(argc, argv, "d:r:a:s:i:S:h", options, NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			s.p.duration = (uint64_t)(atof(optarg) * NSEC_PER_SEC);
+			break;
+
+		case 'r':
+			s.p.rate = atof(optarg);
+			break;
+
+		case 'a':
+			if (dist_parse(optarg, &s.p.ack)) {
+				fprintf(stderr, "error: invalid distribution '%s'\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 's':
+			if (dist_parse(optarg, &s.p.service)) {
+				fprintf(stderr, "error: invalid distribution '%s'\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'i':
+			s.p.interval = (uint64_t)(atof(optarg) * NSEC_PER_SEC);
+			break;
+
+		case 'S':
+			rng_state = strtoull(optarg, NULL, 0) | 1;
+			break;
+
+		case OPT_LOSS_TX:
+			s.p.loss_tx = atof(optarg);
+			break;
+
+		case OPT_LOSS_RX:
+			s.p.loss_rx = atof(optarg);
+			break;
+
+		case OPT_EC_TIMEOUT:
+			s.p.ec_rtx_timeout = ms_to_ns(optarg);
+			break;
+
+		case OPT_EC_TRIES:
+			s.p.ec_rtx_tries = atoi(optarg);
+			break;
+
+		case OPT_TX_LEN:
+			s.p.tx_len = atoi(optarg);
+			break;
+
+		case OPT_RX_LEN:
+			s.p.rx_len = atoi(optarg);
+			break;
+
+		case OPT_BAUD:
+			s.p.baud = atoi(optarg);
+			break;
+
+		case OPT_PTL_TIMEOUT:
+			s.p.ptl_timeout = ms_to_ns(optarg);
+			break;
+
+		case OPT_PTL_TRIES:
+			s.p.ptl_tries = atoi(optarg);
+			break;
+
+		case OPT_PTL_PENDING:
+			s.p.ptl_pending = atoi(optarg);
+			break;
+
+		case OPT_RTL_TIMEOUT:
+			s.p.rtl_timeout = ms_to_ns(optarg);
+			break;
+
+		case OPT_RTL_PENDING:
+			s.p.rtl_pending = atoi(optarg);
+			break;
+
+		case OPT_RTL_TARGET_PENDING:
+			s.p.rtl_target_pending = atoi(optarg);
+			break;
+
+		case OPT_DEFER_DELAY:
+			s.p.defer_delay = ms_to_ns(optarg);
+			break;
+
+		case OPT_IDLE_TIMEOUT:
+			s.p.idle_timeout = ms_to_ns(optarg);
+			break;
+
+		case OPT_KIP_SHARE:
+			s.p.kip_share = atof(optarg);
+			break;
+
+		case OPT_DEFERRABLE:
+			s.p.deferrable = atof(optarg);
+			break;
+
+		case OPT_HZ:
+			s.p.hz = atoi(optarg);
+			break;
+
+		case 'h':
+			usage(argv[0]);
+			return 0;
+
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!s.p.hz || !s.p.baud || !s.p.ptl_tries || !s.p.ptl_pending ||
+	    !s.p.rtl_pending || !s.p.rtl_target_pending || !s.p.ec_rtx_tries) {
+		fprintf(stderr, "error: invalid parameters\n");
+		return 1;
+	}
+
+	/* SSH_{PTL,RTL}_*_TIMEOUT_RESOLUTION: max(2000 / HZ, 50) ms. */
+	res = 2000 / s.p.hz > 50 ? 2000 / s.p.hz : 50;
+	s.p.ptl_resolution = res * NSEC_PER_MSEC;
+	s.p.rtl_resolution = res * NSEC_PER_MSEC;
+
+	s.tick = NSEC_PER_SEC / s.p.hz;
+	s.ptl_reaper.expires = T_MAX;
+	s.rtl_reaper.expires = T_MAX;
+	s.defer.cutoff = -1;
+
+	if (optind < argc && script_load(&s, argv[optind]))
+		return 1;
+
+	s.requests = calloc(REQUEST_SLOTS, sizeof(*s.requests));
+	if (!s.requests) {
+		perror("calloc");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	run(&s);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	print_summary(&s, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+	return 0;
+}
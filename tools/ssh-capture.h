@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Binary capture format for raw SSH traffic.
+ *
+ * A capture file starts with a &struct ssh_capture_header, followed by any
+ * number of records. Each record consists of a &struct ssh_capture_record,
+ * directly followed by ``len`` bytes of data. For valid frames, the data is
+ * the complete SSH message as seen on the wire, i.e. including SYN, frame,
+ * CRCs and (if present) the payload. All fields are little-endian.
+ *
+ * Copyright (C) 2021 Maximilian Luz <luzmaximilian@gmail.com>
+ */
+
+#ifndef _SSAM_TOOLS_SSH_CAPTURE_H
+#define _SSAM_TOOLS_SSH_CAPTURE_H
+
+#include <stdint.h>
+
+#define SSH_CAPTURE_MAGIC	"SSHCAP\0\0"
+#define SSH_CAPTURE_VERSION	1
+
+/**
+ * struct ssh_capture_header - Capture file header.
+ * @magic:   Magic bytes, %SSH_CAPTURE_MAGIC.
+ * @version: Format version, %SSH_CAPTURE_VERSION.
+ * @flags:   Reserved, zero.
+ */
+struct ssh_capture_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+} __attribute__((__packed__));
+
+/**
+ * enum ssh_capture_dir - Direction of the captured data.
+ * @SSH_CAPTURE_DIR_TX: Data sent from host to EC.
+ * @SSH_CAPTURE_DIR_RX: Data sent from EC to host.
+ */
+enum ssh_capture_dir {
+	SSH_CAPTURE_DIR_TX = 0,
+	SSH_CAPTURE_DIR_RX = 1,
+};
+
+/**
+ * enum ssh_capture_flags - Flags of a capture record.
+ * @SSH_CAPTURE_F_INVALID: The data does not represent a valid frame, e.g.
+ *                         bytes skipped while searching for SYN or a message
+ *                         with invalid CRC.
+ */
+enum ssh_capture_flags {
+	SSH_CAPTURE_F_INVALID = 1 << 0,
+};
+
+/**
+ * struct ssh_capture_record - Capture record header.
+ * @ts:       Time stamp at which the first byte of the data has been captured,
+ *            in nanoseconds. The epoch depends on the source of the capture.
+ * @dir:      Direction, see &enum ssh_capture_dir.
+ * @flags:    Flags, see &enum ssh_capture_flags.
+ * @reserved: Reserved, zero.
+ * @len:      Length of the data following this header.
+ */
+struct ssh_capture_record {
+	uint64_t ts;
+	uint8_t dir;
+	uint8_t flags;
+	uint16_t reserved;
+	uint32_t len;
+} __attribute__((__packed__));
+
+#endif /* _SSAM_TOOLS_SSH_CAPTURE_H */